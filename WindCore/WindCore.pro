@@ -24,22 +24,44 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += \
     arm710.cpp \
+    audio.cpp \
+    cfcard.cpp \
     clps7111.cpp \
     clps7600.cpp \
+    codec.cpp \
     emubase.cpp \
     etna.cpp \
+    gdbstub.cpp \
+    governor.cpp \
+    hletable.cpp \
+    inputscript.cpp \
+    logging.cpp \
+    savestate.cpp \
+    trace.cpp \
+    serial.cpp \
+    uart.cpp \
     decoder.c \
     decoder-arm.c \
     windermere.cpp
 
 HEADERS += \
     arm710.h \
+    audio.h \
+    cfcard.h \
     clps7111.h \
     clps7111_defs.h \
     clps7600.h \
     emubase.h \
     etna.h \
+    gdbstub.h \
+    governor.h \
+    hletable.h \
+    inputscript.h \
+    logging.h \
+    savestate.h \
+    trace.h \
     hardware.h \
+    serial.h \
     wind_defs.h \
     macros.h \
     isa-inlines.h \
@@ -1,5 +1,6 @@
 #include "arm710.h"
 #include "common.h"
+#include "trace.h"
 
 // this will need changing if this code ever compiles on big-endian procs
 inline uint32_t read32LE(uint8_t *p) {
@@ -34,12 +35,42 @@ void ARM710::switchBank(BankIndex newBank) {
 }
 
 
+uint32_t &ARM710::bankedGPR(int bankIndex, int index) {
+	if (index < 8 || index == 15)
+		return GPRs[index];
+	if (index <= 12) {
+		bool fiq = (bankIndex == FiqBank);
+		if (fiq == (bank == FiqBank))
+			return GPRs[index];
+		return fiqBankedRegisters[fiq ? 1 : 0][index - 8];
+	}
+	if (bankIndex == bank)
+		return GPRs[index];
+	return allModesBankedRegisters[bankIndex][index - 13];
+}
+
+uint32_t ARM710::getBankedGPR(int bankIndex, int index) const {
+	return const_cast<ARM710 *>(this)->bankedGPR(bankIndex, index);
+}
+
+void ARM710::setBankedGPR(int bankIndex, int index, uint32_t value) {
+	if (index == 15)
+		setGPR(15, value);
+	else
+		bankedGPR(bankIndex, index) = value;
+}
+
+
 void ARM710::switchMode(Mode newMode) {
 	auto oldMode = currentMode();
 	if (newMode != oldMode) {
-//		log("Switching mode! %x", newMode);
+//		log<LogCPU, LogVerbose>("Switching mode! %x", newMode);
 		switchBank(modeToBank[newMode & 0xF]);
 
+		// permissions may differ, so fetches must be re-checked
+		if ((oldMode == User32) != (newMode == User32))
+			invalidateFetchBlock();
+
 		CPSR &= ~CPSR_ModeMask;
 		CPSR |= newMode;
 	}
@@ -47,7 +78,7 @@ void ARM710::switchMode(Mode newMode) {
 
 void ARM710::raiseException(Mode mode, uint32_t savedPC, uint32_t newPC) {
 	auto bankIndex = modeToBank[mode & 0xF];
-//	log("Raising exception mode %x, saving PC %08x, CPSR %08x", mode, savedPC, CPSR);
+//	log<LogCPU, LogVerbose>("Raising exception mode %x, saving PC %08x, CPSR %08x", mode, savedPC, CPSR);
 	SPSRs[bankIndex] = CPSR;
 
 	switchMode(mode);
@@ -64,7 +95,7 @@ void ARM710::requestFIQ() {
 }
 
 void ARM710::requestIRQ() {
-//	log("Requesting IRQ: Last exec = %08x, setting LR = %08x", lastPcExecuted(), getRealPC() + 4);
+//	log<LogCPU, LogVerbose>("Requesting IRQ: Last exec = %08x, setting LR = %08x", lastPcExecuted(), getRealPC() + 4);
 	raiseException(IRQ32, getRealPC() + 4, 0x18);
 	CPSR |= CPSR_IRQDisable;
 }
@@ -78,6 +109,80 @@ void ARM710::reset() {
 
 
 
+void ARM710::saveCPUState(StateWriter &out) const {
+	out.put(bank);
+	out.put(CPSR);
+	out.put(GPRs);
+	out.put(fiqBankedRegisters);
+	out.put(allModesBankedRegisters);
+	out.put(SPSRs);
+	out.put(cp15_control);
+	out.put(cp15_translationTableBase);
+	out.put(cp15_domainAccessControl);
+	out.put(cp15_faultStatus);
+	out.put(cp15_faultAddress);
+#ifdef ARM710T_TLB
+	out.put(tlb);
+	out.put(nextTlbIndex);
+#else
+	out.put(singleTlbEntry);
+#endif
+	out.put(faultTriggeredThisCycle);
+	out.put(writeBuffer);
+	out.put(writeBufferData);
+	out.put(writeBufferEntries);
+	out.put(writeBufferWords);
+	out.put(stallCycles);
+#ifdef ARM710T_CACHE
+	out.put(cacheBlockTags);
+	out.put(cacheBlocks);
+#endif
+	out.put(prefetchCount);
+	out.put(prefetch);
+	out.put(prefetchFaults);
+}
+
+void ARM710::loadCPUState(StateReader &in) {
+	in.get(bank);
+	in.get(CPSR);
+	in.get(GPRs);
+	in.get(fiqBankedRegisters);
+	in.get(allModesBankedRegisters);
+	in.get(SPSRs);
+	in.get(cp15_control);
+	in.get(cp15_translationTableBase);
+	in.get(cp15_domainAccessControl);
+	in.get(cp15_faultStatus);
+	in.get(cp15_faultAddress);
+#ifdef ARM710T_TLB
+	in.get(tlb);
+	in.get(nextTlbIndex);
+#else
+	in.get(singleTlbEntry);
+#endif
+	in.get(faultTriggeredThisCycle);
+	in.get(writeBuffer);
+	in.get(writeBufferData);
+	in.get(writeBufferEntries);
+	in.get(writeBufferWords);
+	in.get(stallCycles);
+#ifdef ARM710T_CACHE
+	in.get(cacheBlockTags);
+	in.get(cacheBlocks);
+#endif
+	in.get(prefetchCount);
+	in.get(prefetch);
+	in.get(prefetchFaults);
+
+	// the fetch block is a host pointer, so it has to be found again
+	invalidateFetchBlock();
+	if (bank > MainBank || prefetchCount < 0 || prefetchCount > 2 ||
+		writeBufferEntries > WriteBufferAddressSlots || writeBufferWords > WriteBufferDataSlots)
+		in.fail();
+}
+
+
+
 uint32_t ARM710::tick() {
 	// pop an instruction off the end of the pipeline
 	bool haveInsn = false;
@@ -96,10 +201,18 @@ uint32_t ARM710::tick() {
 	}
 
 	// fetch a new instruction
-	auto newInsn = readVirtual(GPRs[15], V32);
+	uint32_t pc = GPRs[15];
+	if ((pc & ~0x3FF) == fetchBlockAddr) {
+		prefetch[0] = read32LE(&fetchBlock[pc & 0x3FF]);
+		prefetchFaults[0] = NoFault;
+	} else {
+		MMUFault fault = NoFault;
+		prefetch[0] = readVirtual(pc, V32, fault, false);
+		prefetchFaults[0] = fault;
+		if (fault == NoFault && (pc & ~0x3FF) != fetchSlowBlockAddr)
+			cacheFetchBlock(pc);
+	}
 	GPRs[15] += 4;
-	prefetch[0] = newInsn.first.value_or(0);
-	prefetchFaults[0] = newInsn.second;
 	if (prefetchCount < 2)
 		prefetchCount++;
 
@@ -108,10 +221,12 @@ uint32_t ARM710::tick() {
 	if (haveInsn) {
 		pcHistory[pcHistoryIndex] = {GPRs[15] - 0xC, insn};
 		pcHistoryIndex = (pcHistoryIndex + 1) % PcHistoryCount;
+		if (tracer)
+			tracer->instruction(GPRs[15] - 0xC, insn);
 		if (insnFault != NoFault) {
 			// Raise a prefetch error
 			// These do not set FSR or FAR
-			log("prefetch error! %08x", insnFault >> MMUFaultAddressShift);
+			log<LogCPU, LogWarning>("prefetch error! %08x", insnFault >> MMUFaultAddressShift);
 			logPcHistory();
 			raiseException(Abort32, GPRs[15] - 8, 0xC);
 		} else {
@@ -119,12 +234,19 @@ uint32_t ARM710::tick() {
 		}
 	}
 
+	// waiting on the write buffer holds up the pipeline
+	clocks += stallCycles;
+	stallCycles = 0;
+
 	if (faultTriggeredThisCycle) {
 		// data abort time!
 		faultTriggeredThisCycle = false;
 		raiseException(Abort32, GPRs[15] - 4, 0x10);
 	}
 
+	if (haveInsn && traceRegisters)
+		traceRegisterChanges(tracer->takeRegisterResync());
+
 	return clocks;
 }
 
@@ -140,7 +262,7 @@ static inline bool extract1(uint32_t value, uint32_t bit) {
 
 uint32_t ARM710::executeInstruction(uint32_t i) {
 	uint32_t cycles = 1;
-//	log("executing insn %08x @ %08x", i, GPRs[15] - 0xC);
+//	log<LogCPU, LogVerbose>("executing insn %08x @ %08x", i, GPRs[15] - 0xC);
 
 	// a big old dispatch thing here
 	// but first, conditions!
@@ -317,11 +439,11 @@ uint32_t ARM710::execDataProcessing(bool I, uint32_t Opcode, bool S, uint32_t Rn
 		// Output-less opcodes: special behaviour
 		if (S) {
 			CPSR = (CPSR & ~CPSR_FlagMask) | flags;
-//			log("CPSR setflags=%08x results in CPSR=%08x", flags, CPSR);
+//			log<LogCPU, LogVerbose>("CPSR setflags=%08x results in CPSR=%08x", flags, CPSR);
 		} else if (Opcode == 8) {
 			// MRS, CPSR -> Reg
 			GPRs[Rd] = CPSR;
-//			log("r%d <- CPSR(%08x)", Rd, GPRs[Rd]);
+//			log<LogCPU, LogVerbose>("r%d <- CPSR(%08x)", Rd, GPRs[Rd]);
 		} else if (Opcode == 9) {
 			// MSR, Reg -> CPSR
 			bool canChangeMode = extract1(Rn, 0);
@@ -329,33 +451,33 @@ uint32_t ARM710::execDataProcessing(bool I, uint32_t Opcode, bool S, uint32_t Rn
 				auto newCPSR = GPRs[extract(Operand2, 3, 0)];
 				switchMode(modeFromCPSR(newCPSR));
 				CPSR = newCPSR;
-//				log("CPSR change privileged: %08x", CPSR);
+//				log<LogCPU, LogVerbose>("CPSR change privileged: %08x", CPSR);
 			} else {
 				// for the flag-only version, immediates are allowed
 				// so we just re-use what was calculated earlier...
 				auto newFlag = I ? op2 : GPRs[extract(Operand2, 3, 0)];
 				CPSR &= ~CPSR_FlagMask;
 				CPSR |= (newFlag & CPSR_FlagMask);
-//				log("CPSR change unprivileged: new=%08x result=%08x", newFlag, CPSR);
+//				log<LogCPU, LogVerbose>("CPSR change unprivileged: new=%08x result=%08x", newFlag, CPSR);
 			}
 		} else if (Opcode == 0xA) {
 			// MRS, SPSR -> Reg
 			if (isPrivileged()) {
 				GPRs[Rd] = SPSRs[currentBank()];
-//				log("r%d <- SPSR(%08x)", Rd, GPRs[Rd]);
+//				log<LogCPU, LogVerbose>("r%d <- SPSR(%08x)", Rd, GPRs[Rd]);
 			}
 		} else /*if (Opcode == 0xB)*/ {
 			bool canChangeMode = extract1(Rn, 0);
 			if (isPrivileged()) {
 				if (canChangeMode) {
 					SPSRs[currentBank()] = GPRs[extract(Operand2, 3, 0)];
-//					log("SPSR change privileged: %08x", SPSRs[currentBank()]);
+//					log<LogCPU, LogVerbose>("SPSR change privileged: %08x", SPSRs[currentBank()]);
 				} else {
 					// same hat
 					auto newFlag = I ? op2 : GPRs[extract(Operand2, 3, 0)];
 					SPSRs[currentBank()] &= ~CPSR_FlagMask;
 					SPSRs[currentBank()] |= (newFlag & CPSR_FlagMask);
-//					log("SPSR change unprivileged: new=%08x result=%08x", newFlag, SPSRs[currentBank()]);
+//					log<LogCPU, LogVerbose>("SPSR change unprivileged: new=%08x result=%08x", newFlag, SPSRs[currentBank()]);
 				}
 			}
 		}
@@ -373,11 +495,11 @@ uint32_t ARM710::execDataProcessing(bool I, uint32_t Opcode, bool S, uint32_t Rn
 				auto saved = SPSRs[currentBank()];
 				switchMode(modeFromCPSR(saved));
 				CPSR = saved;
-//				log("dataproc restore CPSR: %08x", saved);
+//				log<LogCPU, LogVerbose>("dataproc restore CPSR: %08x", saved);
 			}
 		} else if (S) {
 			CPSR = (CPSR & ~CPSR_FlagMask) | flags;
-//			log("dataproc flag change: flags=%08x CPSR=%08x", flags, CPSR);
+//			log<LogCPU, LogVerbose>("dataproc flag change: flags=%08x CPSR=%08x", flags, CPSR);
 		}
 	}
 
@@ -434,13 +556,13 @@ uint32_t ARM710::execMultiplyLong(uint32_t UAS, uint32_t RdHi, uint32_t RdLo, ui
 uint32_t ARM710::execSingleDataSwap(bool B, uint32_t Rn, uint32_t Rd, uint32_t Rm)
 {
 	auto valueSize = B ? V8 : V32;
-	auto readResult = readVirtual(GPRs[Rn], valueSize);
-	auto fault = readResult.second;
+	MMUFault fault = NoFault;
+	uint32_t value = readVirtual(GPRs[Rn], valueSize, fault);
 
 	if (fault == NoFault) {
 		fault = writeVirtual(GPRs[Rm], GPRs[Rn], valueSize);
 		if (fault == NoFault)
-			GPRs[Rd] = readResult.first.value();
+			GPRs[Rd] = value;
 	}
 
 	if (fault != NoFault)
@@ -506,17 +628,16 @@ uint32_t ARM710::execSingleDataTransfer(uint32_t IPUBWL, uint32_t Rn, uint32_t R
 	bool changeModes = !preIndex && writeback && isPrivileged();
 	auto saveMode = currentMode();
 
-	MMUFault fault;
+	MMUFault fault = NoFault;
 
 	if (load) {
 		if (changeModes) switchMode(User32);
-		auto readResult = readVirtual(transferAddr, valueSize);
+		uint32_t value = readVirtual(transferAddr, valueSize, fault);
 		if (changeModes) switchMode(saveMode);
-		if (readResult.first.has_value()) {
-			GPRs[Rd] = readResult.first.value();
+		if (fault == NoFault) {
+			GPRs[Rd] = value;
 			if (Rd == 15) prefetchCount = 0;
 		}
-		fault = readResult.second;
 	} else {
 		uint32_t value = GPRs[Rd];
 		if (changeModes) switchMode(User32);
@@ -565,31 +686,55 @@ uint32_t ARM710::execBlockDataTransfer(uint32_t PUSWL, uint32_t Rn, uint32_t reg
 		GPRs[Rn] = updatedBase;
 	}
 
-	uint32_t addr = lowAddr;
-	for (int i = 0; i < 16; i++) {
-		if (registerList & (1 << i)) {
-			// work on this one
-			if (load) {
-				// handling for LDM faults may be kinda iffy...
-				// wording on datasheet is a bit unclear
-				auto readResult = readVirtual(addr, V32);
-				if (readResult.first.has_value())
-					GPRs[i] = readResult.first.value();
-				if (readResult.second != NoFault) {
-					fault = readResult.second;
-					break;
+	uint32_t physAddr;
+	bool buffered = false;
+	if (uint8_t *block = getBlockTransferPointer(lowAddr, blockSize, store, &physAddr, &buffered)) {
+		// fast path: the whole block is plain memory within one page,
+		// and translation/permissions have been checked already
+		uint32_t addr = lowAddr;
+		for (int i = 0; i < 16; i++) {
+			if (registerList & (1 << i)) {
+				if (load)
+					GPRs[i] = read32LE(block);
+				else if (buffered)
+					bufferWrite(GPRs[i], physAddr + (addr - lowAddr), V32); // same timing as STRs
+				else
+					write32LE(block, GPRs[i]);
+				if (traceMemory)
+					tracer->memoryAccess(addr, GPRs[i], store, false);
+				block += 4;
+				addr += 4;
+
+				if (writeback && !doneWriteback) {
+					doneWriteback = true;
+					GPRs[Rn] = updatedBase;
 				}
-			} else {
-				auto newFault = writeVirtual(GPRs[i], addr, V32);
-				if (newFault != NoFault)
-					fault = newFault;
 			}
+		}
+	} else {
+		uint32_t addr = lowAddr;
+		for (int i = 0; i < 16; i++) {
+			if (registerList & (1 << i)) {
+				// work on this one
+				if (load) {
+					// handling for LDM faults may be kinda iffy...
+					// wording on datasheet is a bit unclear
+					uint32_t value = readVirtual(addr, V32, fault);
+					if (fault != NoFault)
+						break;
+					GPRs[i] = value;
+				} else {
+					auto newFault = writeVirtual(GPRs[i], addr, V32);
+					if (newFault != NoFault)
+						fault = newFault;
+				}
 
-			addr += 4;
+				addr += 4;
 
-			if (writeback && !doneWriteback) {
-				doneWriteback = true;
-				GPRs[Rn] = updatedBase;
+				if (writeback && !doneWriteback) {
+					doneWriteback = true;
+					GPRs[Rn] = updatedBase;
+				}
 			}
 		}
 	}
@@ -608,7 +753,7 @@ uint32_t ARM710::execBlockDataTransfer(uint32_t PUSWL, uint32_t Rn, uint32_t reg
 			auto saved = SPSRs[currentBank()];
 			switchMode(modeFromCPSR(saved));
 			CPSR = saved;
-//			log("reloading saved SPSR: %08x", saved);
+//			log<LogCPU, LogVerbose>("reloading saved SPSR: %08x", saved);
 		}
 	}
 
@@ -618,6 +763,102 @@ uint32_t ARM710::execBlockDataTransfer(uint32_t PUSWL, uint32_t Rn, uint32_t reg
 	return 0; // fixme
 }
 
+void ARM710::cacheFetchBlock(uint32_t pc)
+{
+	uint32_t blockAddr = pc & ~0x3FF;
+	uint32_t physAddr;
+	uint8_t *block = getBlockTransferPointer(blockAddr, 0x400, false, &physAddr);
+
+	// with the MMU on, only hold onto memory that can't be written
+	if (block && isMMUEnabled() && getPhysicalPointer(physAddr, 0x400, true))
+		block = nullptr;
+
+	if (block) {
+		fetchBlock = block;
+		fetchBlockAddr = blockAddr;
+	} else {
+		fetchSlowBlockAddr = blockAddr;
+	}
+}
+
+uint8_t *ARM710::getBlockTransferPointer(uint32_t virtAddr, uint32_t size, bool isWrite, uint32_t *physAddrOut, bool *bufferedOut)
+{
+#ifdef ARM710T_CACHE
+	// the cache would have to be kept in step, so don't bother
+	return nullptr;
+#endif
+
+	// stay within one 1KB subpage, the smallest unit that
+	// can carry its own permissions; anything else is slow
+	if (size == 0 || ((virtAddr ^ (virtAddr + size - 1)) & ~0x3FF))
+		return nullptr;
+
+	uint32_t physAddr = virtAddr;
+	bool buffered = false;
+	if (isMMUEnabled()) {
+		// faults are left for the slow path to report
+		MMUFault fault = NoFault;
+		TlbEntry *tlbEntry = translateAddressUsingTlb(virtAddr, fault);
+		if (!tlbEntry)
+			return nullptr;
+		if (checkAccessPermissions(tlbEntry, virtAddr, isWrite) != NoFault)
+			return nullptr;
+		physAddr = physAddrFromTlbEntry(tlbEntry, virtAddr);
+		buffered = isWrite && bufferedOut && isWriteBufferEnabled() && isBufferable(tlbEntry);
+	}
+
+	if (physAddrOut)
+		*physAddrOut = physAddr;
+
+	// watched memory has to be visited one access at a time
+	if (watchingMemory && isWatchedPage(virtAddr, physAddr))
+		return nullptr;
+
+	uint8_t *block = getPhysicalPointer(physAddr, size, isWrite);
+	if (block && bufferedOut) {
+		// caller feeds the stores through bufferWrite itself
+		*bufferedOut = buffered;
+		if (buffered)
+			return block;
+	}
+	if (block) {
+		// keep ordering with anything still sitting in the write buffer
+		if (isWrite && writeBufferEntries)
+			stallCycles += flushWriteBuffer();
+		else
+			syncWriteBuffer(physAddr, size);
+	}
+	return block;
+}
+
+bool ARM710::getHostSpans(uint32_t virtAddr, uint32_t size, bool isWrite, vector<HostSpan> &spans)
+{
+	spans.clear();
+	// whoever's using these won't say what they did with them, so
+	// anything being traced has to go the long way round
+	if (traceMemory)
+		return false;
+	while (size > 0) {
+		uint32_t chunk = 0x400 - (virtAddr & 0x3FF);
+		if (chunk > size)
+			chunk = size;
+
+		uint8_t *ptr = getBlockTransferPointer(virtAddr, chunk, isWrite);
+		if (!ptr)
+			return false;
+
+		// merge with the previous span if the host memory lines up
+		if (!spans.empty() && (spans.back().ptr + spans.back().size) == ptr)
+			spans.back().size += chunk;
+		else
+			spans.push_back({ptr, chunk});
+
+		virtAddr += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
 uint32_t ARM710::execBranch(bool L, uint32_t offset)
 {
 	if (L)
@@ -658,8 +899,14 @@ uint32_t ARM710::execCP15RegisterTransfer(uint32_t CPOpc, bool L, uint32_t CRn,
 		// store a value
 		uint32_t what = GPRs[Rd];
 
+		// MMU/buffer configuration is about to change, so
+		// anything still queued must go out under the old rules
+		if (writeBufferEntries)
+			stallCycles += flushWriteBuffer();
+		invalidateFetchBlock();
+
 		switch (CRn) {
-		case 1: cp15_control = what; log("setting cp15_control to %08x", what); break;
+		case 1: cp15_control = what; log<LogCPU>("setting cp15_control to %08x", what); break;
 		case 2: cp15_translationTableBase = what; break;
 		case 3: cp15_domainAccessControl = what; break;
 		case 5:
@@ -681,7 +928,7 @@ uint32_t ARM710::execCP15RegisterTransfer(uint32_t CPOpc, bool L, uint32_t CRn,
 		case 7:
 #ifdef ARM710T_CACHE
 			clearCache();
-			log("cache cleared");
+			log<LogCPU>("cache cleared");
 #endif
 			break;
 		case 8: {
@@ -727,7 +974,7 @@ uint8_t *ARM710T::findCacheLine(uint32_t virtAddr) {
 	return nullptr;
 }
 
-pair<MaybeU32, ARM710T::MMUFault> ARM710T::addCacheLineAndRead(uint32_t physAddr, uint32_t virtAddr, ValueSize valueSize, int domain, bool isPage) {
+uint32_t ARM710T::addCacheLineAndRead(uint32_t physAddr, uint32_t virtAddr, ValueSize valueSize, int domain, bool isPage, MMUFault &fault) {
 	uint32_t set = virtAddr & CacheAddressSetMask;
 	uint32_t tag = virtAddr & CacheAddressTagMask;
 	set >>= CacheAddressSetShift;
@@ -736,41 +983,40 @@ pair<MaybeU32, ARM710T::MMUFault> ARM710T::addCacheLineAndRead(uint32_t physAddr
 	//    - the ARM710a data sheet, 6-2 (p90)
 	uint32_t i = rand() % CacheBlocksPerSet;
 	uint8_t *block = &cacheBlocks[set][i][0];
-	MaybeU32 result;
-	MMUFault fault = NoFault;
+	uint32_t result = 0;
 
 	for (uint32_t j = 0; j < CacheBlockSize; j += 4) {
-		auto word = readPhysical((physAddr & ~CacheAddressLineMask) + j, V32);
-		if (word.has_value()) {
-			write32LE(&block[j], word.value());
+		bool busError = false;
+		uint32_t word = readPhysical((physAddr & ~CacheAddressLineMask) + j, V32, busError);
+		if (!busError) {
+			write32LE(&block[j], word);
 			if (valueSize == V8 && j == (virtAddr & CacheAddressLineMask & ~3))
-				result = (word.value() >> ((virtAddr & 3) * 8)) & 0xFF;
+				result = (word >> ((virtAddr & 3) * 8)) & 0xFF;
 			else if (valueSize == V32 && j == (virtAddr & CacheAddressLineMask))
-				result = word.value();
+				result = word;
 		} else {
 			// read error, great
 			// TODO: should probably prioritise specific kinds of faults over others
 			fault = encodeFaultSorP(SorPLinefetchError, isPage, domain, virtAddr & ~CacheAddressLineMask);
-			break;
+			return 0;
 		}
 	}
 
 	// the cache block is only stored if it's complete
-	if (fault == NoFault)
-		cacheBlockTags[set][i] = tag | CacheBlockEnabled;
-
-	return make_pair(result, fault);
+	cacheBlockTags[set][i] = tag | CacheBlockEnabled;
+	return result;
 }
 
-MaybeU32 ARM710T::readCached(uint32_t virtAddr, ValueSize valueSize) {
+bool ARM710T::readCached(uint32_t virtAddr, ValueSize valueSize, uint32_t &value) {
 	uint8_t *line = findCacheLine(virtAddr);
 	if (line) {
 		if (valueSize == V8)
-			return line[virtAddr & CacheAddressLineMask];
+			value = line[virtAddr & CacheAddressLineMask];
 		else /*if (valueSize == V32)*/
-			return read32LE(&line[virtAddr & CacheAddressLineMask]);
+			value = read32LE(&line[virtAddr & CacheAddressLineMask]);
+		return true;
 	}
-	return {};
+	return false;
 }
 
 
@@ -802,72 +1048,114 @@ uint32_t ARM710::physAddrFromTlbEntry(TlbEntry *tlbEntry, uint32_t virtAddr) {
 }
 
 
-MaybeU32 ARM710::virtToPhys(uint32_t virtAddr) {
+uint32_t ARM710::virtToPhys(uint32_t virtAddr, bool &fault) {
 	if (!isMMUEnabled())
 		return virtAddr;
 
 	TlbEntry tempEntry;
-	auto translated = translateAddressUsingTlb(virtAddr, &tempEntry);
-	if (holds_alternative<TlbEntry *>(translated)) {
-		auto tlbEntry = get<TlbEntry *>(translated);
-		return physAddrFromTlbEntry(tlbEntry, virtAddr);
-	} else {
-		return MaybeU32();
+	MMUFault mmuFault = NoFault;
+	TlbEntry *tlbEntry = translateAddressUsingTlb(virtAddr, mmuFault, &tempEntry);
+	if (!tlbEntry) {
+		fault = true;
+		return 0;
 	}
+	return physAddrFromTlbEntry(tlbEntry, virtAddr);
 }
 
 
-MaybeU32 ARM710::readVirtualDebug(uint32_t virtAddr, ValueSize valueSize) {
-	if (auto v = virtToPhys(virtAddr); v.has_value())
-		return readPhysical(v.value(), valueSize);
-	else
-		return {};
+uint32_t ARM710::readVirtualDebug(uint32_t virtAddr, ValueSize valueSize, bool &fault) {
+	uint32_t physAddr = virtToPhys(virtAddr, fault);
+	if (fault)
+		return 0;
+	if (writeBufferEntries && writeBufferHolds(physAddr))
+		flushWriteBuffer();
+	uint32_t value = readPhysical(physAddr, valueSize, fault);
+	return fault ? 0 : value;
 }
 
 
-pair<MaybeU32, ARM710::MMUFault> ARM710::readVirtual(uint32_t virtAddr, ValueSize valueSize) {
-	if (isAlignmentFaultEnabled() && valueSize == V32 && virtAddr & 3)
-		return make_pair(MaybeU32(), encodeFault(AlignmentFault, 0, virtAddr));
+void ARM710::markWatchedPages(uint32_t addr, uint32_t length, bool physical) {
+	vector<uint32_t> &pages = watchedPages[physical ? 1 : 0];
+	if (!watchingMemory) {
+		watchedPages[0].assign(0x8000, 0);
+		watchedPages[1].assign(0x8000, 0);
+		watchingMemory = true;
+	}
+
+	uint32_t last = (addr + (length ? length - 1 : 0)) >> 12;
+	for (uint32_t page = addr >> 12; ; page = (page + 1) & 0xFFFFF) {
+		pages[page >> 5] |= 1 << (page & 31);
+		if (page == last)
+			break;
+	}
+}
+
+void ARM710::clearWatchedPages() {
+	watchingMemory = false;
+	watchedPages[0].clear();
+	watchedPages[1].clear();
+}
+
+
+uint32_t ARM710::readVirtual(uint32_t virtAddr, ValueSize valueSize, MMUFault &fault, bool isData) {
+	if (isAlignmentFaultEnabled() && valueSize == V32 && virtAddr & 3) {
+		fault = encodeFault(AlignmentFault, 0, virtAddr);
+		return 0;
+	}
 
 	// fast path: cache
 #ifdef ARM710T_CACHE
-	if (auto v = readCached(virtAddr, valueSize); v.has_value())
-		return make_pair(v.value(), NoFault);
+	if (uint32_t v; !watchingMemory && !traceMemory && readCached(virtAddr, valueSize, v))
+		return v;
 #endif
 
+	bool busError = false;
 	if (!isMMUEnabled()) {
 		// things are very simple without a MMU
-		if (auto v = readPhysical(virtAddr, valueSize); v.has_value())
-			return make_pair(v.value(), NoFault);
-		else
-			return make_pair(MaybeU32(), encodeFault(NonMMUError, 0, virtAddr));
+		if (watchingMemory && isData && isWatchedPage(virtAddr, virtAddr))
+			watchedAccess(virtAddr, virtAddr, valueSize, false);
+		uint32_t value = readPhysical(virtAddr, valueSize, busError);
+		if (busError) {
+			fault = encodeFault(NonMMUError, 0, virtAddr);
+			return 0;
+		}
+		if (traceMemory && isData)
+			tracer->memoryAccess(virtAddr, value, false, valueSize == V8);
+		return value;
 	}
 
-	auto translated = translateAddressUsingTlb(virtAddr);
-	if (holds_alternative<MMUFault>(translated))
-		return make_pair(MaybeU32(), get<MMUFault>(translated));
+	TlbEntry *tlbEntry = translateAddressUsingTlb(virtAddr, fault);
+	if (!tlbEntry)
+		return 0;
 
 	// resolve this boy
-	auto tlbEntry = get<TlbEntry *>(translated);
-
-	if (auto f = checkAccessPermissions(tlbEntry, virtAddr, false); f != NoFault)
-		return make_pair(MaybeU32(), f);
-
-	int domain = (tlbEntry->lv1Entry >> 5) & 0xF;
-	bool isPage = (tlbEntry->lv2Entry != 0);
+	if (auto f = checkAccessPermissions(tlbEntry, virtAddr, false); f != NoFault) {
+		fault = f;
+		return 0;
+	}
 
 	uint32_t physAddr = physAddrFromTlbEntry(tlbEntry, virtAddr);
+	if (watchingMemory && isData && isWatchedPage(virtAddr, physAddr))
+		watchedAccess(virtAddr, physAddr, valueSize, false);
+	syncWriteBuffer(physAddr);
 
 #ifdef ARM710T_CACHE
 	bool cacheable = tlbEntry->lv2Entry ? (tlbEntry->lv2Entry & 8) : (tlbEntry->lv1Entry & 8);
 	if (cacheable && isCacheEnabled())
-		return addCacheLineAndRead(physAddr, virtAddr, valueSize, domain, isPage);
-	else
+		return addCacheLineAndRead(physAddr, virtAddr, valueSize, (tlbEntry->lv1Entry >> 5) & 0xF, tlbEntry->lv2Entry != 0, fault);
 #endif
-	if (auto result = readPhysical(physAddr, valueSize); result.has_value())
-		return make_pair(result, NoFault);
-	else
-		return make_pair(result, encodeFaultSorP(SorPOtherBusError, isPage, domain, virtAddr));
+
+	uint32_t value = readPhysical(physAddr, valueSize, busError);
+	if (busError) {
+		// only work out the details once we know we need them
+		int domain = (tlbEntry->lv1Entry >> 5) & 0xF;
+		bool isPage = (tlbEntry->lv2Entry != 0);
+		fault = encodeFaultSorP(SorPOtherBusError, isPage, domain, virtAddr);
+		return 0;
+	}
+	if (traceMemory && isData)
+		tracer->memoryAccess(virtAddr, value, false, valueSize == V8);
+	return value;
 }
 
 ARM710::MMUFault ARM710::writeVirtual(uint32_t value, uint32_t virtAddr, ValueSize valueSize) {
@@ -876,34 +1164,115 @@ ARM710::MMUFault ARM710::writeVirtual(uint32_t value, uint32_t virtAddr, ValueSi
 
 	if (!isMMUEnabled()) {
 		// direct virtual -> physical mapping, sans MMU
+		if (watchingMemory && isWatchedPage(virtAddr, virtAddr))
+			watchedAccess(virtAddr, virtAddr, valueSize, true);
 		if (!writePhysical(value, virtAddr, valueSize))
 			return encodeFault(NonMMUError, 0, virtAddr);
 	} else {
-		auto translated = translateAddressUsingTlb(virtAddr);
-		if (holds_alternative<MMUFault>(translated))
-			return get<MMUFault>(translated);
+		MMUFault fault = NoFault;
+		TlbEntry *tlbEntry = translateAddressUsingTlb(virtAddr, fault);
+		if (!tlbEntry)
+			return fault;
 
 		// resolve this boy
-		auto tlbEntry = get<TlbEntry *>(translated);
 
 		if (auto f = checkAccessPermissions(tlbEntry, virtAddr, true); f != NoFault)
 			return f;
 
 		uint32_t physAddr = physAddrFromTlbEntry(tlbEntry, virtAddr);
-		int domain = (tlbEntry->lv1Entry >> 5) & 0xF;
-		bool isPage = (tlbEntry->lv2Entry != 0);
+		if (watchingMemory && isWatchedPage(virtAddr, physAddr))
+			watchedAccess(virtAddr, physAddr, valueSize, true);
 
-		if (!writePhysical(value, physAddr, valueSize))
-			return encodeFaultSorP(SorPOtherBusError, isPage, domain, virtAddr);
+		if (isWriteBufferEnabled() && isBufferable(tlbEntry)) {
+			// permissions are already checked, so this can't fault later
+			bufferWrite(value, physAddr, valueSize);
+		} else {
+			// unbuffered writes must not overtake buffered ones
+			if (writeBufferEntries)
+				stallCycles += flushWriteBuffer();
+			if (!writePhysical(value, physAddr, valueSize)) {
+				int domain = (tlbEntry->lv1Entry >> 5) & 0xF;
+				bool isPage = (tlbEntry->lv2Entry != 0);
+				return encodeFaultSorP(SorPOtherBusError, isPage, domain, virtAddr);
+			}
+		}
 	}
 
 	// commit to cache if all was good
 #ifdef ARM710T_CACHE
 	writeCached(value, virtAddr, valueSize);
 #endif
+	if (traceMemory)
+		tracer->memoryAccess(virtAddr, value, true, valueSize == V8);
 	return NoFault;
 }
 
+bool ARM710::writePhysicalBlock(const uint32_t *values, uint32_t physAddr, int count) {
+	if (uint8_t *dest = getPhysicalPointer(physAddr, count * 4, true)) {
+		for (int i = 0; i < count; i++)
+			write32LE(&dest[i * 4], values[i]);
+		return true;
+	}
+
+	bool ok = true;
+	for (int i = 0; i < count; i++)
+		ok &= writePhysical(values[i], physAddr + (i * 4), V32);
+	return ok;
+}
+
+
+
+// Write Buffer
+void ARM710::bufferWrite(uint32_t value, uint32_t physAddr, ValueSize valueSize) {
+	if (valueSize == V32 && writeBufferEntries > 0 && writeBufferWords < WriteBufferDataSlots) {
+		WriteBufferEntry &last = writeBuffer[writeBufferEntries - 1];
+		if (last.valueSize == V32 && physAddr == (last.physAddr + last.count * 4)) {
+			writeBufferData[writeBufferWords++] = value;
+			last.count++;
+			return;
+		}
+	}
+
+	if (writeBufferEntries == WriteBufferAddressSlots || writeBufferWords == WriteBufferDataSlots)
+		stallCycles += flushWriteBuffer();
+
+	writeBuffer[writeBufferEntries++] = {physAddr, (uint8_t)writeBufferWords, 1, valueSize};
+	writeBufferData[writeBufferWords++] = value;
+}
+
+bool ARM710::writeBufferHolds(uint32_t physAddr, uint32_t size) const {
+	physAddr &= ~3;
+	for (int i = 0; i < writeBufferEntries; i++) {
+		uint32_t start = writeBuffer[i].physAddr & ~3;
+		if (physAddr < (start + writeBuffer[i].count * 4) && start < (physAddr + size))
+			return true;
+	}
+	return false;
+}
+
+uint32_t ARM710::flushWriteBuffer() {
+	uint32_t cycles = 0;
+
+	for (int i = 0; i < writeBufferEntries; i++) {
+		const WriteBufferEntry &e = writeBuffer[i];
+		bool ok;
+		if (e.valueSize == V8)
+			ok = writePhysical(writeBufferData[e.dataIndex], e.physAddr, V8);
+		else
+			ok = writePhysicalBlock(&writeBufferData[e.dataIndex], e.physAddr, e.count);
+
+		// too late to abort now; the real chip doesn't either
+		if (!ok)
+			log<LogCPU, LogWarning>("write buffer: bus error draining %08x", e.physAddr);
+
+		cycles += WriteBufferNonSeqCycles + (e.count - 1) * WriteBufferSeqCycles;
+	}
+
+	writeBufferEntries = 0;
+	writeBufferWords = 0;
+	return cycles;
+}
+
 
 
 // TLB
@@ -934,7 +1303,7 @@ ARM710::TlbEntry *ARM710::_allocateTlbEntry(uint32_t addrMask, uint32_t addr) {
 	return entry;
 }
 
-variant<ARM710::TlbEntry *, ARM710::MMUFault> ARM710::translateAddressUsingTlb(uint32_t virtAddr, TlbEntry *useMe) {
+ARM710::TlbEntry *ARM710::translateAddressUsingTlb(uint32_t virtAddr, MMUFault &fault, TlbEntry *useMe) {
 #ifdef ARM710T_TLB
 	// first things first, do we have a matching entry in the TLB?
 	for (TlbEntry &e : tlb) {
@@ -948,17 +1317,21 @@ variant<ARM710::TlbEntry *, ARM710::MMUFault> ARM710::translateAddressUsingTlb(u
 	uint32_t tableIndex = virtAddr >> 20;
 
 	// fetch the Level 1 entry
-	auto lv1EntryOpt = readPhysical(cp15_translationTableBase | (tableIndex << 2), V32);
-	if (!lv1EntryOpt.has_value())
-		return Lv1TranslationError;
-	auto lv1Entry = lv1EntryOpt.value();
+	syncWriteBuffer(cp15_translationTableBase | (tableIndex << 2));
+	bool busError = false;
+	uint32_t lv1Entry = readPhysical(cp15_translationTableBase | (tableIndex << 2), V32, busError);
+	if (busError) {
+		fault = Lv1TranslationError;
+		return nullptr;
+	}
 	int domain = (lv1Entry >> 5) & 0xF;
 
 	switch (lv1Entry & 3) {
 	case 0:
 	case 3:
 		// invalid!
-		return encodeFault(SectionTranslationFault, domain, virtAddr);
+		fault = encodeFault(SectionTranslationFault, domain, virtAddr);
+		return nullptr;
 	case 2:
 		// a Section entry is straightforward
 		// we just throw that immediately into the TLB
@@ -971,16 +1344,19 @@ variant<ARM710::TlbEntry *, ARM710::MMUFault> ARM710::translateAddressUsingTlb(u
 		uint32_t pageTableAddr = lv1Entry & 0xFFFFFC00;
 		uint32_t lv2TableIndex = (virtAddr >> 12) & 0xFF;
 
-		auto lv2EntryOpt = readPhysical(pageTableAddr | (lv2TableIndex << 2), V32);
-		if (!lv2EntryOpt.has_value())
-			return encodeFault(Lv2TranslationError, domain, virtAddr);
-		auto lv2Entry = lv2EntryOpt.value();
+		syncWriteBuffer(pageTableAddr | (lv2TableIndex << 2));
+		uint32_t lv2Entry = readPhysical(pageTableAddr | (lv2TableIndex << 2), V32, busError);
+		if (busError) {
+			fault = encodeFault(Lv2TranslationError, domain, virtAddr);
+			return nullptr;
+		}
 
 		switch (lv2Entry & 3) {
 		case 0:
 		case 3:
 			// invalid!
-			return encodeFault(PageTranslationFault, domain, virtAddr);
+			fault = encodeFault(PageTranslationFault, domain, virtAddr);
+			return nullptr;
 		case 1:
 			// Large 64kb page
 			entry = useMe ? useMe : _allocateTlbEntry(0xFFFF0000, virtAddr);
@@ -998,7 +1374,8 @@ variant<ARM710::TlbEntry *, ARM710::MMUFault> ARM710::translateAddressUsingTlb(u
 
 	// we should never get here as the switch covers 0, 1, 2, 3
 	// but this satisfies a compiler warning
-	return SectionTranslationFault;
+	fault = SectionTranslationFault;
+	return nullptr;
 }
 
 
@@ -1099,7 +1476,7 @@ void ARM710::reportFault(MMUFault fault) {
 			"Lv2TranslationError",
 			"PagePermissionFault"
 		};
-		log("⚠️ Fault type=%s domain=%d address=%08x pc=%08x lr=%08x",
+		log<LogCPU, LogWarning>("⚠️ Fault type=%s domain=%d address=%08x pc=%08x lr=%08x",
 			faultTypes[fault & MMUFaultTypeMask],
 			(fault & MMUFaultDomainMask) >> MMUFaultDomainShift,
 			fault >> MMUFaultAddressShift,
@@ -1112,22 +1489,31 @@ void ARM710::reportFault(MMUFault fault) {
 }
 
 
-void ARM710::log(const char *format, ...) {
-	if (logger) {
-		char buffer[1024];
-
-		va_list vaList;
-		va_start(vaList, format);
-		vsnprintf(buffer, sizeof(buffer), format, vaList);
-		va_end(vaList);
+void ARM710::setTracer(TraceRecorder *recorder) {
+	tracer = recorder;
+	traceMemory = recorder && (recorder->options() & TraceRecorder::TraceMemory);
+	traceRegisters = recorder && (recorder->options() & TraceRecorder::TraceRegisters);
+	if (traceRegisters)
+		traceRegisterChanges(true); // so a reader knows where we started
+}
 
-		logger(buffer);
+void ARM710::traceRegisterChanges(bool all) {
+	// r15 is left out, as the instructions say where it went
+	for (int i = 0; i < 15; i++) {
+		if (all || GPRs[i] != tracedRegisters[i]) {
+			tracedRegisters[i] = GPRs[i];
+			tracer->registerChanged(i, GPRs[i]);
+		}
+	}
+	if (all || CPSR != tracedRegisters[15]) {
+		tracedRegisters[15] = CPSR;
+		tracer->registerChanged(TraceRecorder::RegisterCPSR, CPSR);
 	}
 }
 
 void ARM710::logPcHistory() {
 	for (int i = 0; i < PcHistoryCount; i++) {
 		pcHistoryIndex = (pcHistoryIndex + 1) % PcHistoryCount;
-		log("%03d: %08x %08x", i, pcHistory[pcHistoryIndex].addr, pcHistory[pcHistoryIndex].insn);
+		log<LogCPU, LogWarning>("%03d: %08x %08x", i, pcHistory[pcHistoryIndex].addr, pcHistory[pcHistoryIndex].insn);
 	}
 }
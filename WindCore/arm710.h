@@ -1,10 +1,13 @@
 #pragma once
 #include <stdint.h>
-#include <optional>
-#include <variant>
+#include <vector>
+#include "logging.h"
+#include "savestate.h"
 
 using namespace std;
 
+class TraceRecorder;
+
 // Everything I thought is a lie.
 // Turns out the 5mx/Windermere is an ARM710T, not an ARM710a.
 
@@ -20,8 +23,6 @@ using namespace std;
 //#define ARM710T_CACHE
 //#define ARM710T_TLB
 
-typedef optional<uint32_t> MaybeU32;
-
 class ARM710
 {
 public:
@@ -85,6 +86,10 @@ public:
 		cp15_faultStatus = 0;
 		cp15_faultAddress = 0;
 		prefetchCount = 0;
+		invalidateFetchBlock();
+		writeBufferEntries = 0;
+		writeBufferWords = 0;
+		stallCycles = 0;
 #ifdef ARM710T_CACHE
 		clearCache();
 #endif
@@ -100,30 +105,107 @@ public:
 	void requestIRQ(); // pull nIRQ low
 	void reset();      // pull nRESET low
 
+	// registers, MMU, write buffer and pipeline, between instructions
+	void saveCPUState(StateWriter &out) const;
+	void loadCPUState(StateReader &in);
+
 	bool instructionReady() const { return (prefetchCount == 2); }
 	uint32_t tick();   // run the chip for at least 1 clock cycle
 
-	MaybeU32 readVirtualDebug(uint32_t virtAddr, ValueSize valueSize);
-	MaybeU32 virtToPhys(uint32_t virtAddr);
+	// Memory accesses return plain values and report failures through
+	// the fault argument, which is only ever written on failure - so
+	// callers start it off as false/NoFault and check it afterwards.
+	// A failed read returns 0.
+	uint32_t readVirtualDebug(uint32_t virtAddr, ValueSize valueSize, bool &fault);
+	uint32_t readVirtualDebug(uint32_t virtAddr, ValueSize valueSize) {
+		bool fault = false;
+		return readVirtualDebug(virtAddr, valueSize, fault);
+	}
+	uint32_t virtToPhys(uint32_t virtAddr, bool &fault);
 
-	pair<MaybeU32, MMUFault> readVirtual(uint32_t virtAddr, ValueSize valueSize);
-	virtual MaybeU32 readPhysical(uint32_t physAddr, ValueSize valueSize) = 0;
+	// isData is false for instruction fetches, which watchpoints ignore
+	uint32_t readVirtual(uint32_t virtAddr, ValueSize valueSize, MMUFault &fault, bool isData = true);
+	virtual uint32_t readPhysical(uint32_t physAddr, ValueSize valueSize, bool &busError) = 0;
 	MMUFault writeVirtual(uint32_t value, uint32_t virtAddr, ARM710::ValueSize valueSize);
 	virtual bool writePhysical(uint32_t value, uint32_t physAddr, ARM710::ValueSize valueSize) = 0;
+	bool writePhysicalBlock(const uint32_t *values, uint32_t physAddr, int count);
+	// host pointer to a contiguous run of physical memory, or nullptr
+	// if the range isn't plain RAM (or ROM, for reads)
+	virtual uint8_t *getPhysicalPointer(uint32_t physAddr, uint32_t size, bool isWrite) = 0;
+	void drainWriteBuffer() { flushWriteBuffer(); }
 
 	uint32_t getGPR(int index) const { return GPRs[index]; }
+	void setGPR(int index, uint32_t value) {
+		GPRs[index] = value;
+		if (index == 15)
+			prefetchCount = 0; // refill the pipeline from the new PC
+	}
 	uint32_t getCPSR() const { return CPSR; }
+	void setCPSR(uint32_t value) {
+		switchMode(modeFromCPSR(value));
+		CPSR = value;
+	}
+
+	// Every mode's registers, for debuggers, whichever mode is active.
+	// Banks go FIQ, IRQ, SVC, ABT, UND, then the user/system set;
+	// r8-r12 only differ for FIQ, and only r8-r14 are banked at all.
+	enum { BankCount = 6 };
+	uint32_t getBankedGPR(int bankIndex, int index) const;
+	void setBankedGPR(int bankIndex, int index, uint32_t value);
+	uint32_t getSPSR(int bankIndex) const { return SPSRs[bankIndex]; } // not user/system
+	void setSPSR(int bankIndex, uint32_t value) { SPSRs[bankIndex] = value; }
 	uint32_t getRealPC() const {
 		return GPRs[15] - (4 * prefetchCount);
 	}
 
-	void setLogger(std::function<void(const char *)> newLogger) { logger = newLogger; }
+	// messages arrive on a thread of their own (see LogPipeline)
+	void setLogger(std::function<void(const char *)> newLogger) { logs.setSink(newLogger); }
+	LogPipeline &logPipeline() { return logs; }
+	// record everything executed from here on; not owned, nullptr stops
+	void setTracer(TraceRecorder *recorder);
 	uint32_t lastPcExecuted() const { return pcHistory[(pcHistoryIndex - 1) % PcHistoryCount].addr; }
 public:
-	void log(const char *format, ...);
+	template<LogSubsystem Subsystem, LogLevel Level = LogInfo, typename... Args>
+	void log(const char *format, Args... args) {
+		if constexpr (Level <= WINDCORE_LOG_LEVEL) {
+			if (logs.enabled(Subsystem, Level))
+				logs.post(Subsystem, Level, format, args...);
+		}
+	}
 	void logPcHistory();
+protected:
+	// Splits a virtual range into chunks of host memory, checking
+	// translation and permissions as the current mode would.
+	// Fails without raising any faults if any part of the range
+	// isn't plain memory.
+	struct HostSpan { uint8_t *ptr; uint32_t size; };
+	bool getHostSpans(uint32_t virtAddr, uint32_t size, bool isWrite, vector<HostSpan> &spans);
+
+	// Data watchpoints work on 4KB pages, marked by virtual or physical
+	// address. Marked pages are kept off the block transfer fast paths
+	// (LDM/STM, HLE), and single accesses to them go to watchedAccess.
+	// While nothing is marked, all this costs is a flag test.
+	bool watchingMemory = false;
+	vector<uint32_t> watchedPages[2]; // bitmaps: virtual, physical
+	void markWatchedPages(uint32_t addr, uint32_t length, bool physical);
+	void clearWatchedPages();
+	bool isWatchedPage(uint32_t virtAddr, uint32_t physAddr) const {
+		return (watchedPages[0][virtAddr >> 17] & (1 << ((virtAddr >> 12) & 31))) ||
+			(watchedPages[1][physAddr >> 17] & (1 << ((physAddr >> 12) & 31)));
+	}
+	virtual void watchedAccess(uint32_t virtAddr, uint32_t physAddr, ValueSize valueSize, bool isWrite) {
+		(void)virtAddr; (void)physAddr; (void)valueSize; (void)isWrite;
+	}
+
+	// Tracing. Recording accesses keeps all memory off the block transfer
+	// fast paths, as watchpoints do, which shifts timing a little - so
+	// only compare traces that were taken with the same options.
+	TraceRecorder *tracer = nullptr;
+	bool traceMemory = false, traceRegisters = false;
+	uint32_t tracedRegisters[16];
+	void traceRegisterChanges(bool all);
 private:
-	std::function<void(const char *)> logger;
+	LogPipeline logs;
 
 	enum { PcHistoryCount = 10 };
 	struct { uint32_t addr, insn; } pcHistory[PcHistoryCount];
@@ -224,6 +306,7 @@ private:
 
 	void switchMode(Mode mode);
 	void switchBank(BankIndex bank);
+	uint32_t &bankedGPR(int bankIndex, int index);
 	void raiseException(Mode mode, uint32_t savedPC, uint32_t newPC);
 
 	// MMU/TLB
@@ -255,13 +338,41 @@ private:
 #endif	
 
 	TlbEntry *_allocateTlbEntry(uint32_t addrMask, uint32_t addr);
-	variant<TlbEntry *, MMUFault> translateAddressUsingTlb(uint32_t virtAddr, TlbEntry *useMe=nullptr);
+	TlbEntry *translateAddressUsingTlb(uint32_t virtAddr, MMUFault &fault, TlbEntry *useMe=nullptr);
 	static uint32_t physAddrFromTlbEntry(TlbEntry *tlbEntry, uint32_t virtAddr);
 	MMUFault checkAccessPermissions(TlbEntry *entry, uint32_t virtAddr, bool isWrite) const;
 
 	bool faultTriggeredThisCycle = false;
 	void reportFault(MMUFault fault);
 
+	// Write Buffer
+	// Stores to bufferable pages are queued here and only reach
+	// the bus once the buffer fills up or ordering demands it.
+	// Sequential word stores (STM, fills) share an address slot.
+	enum {
+		WriteBufferAddressSlots = 4,
+		WriteBufferDataSlots = 8,
+		WriteBufferNonSeqCycles = 2, // first word of a burst
+		WriteBufferSeqCycles = 1     // each following word
+	};
+	struct WriteBufferEntry { uint32_t physAddr; uint8_t dataIndex, count; ValueSize valueSize; };
+	WriteBufferEntry writeBuffer[WriteBufferAddressSlots];
+	uint32_t writeBufferData[WriteBufferDataSlots];
+	int writeBufferEntries = 0, writeBufferWords = 0;
+	uint32_t stallCycles = 0; // charged to the next tick
+
+	static bool isBufferable(const TlbEntry *entry) {
+		return entry->lv2Entry ? (entry->lv2Entry & 4) : (entry->lv1Entry & 4);
+	}
+	void bufferWrite(uint32_t value, uint32_t physAddr, ValueSize valueSize);
+	bool writeBufferHolds(uint32_t physAddr, uint32_t size = 4) const;
+	uint32_t flushWriteBuffer();
+	void syncWriteBuffer(uint32_t physAddr, uint32_t size = 4) {
+		// reads must observe any pending writes to the same word
+		if (writeBufferEntries && writeBufferHolds(physAddr, size))
+			stallCycles += flushWriteBuffer();
+	}
+
 	// Instruction/Data Cache
 #ifdef ARM710T_CACHE
 	enum {
@@ -280,11 +391,27 @@ private:
 
 	void clearCache();
 	uint8_t *findCacheLine(uint32_t virtAddr);
-	pair<MaybeU32, MMUFault> addCacheLineAndRead(uint32_t physAddr, uint32_t virtAddr, ValueSize valueSize, int domain, bool isPage);
-	MaybeU32 readCached(uint32_t virtAddr, ValueSize valueSize);
+	uint32_t addCacheLineAndRead(uint32_t physAddr, uint32_t virtAddr, ValueSize valueSize, int domain, bool isPage, MMUFault &fault);
+	bool readCached(uint32_t virtAddr, ValueSize valueSize, uint32_t &value);
 	bool writeCached(uint32_t value, uint32_t virtAddr, ValueSize valueSize);
 #endif
 
+	// Instruction Fetch
+	// Holds a host pointer to the 1KB block the PC is in, as long as
+	// that block can't change under us: anything with the MMU off,
+	// or ROM with the MMU on. Fetches from it skip translation and
+	// fault handling entirely. CP15 writes and privilege changes
+	// drop it, much as they'd invalidate the TLB.
+	uint8_t *fetchBlock = nullptr;
+	uint32_t fetchBlockAddr = 1;     // never matches an aligned PC
+	uint32_t fetchSlowBlockAddr = 1; // last block that didn't qualify
+	void invalidateFetchBlock() {
+		fetchBlock = nullptr;
+		fetchBlockAddr = 1;
+		fetchSlowBlockAddr = 1;
+	}
+	void cacheFetchBlock(uint32_t pc);
+
 	// Instruction Loop
 	int prefetchCount;
 	uint32_t prefetch[2];
@@ -298,6 +425,7 @@ private:
 	uint32_t execSingleDataSwap(bool B, uint32_t Rn, uint32_t Rd, uint32_t Rm);
 	uint32_t execSingleDataTransfer(uint32_t IPUBWL, uint32_t Rn, uint32_t Rd, uint32_t offset);
 	uint32_t execBlockDataTransfer(uint32_t PUSWL, uint32_t Rn, uint32_t registerList);
+	uint8_t *getBlockTransferPointer(uint32_t virtAddr, uint32_t size, bool isWrite, uint32_t *physAddrOut = nullptr, bool *bufferedOut = nullptr);
 	uint32_t execBranch(bool L, uint32_t offset);
 	uint32_t execCP15RegisterTransfer(uint32_t CPOpc, bool L, uint32_t CRn, uint32_t Rd, uint32_t CP, uint32_t CRm);
 };
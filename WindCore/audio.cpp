@@ -0,0 +1,112 @@
+#include "audio.h"
+#include <string.h>
+#include <chrono>
+
+size_t AudioRing::write(const int16_t *samples, size_t count) {
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t t = tail.load(std::memory_order_acquire);
+	size_t room = Capacity - (h - t);
+	size_t n = (count < room) ? count : room;
+
+	for (size_t i = 0; i < n; i++)
+		buffer[(h + i) & (Capacity - 1)] = samples[i];
+	head.store(h + n, std::memory_order_release);
+
+	if (n < count)
+		dropped.fetch_add(count - n, std::memory_order_relaxed);
+	return n;
+}
+
+size_t AudioRing::read(int16_t *samples, size_t count) {
+	size_t t = tail.load(std::memory_order_relaxed);
+	size_t h = head.load(std::memory_order_acquire);
+	size_t n = (count < (h - t)) ? count : (h - t);
+
+	for (size_t i = 0; i < n; i++)
+		samples[i] = buffer[(t + i) & (Capacity - 1)];
+	tail.store(t + n, std::memory_order_release);
+	return n;
+}
+
+
+// G.711, as the codecs speak it
+int16_t decodeMuLaw(uint8_t value) {
+	value = ~value;
+	int exponent = (value >> 4) & 7;
+	int mantissa = value & 0xF;
+	int sample = (((mantissa << 3) + 0x84) << exponent) - 0x84;
+	return (value & 0x80) ? -sample : sample;
+}
+
+int16_t decodeALaw(uint8_t value) {
+	value ^= 0x55;
+	int exponent = (value >> 4) & 7;
+	int mantissa = value & 0xF;
+	int sample;
+	if (exponent == 0)
+		sample = (mantissa << 4) + 8;
+	else
+		sample = ((mantissa << 4) + 0x108) << (exponent - 1);
+	return (value & 0x80) ? sample : -sample;
+}
+
+
+#ifndef __EMSCRIPTEN__
+static void put16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+
+WavFileSink::WavFileSink(AudioRing &ring, const char *path, int sampleRate) : ring(ring), sampleRate(sampleRate) {
+	file = fopen(path, "wb");
+	if (!file)
+		return;
+	writeHeader();
+	thread = std::thread(&WavFileSink::run, this);
+}
+
+WavFileSink::~WavFileSink() {
+	if (!file)
+		return;
+	running = false;
+	thread.join();
+	fseek(file, 0, SEEK_SET);
+	writeHeader();
+	fclose(file);
+}
+
+void WavFileSink::writeHeader() {
+	uint8_t h[44];
+	memcpy(&h[0], "RIFF", 4);
+	put32(&h[4], 36 + dataBytes);
+	memcpy(&h[8], "WAVEfmt ", 8);
+	put32(&h[16], 16);
+	put16(&h[20], 1);              // PCM
+	put16(&h[22], 1);              // mono
+	put32(&h[24], sampleRate);
+	put32(&h[28], sampleRate * 2);
+	put16(&h[32], 2);
+	put16(&h[34], 16);
+	memcpy(&h[36], "data", 4);
+	put32(&h[40], dataBytes);
+	fwrite(h, 1, sizeof(h), file);
+}
+
+void WavFileSink::run() {
+	int16_t chunk[1024];
+	uint8_t bytes[sizeof(chunk)];
+	for (;;) {
+		// check before draining, so everything written before
+		// we were told to stop still makes it into the file
+		bool stopping = !running;
+		size_t n;
+		while ((n = ring.read(chunk, 1024)) > 0) {
+			for (size_t i = 0; i < n; i++)
+				put16(&bytes[i * 2], chunk[i]);
+			fwrite(bytes, 2, n, file);
+			dataBytes += n * 2;
+		}
+		if (stopping)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+#endif
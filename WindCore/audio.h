@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#ifndef __EMSCRIPTEN__
+#include <stdio.h>
+#include <thread>
+#endif
+
+// Single-producer, single-consumer ring of 16-bit PCM samples.
+// The emulation thread writes, a host audio thread (or a sink like the
+// one below) reads; neither side ever waits for the other. If the
+// reader falls behind, new samples are dropped rather than stalling
+// the emulation, and counted so that can be reported.
+class AudioRing {
+public:
+	enum { Capacity = 0x4000 }; // a power of two, ~2s at 8kHz
+
+	size_t write(const int16_t *samples, size_t count);
+	size_t read(int16_t *samples, size_t count);
+	size_t available() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+	}
+	uint64_t droppedSamples() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	int16_t buffer[Capacity];
+	std::atomic<size_t> head{0}, tail{0};
+	std::atomic<uint64_t> dropped{0};
+};
+
+// Decoding for the 8-bit companded samples the codecs deal in
+int16_t decodeMuLaw(uint8_t value);
+int16_t decodeALaw(uint8_t value);
+
+#ifndef __EMSCRIPTEN__
+// Drains a ring into a mono 16-bit WAV file from its own thread.
+// The header is fixed up with the final length when it's destroyed.
+class WavFileSink {
+	AudioRing &ring;
+	FILE *file;
+	int sampleRate;
+	uint32_t dataBytes = 0;
+	std::atomic<bool> running{true};
+	std::thread thread;
+	void run();
+	void writeHeader();
+
+public:
+	WavFileSink(AudioRing &ring, const char *path, int sampleRate);
+	~WavFileSink();
+	bool isOpen() const { return file != nullptr; }
+};
+#endif
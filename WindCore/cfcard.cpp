@@ -0,0 +1,605 @@
+#include "cfcard.h"
+#include <string.h>
+
+#ifdef WINDCORE_CF_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Card Information Structure, as seen at the even attribute addresses.
+// Just enough for a host to recognise an ATA disk and configure it.
+static const uint8_t cis[] = {
+	0x01, 0x03, 0xD9, 0x01, 0xFF,        // CISTPL_DEVICE: function specific, 250ns, 2KB
+	0x1C, 0x04, 0x03, 0xD9, 0x01, 0xFF,  // CISTPL_DEVICE_OC: 3.3V
+	0x15, 0x14, 0x04, 0x01,              // CISTPL_VERS_1: 4.1
+	'W', 'i', 'n', 'd', 'E', 'm', 'u', 0,
+	'C', 'F', ' ', 'i', 'm', 'a', 'g', 'e', 0,
+	0xFF,
+	0x21, 0x02, 0x04, 0x01,              // CISTPL_FUNCID: fixed disk, POST
+	0x22, 0x02, 0x01, 0x01,              // CISTPL_FUNCE: PC Card ATA interface
+	0x1A, 0x05, 0x01, 0x03, 0x00, 0x02, 0x0F, // CISTPL_CONFIG: registers at 0x200
+	0x1B, 0x03, 0xC0, 0x40, 0x00,        // CISTPL_CFTABLE_ENTRY 0: memory mapped
+	0x1B, 0x03, 0xC1, 0x41, 0x00,        // CISTPL_CFTABLE_ENTRY 1: contiguous I/O
+	0x14, 0x00,                          // CISTPL_NO_LINK
+	0xFF                                 // CISTPL_END
+};
+
+static void putIdentifyString(uint8_t *dest, const char *str, int length) {
+	// ATA strings are space padded, with the bytes in each word swapped
+	for (int i = 0; i < length; i++) {
+		size_t len = strlen(str);
+		dest[i ^ 1] = (i < (int)len) ? str[i] : ' ';
+	}
+}
+
+static void putIdentifyWord(uint8_t *identify, int index, uint16_t value) {
+	identify[index * 2] = value & 0xFF;
+	identify[index * 2 + 1] = value >> 8;
+}
+
+
+CFCard::~CFCard() {
+	closeImage();
+}
+
+bool CFCard::openImage(const char *path) {
+	closeImage();
+
+#ifdef WINDCORE_CF_MMAP
+	readOnly = false;
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		readOnly = true;
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < SectorSize) {
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	imageSize = st.st_size;
+	void *mapping = mmap(nullptr, imageSize, readOnly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	image = (uint8_t *)mapping;
+#else
+	readOnly = false;
+	file = fopen(path, "r+b");
+	if (!file) {
+		readOnly = true;
+		file = fopen(path, "rb");
+		if (!file)
+			return false;
+	}
+	fseek(file, 0, SEEK_END);
+	imageSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (imageSize < SectorSize) {
+		fclose(file);
+		file = nullptr;
+		return false;
+	}
+	imageCopy.resize(imageSize);
+	if (fread(imageCopy.data(), 1, imageSize, file) != imageSize) {
+		fclose(file);
+		file = nullptr;
+		imageCopy.clear();
+		return false;
+	}
+	image = imageCopy.data();
+	dirty = false;
+#endif
+
+	// a partial sector at the end is simply not visible
+	uint64_t count = imageSize / SectorSize;
+	sectors = (count > 0x0FFFFFFF) ? 0x0FFFFFFF : (uint32_t)count;
+	reset();
+	return true;
+}
+
+void CFCard::closeImage() {
+	if (!image)
+		return;
+
+#ifdef WINDCORE_CF_MMAP
+	munmap(image, imageSize);
+	close(fd);
+	fd = -1;
+#else
+	if (dirty && !readOnly) {
+		fseek(file, 0, SEEK_SET);
+		fwrite(imageCopy.data(), 1, imageSize, file);
+	}
+	fclose(file);
+	file = nullptr;
+	imageCopy.clear();
+#endif
+	image = nullptr;
+	imageSize = 0;
+	sectors = 0;
+	writtenChunks = DirtyMap();
+	transfer = nullptr;
+	transferLeft = 0;
+}
+
+void CFCard::setDefaultGeometry() {
+	// what a real card of this size would most likely report
+	sectorsPerTrack = 32;
+	heads = 2;
+	while (heads < 16 && sectors / (heads * sectorsPerTrack) > 1024)
+		heads *= 2;
+	if (sectors / (heads * sectorsPerTrack) > 1024)
+		sectorsPerTrack = 63;
+	uint32_t cyl = sectors / (heads * sectorsPerTrack);
+	cylinders = (cyl > 16383) ? 16383 : cyl;
+}
+
+void CFCard::reset() {
+	configOption = 0;
+	configStatus = 0;
+	pinReplacement = 0;
+	socketCopy = 0;
+
+	// the task file after a reset carries the diagnostic result
+	error = 1;
+	features = 0;
+	sectorCountReg = 1;
+	sectorNumber = 1;
+	cylinderLow = 0;
+	cylinderHigh = 0;
+	driveHead = 0;
+	status = StatusReady | StatusSeekComplete;
+	deviceControl = 0;
+	intrq = false;
+	transfer = nullptr;
+	transferLeft = 0;
+	transferSectors = 0;
+	setDefaultGeometry();
+}
+
+
+
+// Addressing
+bool CFCard::currentLBA(uint32_t &lba) const {
+	if (driveHead & HeadLBA) {
+		lba = ((driveHead & 0xF) << 24) | (cylinderHigh << 16) | (cylinderLow << 8) | sectorNumber;
+		return true;
+	}
+
+	uint32_t cyl = (cylinderHigh << 8) | cylinderLow;
+	uint32_t head = driveHead & 0xF;
+	if (sectorNumber == 0 || sectorNumber > sectorsPerTrack || head >= heads)
+		return false;
+	lba = (cyl * heads + head) * sectorsPerTrack + (sectorNumber - 1);
+	return true;
+}
+
+void CFCard::setCurrentLBA(uint32_t lba) {
+	if (driveHead & HeadLBA) {
+		driveHead = (driveHead & 0xF0) | ((lba >> 24) & 0xF);
+		cylinderHigh = (lba >> 16) & 0xFF;
+		cylinderLow = (lba >> 8) & 0xFF;
+		sectorNumber = lba & 0xFF;
+	} else {
+		uint32_t cyl = lba / (heads * sectorsPerTrack);
+		uint32_t rest = lba % (heads * sectorsPerTrack);
+		driveHead = (driveHead & 0xF0) | (rest / sectorsPerTrack);
+		cylinderHigh = (cyl >> 8) & 0xFF;
+		cylinderLow = cyl & 0xFF;
+		sectorNumber = (rest % sectorsPerTrack) + 1;
+	}
+}
+
+
+
+// Commands
+void CFCard::buildIdentify() {
+	memset(identify, 0, sizeof(identify));
+	putIdentifyWord(identify, 0, 0x848A);  // CFA device, removable
+	putIdentifyWord(identify, 1, cylinders);
+	putIdentifyWord(identify, 3, heads);
+	putIdentifyWord(identify, 4, heads * SectorSize);
+	putIdentifyWord(identify, 5, SectorSize);
+	putIdentifyWord(identify, 6, sectorsPerTrack);
+	putIdentifyWord(identify, 7, sectors >> 16);
+	putIdentifyWord(identify, 8, sectors & 0xFFFF);
+	putIdentifyString(&identify[10 * 2], "WINDEMU0001", 20);
+	putIdentifyWord(identify, 20, 2);       // dual ported, multi-sector buffer
+	putIdentifyWord(identify, 21, 1);
+	putIdentifyString(&identify[23 * 2], "1.0", 8);
+	putIdentifyString(&identify[27 * 2], "WindEmu CF image", 40);
+	putIdentifyWord(identify, 47, 0x8001);  // one sector per READ/WRITE MULTIPLE
+	putIdentifyWord(identify, 49, 0x0200);  // LBA supported
+	putIdentifyWord(identify, 51, 0x0200);  // PIO mode 2
+	putIdentifyWord(identify, 53, 0x0001);
+	uint32_t chsSectors = cylinders * heads * sectorsPerTrack;
+	putIdentifyWord(identify, 54, cylinders);
+	putIdentifyWord(identify, 55, heads);
+	putIdentifyWord(identify, 56, sectorsPerTrack);
+	putIdentifyWord(identify, 57, chsSectors & 0xFFFF);
+	putIdentifyWord(identify, 58, chsSectors >> 16);
+	putIdentifyWord(identify, 59, 0x0101);
+	putIdentifyWord(identify, 60, sectors & 0xFFFF);
+	putIdentifyWord(identify, 61, sectors >> 16);
+}
+
+void CFCard::saveState(StateWriter &out) const {
+	out.put(sectors);
+	out.put(cylinders);
+	out.put(heads);
+	out.put(sectorsPerTrack);
+	out.put(configOption);
+	out.put(configStatus);
+	out.put(pinReplacement);
+	out.put(socketCopy);
+	out.put(error);
+	out.put(features);
+	out.put(sectorCountReg);
+	out.put(sectorNumber);
+	out.put(cylinderLow);
+	out.put(cylinderHigh);
+	out.put(driveHead);
+	out.put(status);
+	out.put(deviceControl);
+	out.put(intrq);
+	// the data port points at either the image or identify, so keep
+	// where it is in whichever it is
+	const uint8_t *base = transferIsImage ? image : identify;
+	out.put<uint64_t>(transfer ? (transfer - base) : UINT64_MAX);
+	out.put(transferLeft);
+	out.put(transferLBA);
+	out.put(transferSectors);
+	out.put(transferIsWrite);
+	out.put(transferIsImage);
+	out.put(identify);
+}
+
+void CFCard::loadState(StateReader &in) {
+	uint32_t savedSectors;
+	uint64_t transferOffset;
+	in.get(savedSectors);
+	in.get(cylinders);
+	in.get(heads);
+	in.get(sectorsPerTrack);
+	in.get(configOption);
+	in.get(configStatus);
+	in.get(pinReplacement);
+	in.get(socketCopy);
+	in.get(error);
+	in.get(features);
+	in.get(sectorCountReg);
+	in.get(sectorNumber);
+	in.get(cylinderLow);
+	in.get(cylinderHigh);
+	in.get(driveHead);
+	in.get(status);
+	in.get(deviceControl);
+	in.get(intrq);
+	in.get(transferOffset);
+	in.get(transferLeft);
+	in.get(transferLBA);
+	in.get(transferSectors);
+	in.get(transferIsWrite);
+	in.get(transferIsImage);
+	in.get(identify);
+
+	// it has to be the same size of card, at least
+	uint64_t limit = transferIsImage ? imageSize : (uint64_t)SectorSize;
+	if (savedSectors != sectors || (transferOffset != UINT64_MAX && transferOffset + transferLeft > limit)) {
+		in.fail();
+		transfer = nullptr;
+		transferLeft = 0;
+		return;
+	}
+	if (transferOffset == UINT64_MAX)
+		transfer = nullptr;
+	else
+		transfer = (transferIsImage ? image : identify) + transferOffset;
+}
+
+void CFCard::commandDone(uint8_t errorBits) {
+	error = errorBits;
+	status = StatusReady | StatusSeekComplete;
+	if (errorBits)
+		status |= StatusError;
+	transfer = nullptr;
+	transferLeft = 0;
+	transferSectors = 0;
+	intrq = true;
+}
+
+void CFCard::startSector() {
+	if (transferIsImage)
+		transfer = &image[(uint64_t)transferLBA * SectorSize];
+	transferLeft = SectorSize;
+	status = StatusReady | StatusSeekComplete | StatusDataRequest;
+}
+
+void CFCard::finishSector() {
+	if (transferIsImage) {
+		setCurrentLBA(transferLBA);
+		transferLBA++;
+	}
+
+	if (--transferSectors > 0) {
+		// the host gets an interrupt for every sector
+		startSector();
+		intrq = true;
+	} else if (transferIsWrite) {
+		commandDone();
+	} else {
+		// reads don't interrupt again after the last one is taken
+		transfer = nullptr;
+		transferLeft = 0;
+		status = StatusReady | StatusSeekComplete;
+	}
+}
+
+void CFCard::runCommand(uint8_t command) {
+	intrq = false;
+	if (!image || drive1Selected())
+		return;
+
+	uint32_t count = sectorCountReg ? sectorCountReg : 256;
+	uint32_t lba;
+
+	switch (command) {
+	case 0x20: case 0x21:  // READ SECTORS
+	case 0xC4:             // READ MULTIPLE
+	case 0x30: case 0x31:  // WRITE SECTORS
+	case 0xC5:             // WRITE MULTIPLE
+	case 0x38:             // CFA WRITE SECTORS WITHOUT ERASE
+		transferIsWrite = (command & 0x10) || command == 0xC5 || command == 0x38;
+		if (!currentLBA(lba) || lba >= sectors || count > sectors - lba) {
+			commandDone(ErrorIdNotFound);
+		} else if (transferIsWrite && readOnly) {
+			commandDone(ErrorAbort);
+		} else {
+			transferIsImage = true;
+			transferLBA = lba;
+			transferSectors = count;
+			startSector();
+			// writes wait for the data, reads have it ready at once
+			intrq = !transferIsWrite;
+		}
+		break;
+	case 0x40: case 0x41:  // READ VERIFY SECTORS
+		if (!currentLBA(lba) || lba >= sectors || count > sectors - lba) {
+			commandDone(ErrorIdNotFound);
+		} else {
+			setCurrentLBA(lba + count - 1);
+			commandDone();
+		}
+		break;
+	case 0xEC:             // IDENTIFY DEVICE
+		buildIdentify();
+		transferIsImage = false;
+		transferIsWrite = false;
+		transfer = identify;
+		transferSectors = 1;
+		startSector();
+		intrq = true;
+		break;
+	case 0x91:             // INITIALIZE DEVICE PARAMETERS
+		if (sectorCountReg == 0) {
+			commandDone(ErrorAbort);
+		} else {
+			heads = (driveHead & 0xF) + 1;
+			sectorsPerTrack = sectorCountReg;
+			uint32_t cyl = sectors / (heads * sectorsPerTrack);
+			cylinders = (cyl > 16383) ? 16383 : cyl;
+			commandDone();
+		}
+		break;
+	case 0xC6:             // SET MULTIPLE MODE
+		commandDone((sectorCountReg > 1) ? ErrorAbort : 0);
+		break;
+	case 0xE5: case 0x98:  // CHECK POWER MODE
+		sectorCountReg = 0xFF;
+		commandDone();
+		break;
+	case 0x90:             // EXECUTE DEVICE DIAGNOSTIC
+		commandDone();
+		error = 1; // "no error detected"
+		break;
+	case 0xE7:             // FLUSH CACHE
+#ifdef WINDCORE_CF_MMAP
+		if (!readOnly)
+			msync(image, imageSize, MS_ASYNC);
+#endif
+		commandDone();
+		break;
+	case 0xEF:             // SET FEATURES
+	case 0xE0: case 0xE1: case 0xE2: case 0xE3:  // power management,
+	case 0x94: case 0x95: case 0x96: case 0x97:  // which we don't have
+	case 0xE6: case 0x99:  // SLEEP
+	case 0x70:             // SEEK
+		commandDone();
+		break;
+	default:
+		if ((command & 0xF0) == 0x10) // RECALIBRATE
+			commandDone();
+		else
+			commandDone(ErrorAbort);
+		break;
+	}
+}
+
+
+
+// Data port
+uint32_t CFCard::readData(int size) {
+	if (transferIsWrite || !transfer)
+		return 0;
+
+	uint32_t value = 0;
+	for (int i = 0; i < size && transferLeft > 0; i++) {
+		value |= (uint32_t)*(transfer++) << (i * 8);
+		if (--transferLeft == 0)
+			finishSector();
+	}
+	return value;
+}
+
+void CFCard::writeData(uint32_t value, int size) {
+	if (!transferIsWrite || !transfer)
+		return;
+
+#ifndef WINDCORE_CF_MMAP
+	dirty = true;
+#endif
+	if (transferIsImage)
+		writtenChunks.mark(transfer - image, size);
+	for (int i = 0; i < size && transferLeft > 0; i++) {
+		*(transfer++) = (value >> (i * 8)) & 0xFF;
+		if (--transferLeft == 0)
+			finishSector();
+	}
+}
+
+
+
+// Registers
+uint8_t CFCard::readTaskFile(uint32_t reg) {
+	switch (reg) {
+	case 0x1: case 0xD: return error;
+	case 0x2: return sectorCountReg;
+	case 0x3: return sectorNumber;
+	case 0x4: return cylinderLow;
+	case 0x5: return cylinderHigh;
+	case 0x6: return driveHead | 0xA0;
+	case 0x7:
+		if (drive1Selected())
+			return 0;
+		intrq = false;
+		return status;
+	case 0xE: return drive1Selected() ? 0 : status;
+	case 0xF: return 0x80 | ((~driveHead & 0xF) << 2) | (drive1Selected() ? 1 : 2);
+	}
+	return 0xFF;
+}
+
+void CFCard::writeTaskFile(uint32_t reg, uint8_t value) {
+	switch (reg) {
+	case 0x1: case 0xD: features = value; break;
+	case 0x2: sectorCountReg = value; break;
+	case 0x3: sectorNumber = value; break;
+	case 0x4: cylinderLow = value; break;
+	case 0x5: cylinderHigh = value; break;
+	case 0x6: driveHead = value; break;
+	case 0x7: runCommand(value); break;
+	case 0xE:
+		if ((value & CtlSoftReset) && !(deviceControl & CtlSoftReset)) {
+			uint8_t keepConfig = configOption;
+			reset();
+			configOption = keepConfig;
+		}
+		deviceControl = value;
+		break;
+	}
+}
+
+uint32_t CFCard::readRegisters(uint32_t reg, bool dataWindow, int size) {
+	if (dataWindow || reg == 0x0 || reg == 0x8)
+		return readData(size);
+	if (reg == 0x9)
+		return readData(1);
+
+	// wider accesses to the other registers just cover their neighbours
+	uint32_t value = 0;
+	for (int i = 0; i < size; i++)
+		value |= (uint32_t)readTaskFile((reg + i) & 0xF) << (i * 8);
+	return value;
+}
+
+void CFCard::writeRegisters(uint32_t reg, bool dataWindow, uint32_t value, int size) {
+	if (dataWindow || reg == 0x0 || reg == 0x8) {
+		writeData(value, size);
+	} else if (reg == 0x9) {
+		writeData(value, 1);
+	} else {
+		for (int i = 0; i < size; i++)
+			writeTaskFile((reg + i) & 0xF, (value >> (i * 8)) & 0xFF);
+	}
+}
+
+
+
+// PC Card spaces
+uint8_t CFCard::readAttribute(uint32_t offset) {
+	if (!image || (offset & 1))
+		return 0;
+
+	if (offset < ConfigBase) {
+		uint32_t index = offset >> 1;
+		return (index < sizeof(cis)) ? cis[index] : 0xFF;
+	}
+
+	switch (offset) {
+	case ConfigBase: return configOption;
+	case ConfigBase + 2: return configStatus | (interruptPending() ? 2 : 0);
+	case ConfigBase + 4: return pinReplacement;
+	case ConfigBase + 6: return socketCopy;
+	}
+	return 0;
+}
+
+void CFCard::writeAttribute(uint32_t offset, uint8_t value) {
+	if (!image)
+		return;
+
+	switch (offset) {
+	case ConfigBase:
+		if (value & CorSoftReset)
+			reset();
+		else
+			configOption = value & 0x3F;
+		break;
+	case ConfigBase + 2: configStatus = value & 0x7C; break;
+	case ConfigBase + 4: pinReplacement = value; break;
+	case ConfigBase + 6: socketCopy = value; break;
+	}
+}
+
+uint32_t CFCard::readCommon(uint32_t offset, int size) {
+	if (!image)
+		return 0xFFFFFFFF;
+	// memory mapped mode: the task file is repeated every 1KB, and
+	// the upper half of each 2KB is all data port
+	offset &= 0x7FF;
+	return readRegisters(offset & 0xF, offset >= 0x400, size);
+}
+
+void CFCard::writeCommon(uint32_t offset, uint32_t value, int size) {
+	if (image) {
+		offset &= 0x7FF;
+		writeRegisters(offset & 0xF, offset >= 0x400, value, size);
+	}
+}
+
+uint32_t CFCard::readIO(uint32_t offset, int size) {
+	if (!image)
+		return 0xFFFFFFFF;
+	// in the "primary/secondary" I/O configurations, the alternate
+	// status and drive address registers live off at 0x3F6/0x3F7
+	offset &= 0x3FF;
+	uint32_t reg = (offset >= 0x3F6) ? (0x8 | (offset & 7)) : (offset & 0xF);
+	return readRegisters(reg, false, size);
+}
+
+void CFCard::writeIO(uint32_t offset, uint32_t value, int size) {
+	if (image) {
+		offset &= 0x3FF;
+		uint32_t reg = (offset >= 0x3F6) ? (0x8 | (offset & 7)) : (offset & 0xF);
+		writeRegisters(reg, false, value, size);
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+#include "savestate.h"
+
+#if !defined(_WIN32)
+#define WINDCORE_CF_MMAP
+#endif
+
+// A CompactFlash card in PC Card ATA mode, holding a raw disk image
+// (no partition table games, sector 0 is whatever the file has).
+// The image is mmap'd where we can, and the ATA data port reads and
+// writes sectors directly in the mapping, so even huge images cost
+// nothing up front and writes land in the file as they happen.
+class CFCard {
+public:
+	enum { SectorSize = 512 };
+
+	CFCard() { }
+	~CFCard();
+	CFCard(const CFCard &) = delete;
+	CFCard &operator=(const CFCard &) = delete;
+
+	// a read-only file still works, but writes to it fail
+	bool openImage(const char *path);
+	void closeImage();
+	bool hasImage() const { return image != nullptr; }
+	bool isReadOnly() const { return readOnly; }
+	uint32_t sectorCount() const { return sectors; }
+
+	// the image, for front-ends that need to keep it somewhere themselves
+	uint8_t *imageData() { return image; }
+	uint64_t imageBytes() const { return imageSize; }
+	// which parts of it the host has written to, once asked to keep track
+	void trackWrites() { writtenChunks.track(imageSize); }
+	DirtyMap &writeMap() { return writtenChunks; }
+
+	// the controller's state; the image's contents are up to the owner
+	void saveState(StateWriter &out) const;
+	void loadState(StateReader &in);
+
+	void reset();
+	bool interruptPending() const { return intrq && !(deviceControl & CtlNoInterrupts); }
+
+	// the three PC Card spaces, with offsets relative to each one
+	uint8_t readAttribute(uint32_t offset);
+	void writeAttribute(uint32_t offset, uint8_t value);
+	uint32_t readCommon(uint32_t offset, int size);
+	void writeCommon(uint32_t offset, uint32_t value, int size);
+	uint32_t readIO(uint32_t offset, int size);
+	void writeIO(uint32_t offset, uint32_t value, int size);
+
+private:
+	enum {
+		StatusError = 0x01,
+		StatusDataRequest = 0x08,
+		StatusSeekComplete = 0x10,
+		StatusReady = 0x40,
+		StatusBusy = 0x80,
+		ErrorAbort = 0x04,
+		ErrorIdNotFound = 0x10,
+		CtlNoInterrupts = 0x02,
+		CtlSoftReset = 0x04,
+		HeadLBA = 0x40,
+		HeadDrive1 = 0x10,
+		CorSoftReset = 0x80,
+		ConfigBase = 0x200
+	};
+
+	// image
+	uint8_t *image = nullptr;
+	uint64_t imageSize = 0;
+	uint32_t sectors = 0;
+	bool readOnly = false;
+#ifdef WINDCORE_CF_MMAP
+	int fd = -1;
+#else
+	// no mmap, so keep a copy and write it back when we're done
+	std::vector<uint8_t> imageCopy;
+	FILE *file = nullptr;
+	bool dirty = false;
+#endif
+	DirtyMap writtenChunks;
+	uint16_t cylinders = 0, heads = 0, sectorsPerTrack = 0;
+
+	// PC Card configuration registers
+	uint8_t configOption = 0, configStatus = 0, pinReplacement = 0, socketCopy = 0;
+
+	// ATA task file
+	uint8_t error = 0, features = 0, sectorCountReg = 0;
+	uint8_t sectorNumber = 0, cylinderLow = 0, cylinderHigh = 0, driveHead = 0;
+	uint8_t status = 0, deviceControl = 0;
+	bool intrq = false;
+
+	// the data port moves bytes between `transfer` and the host; it
+	// points into the image for sector I/O and at `identify` otherwise
+	uint8_t *transfer = nullptr;
+	uint32_t transferLeft = 0;
+	uint32_t transferLBA = 0, transferSectors = 0;
+	bool transferIsWrite = false, transferIsImage = false;
+	uint8_t identify[SectorSize];
+
+	bool drive1Selected() const { return (driveHead & HeadDrive1) != 0; }
+	void setDefaultGeometry();
+	bool currentLBA(uint32_t &lba) const;
+	void setCurrentLBA(uint32_t lba);
+	void buildIdentify();
+	void runCommand(uint8_t command);
+	void commandDone(uint8_t errorBits = 0);
+	void startSector();
+	void finishSector();
+	uint32_t readData(int size);
+	void writeData(uint32_t value, int size);
+	uint8_t readTaskFile(uint32_t reg);
+	void writeTaskFile(uint32_t reg, uint8_t value);
+	uint32_t readRegisters(uint32_t reg, bool dataWindow, int size);
+	void writeRegisters(uint32_t reg, bool dataWindow, uint32_t value, int size);
+};
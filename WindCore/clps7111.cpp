@@ -15,9 +15,44 @@ uint32_t Emulator::getRTC() {
 }
 
 
+void Emulator::updatePcCardInterrupt() {
+	pendingInterrupts &= ~(1 << EINT1);
+	if (pcCardController.interruptPending())
+		pendingInterrupts |= (1 << EINT1);
+}
+
+void Emulator::updateCodecInterrupt() {
+	pendingInterrupts &= ~(1 << CSINT);
+	if (codec.interrupt)
+		pendingInterrupts |= (1 << CSINT);
+}
+
+void Emulator::updateUartInterrupts() {
+	pendingInterrupts &= ~((1 << UTXINT) | (1 << URXINT1) | (1 << UTXINT2) | (1 << URXINT2));
+	if (uart1.txInterrupt()) pendingInterrupts |= (1 << UTXINT);
+	if (uart1.rxInterrupt()) pendingInterrupts |= (1 << URXINT1);
+	if (uart2.txInterrupt()) pendingInterrupts |= (1 << UTXINT2);
+	if (uart2.rxInterrupt()) pendingInterrupts |= (1 << URXINT2);
+}
+
+uint32_t Emulator::uartFlags(const UART &uart) const {
+	// UBUSY, URXFE and UTXFF live at the same spots in SYSFLG1/2
+	uint8_t f = uart.flags();
+	uint32_t flg = 0;
+	if (f & UART::FlagBusy) flg |= 0x800;
+	if (f & UART::FlagReceiveFifoEmpty) flg |= 0x400000;
+	if (f & UART::FlagTransmitFifoFull) flg |= 0x800000;
+	return flg;
+}
+
+
 
 uint32_t Emulator::readReg8(uint32_t reg) {
-	if (reg == PADR) {
+	if (reg == CODR) {
+		uint32_t v = codec.readData();
+		updateCodecInterrupt();
+		return v;
+	} else if (reg == PADR) {
 		return ((portValues >> 24) & 0x80) | (readKeyboard() & 0x7F);
 	} else if (reg == PBDR) {
 		return ((portValues >> 16) & 0x0F) | ((keyboardExtra ^ 0xF) << 4);
@@ -34,7 +69,7 @@ uint32_t Emulator::readReg8(uint32_t reg) {
 	} else if (reg == PEDDR) {
 		return portDirections & 0xFF;
 	} else {
-		log("RegRead8 unknown:: pc=%08x lr=%08x reg=%03x", getRealPC(), getGPR(14), reg);
+		log<LogSystem, LogWarning>("RegRead8 unknown:: pc=%08x lr=%08x reg=%03x", getRealPC(), getGPR(14), reg);
 		return 0xFF;
 	}
 }
@@ -46,11 +81,17 @@ uint32_t Emulator::readReg32(uint32_t reg) {
 		if (tc2.config & Timer::PERIODIC) flg |= 0x40;
 		if (tc2.config & Timer::MODE_512KHZ) flg |= 0x80;
 		flg |= (kScan & 0xF);
+		if (uart1.enabled) flg |= 0x100;
+		if (codec.txEnabled()) flg |= 0x2000;
+		if (codec.rxEnabled()) flg |= 0x4000;
 		return flg;
 	} else if (reg == SYSFLG1) {
 		uint32_t flg = sysFlg1;
 		flg |= 2; // external power present
 		flg |= (rtcDiv << 16);
+		flg |= uartFlags(uart1);
+		if (codec.rxCount == 0) flg |= 0x1000000;
+		if (codec.txCount == Codec::FifoSize) flg |= 0x2000000;
 		// maybe set more stuff?
 		return flg;
 	} else if (reg == INTSR1) {
@@ -65,12 +106,14 @@ uint32_t Emulator::readReg32(uint32_t reg) {
 		return tc2.value;
 	} else if (reg == RTCDR) {
 		return rtc;
+	} else if (reg == RTCMR) {
+		return rtcMatch;
 	} else if (reg == SYNCIO) {
 		switch (lastSyncioRequest & 0xFF) {
 		case 0xC1: // DigitiserX
 			return (touchX * 8) + 305;
 		case 0x81: // DigitiserY
-			return (touchY * 13.53) + 680;
+			return (touchY * 1353) / 100 + 680; // y * 13.53
 		case 0x91: // MainBattery
 			return 3000;
 		case 0xD1: // BackupBattery
@@ -78,28 +121,47 @@ uint32_t Emulator::readReg32(uint32_t reg) {
 		case 0xA1: // Reference
 			return 1000;
 		}
-		log("SYNCIO read unknown:: req=%08x", lastSyncioRequest);
+		log<LogSystem, LogWarning>("SYNCIO read unknown:: req=%08x", lastSyncioRequest);
 		return 0xFFFFFFFF;
 	} else if (reg == PALLSW) {
 		return lcdPalette & 0xFFFFFFFF;
 	} else if (reg == PALMSW) {
 		return lcdPalette >> 32;
+	} else if (reg == UARTDR1) {
+		uint32_t v = uart1.readData();
+		updateUartInterrupts();
+		return v;
+	} else if (reg == CODR) {
+		uint32_t v = codec.readData();
+		updateCodecInterrupt();
+		return v;
+	} else if (reg == UBRLCR1) {
+		return (uart1.frameControl << 12) | uart1.baudDivisor;
 	} else if (reg == SYSCON2) {
-		return 0;
+		return sysCon2;
 	} else if (reg == SYSFLG2) {
-		return 0;
+		return uartFlags(uart2);
+	} else if (reg == UARTDR2) {
+		uint32_t v = uart2.readData();
+		updateUartInterrupts();
+		return v;
+	} else if (reg == UBRLCR2) {
+		return (uart2.frameControl << 12) | uart2.baudDivisor;
 	} else if (reg == INTSR2) {
 		return pendingInterrupts >> 16;
 	} else if (reg == INTMR2) {
 		return interruptMask >> 16;
 	} else {
-		log("RegRead32 unknown:: pc=%08x lr=%08x reg=%03x", getRealPC(), getGPR(14), reg);
+		log<LogSystem, LogWarning>("RegRead32 unknown:: pc=%08x lr=%08x reg=%03x", getRealPC(), getGPR(14), reg);
 		return 0xFFFFFFFF;
 	}
 }
 
 void Emulator::writeReg8(uint32_t reg, uint8_t value) {
-	if (reg == PADR) {
+	if (reg == CODR) {
+		codec.writeData(value);
+		updateCodecInterrupt();
+	} else if (reg == PADR) {
 		uint32_t oldPorts = portValues;
 		portValues &= 0x00FFFFFF;
 		portValues |= (uint32_t)value << 24;
@@ -138,10 +200,10 @@ void Emulator::writeReg8(uint32_t reg, uint8_t value) {
 		portDirections &= 0xFFFFFF00;
 		portDirections |= (uint32_t)value;
 	} else if (reg == FRBADDR) {
-		log("LCD: address write %08x", value << 28);
+		log<LogSystem, LogVerbose>("LCD: address write %08x", value << 28);
 		lcdAddress = value << 28;
 	} else {
-		log("RegWrite8 unknown:: pc=%08x reg=%03x value=%02x", getRealPC(), reg, value);
+		log<LogSystem, LogWarning>("RegWrite8 unknown:: pc=%08x reg=%03x value=%02x", getRealPC(), reg, value);
 	}
 }
 void Emulator::writeReg32(uint32_t reg, uint32_t value) {
@@ -155,11 +217,20 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 		if (value & 0x80) tc2cfg |= Timer::MODE_512KHZ;
 		tc1.setConfig(tc1cfg);
 		tc2.setConfig(tc2cfg);
+		uart1.setEnabled(value & 0x100, passedCycles);
+		updateUartInterrupts();
+		// CDENTX and CDENRX; this codec only does mu-law
+		uint8_t codecCfg = 0;
+		if (value & 0x2000) codecCfg |= Codec::ConfigTxEnable;
+		if (value & 0x4000) codecCfg |= Codec::ConfigRxEnable;
+		if (codecCfg != codec.config)
+			codec.setConfig(codecCfg, passedCycles);
+		updateCodecInterrupt();
 	} else if (reg == INTMR1) {
 		interruptMask &= 0xFFFF0000;;
 		interruptMask |= (value & 0xFFFF);
 	} else if (reg == LCDCON) {
-		log("LCD: ctl write %08x", value);
+		log<LogSystem, LogVerbose>("LCD: ctl write %08x", value);
 		lcdControl = value;
 	} else if (reg == TC1D) {
 		tc1.load(value);
@@ -167,6 +238,10 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 		tc2.load(value);
 	} else if (reg == RTCDR) {
 		rtc = value;
+	} else if (reg == RTCMR) {
+		rtcMatch = value;
+	} else if (reg == RTCEOI) {
+		pendingInterrupts &= ~(1 << RTCMI);
 	} else if (reg == SYNCIO) {
 		lastSyncioRequest = value & 0xFFFF;
 	} else if (reg == PALLSW) {
@@ -177,6 +252,9 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 		lcdPalette |= (uint64_t)value << 32;
 	} else if (reg == HALT) {
 		halted = true;
+	} else if (reg == STDBY) {
+		log<LogSystem>("Entering standby");
+		asleep = true;
 	// BLEOI = 0x410,
 	// MCEOI = 0x414,
 	} else if (reg == TEOI) {
@@ -186,30 +264,54 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 	// E2EOI = 0x420,
 	} else if (reg == TC1EOI) {
 		pendingInterrupts &= ~(1 << TC1OI);
+	} else if (reg == CODR) {
+		codec.writeData(value & 0xFF);
+		updateCodecInterrupt();
+	} else if (reg == COEOI) {
+		codec.clearInterrupt();
+		updateCodecInterrupt();
 	} else if (reg == TC2EOI) {
 		pendingInterrupts &= ~(1 << TC2OI);
+	} else if (reg == UARTDR1) {
+		uart1.writeData(value & 0xFF);
+		updateUartInterrupts();
+	} else if (reg == UBRLCR1) {
+		// the frame control bits match Windermere's UART0FCR
+		uart1.setLineControl((value >> 12) & 0x7F, value & 0xFFF);
+		updateUartInterrupts();
 	} else if (reg == SYSCON2) {
-		log("SysCon2 write: %08x", value);
+		log<LogSystem, LogVerbose>("SysCon2 write: %08x", value);
+		sysCon2 = value;
+		uart2.setEnabled(value & 0x100, passedCycles);
+		updateUartInterrupts();
+	} else if (reg == UARTDR2) {
+		uart2.writeData(value & 0xFF);
+		updateUartInterrupts();
+	} else if (reg == UBRLCR2) {
+		uart2.setLineControl((value >> 12) & 0x7F, value & 0xFFF);
+		updateUartInterrupts();
 	} else if (reg == INTMR2) {
 		interruptMask &= 0xFFFF;
 		interruptMask |= (value << 16);
 	} else if (reg == KBDEOI) {
 		pendingInterrupts &= ~(1 << KBDINT);
 	} else {
-		log("RegWrite32 unknown:: pc=%08x reg=%03x value=%08x", getRealPC(), reg, value);
+		log<LogSystem, LogWarning>("RegWrite32 unknown:: pc=%08x reg=%03x value=%08x", getRealPC(), reg, value);
 	}
 }
 
-MaybeU32 Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize) {
+uint32_t Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize, bool &busError) {
 	uint8_t region = (physAddr >> 28);
 	if (valueSize == V8) {
 		if (region == 0)
 			return ROM[physAddr & 0xFFFFFF];
 		else if (region == 1)
 			return ROM2[physAddr & 0x3FFFF];
-		else if (region == 4)
-			return pcCardController.read(physAddr & 0xFFFFFFF, V8);
-		else if (region == 8 && physAddr <= 0x80001FFF)
+		else if (region == 4) {
+			uint32_t v = pcCardController.read(physAddr & 0xFFFFFFF, V8);
+			updatePcCardInterrupt();
+			return v;
+		} else if (region == 8 && physAddr <= 0x80001FFF)
 			return readReg8(physAddr & 0x1FFF);
 		else if (region == 0xC)
 			return MemoryBlockC0[physAddr & MemoryBlockMask];
@@ -221,20 +323,24 @@ MaybeU32 Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize) {
 			LOAD_32LE(result, physAddr & 0xFFFFFF, ROM);
 		else if (region == 1)
 			LOAD_32LE(result, physAddr & 0x3FFFF, ROM2);
-		else if (region == 4)
+		else if (region == 4) {
 			result = pcCardController.read(physAddr & 0xFFFFFFF, V32);
-		else if (region == 8 && physAddr <= 0x80001FFF)
+			updatePcCardInterrupt();
+		} else if (region == 8 && physAddr <= 0x80001FFF)
 			result = readReg32(physAddr & 0x1FFF);
 		else if (region == 0xC)
 			LOAD_32LE(result, physAddr & MemoryBlockMask, MemoryBlockC0);
 		else if (region > 0xC)
 			return 0xFFFFFFFF; // just throw accesses to unmapped RAM away
-		else
-			return {};
+		else {
+			busError = true;
+			return 0;
+		}
 		return result;
 	}
 
-	return {};
+	busError = true;
+	return 0;
 }
 
 bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueSize) {
@@ -244,9 +350,10 @@ bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueS
 			MemoryBlockC0[physAddr & MemoryBlockMask] = (uint8_t)value;
 		else if (region > 0xC)
 			return true; // just throw accesses to unmapped RAM away
-		else if (region == 4)
+		else if (region == 4) {
 			pcCardController.write(value, physAddr & 0xFFFFFFF, V8);
-		else if (region == 8 && physAddr <= 0x80001FFF)
+			updatePcCardInterrupt();
+		} else if (region == 8 && physAddr <= 0x80001FFF)
 			writeReg8(physAddr & 0x1FFF, value);
 		else
 			return false;
@@ -255,9 +362,10 @@ bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueS
 			STORE_32LE(value, physAddr & MemoryBlockMask, MemoryBlockC0);
 		else if (region > 0xC)
 			return true; // just throw accesses to unmapped RAM away
-		else if (region == 4)
+		else if (region == 4) {
 			pcCardController.write(value, physAddr & 0xFFFFFFF, V32);
-		else if (region == 8 && physAddr <= 0x80001FFF)
+			updatePcCardInterrupt();
+		} else if (region == 8 && physAddr <= 0x80001FFF)
 			writeReg32(physAddr & 0x1FFF, value);
 		else
 			return false;
@@ -265,6 +373,22 @@ bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueS
 	return true;
 }
 
+uint8_t *Emulator::getPhysicalPointer(uint32_t physAddr, uint32_t size, bool isWrite) {
+	uint8_t region = (physAddr >> 28);
+
+	if (!isWrite) {
+		if (region == 0 && (physAddr & 0xFFFFFF) + size <= sizeof(ROM))
+			return &ROM[physAddr & 0xFFFFFF];
+		else if (region == 1 && (physAddr & 0x3FFFF) + size <= sizeof(ROM2))
+			return &ROM2[physAddr & 0x3FFFF];
+	}
+
+	// the block must not wrap around its mirror
+	if (region == 0xC && (physAddr & MemoryBlockMask) + size <= (MemoryBlockMask + 1))
+		return &MemoryBlockC0[physAddr & MemoryBlockMask];
+	return nullptr;
+}
+
 
 
 void Emulator::configure() {
@@ -277,6 +401,14 @@ void Emulator::configure() {
 	memset(&tc2, 0, sizeof(tc1));
 	tc1.clockSpeed = CLOCK_SPEED;
 	tc2.clockSpeed = CLOCK_SPEED;
+	uart1.cpu = this;
+	uart2.cpu = this;
+	uart1.clockSpeed = CLOCK_SPEED;
+	uart2.clockSpeed = CLOCK_SPEED;
+	uart1.setLineControl(0, 0);
+	uart2.setLineControl(0, 0);
+	codec.cpu = this;
+	codec.clockSpeed = CLOCK_SPEED;
 
 	nextTickAt = TICK_INTERVAL;
 	tc1.nextTickAt = tc1.tickInterval();
@@ -295,28 +427,102 @@ size_t Emulator::getROMSize() {
 void Emulator::loadROM(uint8_t *buffer, size_t size) {
 	memcpy(ROM, buffer, min(size, sizeof(ROM)));
 }
+void Emulator::setAudioOutput(AudioRing *ring) {
+	codec.output = ring;
+}
+bool Emulator::insertCard(CFCard *card) {
+	pcCardController.insertCard(card);
+	updatePcCardInterrupt();
+	return true;
+}
+bool Emulator::setSerialBackend(int port, SerialBackend *backend) {
+	if (port == 0)
+		uart1.backend = backend;
+	else if (port == 1)
+		uart2.backend = backend;
+	else
+		return false;
+	return true;
+}
+
+void Emulator::advanceTicks(int64_t count) {
+	uint32_t oldRtc = rtc;
+	int64_t div = rtcDiv + count;
+	rtc += (uint32_t)(div / 64);
+	rtcDiv = div % 64;
+
+	nextTickAt += count * TICK_INTERVAL;
+	pendingInterrupts |= (1<<TINT);
+	// did we go past the alarm?
+	if ((uint32_t)(rtcMatch - oldRtc - 1) < (uint32_t)(rtc - oldRtc))
+		pendingInterrupts |= (1<<RTCMI);
+}
+
+void Emulator::sleepUntil(int64_t cycles) {
+	// Only the tick and RTC run in standby, so (as on Windermere) we
+	// skip straight to the alarm or to `cycles`, whichever's sooner.
+	if (pendingInterrupts & interruptMask & WAKE_INTERRUPTS) {
+		wakeUp();
+		return;
+	}
+
+	int64_t until = cycles;
+	if ((interruptMask & (1<<RTCMI)) && rtcMatch > rtc) {
+		int64_t ticksLeft = (int64_t)(rtcMatch - rtc - 1) * 64 + (64 - rtcDiv);
+		int64_t alarmAt = nextTickAt + (ticksLeft - 1) * TICK_INTERVAL;
+		if (alarmAt < until)
+			until = (alarmAt > passedCycles) ? alarmAt : passedCycles;
+	}
+	// scripted input counts too
+	if (nextInputEventAt < until)
+		until = (nextInputEventAt > passedCycles) ? nextInputEventAt : passedCycles;
+
+	if (until >= nextTickAt)
+		advanceTicks((until - nextTickAt) / TICK_INTERVAL + 1);
+
+	int64_t duration = until - passedCycles;
+	tc1.clockStopped(duration);
+	tc2.clockStopped(duration);
+	uart1.clockStopped(duration);
+	uart2.clockStopped(duration);
+	codec.clockStopped(duration);
+	idleCycles += duration;
+	passedCycles = until;
+
+	if (passedCycles >= nextInputEventAt)
+		runInputEvents();
+	if (asleep && (pendingInterrupts & interruptMask & WAKE_INTERRUPTS))
+		wakeUp();
+}
+
+void Emulator::wakeUp() {
+	log<LogSystem>("Leaving standby (rtc=%08x)", rtc);
+	asleep = false;
+	halted = false;
+}
 
 void Emulator::executeUntil(int64_t cycles) {
 	if (!configured)
 		configure();
 
-	while (!asleep && passedCycles < cycles) {
-		if (passedCycles >= nextTickAt) {
-			// increment RTCDIV
-			if (rtcDiv == 0x3F) {
-				rtc++;
-				rtcDiv = 0;
-			} else {
-				rtcDiv++;
-			}
-
-			nextTickAt += TICK_INTERVAL;
-			pendingInterrupts |= (1<<TINT);
+	bool debugging = beginDebugging();
+	while (passedCycles < cycles) {
+		if (asleep) {
+			sleepUntil(cycles);
+			continue;
 		}
+		if (passedCycles >= nextTickAt)
+			advanceTicks(1);
+		if (passedCycles >= nextInputEventAt)
+			runInputEvents();
 		if (tc1.tick(passedCycles))
 			pendingInterrupts |= (1<<TC1OI);
 		if (tc2.tick(passedCycles))
 			pendingInterrupts |= (1<<TC2OI);
+		if (uart1.tick(passedCycles) | uart2.tick(passedCycles))
+			updateUartInterrupts();
+		if (codec.tick(passedCycles))
+			updateCodecInterrupt();
 
 		if ((pendingInterrupts & interruptMask & FIQ_INTERRUPTS) != 0 && canAcceptFIQ()) {
 			requestFIQ();
@@ -331,40 +537,56 @@ void Emulator::executeUntil(int64_t cycles) {
 		if (halted) {
 			// keep the clock moving
 			passedCycles++;
+			idleCycles++;
 		} else {
-			if (auto v = virtToPhys(getGPR(15) - 0xC); v.has_value() && instructionReady())
-				debugPC(v.value());
+			bool executing = instructionReady();
+			if (executing) {
+				bool fault = false;
+				uint32_t physPC = virtToPhys(getGPR(15) - 0xC, fault);
+				if (!fault)
+					debugPC(physPC);
+			}
+			if (debugging && executing && checkBreakpoint())
+				break;
+			if (executing && !hleHooks.empty() && runHleHook())
+				continue;
 			passedCycles += tick();
+			if (debugging && stopReason == StopWatchpoint)
+				break;
+			if (debugging && executing && singleStep) {
+				stopReason = StopStep;
+				break;
+			}
 
 			uint32_t new_pc = getGPR(15) - 0xC;
-			if (_breakpoints.find(new_pc) != _breakpoints.end()) {
-				log("⚠️ Breakpoint triggered at %08x!", new_pc);
-				return;
-			}
 			if (new_pc >= 0x80000000 && new_pc <= 0x90000000) {
-				log("BAD PC %08x!!", new_pc);
+				log<LogCPU, LogError>("BAD PC %08x!!", new_pc);
 				logPcHistory();
+				drainWriteBuffer();
 				return;
 			}
 		}
 	}
+
+	// let the outside world (LCD, debugger) see everything
+	drainWriteBuffer();
 }
 
 
 const char *Emulator::identifyObjectCon(uint32_t ptr) {
-	if (ptr == readVirtualDebug(0x80000880, V32).value()) return "process";
-	if (ptr == readVirtualDebug(0x80000884, V32).value()) return "thread";
-	if (ptr == readVirtualDebug(0x80000888, V32).value()) return "chunk";
-//	if (ptr == readVirtualDebug(0x8000088C, V32).value()) return "semaphore";
-//	if (ptr == readVirtualDebug(0x80000890, V32).value()) return "mutex";
-	if (ptr == readVirtualDebug(0x80000894, V32).value()) return "logicaldevice";
-	if (ptr == readVirtualDebug(0x80000898, V32).value()) return "physicaldevice";
-	if (ptr == readVirtualDebug(0x8000089C, V32).value()) return "channel";
-	if (ptr == readVirtualDebug(0x800008A0, V32).value()) return "server";
-//	if (ptr == readVirtualDebug(0x800008A4, V32).value()) return "unk8A4"; // name always null
-	if (ptr == readVirtualDebug(0x800008AC, V32).value()) return "library";
-//	if (ptr == readVirtualDebug(0x800008B0, V32).value()) return "unk8B0"; // name always null
-//	if (ptr == readVirtualDebug(0x800008B4, V32).value()) return "unk8B4"; // name always null
+	if (ptr == readVirtualDebug(0x80000880, V32)) return "process";
+	if (ptr == readVirtualDebug(0x80000884, V32)) return "thread";
+	if (ptr == readVirtualDebug(0x80000888, V32)) return "chunk";
+//	if (ptr == readVirtualDebug(0x8000088C, V32)) return "semaphore";
+//	if (ptr == readVirtualDebug(0x80000890, V32)) return "mutex";
+	if (ptr == readVirtualDebug(0x80000894, V32)) return "logicaldevice";
+	if (ptr == readVirtualDebug(0x80000898, V32)) return "physicaldevice";
+	if (ptr == readVirtualDebug(0x8000089C, V32)) return "channel";
+	if (ptr == readVirtualDebug(0x800008A0, V32)) return "server";
+//	if (ptr == readVirtualDebug(0x800008A4, V32)) return "unk8A4"; // name always null
+	if (ptr == readVirtualDebug(0x800008AC, V32)) return "library";
+//	if (ptr == readVirtualDebug(0x800008B0, V32)) return "unk8B0"; // name always null
+//	if (ptr == readVirtualDebug(0x800008B4, V32)) return "unk8B4"; // name always null
 	return nullptr;
 }
 
@@ -373,19 +595,19 @@ void Emulator::fetchStr(uint32_t str, char *buf) {
 		strcpy(buf, "<NULL>");
 		return;
 	}
-	int size = readVirtualDebug(str, V32).value();
+	int size = readVirtualDebug(str, V32);
 	for (int i = 0; i < size; i++) {
-		buf[i] = readVirtualDebug(str + 4 + i, V8).value();
+		buf[i] = readVirtualDebug(str + 4 + i, V8);
 	}
 	buf[size] = 0;
 }
 
 void Emulator::fetchName(uint32_t obj, char *buf) {
-	fetchStr(readVirtualDebug(obj + 0x10, V32).value(), buf);
+	fetchStr(readVirtualDebug(obj + 0x10, V32), buf);
 }
 
 void Emulator::fetchProcessFilename(uint32_t obj, char *buf) {
-	fetchStr(readVirtualDebug(obj + 0x3C, V32).value(), buf);
+	fetchStr(readVirtualDebug(obj + 0x3C, V32), buf);
 }
 
 void Emulator::debugPC(uint32_t pc) {
@@ -400,9 +622,9 @@ void Emulator::debugPC(uint32_t pc) {
 			if (strcmp(wut, "process") == 0) {
 				char procName[1000];
 				fetchProcessFilename(obj, procName);
-				log("OBJS: added %s at %08x <%s> <%s>", wut, obj, objName, procName);
+				log<LogKernel>("OBJS: added %s at %08x <%s> <%s>", wut, obj, objName, procName);
 			} else {
-				log("OBJS: added %s at %08x <%s>", wut, obj, objName);
+				log<LogKernel>("OBJS: added %s at %08x <%s>", wut, obj, objName);
 			}
 		}
 	}
@@ -412,7 +634,7 @@ void Emulator::debugPC(uint32_t pc) {
 		uint32_t physAddr = getGPR(1);
 		uint32_t btIndex = getGPR(2);
 		uint32_t regionSize = getGPR(3);
-		log("KERNEL MMU SECTION: v:%08x p:%08x size:%08x idx:%02x",
+		log<LogKernel>("KERNEL MMU SECTION: v:%08x p:%08x size:%08x idx:%02x",
 			virtAddr, physAddr, regionSize, btIndex);
 	}
 	if (pc == 0x66C) {
@@ -422,7 +644,7 @@ void Emulator::debugPC(uint32_t pc) {
 		uint32_t regionSize = getGPR(3);
 		uint32_t pageTableA = getGPR(4);
 		uint32_t pageTableB = getGPR(5);
-		log("KERNEL MMU PAGES: v:%08x p:%08x size:%08x idx:%02x tableA:%08x tableB:%08x",
+		log<LogKernel>("KERNEL MMU PAGES: v:%08x p:%08x size:%08x idx:%02x tableA:%08x tableB:%08x",
 			virtAddr, physAddr, regionSize, btIndex, pageTableA, pageTableB);
 	}
 	if (pc == 0x15070) {
@@ -430,16 +652,16 @@ void Emulator::debugPC(uint32_t pc) {
 		uint32_t physAddr = getGPR(1);
 		uint32_t regionSize = getGPR(2);
 		uint32_t a = getGPR(3);
-		log("DPlatChunkHw MAPPING: v:%08x p:%08x size:%08x arg:%08x",
+		log<LogKernel>("DPlatChunkHw MAPPING: v:%08x p:%08x size:%08x arg:%08x",
 			virtAddr, physAddr, regionSize, a);
 	}
 
 	if (pc == 0x16198) {
 		uint32_t rawEvent = getGPR(0);
-		uint32_t evtType = readVirtualDebug(rawEvent, V32).value_or(0);
-		uint32_t evtTick = readVirtualDebug(rawEvent + 4, V32).value_or(0);
-		uint32_t evtParamA = readVirtualDebug(rawEvent + 8, V32).value_or(0);
-		uint32_t evtParamB = readVirtualDebug(rawEvent + 0xC, V32).value_or(0);
+		uint32_t evtType = readVirtualDebug(rawEvent, V32);
+		uint32_t evtTick = readVirtualDebug(rawEvent + 4, V32);
+		uint32_t evtParamA = readVirtualDebug(rawEvent + 8, V32);
+		uint32_t evtParamB = readVirtualDebug(rawEvent + 0xC, V32);
 		const char *n = "???";
 		switch (evtType) {
 		case 0: n = "ENone"; break;
@@ -460,7 +682,7 @@ void Emulator::debugPC(uint32_t pc) {
 		case 15: n = "EButton3Up"; break;
 		case 16: n = "ESwitchOff"; break;
 		}
-		log("EVENT %s: tick=%d params=%08x,%08x", n, evtTick, evtParamA, evtParamB);
+		log<LogKernel>("EVENT %s: tick=%d params=%08x,%08x", n, evtTick, evtParamA, evtParamB);
 	}
 }
 
@@ -513,25 +735,25 @@ void Emulator::readLCDIntoBuffer(uint8_t **lines, bool is32BitOutput) const {
 
 void Emulator::diffPorts(uint32_t oldval, uint32_t newval) {
 	uint32_t changes = oldval ^ newval;
-	if (changes & 1) log("PRT E0: %d", newval&1);
-	if (changes & 2) log("PRT E1: %d", newval&2);
-	if (changes & 4) log("PRT E2: %d", newval&4);
-	if (changes & 0x100) log("PRT D0: %d", newval&0x100);
-	if (changes & 0x200) log("PRT D1: %d", newval&0x200);
-	if (changes & 0x400) log("PRT D2: %d", newval&0x400);
-	if (changes & 0x800) log("PRT D3: %d", newval&0x800);
-	if (changes & 0x1000) log("PRT D4: %d", newval&0x1000);
-	if (changes & 0x2000) log("PRT D5: %d", newval&0x2000);
-	if (changes & 0x4000) log("PRT D6: %d", newval&0x4000);
-	if (changes & 0x8000) log("PRT D7: %d", newval&0x8000);
-	if (changes & 0x10000) log("PRT B0: %d", newval&0x10000);
-	if (changes & 0x20000) log("PRT B1: %d", newval&0x20000);
-	if (changes & 0x40000) log("PRT B2: %d", newval&0x40000);
-	if (changes & 0x80000) log("PRT B3: %d", newval&0x80000);
-	if (changes & 0x100000) log("PRT B4: %d", newval&0x100000);
-	if (changes & 0x200000) log("PRT B5: %d", newval&0x200000);
-	if (changes & 0x400000) log("PRT B6: %d", newval&0x400000);
-	if (changes & 0x800000) log("PRT B7: %d", newval&0x800000);
+	if (changes & 1) log<LogSystem>("PRT E0: %d", newval&1);
+	if (changes & 2) log<LogSystem>("PRT E1: %d", newval&2);
+	if (changes & 4) log<LogSystem>("PRT E2: %d", newval&4);
+	if (changes & 0x100) log<LogSystem>("PRT D0: %d", newval&0x100);
+	if (changes & 0x200) log<LogSystem>("PRT D1: %d", newval&0x200);
+	if (changes & 0x400) log<LogSystem>("PRT D2: %d", newval&0x400);
+	if (changes & 0x800) log<LogSystem>("PRT D3: %d", newval&0x800);
+	if (changes & 0x1000) log<LogSystem>("PRT D4: %d", newval&0x1000);
+	if (changes & 0x2000) log<LogSystem>("PRT D5: %d", newval&0x2000);
+	if (changes & 0x4000) log<LogSystem>("PRT D6: %d", newval&0x4000);
+	if (changes & 0x8000) log<LogSystem>("PRT D7: %d", newval&0x8000);
+	if (changes & 0x10000) log<LogSystem>("PRT B0: %d", newval&0x10000);
+	if (changes & 0x20000) log<LogSystem>("PRT B1: %d", newval&0x20000);
+	if (changes & 0x40000) log<LogSystem>("PRT B2: %d", newval&0x40000);
+	if (changes & 0x80000) log<LogSystem>("PRT B3: %d", newval&0x80000);
+	if (changes & 0x100000) log<LogSystem>("PRT B4: %d", newval&0x100000);
+	if (changes & 0x200000) log<LogSystem>("PRT B5: %d", newval&0x200000);
+	if (changes & 0x400000) log<LogSystem>("PRT B6: %d", newval&0x400000);
+	if (changes & 0x800000) log<LogSystem>("PRT B7: %d", newval&0x800000);
 }
 
 
@@ -544,20 +766,18 @@ uint32_t Emulator::readKeyboard() const {
 			return 0;
 	} else if (kScan == 0) {
 		// Report all columns combined
-		uint8_t val = 0;
-		for (int i = 0; i < 7; i++)
-			val |= keyboardColumns[i];
-		return val;
+		return keyboardAnyColumn;
 	} else {
 		return 0;
 	}
 }
 
-void Emulator::setKeyboardKey(EpocKey key, bool value) {
-	int idx = -1;
-#define KEY(column, bit) idx = (column << 8) | (1 << bit); break
-
-	switch ((int)key) {
+// Where each key sits in the matrix, as (column << 8) | row bit.
+// This is all worked out at compile time, so a key event is a table
+// lookup, a bit twiddle and re-ORing the handful of column bytes.
+#define KEY(column, bit) return (column << 8) | (1 << bit)
+static constexpr int keyPosition(int key) {
+	switch (key) {
 	case '1':                KEY(0, 0);
 	case '2':                KEY(1, 0);
 	case '3':                KEY(2, 0);
@@ -619,17 +839,45 @@ void Emulator::setKeyboardKey(EpocKey key, bool value) {
 	case EStdKeyLeftCtrl:    KEY(8, 2);
 	case EStdKeyLeftFunc:    KEY(8, 3);
 	}
+	return -1;
+}
+#undef KEY
+
+static constexpr struct KeyMatrix {
+	int16_t position[EStdKeyDial + 1];
+	constexpr KeyMatrix() : position() {
+		for (int i = 0; i <= EStdKeyDial; i++)
+			position[i] = keyPosition(i);
+	}
+} keyMatrix;
+
+void Emulator::setKeyboardKey(EpocKey key, bool value) {
+	int idx = ((unsigned)key <= EStdKeyDial) ? keyMatrix.position[key] : -1;
+	if (idx < 0)
+		return;
 
 	if (idx >= 0x800) {
 		if (value)
 			keyboardExtra |= (idx & 0xFF);
 		else
 			keyboardExtra &= ~(idx & 0xFF);
-	} else if (idx >= 0) {
+	} else {
 		if (value)
 			keyboardColumns[idx >> 8] |= (idx & 0xFF);
 		else
 			keyboardColumns[idx >> 8] &= ~(idx & 0xFF);
+		// keep the all-columns view current so KSCAN reads don't rebuild it
+		keyboardAnyColumn = 0;
+		for (int i = 0; i < 7; i++)
+			keyboardAnyColumn |= keyboardColumns[i];
+	}
+
+	if (value) {
+		// the OS gets told about new presses rather than having to poll
+		pendingInterrupts |= (1 << KBDINT);
+		// and one pulls WAKEUP, so it'll bring us out of standby
+		if (asleep)
+			wakeUp();
 	}
 }
 
@@ -638,7 +886,7 @@ void Emulator::updateTouchInput(int32_t x, int32_t y, bool down) {
 	pendingInterrupts &= ~(1 << EINT2);
 	if (down)
 		pendingInterrupts |= (1 << EINT2);
-	log("Touch: x=%d y=%d down=%s", x, y, down ? "yes" : "no");
+	log<LogSystem, LogVerbose>("Touch: x=%d y=%d down=%s", x, y, down ? "yes" : "no");
 	touchX = x;
 	touchY = y;
 }
@@ -14,29 +14,41 @@ public:
 	enum { MemoryBlockMask = 0x3FFFFF };
 
 private:
-	uint16_t pendingInterrupts = 0;
-	uint16_t interruptMask = 0;
+	uint32_t pendingInterrupts = 0;
+	uint32_t interruptMask = 0;
 	uint32_t portValues = 0;
 	uint32_t portDirections = 0;
 	uint32_t sysFlg1 = 0x20008000; // constant CL-PS7111 flag and cold start flag
+	uint32_t sysCon2 = 0;
 	uint32_t lcdControl = 0;
 	uint32_t lcdAddress = 0xC0000000;
 	uint32_t rtc = 0;
 	uint32_t rtcDiv = 0;
+	uint32_t rtcMatch = 0;
 	uint64_t lcdPalette = 0;
 	uint16_t lastSyncioRequest = 0;
 
 	uint32_t kScan = 0;
 	uint8_t keyboardColumns[7] = {0,0,0,0,0,0,0};
+	uint8_t keyboardAnyColumn = 0;
 	uint8_t keyboardExtra = 0;
 	int32_t touchX = 0, touchY = 0;
 
 	Timer tc1, tc2;
+	UART uart1, uart2;
+	Codec codec;
 	CLPS7600 pcCardController;
 	bool halted = false, asleep = false;
 
 
 	uint32_t getRTC();
+	void advanceTicks(int64_t count);
+	void sleepUntil(int64_t cycles);
+	void wakeUp();
+	void updateUartInterrupts();
+	void updateCodecInterrupt();
+	void updatePcCardInterrupt();
+	uint32_t uartFlags(const UART &uart) const;
 
 	uint32_t readReg8(uint32_t reg);
 	uint32_t readReg32(uint32_t reg);
@@ -44,8 +56,9 @@ private:
 	void writeReg32(uint32_t reg, uint32_t value);
 
 public:
-	MaybeU32 readPhysical(uint32_t physAddr, ValueSize valueSize) override;
+	uint32_t readPhysical(uint32_t physAddr, ValueSize valueSize, bool &busError) override;
 	bool writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueSize) override;
+	uint8_t *getPhysicalPointer(uint32_t physAddr, uint32_t size, bool isWrite) override;
 
 private:
 	bool configured = false;
@@ -64,6 +77,9 @@ public:
 	uint8_t *getROMBuffer() override;
 	size_t getROMSize() override;
 	void loadROM(uint8_t *buffer, size_t size) override;
+	bool setSerialBackend(int port, SerialBackend *backend) override;
+	bool insertCard(CFCard *card) override;
+	void setAudioOutput(AudioRing *ring) override;
 	void executeUntil(int64_t cycles) override;
 	int32_t getClockSpeed() const override { return CLOCK_SPEED; }
 	const char *getDeviceName() const override;
@@ -27,8 +27,10 @@ enum Interrupt {
 	KBDINT = 16,  // IrqKeyPress?
 	UTXINT2 = 28, // IrqSpi2Tx?
 	URXINT2 = 29, // IrqSpi2Rx?
-	FIQ_INTERRUPTS = 0x000F,
-	IRQ_INTERRUPTS = 0xFFF0
+	FIQ_INTERRUPTS = 0x0000000F,
+	IRQ_INTERRUPTS = 0xFFFFFFF0,
+	// enabled interrupts that can bring us out of standby
+	WAKE_INTERRUPTS = (1<<EXTFIQ) | (1<<MCINT) | (1<<EINT1) | (1<<EINT2) | (1<<EINT3) | (1<<RTCMI) | (1<<KBDINT)
 };
 
 enum Register {
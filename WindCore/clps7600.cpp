@@ -6,6 +6,15 @@ CLPS7600::CLPS7600(ARM710 *_cpu)
 	cpu = _cpu;
 }
 
+// The four 64MB spaces within our chip select
+enum {
+	SpaceMask = 0xC000000,
+	SpaceAttribute = 0x0000000,
+	SpaceIO = 0x4000000,
+	SpaceCommon = 0x8000000,
+	SpaceRegisters = 0xC000000
+};
+
 enum {
 	PCM_BVD1 = 1,
 	PCM_BVD2 = 2,
@@ -27,107 +36,247 @@ enum {
 uint32_t CLPS7600::getInputLevel() const {
 	uint32_t v = 0;
 
+	if (card) {
+		v |= PCM_CD1 | PCM_CD2;
+		if (card->isReadOnly())
+			v |= PCM_WP;
+	}
+
 	if (isMemoryMode())
 		v |= PCM_RDY; // we are ALWAYS ready
+	else if (!card || !card->interruptPending())
+		v |= PCM_RDY; // in I/O mode this pin is IREQ#, low while interrupting
 
 	return v;
 }
 
+int CLPS7600::fifoThreshold() const {
+	int words = (dmaControl & DmaThresholdMask) >> DmaThresholdShift;
+	return (words == 0 || words > FifoWords) ? FifoWords : words;
+}
+
+void CLPS7600::updateInterrupts() {
+	interruptStatus &= ~(FIFOTHLD | PCM_RDY);
+	// the card never keeps us waiting, so a DMA burst is always ready
+	if (dmaActive())
+		interruptStatus |= FIFOTHLD;
+	if (isIOMode() && card && card->interruptPending())
+		interruptStatus |= PCM_RDY;
+}
+
+void CLPS7600::insertCard(CFCard *newCard) {
+	if (newCard == card)
+		return;
+	flushFifo();
+	card = newCard;
+	if (card)
+		card->reset();
+	interruptStatus |= PCM_CD1 | PCM_CD2;
+	updateInterrupts();
+}
+
+
+
 uint32_t CLPS7600::read(uint32_t addr, ARM710::ValueSize valueSize)
 {
-	cpu->log("CLPS7600 read: addr=%07x size=%d pc=%08x lr=%08x", addr, (valueSize == ARM710::V32) ? 32 : 8, cpu->getRealPC(), cpu->getGPR(14));
-	if (valueSize == ARM710::V32) {
-		switch (addr) {
-		case 0xC000000: // Interrupt Status
-			return interruptStatus;
-		case 0xC000400: // Interrupt Mask
-			return interruptMask;
-		case 0xC001C00: // Interrupt Input Level
-			return getInputLevel();
-		case 0xC002000: // System Interface Configuration
-			return systemInterfaceConfig;
-		case 0xC002400: // Card Interface Configuration
-			return cardInterfaceConfig;
-		case 0xC002800: // Power Management
-			return powerManagement;
-		case 0xC002C00: // Card Power Control
-			return cardPowerControl;
-		case 0xC003000: // Card Interface Timing 0A
-			return cardInterfaceTiming0A;
-		case 0xC003400: // Card Interface Timing 0B
-			return cardInterfaceTiming0B;
-		case 0xC003800: // Card Interface Timing 1A
-			return cardInterfaceTiming1A;
-		case 0xC003C00: // Card Interface Timing 1B
-			return cardInterfaceTiming1B;
-		case 0xC004000: // DMA Control
-			return dmaControl;
-		case 0xC004400: // Device Information
-			return deviceInformation;
-		default:
-			cpu->log("CLPS7600 unknown register read: addr=%07x pc=%08x lr=%08x", addr, cpu->getRealPC(), cpu->getGPR(14));
-			return 0xFFFFFFFF;
-		}
+	cpu->log<LogPCCard, LogVerbose>("CLPS7600 read: addr=%07x size=%d pc=%08x lr=%08x", addr, (valueSize == ARM710::V32) ? 32 : 8, cpu->getRealPC(), cpu->getGPR(14));
+
+	if ((addr & SpaceMask) != SpaceRegisters) {
+		uint32_t v = readCard(addr, (valueSize == ARM710::V32) ? 4 : 1);
+		updateInterrupts();
+		return v;
 	}
-	cpu->log("unknown!!");
+
+	if (valueSize == ARM710::V32)
+		return readRegister(addr);
+	cpu->log<LogPCCard, LogVerbose>("CLPS7600 byte register read: addr=%07x pc=%08x", addr, cpu->getRealPC());
 	return 0xFF;
 }
 
 void CLPS7600::write(uint32_t value, uint32_t addr, ARM710::ValueSize valueSize)
 {
-	cpu->log("CLPS7600 write: addr=%07x size=%d value=%08x pc=%08x lr=%08x", addr, (valueSize == ARM710::V32) ? 32 : 8, value, cpu->getRealPC(), cpu->getGPR(14));
-	if (valueSize == ARM710::V32) {
-		switch (addr) {
-		case 0xC000400: // Interrupt Mask
-			interruptMask = value;
-			break;
-		case 0xC000800: // Interrupt Clear
-			break;
-		case 0xC000C00: // Interrupt Output Select
-			break;
-		case 0xC001000: // Interrupt Reserved Register 1
-			break;
-		case 0xC001400: // Interrupt Reserved Register 2
-			break;
-		case 0xC001800: // Interrupt Reserved Register 3
-			break;
-		case 0xC002000: // System Interface Configuration
-			systemInterfaceConfig = value;
-			break;
-		case 0xC002400: // Card Interface Configuration
-			cardInterfaceConfig = value;
-			cpu->log("PC card enabled: %s", (value & 0x400) ? "yes" : "no");
-			cpu->log("PC card write protect: %s", (value & 0x200) ? "yes" : "no");
-			cpu->log("PC card mode: %s", (value & 0x100) ? "i/o" : "memory");
-			break;
-		case 0xC002800: // Power Management
-			powerManagement = value;
-			break;
-		case 0xC002C00: // Card Power Control
-			cardPowerControl = value;
-			break;
-		case 0xC003000: // Card Interface Timing 0A
-			cardInterfaceTiming0A = value;
-			break;
-		case 0xC003400: // Card Interface Timing 0B
-			cardInterfaceTiming0B = value;
-			break;
-		case 0xC003800: // Card Interface Timing 1A
-			cardInterfaceTiming1A = value;
-			break;
-		case 0xC003C00: // Card Interface Timing 1B
-			cardInterfaceTiming1B = value;
-			break;
-		case 0xC004000: // DMA Control
-			dmaControl = value;
-			break;
-		case 0xC004400: // Device Information
-			deviceInformation = value;
-			break;
-		default:
-			cpu->log("CLPS7600 unknown register write: addr=%07x value=%08x pc=%08x lr=%08x", addr, value, cpu->getRealPC(), cpu->getGPR(14));
-		}
-	} else {
-		cpu->log("unknown write!!");
+	cpu->log<LogPCCard, LogVerbose>("CLPS7600 write: addr=%07x size=%d value=%08x pc=%08x lr=%08x", addr, (valueSize == ARM710::V32) ? 32 : 8, value, cpu->getRealPC(), cpu->getGPR(14));
+
+	if ((addr & SpaceMask) != SpaceRegisters) {
+		if (valueSize == ARM710::V32 && dmaActive() && (dmaControl & DmaToCard))
+			writeCardFifo(value, addr);
+		else
+			writeCard(value, addr, (valueSize == ARM710::V32) ? 4 : 1);
+		updateInterrupts();
+		return;
+	}
+
+	if (valueSize == ARM710::V32)
+		writeRegister(value, addr);
+	else
+		cpu->log<LogPCCard, LogVerbose>("CLPS7600 byte register write: addr=%07x value=%02x pc=%08x", addr, value, cpu->getRealPC());
+}
+
+
+
+// Card windows
+uint32_t CLPS7600::readCard(uint32_t addr, int size)
+{
+	if (!card || !isCardEnabled())
+		return (size == 1) ? 0xFF : 0xFFFFFFFF;
+
+	// anything still queued for the card has to get there first
+	flushFifo();
+
+	uint32_t offset = addr & ~SpaceMask;
+	switch (addr & SpaceMask) {
+	case SpaceAttribute:
+		return card->readAttribute(offset);
+	case SpaceIO:
+		return card->readIO(offset, size);
+	default:
+		return card->readCommon(offset, size);
+	}
+}
+
+void CLPS7600::writeCard(uint32_t value, uint32_t addr, int size)
+{
+	if (!card || !isCardEnabled())
+		return;
+	if (cardInterfaceConfig & 0x200)
+		return; // write protected by the host
+
+	flushFifo();
+
+	uint32_t offset = addr & ~SpaceMask;
+	switch (addr & SpaceMask) {
+	case SpaceAttribute:
+		card->writeAttribute(offset, value & 0xFF);
+		break;
+	case SpaceIO:
+		card->writeIO(offset, value, size);
+		break;
+	default:
+		card->writeCommon(offset, value, size);
+		break;
+	}
+}
+
+void CLPS7600::writeCardFifo(uint32_t value, uint32_t addr)
+{
+	if (fifoCount > 0 && addr != fifoAddress)
+		flushFifo();
+
+	if (fifoCount == 0) {
+		fifoHead = 0;
+		fifoAddress = addr;
+	}
+	fifo[(fifoHead + fifoCount) % FifoWords] = value;
+	fifoCount++;
+
+	if (fifoCount >= fifoThreshold())
+		flushFifo();
+}
+
+void CLPS7600::flushFifo()
+{
+	// only writes ever get queued
+	int count = fifoCount;
+	fifoCount = 0;
+
+	for (int i = 0; i < count; i++)
+		writeCard(fifo[(fifoHead + i) % FifoWords], fifoAddress, 4);
+}
+
+
+
+// Registers
+uint32_t CLPS7600::readRegister(uint32_t addr)
+{
+	switch (addr) {
+	case 0xC000000: // Interrupt Status
+		return interruptStatus;
+	case 0xC000400: // Interrupt Mask
+		return interruptMask;
+	case 0xC001C00: // Interrupt Input Level
+		return getInputLevel();
+	case 0xC002000: // System Interface Configuration
+		return systemInterfaceConfig;
+	case 0xC002400: // Card Interface Configuration
+		return cardInterfaceConfig;
+	case 0xC002800: // Power Management
+		return powerManagement;
+	case 0xC002C00: // Card Power Control
+		return cardPowerControl;
+	case 0xC003000: // Card Interface Timing 0A
+		return cardInterfaceTiming0A;
+	case 0xC003400: // Card Interface Timing 0B
+		return cardInterfaceTiming0B;
+	case 0xC003800: // Card Interface Timing 1A
+		return cardInterfaceTiming1A;
+	case 0xC003C00: // Card Interface Timing 1B
+		return cardInterfaceTiming1B;
+	case 0xC004000: // DMA Control
+		return dmaControl;
+	case 0xC004400: // Device Information
+		return deviceInformation;
+	default:
+		cpu->log<LogPCCard, LogWarning>("CLPS7600 unknown register read: addr=%07x pc=%08x lr=%08x", addr, cpu->getRealPC(), cpu->getGPR(14));
+		return 0xFFFFFFFF;
+	}
+}
+
+void CLPS7600::writeRegister(uint32_t value, uint32_t addr)
+{
+	switch (addr) {
+	case 0xC000400: // Interrupt Mask
+		interruptMask = value;
+		break;
+	case 0xC000800: // Interrupt Clear
+		interruptStatus &= ~value;
+		updateInterrupts(); // level-triggered ones come straight back
+		break;
+	case 0xC000C00: // Interrupt Output Select
+		break;
+	case 0xC001000: // Interrupt Reserved Register 1
+		break;
+	case 0xC001400: // Interrupt Reserved Register 2
+		break;
+	case 0xC001800: // Interrupt Reserved Register 3
+		break;
+	case 0xC002000: // System Interface Configuration
+		systemInterfaceConfig = value;
+		break;
+	case 0xC002400: // Card Interface Configuration
+		flushFifo();
+		cardInterfaceConfig = value;
+		cpu->log<LogPCCard, LogVerbose>("PC card enabled: %s, write protect: %s, mode: %s",
+			(value & 0x400) ? "yes" : "no", (value & 0x200) ? "yes" : "no", (value & 0x100) ? "i/o" : "memory");
+		updateInterrupts();
+		break;
+	case 0xC002800: // Power Management
+		powerManagement = value;
+		break;
+	case 0xC002C00: // Card Power Control
+		cardPowerControl = value;
+		break;
+	case 0xC003000: // Card Interface Timing 0A
+		cardInterfaceTiming0A = value;
+		break;
+	case 0xC003400: // Card Interface Timing 0B
+		cardInterfaceTiming0B = value;
+		break;
+	case 0xC003800: // Card Interface Timing 1A
+		cardInterfaceTiming1A = value;
+		break;
+	case 0xC003C00: // Card Interface Timing 1B
+		cardInterfaceTiming1B = value;
+		break;
+	case 0xC004000: // DMA Control
+		// a burst in progress finishes with the old settings
+		flushFifo();
+		dmaControl = value;
+		updateInterrupts();
+		break;
+	case 0xC004400: // Device Information
+		deviceInformation = value;
+		break;
+	default:
+		cpu->log<LogPCCard, LogWarning>("CLPS7600 unknown register write: addr=%07x value=%08x pc=%08x lr=%08x", addr, value, cpu->getRealPC(), cpu->getGPR(14));
 	}
 }
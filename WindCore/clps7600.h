@@ -1,11 +1,13 @@
 #pragma once
 #include <stdint.h>
 #include "arm710.h"
+#include "cfcard.h"
 
 class CLPS7600
 {
 private:
 	ARM710 *cpu;
+	CFCard *card = nullptr;
 
 	uint32_t interruptStatus = 0;
 	uint32_t interruptMask = 0;
@@ -20,14 +22,44 @@ private:
 	uint32_t dmaControl = 0;
 	uint32_t deviceInformation = 0x40;
 
+	// The burst FIFO sits between the host and the card while DMA is
+	// on: host-to-card bursts collect words and write them out together
+	// once it fills (or DMA is switched off). Card-to-host reads go
+	// straight through instead of being prefetched, as reading the
+	// card's data port moves it along; fetching ahead would take words
+	// the host may never ask for, and the card never keeps us waiting.
+	enum {
+		FifoWords = 16,
+		DmaEnable = 1,
+		DmaToCard = 2,
+		DmaThresholdShift = 4,
+		DmaThresholdMask = 0xF0
+	};
+	uint32_t fifo[FifoWords];
+	int fifoHead = 0, fifoCount = 0;
+	uint32_t fifoAddress = 0;
+
 	bool isIOMode() const { return (cardInterfaceConfig & 0x100); }
 	bool isMemoryMode() const { return !(cardInterfaceConfig & 0x100); }
+	bool isCardEnabled() const { return (cardInterfaceConfig & 0x400); }
+	bool dmaActive() const { return (dmaControl & DmaEnable) && card && isCardEnabled(); }
+	int fifoThreshold() const;
 	uint32_t getInputLevel() const;
+	void updateInterrupts();
+
+	uint32_t readRegister(uint32_t addr);
+	void writeRegister(uint32_t value, uint32_t addr);
+	uint32_t readCard(uint32_t addr, int size);
+	void writeCard(uint32_t value, uint32_t addr, int size);
+	void writeCardFifo(uint32_t value, uint32_t addr);
+	void flushFifo();
 
 public:
 	CLPS7600(ARM710 *_cpu);
 
+	void insertCard(CFCard *newCard); // nullptr to eject
+	bool interruptPending() const { return (interruptStatus & interruptMask) != 0; }
+
 	uint32_t read(uint32_t addr, ARM710::ValueSize valueSize);
 	void write(uint32_t value, uint32_t addr, ARM710::ValueSize valueSize);
 };
-
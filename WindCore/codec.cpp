@@ -0,0 +1,112 @@
+#include "hardware.h"
+
+
+void Codec::setConfig(uint8_t value, int64_t cycles) {
+	bool wasRunning = txEnabled() || rxEnabled();
+	config = value;
+	if (!wasRunning && (txEnabled() || rxEnabled()))
+		lastEventAt = cycles; // the sample clock only starts now
+
+	// an empty FIFO asks to be filled straight away
+	if (txEnabled() && txCount <= FifoTrigger)
+		interrupt = true;
+	schedule();
+}
+
+uint8_t Codec::readData() {
+	if (rxCount == 0)
+		return 0;
+	uint8_t value = rxFifo[rxHead];
+	rxHead = (rxHead + 1) % FifoSize;
+	rxCount--;
+	return value;
+}
+
+void Codec::writeData(uint8_t value) {
+	// overflowing the FIFO loses the sample
+	if (txCount < FifoSize) {
+		txFifo[(txHead + txCount) % FifoSize] = value;
+		txCount++;
+	}
+}
+
+void Codec::schedule() {
+	if (txEnabled() || rxEnabled())
+		nextEventAt = lastEventAt + cyclesPerSample() * FifoTrigger;
+	else
+		nextEventAt = INT64_MAX;
+}
+
+void Codec::runEvent(int64_t cycles) {
+	int64_t perSample = cyclesPerSample();
+	int64_t samples = (cycles - lastEventAt) / perSample;
+	if (samples > AudioRing::Capacity) {
+		// we've been away a while; don't flood the ring with silence
+		samples = AudioRing::Capacity;
+		lastEventAt = cycles;
+	} else {
+		lastEventAt += samples * perSample; // keep the exact rate
+	}
+
+	if (txEnabled()) {
+		// whatever was queued, then silence if the guest fell behind
+		int16_t pcm[FifoSize];
+		int fromFifo = (samples < txCount) ? (int)samples : txCount;
+		for (int i = 0; i < fromFifo; i++) {
+			uint8_t value = txFifo[(txHead + i) % FifoSize];
+			pcm[i] = (config & ConfigALaw) ? decodeALaw(value) : decodeMuLaw(value);
+		}
+		txHead = (txHead + fromFifo) % FifoSize;
+		txCount -= fromFifo;
+		if (output) {
+			output->write(pcm, fromFifo);
+			int16_t silence[256] = {};
+			for (int64_t left = samples - fromFifo; left > 0; left -= 256)
+				output->write(silence, (left < 256) ? left : 256);
+		}
+	}
+
+	if (rxEnabled()) {
+		// no microphone, so the line is quiet
+		uint8_t quiet = (config & ConfigALaw) ? 0xD5 : 0xFF;
+		int room = FifoSize - rxCount;
+		int count = (samples < room) ? (int)samples : room;
+		for (int i = 0; i < count; i++)
+			rxFifo[(rxHead + rxCount + i) % FifoSize] = quiet;
+		rxCount += count;
+	}
+
+	if ((txEnabled() && txCount <= FifoTrigger) || (rxEnabled() && rxCount >= FifoTrigger))
+		interrupt = true;
+	schedule();
+}
+
+
+void Codec::saveState(StateWriter &out) const {
+	out.put(config);
+	out.put(interrupt);
+	out.put(txFifo);
+	out.put(rxFifo);
+	out.put(txHead);
+	out.put(txCount);
+	out.put(rxHead);
+	out.put(rxCount);
+	out.put(lastEventAt);
+	out.put(nextEventAt);
+}
+
+void Codec::loadState(StateReader &in) {
+	in.get(config);
+	in.get(interrupt);
+	in.get(txFifo);
+	in.get(rxFifo);
+	in.get(txHead);
+	in.get(txCount);
+	in.get(rxHead);
+	in.get(rxCount);
+	in.get(lastEventAt);
+	in.get(nextEventAt);
+	if (txHead < 0 || txHead >= FifoSize || txCount < 0 || txCount > FifoSize ||
+		rxHead < 0 || rxHead >= FifoSize || rxCount < 0 || rxCount > FifoSize)
+		in.fail();
+}
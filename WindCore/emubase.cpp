@@ -1 +1,333 @@
 #include "emubase.h"
+#include <string.h>
+
+
+void EmuBase::saveBaseState(StateWriter &out) const {
+	saveCPUState(out);
+	out.put(passedCycles);
+	out.put(nextTickAt);
+}
+
+void EmuBase::trackDirtyMemory() {
+	dirtyRegions.clear();
+	for (const MemoryRegion &region : memoryRegions()) {
+		dirtyRegions.push_back({region.data, region.size, DirtyMap()});
+		dirtyRegions.back().map.track(region.size);
+	}
+}
+
+void EmuBase::loadBaseState(StateReader &in) {
+	loadCPUState(in);
+	in.get(passedCycles);
+	in.get(nextTickAt);
+	// scripted input belongs to whoever queued it, not the machine
+	inputEvents.clear();
+	nextInputEventAt = INT64_MAX;
+}
+
+
+bool EmuBase::addHleHooks(const HleHook *hooks, size_t count) {
+	// refuse hooks meant for a different ROM build
+	for (size_t i = 0; i < count; i++) {
+		bool busError = false;
+		uint32_t insn = readPhysical(hooks[i].address, V32, busError);
+		if (busError || insn != hooks[i].firstInsn)
+			return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		hleHooks[hooks[i].address] = hooks[i].function;
+		hleFilter[(hooks[i].address >> 7) & 31] |= 1 << ((hooks[i].address >> 2) & 31);
+	}
+	return true;
+}
+
+void EmuBase::clearHleHooks() {
+	hleHooks.clear();
+	memset(hleFilter, 0, sizeof(hleFilter));
+}
+
+
+#ifndef __EMSCRIPTEN__
+bool EmuBase::beginDebugging() {
+	// if we stopped on a breakpoint last time, it mustn't fire again
+	// before that instruction has had a chance to run
+	resumingFromBreakpoint = (stopReason == StopBreakpoint);
+	// (not PC - 8, as the pipeline is empty if the PC's just been set)
+	resumePC = getRealPC();
+	stopReason = StopNone;
+	return singleStep || !_breakpoints.empty() || !_watchpoints.empty();
+}
+
+bool EmuBase::checkBreakpoint() {
+	// called just before the instruction at PC executes
+	uint32_t pc = getGPR(15) - 8;
+	if (resumingFromBreakpoint) {
+		resumingFromBreakpoint = false;
+		if (pc == resumePC)
+			return false;
+	}
+	if (_breakpoints.find(pc) == _breakpoints.end())
+		return false;
+
+	log<LogDebugger>("⚠️ Breakpoint triggered at %08x!", pc);
+	stopReason = StopBreakpoint;
+	return true;
+}
+
+bool EmuBase::addWatchpoint(const Watchpoint &watchpoint) {
+	for (const Watchpoint &w : _watchpoints)
+		if (w == watchpoint)
+			return false;
+	_watchpoints.push_back(watchpoint);
+	markWatchedPages(watchpoint.addr, watchpoint.length, watchpoint.physical);
+	return true;
+}
+
+bool EmuBase::removeWatchpoint(const Watchpoint &watchpoint) {
+	for (auto it = _watchpoints.begin(); it != _watchpoints.end(); ++it) {
+		if (*it == watchpoint) {
+			_watchpoints.erase(it);
+			rebuildWatchedPages();
+			return true;
+		}
+	}
+	return false;
+}
+
+void EmuBase::clearWatchpoints() {
+	_watchpoints.clear();
+	clearWatchedPages();
+}
+
+void EmuBase::rebuildWatchedPages() {
+	// pages can be shared between watchpoints, so start over
+	clearWatchedPages();
+	for (const Watchpoint &w : _watchpoints)
+		markWatchedPages(w.addr, w.length, w.physical);
+}
+
+void EmuBase::watchedAccess(uint32_t virtAddr, uint32_t physAddr, ValueSize valueSize, bool isWrite) {
+	// only the first hit in an instruction is reported
+	if (stopReason == StopWatchpoint)
+		return;
+
+	// the page is watched, but maybe not this part of it
+	uint32_t size = (valueSize == V32) ? 4 : 1;
+	for (const Watchpoint &w : _watchpoints) {
+		if (!(w.kind & (isWrite ? WatchWrite : WatchRead)))
+			continue;
+		uint32_t addr = w.physical ? physAddr : virtAddr;
+		if ((addr - w.addr) < w.length || (w.addr - addr) < size) {
+			log<LogDebugger>("⚠️ Watchpoint: %s %08x (phys %08x) by %08x", isWrite ? "write to" : "read from", virtAddr, physAddr, getGPR(15) - 0xC);
+			watchHit = {w, virtAddr, physAddr, isWrite};
+			stopReason = StopWatchpoint;
+			return;
+		}
+	}
+}
+#endif
+
+void EmuBase::queueInputEvent(const InputEvent &event) {
+	// scripts almost always queue in order, so this is nearly always an append
+	auto it = inputEvents.end();
+	while (it != inputEvents.begin() && (it - 1)->at > event.at)
+		--it;
+	inputEvents.insert(it, event);
+	nextInputEventAt = inputEvents.front().at;
+}
+
+void EmuBase::queueKeyEvent(int64_t at, EpocKey key, bool down) {
+	queueInputEvent(InputEvent{at, false, down, key, 0, 0});
+}
+
+void EmuBase::queueTouchEvent(int64_t at, int32_t x, int32_t y, bool down) {
+	queueInputEvent(InputEvent{at, true, down, EStdKeyNull, x, y});
+}
+
+void EmuBase::runInputEvents() {
+	while (!inputEvents.empty() && inputEvents.front().at <= passedCycles) {
+		const InputEvent &event = inputEvents.front();
+		if (event.isTouch)
+			updateTouchInput(event.x, event.y, event.down);
+		else
+			setKeyboardKey(event.key, event.down);
+		inputEvents.pop_front();
+	}
+	nextInputEventAt = inputEvents.empty() ? INT64_MAX : inputEvents.front().at;
+}
+
+bool EmuBase::runHleHook() {
+	// only called when the next instruction is about to execute
+	uint32_t pc = getGPR(15) - 8;
+	if (!(hleFilter[(pc >> 7) & 31] & (1 << ((pc >> 2) & 31))))
+		return false;
+
+	bool fault = false;
+	uint32_t physPC = virtToPhys(pc, fault);
+	if (fault)
+		return false;
+	auto hook = hleHooks.find(physPC);
+	if (hook == hleHooks.end())
+		return false;
+
+	uint32_t cycles = 0;
+	switch (hook->second) {
+	case HleMemCopy:  cycles = hleMemCopy(); break;
+	case HleMemFill:  cycles = hleMemFill(getGPR(2) & 0xFF); break;
+	case HleMemFillZ: cycles = hleMemFill(0); break;
+	case HleDes8Copy: cycles = hleDes8Copy(); break;
+	}
+
+	// anything awkward (faults, MMIO, odd descriptors) is
+	// left to the real routine, which knows how to fail properly
+	if (cycles == 0)
+		return false;
+
+	setGPR(15, getGPR(14));
+	passedCycles += cycles;
+	return true;
+}
+
+
+bool EmuBase::hleGather(uint32_t virtAddr, uint32_t size) {
+	if (!getHostSpans(virtAddr, size, false, hleSpansA))
+		return false;
+
+	hleScratch.resize(size);
+	uint8_t *out = hleScratch.data();
+	for (const HostSpan &span : hleSpansA) {
+		memcpy(out, span.ptr, span.size);
+		out += span.size;
+	}
+	return true;
+}
+
+bool EmuBase::hleScatter(uint32_t virtAddr, uint32_t size) {
+	if (!getHostSpans(virtAddr, size, true, hleSpansB))
+		return false;
+
+	const uint8_t *in = hleScratch.data();
+	for (const HostSpan &span : hleSpansB) {
+		memcpy(span.ptr, in, span.size);
+		in += span.size;
+	}
+	return true;
+}
+
+bool EmuBase::hleReadWord(uint32_t virtAddr, uint32_t &value) {
+	if ((virtAddr & 3) || !getHostSpans(virtAddr, 4, false, hleSpansA))
+		return false;
+	memcpy(&value, hleSpansA[0].ptr, 4); // little-endian host, as in arm710.cpp
+	return true;
+}
+
+bool EmuBase::hleWriteWord(uint32_t virtAddr, uint32_t value) {
+	if ((virtAddr & 3) || !getHostSpans(virtAddr, 4, true, hleSpansB))
+		return false;
+	memcpy(hleSpansB[0].ptr, &value, 4);
+	return true;
+}
+
+
+uint32_t EmuBase::hleMemCopy() {
+	uint32_t trg = getGPR(0), src = getGPR(1);
+	int32_t length = getGPR(2);
+	if (length < 0 || length > HleMaxLength)
+		return 0;
+
+	// going through the scratch buffer gives us memmove semantics
+	// for free, and lets us bail out before touching the target
+	if (!hleGather(src, length))
+		return 0;
+	if (!hleScatter(trg, length))
+		return 0;
+
+	setGPR(0, trg + length);
+	return HleCallCycles + (length / 4) * HleCyclesPerWord;
+}
+
+uint32_t EmuBase::hleMemFill(uint8_t value) {
+	uint32_t trg = getGPR(0);
+	int32_t length = getGPR(1);
+	if (length < 0 || length > HleMaxLength)
+		return 0;
+
+	if (!getHostSpans(trg, length, true, hleSpansB))
+		return 0;
+	for (const HostSpan &span : hleSpansB)
+		memset(span.ptr, value, span.size);
+
+	return HleCallCycles + (length / 4) * HleCyclesPerWord;
+}
+
+uint32_t EmuBase::hleDes8Copy() {
+	// descriptor layout: word 0 is length | (type << 28),
+	// and modifiable ones keep their max length in word 1
+	enum { EBufC = 0, EPtrC = 1, EPtr = 2, EBuf = 3, EBufCPtr = 4 };
+	uint32_t self = getGPR(0), src = getGPR(1);
+
+	uint32_t srcHeader, srcData;
+	if (!hleReadWord(src, srcHeader))
+		return 0;
+	switch (srcHeader >> 28) {
+	case EBufC: srcData = src + 4; break;
+	case EBuf:  srcData = src + 8; break;
+	case EPtrC:
+		if (!hleReadWord(src + 4, srcData))
+			return 0;
+		break;
+	case EPtr:
+		if (!hleReadWord(src + 8, srcData))
+			return 0;
+		break;
+	case EBufCPtr:
+		if (!hleReadWord(src + 8, srcData))
+			return 0;
+		srcData += 4;
+		break;
+	default:
+		return 0;
+	}
+
+	uint32_t selfHeader, selfMax, selfData, bufCHeader = 0;
+	if (!hleReadWord(self, selfHeader) || !hleReadWord(self + 4, selfMax))
+		return 0;
+	switch (selfHeader >> 28) {
+	case EBuf:  selfData = self + 8; break;
+	case EPtr:
+		if (!hleReadWord(self + 8, selfData))
+			return 0;
+		break;
+	case EBufCPtr: {
+		// points at a TBufC whose length must be kept in step
+		uint32_t bufC;
+		if (!hleReadWord(self + 8, bufC) || !hleReadWord(bufC, bufCHeader))
+			return 0;
+		selfData = bufC + 4;
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	// overflowing the target panics, so let EPOC do that
+	uint32_t length = srcHeader & 0x0FFFFFFF;
+	if (length > selfMax || length > HleMaxLength)
+		return 0;
+
+	// make sure the headers can be updated before changing anything
+	bool isBufCPtr = ((selfHeader >> 28) == EBufCPtr);
+	if (!getHostSpans(self, 4, true, hleSpansB))
+		return 0;
+	if (isBufCPtr && !getHostSpans(selfData - 4, 4, true, hleSpansB))
+		return 0;
+
+	if (!hleGather(srcData, length) || !hleScatter(selfData, length))
+		return 0;
+	hleWriteWord(self, (selfHeader & 0xF0000000) | length);
+	if (isBufCPtr)
+		hleWriteWord(selfData - 4, (bufCHeader & 0xF0000000) | length);
+
+	return HleCallCycles + (length / 4) * HleCyclesPerWord;
+}
@@ -1,5 +1,10 @@
 #pragma once
 #include "arm710.h"
+#include "serial.h"
+#include "cfcard.h"
+#include "audio.h"
+#include <deque>
+#include <unordered_map>
 #include <unordered_set>
 
 enum EpocKey {
@@ -100,15 +105,125 @@ enum EpocKey {
 	EStdKeyNull = 0
 };
 
+// EPOC library routines that can be replaced with native code
+enum HleFunction {
+	HleMemCopy,  // TUint8 *Mem::Copy(TAny *aTrg, const TAny *aSrc, TInt aLength)
+	HleMemFill,  // void Mem::Fill(TAny *aTrg, TInt aLength, TChar aChar)
+	HleMemFillZ, // void Mem::FillZ(TAny *aTrg, TInt aLength)
+	HleDes8Copy  // void TDes8::Copy(const TDesC8 &aDes)
+};
+
+struct HleHook {
+	uint32_t address;    // physical address of the routine's entry point
+	uint32_t firstInsn;  // what the ROM should have there, to be sure it's the right build
+	HleFunction function;
+};
+
 class EmuBase : public ARM710
 {
+public:
+	// why the last executeUntil returned
+	enum StopReason {
+		StopNone,       // it ran for as long as it was asked to
+		StopBreakpoint, // the next instruction is on a breakpoint
+		StopStep,       // single-stepping, and one instruction ran
+		StopWatchpoint  // the last instruction touched watched memory
+	};
+
+	enum WatchKind { WatchRead = 1, WatchWrite = 2, WatchAccess = 3 };
+	struct Watchpoint {
+		uint32_t addr, length;
+		WatchKind kind;
+		bool physical; // otherwise virtual, as the current mode sees it
+		bool operator==(const Watchpoint &other) const {
+			return addr == other.addr && length == other.length && kind == other.kind && physical == other.physical;
+		}
+	};
+	struct WatchHit {
+		Watchpoint watchpoint;
+		uint32_t virtAddr, physAddr;
+		bool isWrite;
+	};
+
 protected:
 #ifndef __EMSCRIPTEN__
 	std::unordered_set<uint32_t> _breakpoints;
+
+	// None of this is looked at per instruction unless a breakpoint
+	// or single-step is armed when executeUntil starts.
+	StopReason stopReason = StopNone;
+	bool singleStep = false;
+	bool resumingFromBreakpoint = false;
+	uint32_t resumePC = 0;
+	bool beginDebugging();
+	bool checkBreakpoint();
+
+	std::vector<Watchpoint> _watchpoints;
+	WatchHit watchHit = {};
+	void rebuildWatchedPages();
+	void watchedAccess(uint32_t virtAddr, uint32_t physAddr, ValueSize valueSize, bool isWrite) override;
 #endif
 	int64_t passedCycles = 0;
+	int64_t idleCycles = 0;
 	int64_t nextTickAt = 0;
 	uint8_t readKeyboard(int kScan);
+	void saveBaseState(StateWriter &out) const;
+	void loadBaseState(StateReader &in);
+
+	// see trackDirtyMemory; devices call markDirty for anything they
+	// write to memoryRegions() while it's on
+	struct DirtyRegion {
+		const uint8_t *data;
+		size_t size;
+		DirtyMap map;
+	};
+	std::vector<DirtyRegion> dirtyRegions;
+	bool isTrackingDirty() const { return !dirtyRegions.empty(); }
+	void markDirty(const uint8_t *ptr, size_t size) {
+		for (DirtyRegion &region : dirtyRegions) {
+			if (ptr >= region.data && ptr < region.data + region.size) {
+				region.map.mark(ptr - region.data, size);
+				return;
+			}
+		}
+	}
+
+	// Scripted key and pen changes, applied by executeUntil when their
+	// time comes rather than whenever the host gets round to it. That
+	// way the OS sees each one exactly when intended (a key held for as
+	// long as asked, every point of a pen stroke at the ADC's rate),
+	// however many are queued and however fast we're running.
+	struct InputEvent {
+		int64_t at;
+		bool isTouch;
+		bool down;
+		EpocKey key;
+		int32_t x, y;
+	};
+	std::deque<InputEvent> inputEvents;
+	int64_t nextInputEventAt = INT64_MAX;
+	void queueInputEvent(const InputEvent &event);
+	void runInputEvents();
+
+	// High-level emulation
+	enum {
+		HleMaxLength = 0x100000,  // longer calls just run natively in the guest
+		HleCallCycles = 8,
+		HleCyclesPerWord = 2      // roughly what an LDM/STM loop would take
+	};
+	std::unordered_map<uint32_t, HleFunction> hleHooks;
+	uint32_t hleFilter[32] = {}; // bitset over (pc >> 2) & 0x3FF, as pages are >= 4KB
+	std::vector<uint8_t> hleScratch;
+	std::vector<HostSpan> hleSpansA, hleSpansB;
+
+	bool runHleHook();
+	uint32_t hleMemCopy();
+	uint32_t hleMemFill(uint8_t value);
+	uint32_t hleDes8Copy();
+	bool hleReadWord(uint32_t virtAddr, uint32_t &value);
+	bool hleWriteWord(uint32_t virtAddr, uint32_t value);
+	bool hleGather(uint32_t virtAddr, uint32_t size);
+	bool hleScatter(uint32_t virtAddr, uint32_t size);
 
 public:
 	EmuBase(bool isTVersion) : ARM710(isTVersion) { }
@@ -116,6 +231,12 @@ public:
 	virtual uint8_t *getROMBuffer() = 0;
 	virtual size_t getROMSize() = 0;
 	virtual void loadROM(uint8_t *buffer, size_t size) = 0;
+	// port 0 is UART1, 1 is UART2; the backend is not owned
+	virtual bool setSerialBackend(int port, SerialBackend *backend) = 0;
+	// CompactFlash socket, if there is one; nullptr ejects, not owned
+	virtual bool insertCard(CFCard *card) = 0;
+	// codec output as 8kHz mono PCM; the ring is not owned
+	virtual void setAudioOutput(AudioRing *ring) = 0;
 	virtual void executeUntil(int64_t cycles) = 0;
 	virtual int32_t getClockSpeed() const = 0;
 	virtual const char *getDeviceName() const = 0;
@@ -129,9 +250,51 @@ public:
 	virtual void setKeyboardKey(EpocKey key, bool value) = 0;
 	virtual void updateTouchInput(int32_t x, int32_t y, bool down) = 0;
 
+	// Save states (see savestate.h) cover everything but RAM, which is
+	// here for front-ends to keep as they see fit; the two have to be
+	// taken and restored together, between executeUntil calls. Any card
+	// that was in has to be inserted again before loading. A device that
+	// can't do this saves nothing; if loading fails, the emulator is in
+	// no fit state to carry on and should be thrown away.
+	struct MemoryRegion {
+		const char *name;
+		uint8_t *data;
+		size_t size;
+	};
+	virtual std::vector<MemoryRegion> memoryRegions() { return {}; }
+	// start keeping a DirtyMap for each of those; RAM writes cost a
+	// little more from then on
+	void trackDirtyMemory();
+	DirtyMap &dirtyMap(size_t region) { return dirtyRegions[region].map; }
+	virtual void saveState(StateWriter &out) { (void)out; }
+	virtual bool loadState(StateReader &in) { (void)in; return false; }
+
 #ifndef __EMSCRIPTEN__
 	std::unordered_set<uint32_t> &breakpoints() { return _breakpoints; }
+	// run one instruction per executeUntil (or less, if the CPU is halted)
+	void setSingleStep(bool on) { singleStep = on; }
+	StopReason lastStopReason() const { return stopReason; }
+
+	// execution stops after the instruction that made the access
+	bool addWatchpoint(const Watchpoint &watchpoint);
+	bool removeWatchpoint(const Watchpoint &watchpoint);
+	void clearWatchpoints();
+	const std::vector<Watchpoint> &watchpoints() const { return _watchpoints; }
+	// only meaningful when the last stop was StopWatchpoint
+	const WatchHit &lastWatchHit() const { return watchHit; }
 #endif
+	// Hooks come in sets, one per ROM build (see loadHleTable); if any
+	// routine's first instruction isn't what the set expects, the set is
+	// for some other ROM and none of it is added.
+	bool addHleHooks(const HleHook *hooks, size_t count);
+	void clearHleHooks();
+	// press or release a key once the cycle counter reaches `at`
+	void queueKeyEvent(int64_t at, EpocKey key, bool down);
+	// likewise for the pen; a stroke is a run of these with down set
+	void queueTouchEvent(int64_t at, int32_t x, int32_t y, bool down);
 	uint64_t currentCycles() const { return passedCycles; }
+	// how many of those went by with the CPU halted or asleep, which
+	// costs next to nothing to emulate
+	uint64_t currentIdleCycles() const { return idleCycles; }
 };
 
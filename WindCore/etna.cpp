@@ -22,6 +22,16 @@ enum EtnaReg {
     regWake2 = 0xF
 };
 
+// Sources in PcCdIntStatus/PcCdIntMask, and bits in SktVarA1.
+// These are our best reading of the EPOC driver, not a datasheet.
+enum {
+    intCardIreq = 1,     // the card's own interrupt line (level)
+    intCardChange = 2,   // inserted or removed
+    sktCardDetect = 1,
+    sktCardReady = 2,
+    sktWriteProtect = 4
+};
+
 static const char *nameReg(uint32_t reg) {
     switch (reg) {
     case regUnk0: return "unk0";
@@ -86,11 +96,17 @@ Etna::Etna(ARM710 *owner) {
 uint32_t Etna::readReg8(uint32_t reg)
 {
 //    if (!promReadActive)
-//		owner->log("ETNA readReg8: reg=%s @ pc=%08x,lr=%08x", nameReg(reg), owner->getGPR(15) - 4, owner->getGPR(14));
+//		owner->log<LogPCCard, LogVerbose>("ETNA readReg8: reg=%s @ pc=%08x,lr=%08x", nameReg(reg), owner->getGPR(15) - 4, owner->getGPR(14));
     switch (reg) {
+    case regPcCdIntStatus: return pendingInterrupts;
+    case regPcCdIntMask: return interruptMask;
     case regIntClear: return 0;
     case regSktVarA0: return 1; // will store some status flags
-    case regSktVarA1: return 0; // will store some more status flags
+    case regSktVarA1:
+        if (!card)
+            return 0;
+        return sktCardDetect | sktCardReady | (card->isReadOnly() ? sktWriteProtect : 0);
+    case regSktCtrl: return socketControl;
     case regWake1: return wake1;
     case regWake2: return wake2;
     }
@@ -100,16 +116,21 @@ uint32_t Etna::readReg8(uint32_t reg)
 uint32_t Etna::readReg32(uint32_t reg)
 {
     // may be able to remove this, p. sure Etna is byte addressing only
-	owner->log("ETNA readReg32: reg=%x", reg);
+	owner->log<LogPCCard, LogVerbose>("ETNA readReg32: reg=%x", reg);
     return 0xFFFFFFFF;
 }
 
 void Etna::writeReg8(uint32_t reg, uint8_t value)
 {
     if (!promReadActive)
-		owner->log("ETNA writeReg8: reg=%s value=%02x @ pc=%08x,lr=%08x", nameReg(reg), value, owner->getGPR(15) - 4, owner->getGPR(14));
+		owner->log<LogPCCard, LogVerbose>("ETNA writeReg8: reg=%s value=%02x @ pc=%08x,lr=%08x", nameReg(reg), value, owner->getGPR(15) - 4, owner->getGPR(14));
     switch (reg) {
-    case regIntClear: pendingInterrupts &= ~value; break;
+    case regPcCdIntMask: interruptMask = value; break;
+    case regIntClear:
+        pendingInterrupts &= ~value;
+        updateCardInterrupt();
+        break;
+    case regSktCtrl: socketControl = value; break;
     case regWake1: wake1 = value; break;
     case regWake2: wake2 = value; break;
     }
@@ -118,7 +139,118 @@ void Etna::writeReg8(uint32_t reg, uint8_t value)
 void Etna::writeReg32(uint32_t reg, uint32_t value)
 {
     // may be able to remove this, p. sure Etna is byte addressing only
-	owner->log("ETNA writeReg32: reg=%x value=%08x", reg, value);
+	owner->log<LogPCCard, LogVerbose>("ETNA writeReg32: reg=%x value=%08x", reg, value);
+}
+
+void Etna::updateCardInterrupt()
+{
+    // the card's IREQ is a level, so it stays up until the card is serviced
+    if (card && card->interruptPending())
+        pendingInterrupts |= intCardIreq;
+    else
+        pendingInterrupts &= ~intCardIreq;
+}
+
+void Etna::insertCard(CFCard *newCard)
+{
+    if (newCard == card)
+        return;
+    card = newCard;
+    if (card)
+        card->reset();
+    pendingInterrupts &= ~intCardIreq;
+    pendingInterrupts |= intCardChange;
+}
+
+void Etna::saveState(StateWriter &out) const
+{
+    out.put(prom);
+    out.put(promReadAddress);
+    out.put(promReadValue);
+    out.put(promReadActive);
+    out.put(promAddressBitsReceived);
+    out.put(pendingInterrupts);
+    out.put(interruptMask);
+    out.put(wake1);
+    out.put(wake2);
+    out.put(socketControl);
+    out.put<bool>(card != nullptr);
+    if (card)
+        card->saveState(out);
+}
+
+void Etna::loadState(StateReader &in)
+{
+    bool hadCard;
+    in.get(prom);
+    in.get(promReadAddress);
+    in.get(promReadValue);
+    in.get(promReadActive);
+    in.get(promAddressBitsReceived);
+    in.get(pendingInterrupts);
+    in.get(interruptMask);
+    in.get(wake1);
+    in.get(wake2);
+    in.get(socketControl);
+    in.get(hadCard);
+    if (hadCard != (card != nullptr))
+        in.fail();
+    else if (card)
+        card->loadState(in);
+}
+
+void Etna::cardPowerChanged(bool on)
+{
+    // the card comes up fresh every time it's powered
+    if (on && card)
+        card->reset();
+}
+
+// The socket's three spaces sit side by side in CS3, each 64MB.
+// Accesses with no card there float high, like the real bus.
+uint32_t Etna::readCard(uint32_t offset, int size)
+{
+    if (!card)
+        return (size == 1) ? 0xFF : 0xFFFFFFFF;
+
+    uint32_t value;
+    switch (offset & CardSpaceMask) {
+    case CardAttribute:
+        value = card->readAttribute(offset & ~CardSpaceMask);
+        break;
+    case CardIO:
+        value = card->readIO(offset & ~CardSpaceMask, size);
+        break;
+    case CardCommon:
+        value = card->readCommon(offset & ~CardSpaceMask, size);
+        break;
+    default:
+        value = 0xFFFFFFFF;
+        break;
+    }
+
+    updateCardInterrupt();
+    return (size == 1) ? (value & 0xFF) : value;
+}
+
+void Etna::writeCard(uint32_t offset, uint32_t value, int size)
+{
+    if (!card)
+        return;
+
+    switch (offset & CardSpaceMask) {
+    case CardAttribute:
+        card->writeAttribute(offset & ~CardSpaceMask, value & 0xFF);
+        break;
+    case CardIO:
+        card->writeIO(offset & ~CardSpaceMask, value, size);
+        break;
+    case CardCommon:
+        card->writeCommon(offset & ~CardSpaceMask, value, size);
+        break;
+    }
+
+    updateCardInterrupt();
 }
 
 void Etna::setPromBit0High()
@@ -1,5 +1,7 @@
 #pragma once
 #include <stdint.h>
+#include "cfcard.h"
+#include "savestate.h"
 
 class ARM710;
 
@@ -11,8 +13,11 @@ class Etna {
 
     uint8_t pendingInterrupts = 0, interruptMask = 0;
     uint8_t wake1 = 0, wake2 = 0;
+    uint8_t socketControl = 0;
 
 	ARM710 *owner;
+	CFCard *card = nullptr;
+	void updateCardInterrupt();
 
 public:
 	Etna(ARM710 *owner);
@@ -22,8 +27,25 @@ public:
     void writeReg8(uint32_t reg, uint8_t value);
     void writeReg32(uint32_t reg, uint32_t value);
 
+    // CompactFlash socket, decoded by Etna on CS3; see etna.cpp
+    enum {
+        CardSpaceMask = 0x0C000000,
+        CardAttribute = 0x00000000,
+        CardIO = 0x04000000,
+        CardCommon = 0x08000000
+    };
+    void insertCard(CFCard *newCard); // nullptr to eject
+    void cardPowerChanged(bool on);
+    uint32_t readCard(uint32_t offset, int size);
+    void writeCard(uint32_t offset, uint32_t value, int size);
+    bool interruptPending() const { return (pendingInterrupts & interruptMask) != 0; }
+
     // PROM
     void setPromBit0High(); // port B, bit 0
     void setPromBit0Low(); // port B, bit 0
     void setPromBit1High(); // port B, bit 1
+
+    // includes the card's, so the same one needs to be in before loading
+    void saveState(StateWriter &out) const;
+    void loadState(StateReader &in);
 };
@@ -0,0 +1,526 @@
+#include "gdbstub.h"
+
+#ifdef WINDCORE_GDB_STUB
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+enum {
+	CpsrRegister = 25,       // where GDB's ARM numbering puts it
+	FirstBankedRegister = 26,
+	SpsrIndex = 16           // stands in for a GPR index in the table below
+};
+
+static const struct {
+	const char *name;
+	int bank, index;
+} bankedRegisters[] = {
+	{"r8_usr", 5, 8}, {"r9_usr", 5, 9}, {"r10_usr", 5, 10}, {"r11_usr", 5, 11}, {"r12_usr", 5, 12},
+	{"sp_usr", 5, 13}, {"lr_usr", 5, 14},
+	{"r8_fiq", 0, 8}, {"r9_fiq", 0, 9}, {"r10_fiq", 0, 10}, {"r11_fiq", 0, 11}, {"r12_fiq", 0, 12},
+	{"sp_fiq", 0, 13}, {"lr_fiq", 0, 14}, {"spsr_fiq", 0, SpsrIndex},
+	{"sp_irq", 1, 13}, {"lr_irq", 1, 14}, {"spsr_irq", 1, SpsrIndex},
+	{"sp_svc", 2, 13}, {"lr_svc", 2, 14}, {"spsr_svc", 2, SpsrIndex},
+	{"sp_abt", 3, 13}, {"lr_abt", 3, 14}, {"spsr_abt", 3, SpsrIndex},
+	{"sp_und", 4, 13}, {"lr_und", 4, 14}, {"spsr_und", 4, SpsrIndex}
+};
+enum { BankedRegisterCount = sizeof(bankedRegisters) / sizeof(bankedRegisters[0]) };
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static void appendHex8(std::string &s, uint8_t v) {
+	s += hexDigits[v >> 4];
+	s += hexDigits[v & 15];
+}
+
+static void appendHex32LE(std::string &s, uint32_t v) {
+	for (int i = 0; i < 4; i++)
+		appendHex8(s, (v >> (8 * i)) & 0xFF);
+}
+
+static int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static bool parseHex32LE(const char *p, uint32_t &value) {
+	value = 0;
+	for (int i = 0; i < 8; i++) {
+		int d = hexValue(p[i]);
+		if (d < 0)
+			return false;
+		value |= (uint32_t)d << ((i ^ 1) * 4);
+	}
+	return true;
+}
+
+
+GdbStub::GdbStub(EmuBase *emu, int listenFd) : emu(emu), listenFd(listenFd) {
+}
+
+GdbStub::~GdbStub() {
+	disconnect();
+	close(listenFd);
+}
+
+GdbStub *GdbStub::create(EmuBase *emu, const char *spec) {
+	int fd = -1;
+	bool ok = false;
+
+	if (strncmp(spec, "tcp:", 4) == 0) {
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(atoi(spec + 4));
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0) {
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			ok = bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+		}
+	} else if (strncmp(spec, "unix:", 5) == 0) {
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(spec + 5) >= sizeof(addr.sun_path))
+			return nullptr;
+		strcpy(addr.sun_path, spec + 5);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0) {
+			unlink(addr.sun_path);
+			ok = bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+		}
+	}
+
+	if (fd >= 0 && ok)
+		ok = listen(fd, 1) == 0;
+	if (!ok) {
+		if (fd >= 0)
+			close(fd);
+		return nullptr;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return new GdbStub(emu, fd);
+}
+
+
+bool GdbStub::acceptPeer() {
+	int newFd = accept(listenFd, nullptr, nullptr);
+	if (newFd < 0)
+		return false;
+
+	fcntl(newFd, F_SETFL, fcntl(newFd, F_GETFL) | O_NONBLOCK);
+	int one = 1;
+	setsockopt(newFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on Unix sockets
+	fd = newFd;
+	noAck = false;
+	input.clear();
+	emu->log<LogDebugger>("GDB attached");
+	return true;
+}
+
+void GdbStub::disconnect() {
+	if (fd < 0)
+		return;
+	close(fd);
+	fd = -1;
+
+	// leave the emulator as we found it
+	for (uint32_t addr : ourBreakpoints)
+		emu->breakpoints().erase(addr);
+	ourBreakpoints.clear();
+	for (const EmuBase::Watchpoint &w : ourWatchpoints)
+		emu->removeWatchpoint(w);
+	ourWatchpoints.clear();
+	emu->setSingleStep(false);
+	running = true;
+	stepping = false;
+	emu->log<LogDebugger>("GDB detached");
+}
+
+bool GdbStub::pump(int timeoutMs) {
+	pollfd pfd = {fd, POLLIN, 0};
+	if (poll(&pfd, 1, timeoutMs) <= 0)
+		return false;
+
+	char buffer[4096];
+	ssize_t amount = read(fd, buffer, sizeof(buffer));
+	if (amount == 0 || (amount < 0 && errno != EAGAIN && errno != EINTR)) {
+		disconnect();
+		return false;
+	}
+	if (amount < 0)
+		return false;
+	input.append(buffer, amount);
+
+	for (;;) {
+		// acks, and Ctrl-C outside of a packet
+		size_t start = 0;
+		while (start < input.size() && input[start] != '$') {
+			if (input[start] == 3 && running) {
+				running = false;
+				sendPacket("S02");
+			}
+			start++;
+		}
+		input.erase(0, start);
+
+		size_t hash = input.find('#');
+		if (input.empty() || hash == std::string::npos || hash + 2 >= input.size())
+			break;
+
+		std::string packet = input.substr(1, hash - 1);
+		input.erase(0, hash + 3);
+		if (!noAck)
+			sendRaw("+"); // TCP already made sure it got here intact
+		handlePacket(packet);
+		if (fd < 0)
+			break;
+	}
+	return true;
+}
+
+void GdbStub::sendRaw(const std::string &data) {
+	size_t done = 0;
+	while (fd >= 0 && done < data.size()) {
+		ssize_t amount = write(fd, data.data() + done, data.size() - done);
+		if (amount > 0) {
+			done += amount;
+		} else if (amount < 0 && (errno == EAGAIN || errno == EINTR)) {
+			pollfd pfd = {fd, POLLOUT, 0};
+			poll(&pfd, 1, 100);
+		} else {
+			disconnect();
+		}
+	}
+}
+
+void GdbStub::sendPacket(const std::string &data) {
+	uint8_t checksum = 0;
+	for (char c : data)
+		checksum += (uint8_t)c;
+
+	std::string packet = "$";
+	packet += data;
+	packet += '#';
+	appendHex8(packet, checksum);
+	sendRaw(packet);
+}
+
+
+bool GdbStub::service() {
+	if (fd < 0 && acceptPeer())
+		running = false; // GDB expects to find the target stopped
+	if (fd >= 0)
+		pump(0);
+
+	// While stopped, GDB sends a request, waits for the answer and
+	// then sends the next. Keep answering as long as they keep coming
+	// instead of handling one per host frame.
+	while (fd >= 0 && !running && pump(5)) { }
+	return wantsToRun();
+}
+
+bool GdbStub::run(int64_t cycles) {
+	service();
+	if (fd >= 0 && !running)
+		return false;
+
+	emu->setSingleStep(fd >= 0 && stepping);
+	emu->executeUntil(cycles);
+
+	if (fd >= 0 && emu->lastStopReason() != EmuBase::StopNone) {
+		running = false;
+		sendPacket(stopReply());
+	}
+	return true;
+}
+
+std::string GdbStub::stopReply() const {
+	if (emu->lastStopReason() != EmuBase::StopWatchpoint)
+		return "S05";
+
+	// GDB works out which watchpoint it was from the address
+	const EmuBase::WatchHit &hit = emu->lastWatchHit();
+	const char *kind = "awatch";
+	if (hit.watchpoint.kind == EmuBase::WatchWrite)
+		kind = "watch";
+	else if (hit.watchpoint.kind == EmuBase::WatchRead)
+		kind = "rwatch";
+	uint32_t addr = (hit.virtAddr < hit.watchpoint.addr) ? hit.watchpoint.addr : hit.virtAddr;
+	char buf[32];
+	snprintf(buf, sizeof(buf), "T05%s:%08x;", kind, addr);
+	return buf;
+}
+
+void GdbStub::resume(const std::string &args, bool step) {
+	// an optional address to resume from
+	if (!args.empty())
+		emu->setGPR(15, strtoul(args.c_str(), nullptr, 16));
+	running = true;
+	stepping = step;
+}
+
+void GdbStub::handlePacket(const std::string &packet) {
+	if (packet.empty()) {
+		sendPacket("");
+		return;
+	}
+
+	char command = packet[0];
+	std::string args = packet.substr(1);
+
+	if (command == '?') {
+		sendPacket(stopReply());
+	} else if (command == 'g') {
+		std::string reply;
+		for (int i = 0; i < 16; i++)
+			appendHex32LE(reply, readRegister(i));
+		appendHex32LE(reply, readRegister(CpsrRegister));
+		for (int i = 0; i < BankedRegisterCount; i++)
+			appendHex32LE(reply, readRegister(FirstBankedRegister + i));
+		sendPacket(reply);
+	} else if (command == 'G') {
+		// same layout as 'g'; take as much as we were given
+		int count = 0;
+		for (size_t pos = 0; pos + 8 <= args.size(); pos += 8, count++) {
+			uint32_t value;
+			if (!parseHex32LE(&args[pos], value))
+				break;
+			int regnum = (count < 16) ? count : (count == 16) ? CpsrRegister : (FirstBankedRegister + count - 17);
+			writeRegister(regnum, value);
+		}
+		sendPacket("OK");
+	} else if (command == 'p') {
+		char *end;
+		long regnum = strtol(args.c_str(), &end, 16);
+		if (end == args.c_str() || *end != 0 || regnum < 0 || regnum >= registerCount()) {
+			sendPacket("E00");
+			return;
+		}
+		std::string reply;
+		appendHex32LE(reply, readRegister(regnum));
+		sendPacket(reply);
+	} else if (command == 'P') {
+		char *end;
+		long regnum = strtol(args.c_str(), &end, 16);
+		uint32_t value;
+		if (end == args.c_str() || *end != '=' || regnum < 0 || regnum >= registerCount()) {
+			sendPacket("E00");
+			return;
+		}
+		if (strlen(end + 1) < 8 || !parseHex32LE(end + 1, value)) {
+			sendPacket("E00");
+			return;
+		}
+		sendPacket(writeRegister(regnum, value) ? "OK" : "E00");
+	} else if (command == 'm') {
+		char *end;
+		uint32_t addr = strtoul(args.c_str(), &end, 16);
+		if (*end != ',') {
+			sendPacket("E00");
+			return;
+		}
+		uint32_t length = strtoul(end + 1, nullptr, 16);
+		std::string reply = readMemory(addr, length);
+		sendPacket(reply.empty() && length > 0 ? "E14" : reply);
+	} else if (command == 'M') {
+		char *end;
+		uint32_t addr = strtoul(args.c_str(), &end, 16);
+		size_t colon = args.find(':');
+		if (colon == std::string::npos) {
+			sendPacket("E00");
+			return;
+		}
+		sendPacket(writeMemory(addr, args.substr(colon + 1)) ? "OK" : "E14");
+	} else if (command == 'c') {
+		resume(args, false);
+	} else if (command == 's') {
+		resume(args, true);
+	} else if (command == 'Z' || command == 'z') {
+		// Z0/Z1: breakpoints; Z2/Z3/Z4: write/read/access watchpoints
+		char *end;
+		int type = strtol(args.c_str(), &end, 16);
+		if (*end != ',') {
+			sendPacket("E00");
+			return;
+		}
+		uint32_t addr = strtoul(end + 1, &end, 16);
+		if (*end != ',') {
+			sendPacket("E00");
+			return;
+		}
+		uint32_t length = strtoul(end + 1, nullptr, 16);
+		if (type < 0 || type > 4) {
+			sendPacket("");
+			return;
+		}
+		if (type >= 2) {
+			static const EmuBase::WatchKind kinds[] = {EmuBase::WatchWrite, EmuBase::WatchRead, EmuBase::WatchAccess};
+			EmuBase::Watchpoint w = {addr, length, kinds[type - 2], false};
+			if (command == 'Z') {
+				if (emu->addWatchpoint(w))
+					ourWatchpoints.push_back(w);
+			} else {
+				for (auto it = ourWatchpoints.begin(); it != ourWatchpoints.end(); ++it) {
+					if (*it == w) {
+						emu->removeWatchpoint(w);
+						ourWatchpoints.erase(it);
+						break;
+					}
+				}
+			}
+		} else if (command == 'Z') {
+			if (emu->breakpoints().insert(addr).second)
+				ourBreakpoints.insert(addr);
+		} else if (ourBreakpoints.erase(addr)) {
+			emu->breakpoints().erase(addr);
+		}
+		sendPacket("OK");
+	} else if (packet == "vCont?") {
+		sendPacket("vCont;c;s");
+	} else if (packet.compare(0, 6, "vCont;") == 0) {
+		// there's only the one thread, so the first action is the one
+		resume("", packet[6] == 's' || packet[6] == 'S');
+	} else if (packet.compare(0, 10, "qSupported") == 0) {
+		sendPacket("PacketSize=4000;qXfer:features:read+;QStartNoAckMode+");
+	} else if (packet == "QStartNoAckMode") {
+		sendPacket("OK");
+		noAck = true;
+	} else if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0) {
+		const char *p = packet.c_str() + 31;
+		char *end;
+		size_t offset = strtoul(p, &end, 16);
+		if (*end != ',') {
+			sendPacket("E00");
+			return;
+		}
+		size_t length = strtoul(end + 1, nullptr, 16);
+		std::string xml = targetXml();
+		if (offset >= xml.size())
+			sendPacket("l");
+		else if (offset + length >= xml.size())
+			sendPacket("l" + xml.substr(offset));
+		else
+			sendPacket("m" + xml.substr(offset, length));
+	} else if (packet == "qAttached") {
+		sendPacket("1");
+	} else if (packet == "qC") {
+		sendPacket("QC1");
+	} else if (packet == "qfThreadInfo") {
+		sendPacket("m1");
+	} else if (packet == "qsThreadInfo") {
+		sendPacket("l");
+	} else if (command == 'H' || command == 'T') {
+		sendPacket("OK");
+	} else if (command == 'D') {
+		sendPacket("OK");
+		disconnect();
+	} else if (command == 'k') {
+		// GDB's done with us, but the emulator carries on
+		disconnect();
+	} else {
+		sendPacket("");
+	}
+}
+
+
+std::string GdbStub::targetXml() const {
+	std::string xml =
+		"<?xml version=\"1.0\"?>"
+		"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+		"<target><architecture>arm</architecture>"
+		"<feature name=\"org.gnu.gdb.arm.core\">";
+	for (int i = 0; i < 13; i++)
+		xml += "<reg name=\"r" + std::to_string(i) + "\" bitsize=\"32\"/>";
+	xml +=
+		"<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+		"<reg name=\"lr\" bitsize=\"32\"/>"
+		"<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+		"<reg name=\"cpsr\" bitsize=\"32\" regnum=\"25\"/>"
+		"</feature><feature name=\"org.windemu.arm.banked\">";
+	for (int i = 0; i < BankedRegisterCount; i++)
+		xml += std::string("<reg name=\"") + bankedRegisters[i].name + "\" bitsize=\"32\" group=\"banked\"/>";
+	xml += "</feature></target>";
+	return xml;
+}
+
+int GdbStub::registerCount() const {
+	return FirstBankedRegister + BankedRegisterCount;
+}
+
+uint32_t GdbStub::readRegister(int regnum) const {
+	if (regnum < 0)
+		return 0;
+	if (regnum < 15)
+		return emu->getGPR(regnum);
+	if (regnum == 15)
+		return emu->getRealPC();
+	if (regnum == CpsrRegister)
+		return emu->getCPSR();
+	if (regnum >= FirstBankedRegister && regnum < registerCount()) {
+		auto &reg = bankedRegisters[regnum - FirstBankedRegister];
+		if (reg.index == SpsrIndex)
+			return emu->getSPSR(reg.bank);
+		return emu->getBankedGPR(reg.bank, reg.index);
+	}
+	return 0; // FPA leftovers
+}
+
+bool GdbStub::writeRegister(int regnum, uint32_t value) {
+	if (regnum < 0) {
+		return false;
+	} else if (regnum < 16) {
+		emu->setGPR(regnum, value);
+	} else if (regnum == CpsrRegister) {
+		emu->setCPSR(value);
+	} else if (regnum >= FirstBankedRegister && regnum < registerCount()) {
+		auto &reg = bankedRegisters[regnum - FirstBankedRegister];
+		if (reg.index == SpsrIndex)
+			emu->setSPSR(reg.bank, value);
+		else
+			emu->setBankedGPR(reg.bank, reg.index, value);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+std::string GdbStub::readMemory(uint32_t addr, uint32_t length) {
+	// as far as we can get before something faults
+	std::string reply;
+	for (uint32_t i = 0; i < length; i++) {
+		bool fault = false;
+		uint8_t value = emu->readVirtualDebug(addr + i, ARM710::V8, fault);
+		if (fault)
+			break;
+		appendHex8(reply, value);
+	}
+	return reply;
+}
+
+bool GdbStub::writeMemory(uint32_t addr, const std::string &hex) {
+	for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+		int hi = hexValue(hex[i]), lo = hexValue(hex[i + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		if (emu->writeVirtual((hi << 4) | lo, addr + (i / 2), ARM710::V8) != ARM710::NoFault)
+			return false;
+	}
+	emu->drainWriteBuffer();
+	return true;
+}
+#endif
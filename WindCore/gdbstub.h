@@ -0,0 +1,62 @@
+#pragma once
+#include "emubase.h"
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define WINDCORE_GDB_STUB
+
+// A GDB remote serial protocol server for the ARM710 core.
+//   (gdb) target remote localhost:PORT
+// The host calls run() where it would have called executeUntil. Until
+// GDB connects, that's all it does; once GDB is attached, the target
+// only moves when GDB says so, and run() answers its requests instead.
+//
+// Registers are r0-r15 and cpsr as usual, plus every mode's banked
+// registers (r8_fiq, sp_svc, spsr_irq...) as extras. Memory goes
+// through the MMU as the current mode sees it. Breakpoints and
+// watchpoints are the emulator's own, so they cost nothing while none
+// are set.
+class GdbStub {
+	EmuBase *emu;
+	int listenFd, fd = -1;
+	bool noAck = false;
+	bool running = true;  // as far as GDB is concerned
+	bool stepping = false;
+	std::string input;
+	std::unordered_set<uint32_t> ourBreakpoints;
+	std::vector<EmuBase::Watchpoint> ourWatchpoints;
+
+	bool acceptPeer();
+	void disconnect();
+	bool pump(int timeoutMs);
+	void sendRaw(const std::string &data);
+	void sendPacket(const std::string &data);
+	void handlePacket(const std::string &packet);
+	void resume(const std::string &args, bool step);
+	std::string stopReply() const;
+
+	std::string targetXml() const;
+	int registerCount() const;
+	uint32_t readRegister(int regnum) const;
+	bool writeRegister(int regnum, uint32_t value);
+	std::string readMemory(uint32_t addr, uint32_t length);
+	bool writeMemory(uint32_t addr, const std::string &hex);
+
+public:
+	GdbStub(EmuBase *emu, int listenFd);
+	~GdbStub();
+
+	// SPEC is tcp:PORT (localhost only) or unix:PATH; nullptr on failure
+	static GdbStub *create(EmuBase *emu, const char *spec);
+
+	bool isAttached() const { return fd >= 0; }
+	// Answers GDB without running anything, for when the front-end has
+	// the emulator stopped. Returns true if GDB has since resumed it.
+	bool service();
+	bool wantsToRun() const { return fd >= 0 && running; }
+	// Returns false if GDB has the target stopped and nothing ran.
+	bool run(int64_t cycles);
+};
+#endif
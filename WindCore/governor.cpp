@@ -0,0 +1,53 @@
+#include "governor.h"
+
+
+SpeedGovernor::SpeedGovernor(int32_t clockSpeed, double framePeriod) :
+	clockSpeed(clockSpeed), framePeriod(framePeriod)
+{
+}
+
+int64_t SpeedGovernor::beginFrame(double now) {
+	double elapsed = (lastFrame < 0) ? framePeriod : (now - lastFrame);
+	lastFrame = now;
+	frameStart = now;
+	// after a stall, don't try to make it all up at once
+	if (elapsed > framePeriod * 4)
+		elapsed = framePeriod * 4;
+
+	// leave a little of each frame for everything else
+	double affordable = (hostRate > 0) ? (hostRate * framePeriod * 0.9) : (clockSpeed * framePeriod);
+	double wanted = isUnlimited() ? affordable : (clockSpeed * speedMultiple * elapsed);
+	fallingBehind = (wanted > affordable && hostRate > 0);
+	if (fallingBehind)
+		wanted = affordable;
+	if (wanted > clockSpeed * framePeriod * MaxBatchFrames)
+		wanted = clockSpeed * framePeriod * MaxBatchFrames;
+	return (wanted < 1) ? 1 : (int64_t)wanted;
+}
+
+void SpeedGovernor::endFrame(int64_t cyclesRun, int64_t cyclesIdle, double now) {
+	// too short a batch says more about the clock than the host
+	double took = now - frameStart;
+	int64_t executed = cyclesRun - cyclesIdle;
+	if (took > 0.001 && executed > 0) {
+		double rate = executed / took;
+		hostRate = (hostRate > 0) ? (hostRate * 0.75 + rate * 0.25) : rate;
+	}
+
+	if (windowStart < 0)
+		windowStart = frameStart;
+	windowCycles += cyclesRun;
+	if (now - windowStart >= 1) {
+		achieved = (windowCycles / (double)clockSpeed) / (now - windowStart);
+		windowStart = now;
+		windowCycles = 0;
+	}
+}
+
+bool SpeedGovernor::presentDue(double now) {
+	// a little slack, so jitter doesn't make it skip every other frame
+	if (lastPresent >= 0 && (now - lastPresent) < framePeriod * 0.75)
+		return false;
+	lastPresent = now;
+	return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+
+// Decides how many cycles a front-end should run each host frame, so
+// the same loop can go at real time, some multiple of it, or as fast
+// as the host allows.
+//
+// Each frame's batch is sized from how much host time has passed, but
+// never more than the host has been able to get through in most of a
+// frame (going by how long previous batches took), so a slow host or
+// an unlimited speed still leaves time for input and drawing. Idle
+// cycles are left out of that, as skipping over them is nearly free,
+// and no batch covers more than MaxBatchFrames of emulated time. Times
+// are in seconds, from whatever clock the front-end has to hand.
+class SpeedGovernor {
+public:
+	enum { MaxBatchFrames = 16 };
+
+	SpeedGovernor(int32_t clockSpeed, double framePeriod = 1.0 / 64);
+
+	// 1 is real time, 2 twice that and so on; 0 is unlimited
+	void setSpeed(double multiple) { speedMultiple = (multiple > 0) ? multiple : 0; }
+	double speed() const { return speedMultiple; }
+	bool isUnlimited() const { return speedMultiple == 0; }
+
+	// forget about the last frame, e.g. after being paused
+	void reset() {
+		lastFrame = -1;
+		windowStart = -1;
+		windowCycles = 0;
+	}
+
+	// cycles to run for a frame starting now
+	int64_t beginFrame(double now);
+	// and how many actually ran once they have, and how many of those
+	// were idle (see EmuBase::currentIdleCycles)
+	void endFrame(int64_t cyclesRun, int64_t cyclesIdle, double now);
+	// whether the last batch was cut short because the host can't keep
+	// up, in which case there's no point waiting before the next one
+	bool isFallingBehind() const { return fallingBehind; }
+
+	// whether there's been long enough since the last screen update
+	// for another to be worth converting and showing
+	bool presentDue(double now);
+
+	// the speed actually achieved over the last second or so
+	double achievedSpeed() const { return achieved; }
+
+private:
+	int32_t clockSpeed;
+	double framePeriod;
+	double speedMultiple = 1;
+	double lastFrame = -1, frameStart = 0, lastPresent = -1;
+	double hostRate = 0; // executed cycles per host second
+	bool fallingBehind = false;
+
+	double windowStart = -1;
+	int64_t windowCycles = 0;
+	double achieved = 0;
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include "arm710.h"
+#include "serial.h"
+#include "audio.h"
 #include <stdio.h>
 
 struct Timer {
@@ -43,6 +45,20 @@ struct Timer {
 		}
 		return false;
 	}
+	// the main oscillator was stopped (standby) for this long
+	void clockStopped(int64_t duration) { nextTickAt += duration; }
+	void saveState(StateWriter &out) const {
+		out.put(nextTickAt);
+		out.put(config);
+		out.put(interval);
+		out.put(value);
+	}
+	void loadState(StateReader &in) {
+		in.get(nextTickAt);
+		in.get(config);
+		in.get(interval);
+		in.get(value);
+	}
 	void dump() {
 		printf("enabled=%s periodic=%s interval=%d value=%d\n",
 			(config & ENABLED) ? "true" : "false",
@@ -79,6 +95,8 @@ enum UartRegs {
 
 struct UART {
 	ARM710 *cpu;
+	SerialBackend *backend = nullptr;
+	int clockSpeed;
 
 	enum {
 		IntRx = 1,
@@ -105,12 +123,74 @@ struct UART {
 		FlagDataCarrierDetect = 4,
 		FlagBusy = 8,
 		FlagReceiveFifoEmpty = 0x10,
-		FlagTransmitFifoFull = 0x20
+		FlagTransmitFifoFull = 0x20,
+		FlagReceiveFifoFull = 0x40,
+		FlagTransmitFifoEmpty = 0x80
+	};
+	enum {
+		FifoSize = 16,
+		FifoTrigger = FifoSize / 2, // RX/TX interrupts fire at half full/empty
+		BaudBase = 230400           // 3.6864MHz UART clock / 16
 	};
 	uint8_t portControl = 0;
 	uint8_t frameControl = 0;
-	uint8_t interrupts = 0, interruptMask = 0;
+	uint16_t baudDivisor = 0;
+	uint8_t interruptMask = 0;
+	bool enabled = false;
+
+	// The line is modelled in batches: each event moves however many
+	// characters would have crossed it since the last one, and events
+	// are spaced so one lands whenever the FIFOs reach their trigger
+	// levels. Nothing is polled per instruction.
+	uint8_t rxFifo[FifoSize], txFifo[FifoSize];
+	int rxHead = 0, rxCount = 0, txHead = 0, txCount = 0;
+	bool rxTimeout = false;
+	int64_t cyclesPerChar = 1;
+	int64_t lastEventAt = 0, nextEventAt = INT64_MAX;
 
+	bool fifoEnabled() const { return frameControl & FrameCtrlUFifoEn; }
+	int fifoDepth() const { return fifoEnabled() ? FifoSize : 1; }
+	uint8_t flags() const {
+		uint8_t f = FlagClearToSend | FlagDataSetReady | FlagDataCarrierDetect;
+		if (txCount > 0) f |= FlagBusy;
+		if (rxCount == 0) f |= FlagReceiveFifoEmpty;
+		if (rxCount == fifoDepth()) f |= FlagReceiveFifoFull;
+		if (txCount == fifoDepth()) f |= FlagTransmitFifoFull;
+		if (txCount == 0) f |= FlagTransmitFifoEmpty;
+		return f;
+	}
+	bool rxInterrupt() const {
+		return enabled && (rxCount >= (fifoEnabled() ? FifoTrigger : 1) || (rxTimeout && rxCount > 0));
+	}
+	bool txInterrupt() const {
+		return enabled && txCount <= (fifoEnabled() ? FifoTrigger : 0);
+	}
+	uint8_t rawInterrupts() const {
+		return (rxInterrupt() ? IntRx : 0) | (txInterrupt() ? IntTx : 0);
+	}
+	bool interruptPending() const { return rawInterrupts() & interruptMask; }
+
+	void setEnabled(bool on, int64_t cycles);
+	void setLineControl(uint8_t frame, uint16_t divisor);
+	uint8_t readData();
+	void writeData(uint8_t value);
+	// returns true if anything happened that could affect interrupts
+	bool tick(int64_t cycles) {
+		if (cycles < nextEventAt)
+			return false;
+		runEvent(cycles);
+		return true;
+	}
+	void runEvent(int64_t cycles);
+	void schedule();
+	void clockStopped(int64_t duration) {
+		lastEventAt += duration;
+		if (nextEventAt != INT64_MAX) nextEventAt += duration;
+	}
+	void saveState(StateWriter &out) const;
+	void loadState(StateReader &in);
+
+	// Windermere register interface
 	// UART0DATA = 0x600, byte write, long read
 	// UART0FCR = 0x604, long
 	// UART0LCR = 0x608, long
@@ -122,64 +202,71 @@ struct UART {
 	// UART0TEST1 = 0x620,
 	// UART0TEST2 = 0x624,
 	// UART0TEST3 = 0x628,
-	uint32_t readReg8(uint32_t reg) {
-		// UART0DATA
-		if (reg == (UART0CON & 0xFF)) {
-			return portControl;
-		} else if (reg == (UART0FLG & 0xFF)) {
-			// we pretend we are never busy, never have full fifo
-			return FlagReceiveFifoEmpty;
-		// UART0INT?
-		// UART0INTM?
-		// UART0INTR?
-		} else {
-			printf("unhandled 8bit uart read %x at pc=%08x lr=%08x\n", reg, cpu->getGPR(15), cpu->getGPR(14));
-			return 0xFF;
-		}
-	}
-	uint32_t readReg32(uint32_t reg) {
-		// UART0DATA
-		if (reg == (UART0FCR & 0xFF)) {
-			return frameControl;
-		// UART0LCR
-		} else if (reg == (UART0FLG & 0xFF)) {
-			// we pretend we are never busy, never have full fifo
-			return FlagReceiveFifoEmpty;
-		} else {
-			printf("unhandled 32bit uart read %x at pc=%08x lr=%08x\n", reg, cpu->getGPR(15), cpu->getGPR(14));
-			return 0xFFFFFFFF;
-		}
+	uint32_t readReg(uint32_t reg);
+	void writeReg(uint32_t reg, uint32_t value, int64_t cycles);
+	uint32_t readReg8(uint32_t reg) { return readReg(reg) & 0xFF; }
+	uint32_t readReg32(uint32_t reg) { return readReg(reg); }
+	void writeReg8(uint32_t reg, uint8_t value, int64_t cycles) { writeReg(reg, value, cycles); }
+	void writeReg32(uint32_t reg, uint32_t value, int64_t cycles) { writeReg(reg, value, cycles); }
+};
+
+struct Codec {
+	ARM710 *cpu;
+	AudioRing *output = nullptr;
+	int clockSpeed;
+
+	enum {
+		SampleRate = 8000,
+		FifoSize = 16,
+		FifoTrigger = FifoSize / 2, // CSINT fires at half empty/full
+		// Windermere CONFG
+		ConfigTxEnable = 1,
+		ConfigRxEnable = 2,
+		ConfigALaw = 4,
+		// Windermere COLFG
+		FlagTxFull = 1,
+		FlagRxEmpty = 2,
+		FlagTxHalfEmpty = 4,
+		FlagRxHalfFull = 8
+	};
+	uint8_t config = 0;
+	bool interrupt = false; // latched until COEOI
+
+	// Like the UART, samples move in batches of FifoTrigger, so there's
+	// one event per interrupt rather than one per sample.
+	uint8_t txFifo[FifoSize], rxFifo[FifoSize];
+	int txHead = 0, txCount = 0, rxHead = 0, rxCount = 0;
+	int64_t lastEventAt = 0, nextEventAt = INT64_MAX;
+
+	int64_t cyclesPerSample() const { return clockSpeed / SampleRate; }
+	bool txEnabled() const { return config & ConfigTxEnable; }
+	bool rxEnabled() const { return config & ConfigRxEnable; }
+	uint8_t flags() const {
+		uint8_t f = 0;
+		if (txCount == FifoSize) f |= FlagTxFull;
+		if (rxCount == 0) f |= FlagRxEmpty;
+		if (txCount <= FifoTrigger) f |= FlagTxHalfEmpty;
+		if (rxCount >= FifoTrigger) f |= FlagRxHalfFull;
+		return f;
 	}
-	void writeReg8(uint32_t reg, uint8_t value) {
-		// UART0DATA
-		if (reg == (UART0CON & 0xFF)) {
-			portControl = value;
-			printf("portcon updated: enable=%d sirenable=%d irdatx=%d\n", value&1, value&2, value&4);
-		} else if (reg == (UART0INTM & 0xFF)) {
-			interruptMask = value;
-			printf("uart interruptmask updated: %d\n", value);
-		// UART0INTR?
-		} else {
-			printf("unhandled 8bit uart write %x value %02x at pc=%08x lr=%08x\n", reg, value, cpu->getGPR(15), cpu->getGPR(14));
-		}
+
+	void setConfig(uint8_t value, int64_t cycles);
+	uint8_t readData();
+	void writeData(uint8_t value);
+	void clearInterrupt() { interrupt = false; }
+	// returns true if anything happened that could affect interrupts
+	bool tick(int64_t cycles) {
+		if (cycles < nextEventAt)
+			return false;
+		runEvent(cycles);
+		return true;
 	}
-	void writeReg32(uint32_t reg, uint32_t value) {
-		if (reg == (UART0FCR & 0xFF)) {
-			frameControl = value;
-			printf("frameControl updated: break=%d parityEn=%d evenParity=%d extraStop=%d ufifoEn=%d wrdLen=%d\n",
-				value&1,
-				value&2,
-				value&4,
-				value&8,
-				value&0x10,
-				((value&0x60)>>5)+5);
-		} else if (reg == (UART0LCR & 0xFF)) {
-			printf("** uart writing lcr %x **\n", value);
-		} else if (reg == (UART0INT & 0xFF)) {
-			printf("uart interrupts %x -> %x\n", interrupts, value);
-			interrupts = value;
-		} else {
-			printf("unhandled 32bit uart write %x value %08x at pc=%08x lr=%08x\n", reg, value, cpu->getGPR(15), cpu->getGPR(14));
-		}
+	void runEvent(int64_t cycles);
+	void schedule();
+	void clockStopped(int64_t duration) {
+		lastEventAt += duration;
+		if (nextEventAt != INT64_MAX) nextEventAt += duration;
 	}
+	void saveState(StateWriter &out) const;
+	void loadState(StateReader &in);
 };
@@ -0,0 +1,97 @@
+#include "hletable.h"
+#include "emubase.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static const struct { const char *name; HleFunction function; } functionNames[] = {
+	{ "MemCopy", HleMemCopy },
+	{ "MemFill", HleMemFill },
+	{ "MemFillZ", HleMemFillZ },
+	{ "Des8Copy", HleDes8Copy },
+};
+
+static bool parseHex(const std::string &word, uint32_t &value) {
+	char *end;
+	value = strtoul(word.c_str(), &end, 16);
+	return !word.empty() && word.size() <= 8 && *end == 0;
+}
+
+// splits off the next whitespace-separated word, leaving `p` after it
+static std::string nextWord(const char *&p) {
+	while (*p == ' ' || *p == '\t') p++;
+	const char *start = p;
+	while (*p && !isspace((unsigned char)*p)) p++;
+	return std::string(start, p);
+}
+
+bool loadHleTable(EmuBase *emu, const char *path, std::string &error) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		error = std::string("can't open ") + path;
+		return false;
+	}
+
+	struct Group { std::string rom; std::vector<HleHook> hooks; };
+	std::vector<Group> groups(1);
+	char line[1024];
+	int lineNumber = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), f)) {
+		lineNumber++;
+		line[strcspn(line, "#\r\n")] = 0;
+
+		const char *p = line;
+		std::string first = nextWord(p);
+		if (first.empty())
+			continue;
+		if (first == "rom") {
+			// the name is only for messages, so take it as it comes
+			while (*p == ' ' || *p == '\t') p++;
+			groups.push_back(Group{p, {}});
+			ok = !groups.back().rom.empty();
+			continue;
+		}
+
+		HleHook hook;
+		ok = parseHex(first, hook.address) && parseHex(nextWord(p), hook.firstInsn);
+		if (ok) {
+			ok = false;
+			std::string name = nextWord(p);
+			for (const auto &entry : functionNames) {
+				if (name == entry.name) {
+					hook.function = entry.function;
+					ok = true;
+				}
+			}
+		}
+		if (ok && ((hook.address & 3) || !nextWord(p).empty()))
+			ok = false;
+		if (ok)
+			groups.back().hooks.push_back(hook);
+	}
+	fclose(f);
+
+	if (!ok) {
+		error = std::string(path) + ":" + std::to_string(lineNumber) + ": can't make sense of this";
+		return false;
+	}
+
+	int matched = 0;
+	for (const Group &group : groups) {
+		if (group.hooks.empty())
+			continue;
+		if (emu->addHleHooks(group.hooks.data(), group.hooks.size())) {
+			emu->log<LogDebugger>("HLE: using %d routines for %s", (int)group.hooks.size(), group.rom.empty() ? "this ROM" : group.rom.c_str());
+			matched++;
+		}
+	}
+	if (matched == 0) {
+		error = std::string("nothing in ") + path + " is for this ROM";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+
+class EmuBase;
+
+// Tables of EPOC library routines to replace with native code (see
+// HleFunction), read from a text file so that addresses for more ROM
+// builds can be added without rebuilding. Entries are grouped by ROM:
+//
+//   rom NAME                          starts the entries for one build
+//   ADDRESS FIRSTINSN ROUTINE         e.g. 00012340 e92d4010 MemCopy
+//
+// ADDRESS is the routine's physical address and FIRSTINSN the word the
+// ROM has there, both in hex. ROUTINE is MemCopy, MemFill, MemFillZ or
+// Des8Copy. Anything after a '#' is ignored.
+//
+// A group is only used if every one of its first instructions matches
+// the loaded ROM, so one file can cover several builds. Returns false,
+// with `error` saying why, if the file can't be read or makes no sense,
+// or if none of the groups are for this ROM.
+bool loadHleTable(EmuBase *emu, const char *path, std::string &error);
@@ -0,0 +1,165 @@
+#include "inputscript.h"
+#include "emubase.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define K(name) { #name, EStdKey##name }
+static const struct { const char *name; EpocKey key; } keyNames[] = {
+	K(Backspace), K(Tab), K(Enter), K(Escape), K(Space), K(Delete),
+	K(Home), K(End), K(PageUp), K(PageDown),
+	K(LeftArrow), K(RightArrow), K(UpArrow), K(DownArrow),
+	K(LeftShift), K(RightShift), K(LeftAlt), K(RightAlt),
+	K(LeftCtrl), K(RightCtrl), K(LeftFunc), K(RightFunc), K(CapsLock),
+	K(Comma), K(FullStop), K(ForwardSlash), K(BackSlash), K(SemiColon),
+	K(SingleQuote), K(Hash), K(SquareBracketLeft), K(SquareBracketRight),
+	K(Minus), K(Equals), K(Menu), K(Off), K(Dial), K(Help),
+	K(BacklightOn), K(BacklightOff), K(BacklightToggle),
+	K(IncContrast), K(DecContrast), K(SliderUp), K(SliderDown),
+	K(DictaphonePlay), K(DictaphoneStop), K(DictaphoneRecord),
+};
+#undef K
+
+static bool sameName(const std::string &a, const char *b) {
+	if (a.size() != strlen(b))
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+			return false;
+	return true;
+}
+
+static bool parseKey(const std::string &name, EpocKey &key) {
+	if (name.size() == 1 && isalnum((unsigned char)name[0])) {
+		key = (EpocKey)toupper((unsigned char)name[0]);
+		return true;
+	}
+	for (const auto &entry : keyNames) {
+		if (sameName(name, entry.name)) {
+			key = entry.key;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool parseState(const std::string &word, bool &down) {
+	if (word == "down") down = true;
+	else if (word == "up") down = false;
+	else return false;
+	return true;
+}
+
+static bool parseNumber(const std::string &word, double &value) {
+	char *end;
+	value = strtod(word.c_str(), &end);
+	return !word.empty() && *end == 0;
+}
+
+// splits off the next whitespace-separated word, leaving `p` after it
+static std::string nextWord(const char *&p) {
+	while (*p == ' ' || *p == '\t') p++;
+	const char *start = p;
+	while (*p && !isspace((unsigned char)*p)) p++;
+	return std::string(start, p);
+}
+
+bool loadInputScript(EmuBase *emu, const char *path, std::string &error) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		error = std::string("can't open ") + path;
+		return false;
+	}
+
+	// everything's checked before anything is queued
+	struct Event { double at; bool isTouch, down; EpocKey key; int32_t x, y; };
+	std::vector<Event> events;
+	const double pressLength = 0.1;
+	double last = 0;
+	char line[1024];
+	int lineNumber = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), f)) {
+		lineNumber++;
+		line[strcspn(line, "#\r\n")] = 0;
+
+		const char *p = line;
+		std::string time = nextWord(p);
+		if (time.empty())
+			continue;
+		double at;
+		if (!parseNumber(time, at) || at < 0) {
+			ok = false;
+			break;
+		}
+		if (time[0] == '+')
+			at += last;
+
+		std::string command = nextWord(p);
+		EpocKey key;
+		bool down = true;
+		if (command == "key" || command == "press") {
+			ok = parseKey(nextWord(p), key);
+			if (ok && command == "key")
+				ok = parseState(nextWord(p), down);
+			if (ok) {
+				events.push_back(Event{at, false, down, key, 0, 0});
+				last = at;
+				if (command == "press") {
+					last = at + pressLength;
+					events.push_back(Event{last, false, false, key, 0, 0});
+				}
+			}
+		} else if (command == "type") {
+			// the rest of the line, as is
+			while (*p == ' ' || *p == '\t') p++;
+			for (; *p && ok; p++) {
+				if (*p == ' ') {
+					key = EStdKeySpace;
+				} else if (isalnum((unsigned char)*p)) {
+					key = (EpocKey)toupper((unsigned char)*p);
+				} else {
+					ok = false;
+					break;
+				}
+				events.push_back(Event{at, false, true, key, 0, 0});
+				last = at + pressLength / 2;
+				events.push_back(Event{last, false, false, key, 0, 0});
+				at += pressLength;
+			}
+		} else if (command == "pen") {
+			double x, y;
+			ok = parseNumber(nextWord(p), x) && parseNumber(nextWord(p), y) && parseState(nextWord(p), down);
+			if (ok) {
+				events.push_back(Event{at, true, down, EStdKeyNull, (int32_t)x, (int32_t)y});
+				last = at;
+			}
+		} else {
+			ok = false;
+		}
+
+		// nothing should be left over
+		if (ok && !nextWord(p).empty())
+			ok = false;
+	}
+	fclose(f);
+
+	if (!ok) {
+		error = std::string(path) + ":" + std::to_string(lineNumber) + ": can't make sense of this";
+		return false;
+	}
+
+	int64_t start = emu->currentCycles();
+	int32_t clockSpeed = emu->getClockSpeed();
+	for (const Event &event : events) {
+		int64_t at = start + (int64_t)(event.at * clockSpeed);
+		if (event.isTouch)
+			emu->queueTouchEvent(at, event.x, event.y, event.down);
+		else
+			emu->queueKeyEvent(at, event.key, event.down);
+	}
+	return true;
+}
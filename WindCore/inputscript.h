@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+class EmuBase;
+
+// Timed key presses and pen strokes read from a text file and fed into
+// EmuBase's input queue (queueKeyEvent/queueTouchEvent), so a front-end
+// can drive the device without anyone at the keyboard. One per line:
+//
+//   TIME key NAME down|up
+//   TIME press NAME          down, then up a tenth of a second later
+//   TIME type TEXT           a press for each letter, digit or space
+//   TIME pen X Y down|up     a stroke is a down for each point, then an up
+//
+// TIME is in emulated seconds from when the script is loaded, or from
+// the end of the previous line if it starts with '+'. NAME is a letter
+// or digit, or an EStdKey name without the prefix (Enter, LeftCtrl,
+// Menu...). X and Y are screen pixels. Anything after a '#' is ignored.
+//
+// Returns false, with `error` saying where, if the file can't be read
+// or makes no sense; nothing is queued in that case.
+bool loadInputScript(EmuBase *emu, const char *path, std::string &error);
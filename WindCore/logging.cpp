@@ -0,0 +1,161 @@
+#include "logging.h"
+#include <chrono>
+
+
+static const char *subsystemNames[LogSubsystemCount] = {
+	"cpu", "system", "serial", "pccard", "kernel", "debugger"
+};
+static const char *levelNames[] = {
+	"off", "error", "warning", "info", "verbose"
+};
+
+LogPipeline::LogPipeline() {
+	cells = new Cell[Capacity];
+	for (size_t i = 0; i < Capacity; i++)
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+	for (int i = 0; i < LogSubsystemCount; i++)
+		levels[i].store(LogInfo, std::memory_order_relaxed);
+}
+
+LogPipeline::~LogPipeline() {
+#ifdef WINDCORE_LOG_THREAD
+	if (running) {
+		running = false;
+		thread.join();
+	}
+#endif
+	drain();
+	delete[] cells;
+}
+
+void LogPipeline::setSink(std::function<void(const char *)> newSink) {
+	{
+		std::lock_guard<std::mutex> guard(sinkLock);
+		sink = newSink;
+	}
+	hasSink.store((bool)newSink, std::memory_order_relaxed);
+
+#ifdef WINDCORE_LOG_THREAD
+	// nothing's needed until there's somewhere for messages to go
+	if (newSink && !running) {
+		running = true;
+		thread = std::thread(&LogPipeline::run, this);
+	}
+#endif
+}
+
+bool LogPipeline::configure(const char *spec) {
+	bool ok = true;
+	while (*spec) {
+		const char *end = strchr(spec, ',');
+		size_t length = end ? (size_t)(end - spec) : strlen(spec);
+		const char *colon = (const char *)memchr(spec, ':', length);
+
+		int level = -1;
+		if (colon) {
+			size_t levelLength = length - (colon + 1 - spec);
+			for (int i = 0; i <= LogVerbose; i++)
+				if (strlen(levelNames[i]) == levelLength && !strncmp(colon + 1, levelNames[i], levelLength))
+					level = i;
+		}
+		if (level < 0) {
+			ok = false;
+		} else {
+			size_t nameLength = colon - spec;
+			bool found = false;
+			for (int i = 0; i < LogSubsystemCount; i++) {
+				if ((nameLength == 3 && !strncmp(spec, "all", 3)) ||
+					(strlen(subsystemNames[i]) == nameLength && !strncmp(spec, subsystemNames[i], nameLength))) {
+					setLevel((LogSubsystem)i, (LogLevel)level);
+					found = true;
+				}
+			}
+			ok = ok && found;
+		}
+
+		spec += length;
+		if (*spec == ',')
+			spec++;
+	}
+	return ok;
+}
+
+LogPipeline::Cell *LogPipeline::beginPush(size_t &position) {
+	// a bounded MPMC queue (after Dmitry Vyukov's), though really
+	// there's only ever one consumer
+	size_t pos = enqueuePos.load(std::memory_order_relaxed);
+	for (;;) {
+		Cell *cell = &cells[pos & (Capacity - 1)];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				position = pos;
+				posted.fetch_add(1, std::memory_order_relaxed);
+				return cell;
+			}
+		} else if (diff < 0) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr; // full
+		} else {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool LogPipeline::drainOne() {
+	size_t pos = dequeuePos.load(std::memory_order_relaxed);
+	Cell *cell = &cells[pos & (Capacity - 1)];
+	size_t sequence = cell->sequence.load(std::memory_order_acquire);
+	if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0)
+		return false; // empty, or the next one is still being written
+
+	char buffer[1024];
+	Record &record = cell->record;
+	record.formatter(buffer, sizeof(buffer), record.format, record.args);
+	dequeuePos.store(pos + 1, std::memory_order_relaxed);
+	cell->sequence.store(pos + Capacity, std::memory_order_release);
+
+	{
+		std::lock_guard<std::mutex> guard(sinkLock);
+		if (sink)
+			sink(buffer);
+	}
+	delivered.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+void LogPipeline::drain() {
+	while (drainOne()) { }
+
+	uint64_t lost = dropped.load(std::memory_order_relaxed);
+	if (lost != droppedReported) {
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "(%llu log messages dropped)", (unsigned long long)(lost - droppedReported));
+		droppedReported = lost;
+		std::lock_guard<std::mutex> guard(sinkLock);
+		if (sink)
+			sink(buffer);
+	}
+}
+
+void LogPipeline::flush() {
+#ifdef WINDCORE_LOG_THREAD
+	if (running) {
+		uint64_t target = posted.load(std::memory_order_relaxed);
+		while (delivered.load(std::memory_order_acquire) < target)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return;
+	}
+#endif
+	drain();
+}
+
+#ifdef WINDCORE_LOG_THREAD
+void LogPipeline::run() {
+	while (running) {
+		drain();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+#endif
@@ -0,0 +1,189 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <thread>
+#define WINDCORE_LOG_THREAD
+#endif
+
+// Every message belongs to a subsystem and has a level. Each subsystem
+// has its own runtime level, and anything above WINDCORE_LOG_LEVEL isn't
+// compiled in at all.
+enum LogSubsystem {
+	LogCPU,      // ARM710 core and MMU
+	LogSystem,   // system controller, power, interrupts, LCD, GPIO
+	LogSerial,   // UARTs
+	LogPCCard,   // CLPS7600, Etna
+	LogKernel,   // what we can see of EPOC's kernel
+	LogDebugger, // breakpoints, watchpoints, GDB, HLE
+	LogSubsystemCount
+};
+
+enum LogLevel {
+	LogOff,
+	LogError,
+	LogWarning,
+	LogInfo,
+	LogVerbose // register accesses and the like; off unless asked for
+};
+
+#ifndef WINDCORE_LOG_LEVEL
+#define WINDCORE_LOG_LEVEL LogVerbose
+#endif
+
+// Messages are captured as a format string plus the raw arguments, and
+// pushed onto a lock-free ring. Formatting and the sink itself run on a
+// consumer thread (or, without threads, whenever flush is called), so a
+// noisy device costs the emulation a copy rather than a vsnprintf and a
+// trip through the UI. If the ring fills up, messages are dropped and
+// counted rather than making the emulation wait.
+//
+// Format strings must be literals, as only the pointer is kept; string
+// arguments are copied, up to LogStringSize - 1 characters.
+class LogPipeline {
+public:
+	enum {
+		Capacity = 0x1000, // records; a power of two
+		ArgBytes = 176,
+		LogStringSize = 48
+	};
+
+	LogPipeline();
+	~LogPipeline();
+
+	// the sink is called from the consumer thread
+	void setSink(std::function<void(const char *)> newSink);
+	void setLevel(LogSubsystem subsystem, LogLevel level) {
+		levels[subsystem].store(level, std::memory_order_relaxed);
+	}
+	LogLevel level(LogSubsystem subsystem) const {
+		return (LogLevel)levels[subsystem].load(std::memory_order_relaxed);
+	}
+	// "serial:verbose,pccard:off" and so on; "all" sets every subsystem
+	bool configure(const char *spec);
+
+	bool enabled(LogSubsystem subsystem, LogLevel messageLevel) const {
+		return hasSink.load(std::memory_order_relaxed) &&
+			messageLevel <= levels[subsystem].load(std::memory_order_relaxed);
+	}
+
+	template<typename... Args>
+	void post(LogSubsystem subsystem, LogLevel messageLevel, const char *format, Args... args);
+
+	// returns once everything logged so far has reached the sink
+	void flush();
+
+private:
+	struct LogString { char text[LogStringSize]; };
+
+	// how each kind of argument is kept: strings by value, the rest as-is
+	template<typename T> struct Stored {
+		typedef T Type;
+		static Type store(T value) { return value; }
+		static T load(const Type &value) { return value; }
+	};
+
+	struct Record {
+		const char *format;
+		void (*formatter)(char *out, size_t size, const char *format, const uint8_t *args);
+		uint8_t subsystem, level;
+		alignas(8) uint8_t args[ArgBytes];
+	};
+	struct Cell {
+		std::atomic<size_t> sequence;
+		Record record;
+	};
+
+	template<typename... S, size_t... I>
+	static void formatWith(char *out, size_t size, const char *format, const uint8_t *args, std::index_sequence<I...>);
+	template<typename... S>
+	static void formatRecord(char *out, size_t size, const char *format, const uint8_t *args) {
+		formatWith<S...>(out, size, format, args, std::index_sequence_for<S...>());
+	}
+	template<typename... S, size_t... I>
+	static void storeWith(uint8_t *out, std::index_sequence<I...>, S... args);
+	template<typename... S>
+	static constexpr size_t offsetOf(size_t index) {
+		size_t sizes[] = {sizeof(typename Stored<S>::Type)..., 0};
+		size_t offset = 0;
+		for (size_t i = 0; i < index; i++)
+			offset += (sizes[i] + 7) & ~(size_t)7;
+		return offset;
+	}
+
+	Cell *cells;
+	std::atomic<size_t> enqueuePos{0}, dequeuePos{0};
+	std::atomic<uint64_t> posted{0}, delivered{0}, dropped{0};
+	uint64_t droppedReported = 0;
+	std::atomic<uint8_t> levels[LogSubsystemCount];
+	std::atomic<bool> hasSink{false};
+	std::function<void(const char *)> sink;
+	std::mutex sinkLock;
+
+	Cell *beginPush(size_t &position);
+	void endPush(Cell *cell, size_t position) {
+		cell->sequence.store(position + 1, std::memory_order_release);
+	}
+	bool drainOne();
+	void drain();
+
+#ifdef WINDCORE_LOG_THREAD
+	std::atomic<bool> running{false};
+	std::thread thread;
+	void run();
+#endif
+};
+
+template<> struct LogPipeline::Stored<const char *> {
+	typedef LogString Type;
+	static Type store(const char *value) {
+		Type s;
+		strncpy(s.text, value ? value : "(null)", LogStringSize - 1);
+		s.text[LogStringSize - 1] = 0;
+		return s;
+	}
+	static const char *load(const Type &value) { return value.text; }
+};
+template<> struct LogPipeline::Stored<char *> : LogPipeline::Stored<const char *> { };
+
+template<typename... S, size_t... I>
+void LogPipeline::formatWith(char *out, size_t size, const char *format, const uint8_t *args, std::index_sequence<I...>) {
+	if constexpr (sizeof...(S) == 0) {
+		(void)args;
+		snprintf(out, size, "%s", format);
+	} else {
+		snprintf(out, size, format,
+			Stored<S>::load(*(const typename Stored<S>::Type *)(args + offsetOf<S...>(I)))...);
+	}
+}
+
+template<typename... S, size_t... I>
+void LogPipeline::storeWith(uint8_t *out, std::index_sequence<I...>, S... args) {
+	(void)out;
+	((new (out + offsetOf<S...>(I)) typename Stored<S>::Type(Stored<S>::store(args))), ...);
+}
+
+template<typename... Args>
+void LogPipeline::post(LogSubsystem subsystem, LogLevel messageLevel, const char *format, Args... args) {
+	static_assert(offsetOf<Args...>(sizeof...(Args)) <= ArgBytes, "too many log arguments");
+
+	size_t position;
+	Cell *cell = beginPush(position);
+	if (!cell)
+		return;
+	Record *record = &cell->record;
+	record->format = format;
+	record->formatter = &formatRecord<Args...>;
+	record->subsystem = subsystem;
+	record->level = messageLevel;
+	storeWith(record->args, std::index_sequence_for<Args...>(), args...);
+	endPush(cell, position);
+}
@@ -0,0 +1,26 @@
+#include "savestate.h"
+
+static const char magic[4] = {'W', 'S', 'T', 'A'};
+enum { DeviceNameSize = 32 };
+
+void StateWriter::header(const char *deviceName) {
+	bytes(magic, 4);
+	put<uint32_t>(Version);
+	char name[DeviceNameSize] = {};
+	strncpy(name, deviceName, DeviceNameSize - 1);
+	bytes(name, DeviceNameSize);
+}
+
+bool StateReader::header(const char *deviceName) {
+	char check[4];
+	uint32_t version;
+	char name[DeviceNameSize];
+	bytes(check, 4);
+	get(version);
+	bytes(name, DeviceNameSize);
+	name[DeviceNameSize - 1] = 0;
+
+	if (memcmp(check, magic, 4) != 0 || version != StateWriter::Version || strcmp(name, deviceName) != 0)
+		failed = true;
+	return ok();
+}
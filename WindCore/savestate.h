@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+// Machine state (CPU, devices, timing) as a flat blob, for resuming
+// exactly where things left off. Memory isn't included: front-ends get
+// at that through EmuBase::memoryRegions, so they can keep track of
+// which parts have changed and store only those.
+//
+// Format: "WSTA", a version and the device name, then each component's
+// fields in a fixed order, in host byte order. There are no tags or
+// lengths; if the version or device don't match, it's not loaded.
+class StateWriter {
+public:
+	enum { Version = 1 };
+
+	void bytes(const void *src, size_t size) {
+		const uint8_t *p = (const uint8_t *)src;
+		data.insert(data.end(), p, p + size);
+	}
+	template<typename T> void put(const T &value) {
+		static_assert(std::is_trivially_copyable<T>::value, "can only save plain data");
+		bytes(&value, sizeof(T));
+	}
+	void header(const char *deviceName);
+
+	const std::vector<uint8_t> &result() const { return data; }
+
+private:
+	std::vector<uint8_t> data;
+};
+
+// Which chunks of a block of memory have been written since the owner
+// last looked, so a save only has to visit those rather than all of RAM
+// and the card. Tracking is off (and costs nothing) until track().
+class DirtyMap {
+public:
+	enum { ChunkShift = 14, ChunkSize = 1 << ChunkShift };
+
+	// everything starts out dirty, as nothing's been looked at yet
+	void track(size_t size) { chunks.assign((size + ChunkSize - 1) >> ChunkShift, 1); }
+	bool isTracking() const { return !chunks.empty(); }
+	void mark(size_t offset, size_t size) {
+		if (size == 0 || chunks.empty())
+			return;
+		size_t last = (offset + size - 1) >> ChunkShift;
+		for (size_t i = offset >> ChunkShift; i <= last && i < chunks.size(); i++)
+			chunks[i] = 1;
+	}
+	// whether it was dirty, and it isn't now
+	bool take(size_t chunk) {
+		bool was = chunk < chunks.size() && chunks[chunk];
+		if (was)
+			chunks[chunk] = 0;
+		return was;
+	}
+	void clearAll() { chunks.assign(chunks.size(), 0); }
+
+private:
+	std::vector<uint8_t> chunks;
+};
+
+class StateReader {
+public:
+	StateReader(const uint8_t *data, size_t size) : data(data), size(size) { }
+
+	// reading past the end gives zeroes, and marks the whole thing bad
+	void bytes(void *dest, size_t count) {
+		if (count > size - pos) {
+			failed = true;
+			memset(dest, 0, count);
+			return;
+		}
+		memcpy(dest, data + pos, count);
+		pos += count;
+	}
+	template<typename T> void get(T &value) {
+		static_assert(std::is_trivially_copyable<T>::value, "can only load plain data");
+		bytes(&value, sizeof(T));
+	}
+	// false if it's not ours, or for some other device
+	bool header(const char *deviceName);
+
+	void fail() { failed = true; }
+	bool ok() const { return !failed; }
+	bool atEnd() const { return pos == size; }
+
+private:
+	const uint8_t *data;
+	size_t size, pos = 0;
+	bool failed = false;
+};
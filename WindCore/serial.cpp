@@ -0,0 +1,194 @@
+#include "serial.h"
+
+#ifdef WINDCORE_SERIAL_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <string>
+
+static void setNonBlocking(int fd) {
+	if (fd >= 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+FdSerialBackend::FdSerialBackend(int inFd, int outFd) : inFd(inFd), outFd(-1) {
+	setNonBlocking(inFd);
+	setOutFd(outFd);
+}
+
+void FdSerialBackend::setOutFd(int fd) {
+	outFd = fd;
+	setNonBlocking(fd);
+
+	// a peer going away should not take the emulator down with it, so
+	// sockets are written without SIGPIPE (what pipes do is up to the
+	// front-end; ours are opened for reading too, so never see it)
+	struct stat st;
+	outIsSocket = fd >= 0 && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	if (outIsSocket) {
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+	}
+#endif
+}
+
+FdSerialBackend::~FdSerialBackend() {
+	closeFds();
+}
+
+void FdSerialBackend::closeFds() {
+	if (inFd >= 0)
+		close(inFd);
+	if (outFd >= 0 && outFd != inFd)
+		close(outFd);
+	inFd = outFd = -1;
+	outIsSocket = false;
+}
+
+size_t FdSerialBackend::read(uint8_t *buffer, size_t size) {
+	if (inFd < 0)
+		return 0;
+
+	ssize_t done = ::read(inFd, buffer, size);
+	return (done > 0) ? done : 0;
+}
+
+size_t FdSerialBackend::write(const uint8_t *buffer, size_t size) {
+	if (outFd < 0)
+		return size;
+
+	ssize_t done;
+#ifdef MSG_NOSIGNAL
+	if (outIsSocket)
+		done = send(outFd, buffer, size, MSG_NOSIGNAL);
+	else
+#endif
+		done = ::write(outFd, buffer, size);
+	// the rest waits in the UART until there's room
+	return (done > 0) ? done : 0;
+}
+
+
+UnixSocketSerialBackend::~UnixSocketSerialBackend() {
+	close(listenFd);
+}
+
+bool UnixSocketSerialBackend::acceptPeer() {
+	if (inFd >= 0)
+		return true;
+
+	int fd = accept(listenFd, nullptr, nullptr);
+	if (fd < 0)
+		return false;
+	setNonBlocking(fd);
+	inFd = fd;
+	setOutFd(fd);
+	return true;
+}
+
+size_t UnixSocketSerialBackend::read(uint8_t *buffer, size_t size) {
+	if (!acceptPeer())
+		return 0;
+
+	ssize_t done = ::read(inFd, buffer, size);
+	if (done > 0)
+		return done;
+	if (done == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		closeFds(); // hung up, wait for the next one
+	return 0;
+}
+
+size_t UnixSocketSerialBackend::write(const uint8_t *buffer, size_t size) {
+	// with nobody there, it's all dropped rather than held up
+	if (!acceptPeer())
+		return size;
+	return FdSerialBackend::write(buffer, size);
+}
+
+
+static int openUnixSocket(const std::string &path, bool listening) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	bool ok;
+	if (listening) {
+		unlink(path.c_str());
+		ok = bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0 && listen(fd, 1) == 0;
+		setNonBlocking(fd);
+	} else {
+		ok = connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+	}
+
+	if (!ok) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int openFifo(const std::string &path) {
+	if (path.empty())
+		return -1;
+	if (mkfifo(path.c_str(), 0600) != 0 && errno != EEXIST)
+		return -1;
+	// O_RDWR means we neither block waiting for the other end to
+	// open it, nor see EOF whenever the other end closes it
+	return open(path.c_str(), O_RDWR | O_NONBLOCK);
+}
+
+SerialBackend *createSerialBackend(const char *spec) {
+	std::string s = spec;
+	size_t colon = s.find(':');
+	if (colon == std::string::npos)
+		return nullptr;
+
+	std::string kind = s.substr(0, colon), arg = s.substr(colon + 1);
+	std::string in = arg, out;
+	size_t comma = arg.find(',');
+	if (comma != std::string::npos) {
+		in = arg.substr(0, comma);
+		out = arg.substr(comma + 1);
+	}
+
+	if (kind == "pipe") {
+		int inFd = openFifo(in), outFd = openFifo(out);
+		if ((!in.empty() && inFd < 0) || (!out.empty() && outFd < 0)) {
+			if (inFd >= 0) close(inFd);
+			if (outFd >= 0) close(outFd);
+			return nullptr;
+		}
+		return new FdSerialBackend(inFd, outFd);
+	} else if (kind == "file") {
+		int inFd = in.empty() ? -1 : open(in.c_str(), O_RDONLY);
+		int outFd = out.empty() ? -1 : open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if ((!in.empty() && inFd < 0) || (!out.empty() && outFd < 0)) {
+			if (inFd >= 0) close(inFd);
+			if (outFd >= 0) close(outFd);
+			return nullptr;
+		}
+		return new FdSerialBackend(inFd, outFd);
+	} else if (kind == "unix") {
+		int fd = openUnixSocket(arg, false);
+		return (fd < 0) ? nullptr : new FdSerialBackend(fd, fd);
+	} else if (kind == "unix-listen") {
+		int fd = openUnixSocket(arg, true);
+		return (fd < 0) ? nullptr : new UnixSocketSerialBackend(fd);
+	}
+
+	return nullptr;
+}
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// The host end of an emulated serial port.
+// Neither call may block: read returns whatever is available right now
+// (possibly nothing), and write returns how much it took. Whatever it
+// didn't take stays in the UART's TX FIFO until the next try, as if
+// the other end had dropped CTS.
+class SerialBackend {
+public:
+	virtual ~SerialBackend() { }
+	virtual size_t read(uint8_t *buffer, size_t size) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+};
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define WINDCORE_SERIAL_POSIX
+
+// Plain file descriptors: pipes, FIFOs, sockets or regular files.
+// Takes ownership of both fds (which may be the same one, or -1).
+// With no output fd, everything written is thrown away.
+class FdSerialBackend : public SerialBackend {
+protected:
+	int inFd, outFd;
+	bool outIsSocket = false;
+	void setOutFd(int fd);
+	void closeFds();
+
+public:
+	FdSerialBackend(int inFd, int outFd);
+	~FdSerialBackend() override;
+	size_t read(uint8_t *buffer, size_t size) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+};
+
+// Listens on a Unix socket and talks to whoever is connected to it.
+// Nothing is received (and everything sent is dropped) until a peer
+// turns up, and the next one is accepted once it goes away.
+class UnixSocketSerialBackend : public FdSerialBackend {
+	int listenFd;
+	bool acceptPeer();
+
+public:
+	UnixSocketSerialBackend(int listenFd) : FdSerialBackend(-1, -1), listenFd(listenFd) { }
+	~UnixSocketSerialBackend() override;
+	size_t read(uint8_t *buffer, size_t size) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+};
+
+// Creates a backend from a spec string:
+//   pipe:IN,OUT       - named pipes (created if they don't exist)
+//   file:IN,OUT       - feed IN to the guest, write everything to OUT
+//   unix:PATH         - connect to an existing Unix socket
+//   unix-listen:PATH  - create a Unix socket and wait for a peer
+// Either of IN and OUT may be left empty. Returns nullptr on failure.
+SerialBackend *createSerialBackend(const char *spec);
+#endif
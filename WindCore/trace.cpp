@@ -0,0 +1,270 @@
+#include "trace.h"
+#include <string.h>
+
+
+TraceRecorder::TraceRecorder(const char *path, int options) : traceOptions(options) {
+	file = fopen(path, "wb");
+	if (!file)
+		return;
+
+	uint8_t header[6] = {'W', 'T', 'R', 'C', Version, (uint8_t)options};
+	fwrite(header, 1, sizeof(header), file);
+
+	for (int i = 0; i < BlockCount; i++) {
+		blocks.emplace_back(new Block);
+		blocks.back()->events.resize(BlockEvents);
+		freeBlocks.push_back(blocks.back().get());
+	}
+	opcodeCache.assign(OpcodeCacheSize, 0);
+	thread = std::thread(&TraceRecorder::run, this);
+}
+
+TraceRecorder::~TraceRecorder() {
+	if (!file)
+		return;
+
+	{
+		// whatever's in the current block still counts
+		std::lock_guard<std::mutex> guard(lock);
+		if (current)
+			submit();
+		stopping = true;
+	}
+	wake.notify_all();
+	thread.join();
+	fclose(file);
+}
+
+void TraceRecorder::submit() {
+	// lock must be held
+	current->count = cursor - current->events.data();
+	fullBlocks.push_back(current);
+	gapEvents = 0; // the block's gap record has the count
+	current = nullptr;
+	cursor = end = nullptr;
+	wake.notify_all();
+}
+
+void TraceRecorder::nextBlock() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	// never wait for the writer, as the emulation can't be held up by
+	// I/O; if there's nowhere to put this block, start it over
+	if (current && freeBlocks.empty()) {
+		Event *first = current->events.data();
+		size_t lost = cursor - first;
+		if (first->tag == TagGap)
+			lost--; // that's only the last gap record
+		gapEvents += lost;
+		dropped += lost;
+		cursor = first;
+		registerResync = true;
+	} else {
+		if (current)
+			submit();
+		current = freeBlocks.front();
+		freeBlocks.pop_front();
+		cursor = current->events.data();
+		end = cursor + BlockEvents;
+	}
+
+	if (gapEvents)
+		*cursor++ = {TagGap, (uint32_t)gapEvents, (uint32_t)(gapEvents >> 32)};
+}
+
+void TraceRecorder::run() {
+	for (;;) {
+		Block *block;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !fullBlocks.empty(); });
+			if (fullBlocks.empty())
+				break; // only once everything's been written
+			block = fullBlocks.front();
+			fullBlocks.pop_front();
+		}
+
+		output.clear();
+		for (size_t i = 0; i < block->count; i++)
+			encode(block->events[i]);
+		fwrite(output.data(), 1, output.size(), file);
+
+		std::lock_guard<std::mutex> guard(lock);
+		freeBlocks.push_back(block);
+	}
+}
+
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+	while (value >= 0x80) {
+		out.push_back((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(value);
+}
+
+static uint32_t zigzag(uint32_t delta) {
+	return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+void TraceRecorder::encode(const Event &event) {
+	uint32_t tag = event.tag;
+	switch (tag & TagKindMask) {
+	case TagInstruction: {
+		uint32_t pc = event.a, insn = event.b;
+		uint32_t &cached = opcodeCache[(pc >> 2) & (OpcodeCacheSize - 1)];
+		if (pc == lastPC + 4) tag |= TagSequential;
+		if (insn == cached) tag |= TagSameOpcode;
+		output.push_back(tag);
+		if (!(tag & TagSequential))
+			putVarint(output, zigzag(pc - (lastPC + 4)));
+		if (!(tag & TagSameOpcode)) {
+			for (int i = 0; i < 4; i++)
+				output.push_back(insn >> (i * 8));
+		}
+		lastPC = pc;
+		cached = insn;
+		break;
+	}
+	case TagMemory:
+		output.push_back(tag);
+		putVarint(output, zigzag(event.a - lastAddr));
+		putVarint(output, event.b);
+		lastAddr = event.a;
+		break;
+	case TagRegister: {
+		uint32_t &reg = registers[(tag >> 2) & 0x1F];
+		output.push_back(tag);
+		putVarint(output, event.b ^ reg);
+		reg = event.b;
+		break;
+	}
+	case TagGap:
+		output.push_back(tag);
+		putVarint(output, event.a | ((uint64_t)event.b << 32));
+		break;
+	}
+}
+
+
+TraceReader::TraceReader(const char *path) {
+	file = fopen(path, "rb");
+	if (!file)
+		return;
+
+	uint8_t header[6];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+		memcmp(header, "WTRC", 4) != 0 || header[4] != TraceRecorder::Version) {
+		fclose(file);
+		file = nullptr;
+		return;
+	}
+	traceOptions = header[5];
+	opcodeCache.assign(TraceRecorder::OpcodeCacheSize, 0);
+}
+
+TraceReader::~TraceReader() {
+	if (file)
+		fclose(file);
+}
+
+bool TraceReader::getByte(uint8_t &value) {
+	if (pos == size) {
+		size = fread(buffer, 1, sizeof(buffer), file);
+		pos = 0;
+		if (size == 0)
+			return false;
+	}
+	value = buffer[pos++];
+	return true;
+}
+
+bool TraceReader::getVarint64(uint64_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 70; shift += 7) {
+		uint8_t byte;
+		if (!getByte(byte))
+			return false;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool TraceReader::getVarint(uint32_t &value) {
+	uint64_t wide;
+	if (!getVarint64(wide) || wide > UINT32_MAX)
+		return false;
+	value = wide;
+	return true;
+}
+
+static uint32_t unzigzag(uint32_t value) {
+	return (value >> 1) ^ (0 - (value & 1));
+}
+
+bool TraceReader::next(Entry &entry) {
+	uint8_t tag;
+	if (!file || !getByte(tag))
+		return false; // a clean end
+
+	// running out from here on means the file was cut short
+	damaged = true;
+	entry.kind = tag & TraceRecorder::TagKindMask;
+	entry.isWrite = false;
+	entry.isByte = false;
+	switch (entry.kind) {
+	case TraceRecorder::TagInstruction: {
+		uint32_t pc = lastPC + 4;
+		if (!(tag & TraceRecorder::TagSequential)) {
+			uint32_t delta;
+			if (!getVarint(delta))
+				return false;
+			pc += unzigzag(delta);
+		}
+		uint32_t &cached = opcodeCache[(pc >> 2) & (TraceRecorder::OpcodeCacheSize - 1)];
+		if (!(tag & TraceRecorder::TagSameOpcode)) {
+			uint32_t insn = 0;
+			for (int i = 0; i < 4; i++) {
+				uint8_t byte;
+				if (!getByte(byte))
+					return false;
+				insn |= (uint32_t)byte << (i * 8);
+			}
+			cached = insn;
+		}
+		entry.a = lastPC = pc;
+		entry.b = cached;
+		break;
+	}
+	case TraceRecorder::TagMemory: {
+		uint32_t delta;
+		if (!getVarint(delta) || !getVarint(entry.b))
+			return false;
+		entry.a = lastAddr = lastAddr + unzigzag(delta);
+		entry.isWrite = tag & TraceRecorder::TagWrite;
+		entry.isByte = tag & TraceRecorder::TagByte;
+		break;
+	}
+	case TraceRecorder::TagRegister: {
+		uint32_t reg = (tag >> 2) & 0x1F, change;
+		if (reg > TraceRecorder::RegisterCPSR || !getVarint(change))
+			return false;
+		registers[reg] ^= change;
+		entry.a = reg;
+		entry.b = registers[reg];
+		break;
+	}
+	case TraceRecorder::TagGap: {
+		uint64_t count;
+		if (!getVarint64(count))
+			return false;
+		entry.a = (count > UINT32_MAX) ? UINT32_MAX : count;
+		entry.b = 0;
+		break;
+	}
+	}
+	damaged = false;
+	return true;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Records every instruction the CPU executes (and optionally every data
+// access and register change) to a file, so two runs can be compared.
+//
+// The emulation thread only appends fixed-size events to an in-memory
+// block. Full blocks go to a writer thread, which packs them down and
+// writes them out. There's a fixed number of blocks; if the writer falls
+// behind and they're all full, the emulation neither waits nor takes
+// more memory, but throws away what's in the block it's filling and
+// starts it again with a gap record saying how much went. Readers
+// report the gap, since nothing past it can be lined up with another
+// run. A faster disk (or fewer options) avoids them.
+//
+// The packing is just deltas and varints, not general-purpose
+// compression; traces still shrink a good deal more through gzip or
+// zstd afterwards, if space matters.
+//
+// File format: "WTRC", a version byte and the options byte, then one
+// record per event. Each record starts with a tag byte, whose low two
+// bits say what it is:
+//   0: instruction, recorded just before it executes
+//      bit 2 set: PC is 4 past the last one, else a zigzag varint
+//                 of the difference from that follows
+//      bit 3 set: opcode is the last one seen at this PC (mod 16KB),
+//                 else it follows as 4 little-endian bytes
+//   1: data access at a virtual address, once it's succeeded
+//      bit 2 set: write; bit 3 set: byte
+//      then a zigzag varint of the difference from the last access's
+//      address, and the value as a varint
+//   2: register change, recorded after an instruction
+//      bits 2-6: register, 0-14 or 16 for CPSR
+//      then a varint of the new value XORed with the old one
+//   3: gap; a varint of how many events were dropped here
+// The last PC, the last address and the registers all start at 0, and
+// the registers are recorded in full when tracing starts and again
+// after a gap. Varints are LEB128.
+class TraceRecorder {
+public:
+	enum {
+		TraceMemory = 1,   // data accesses, with their values
+		TraceRegisters = 2 // registers changed by each instruction
+	};
+	enum {
+		Version = 1,
+		TagInstruction = 0,
+		TagMemory = 1,
+		TagRegister = 2,
+		TagGap = 3,
+		TagKindMask = 3,
+		TagSequential = 4,
+		TagSameOpcode = 8,
+		TagWrite = 4,
+		TagByte = 8,
+		RegisterCPSR = 16,
+		OpcodeCacheSize = 0x1000
+	};
+
+	TraceRecorder(const char *path, int options);
+	~TraceRecorder();
+	bool isOpen() const { return file != nullptr; }
+	int options() const { return traceOptions; }
+
+	// only ever called from the emulation thread
+	void instruction(uint32_t pc, uint32_t insn) { add(TagInstruction, pc, insn); }
+	void memoryAccess(uint32_t addr, uint32_t value, bool isWrite, bool isByte) {
+		add(TagMemory | (isWrite ? TagWrite : 0) | (isByte ? TagByte : 0), addr, value);
+	}
+	void registerChanged(int index, uint32_t value) { add(TagRegister | (index << 2), 0, value); }
+	// true once after each gap, when all the registers should be
+	// recorded again
+	bool takeRegisterResync() {
+		bool was = registerResync;
+		registerResync = false;
+		return was;
+	}
+	// how many events have been thrown away, from times the writer
+	// couldn't keep up
+	uint64_t droppedEvents() const { return dropped; }
+
+private:
+	enum {
+		BlockEvents = 0x10000,
+		BlockCount = 16 // 12MB of events
+	};
+	struct Event { uint32_t tag, a, b; };
+	struct Block { std::vector<Event> events; size_t count; };
+
+	FILE *file;
+	int traceOptions;
+	std::vector<std::unique_ptr<Block>> blocks;
+	Event *cursor = nullptr, *end = nullptr;
+	Block *current = nullptr;
+	uint64_t gapEvents = 0; // dropped since the last block went out
+	std::atomic<uint64_t> dropped{0};
+	bool registerResync = false;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<Block *> freeBlocks, fullBlocks;
+	bool stopping = false;
+	std::thread thread;
+
+	void add(uint32_t tag, uint32_t a, uint32_t b) {
+		if (cursor == end)
+			nextBlock();
+		*cursor++ = {tag, a, b};
+	}
+	void nextBlock();
+	void submit();
+	void run();
+
+	// the writer's side of the encoding
+	uint32_t lastPC = 0, lastAddr = 0;
+	uint32_t registers[17] = {};
+	std::vector<uint32_t> opcodeCache;
+	std::vector<uint8_t> output;
+	void encode(const Event &event);
+};
+
+// Reads a trace back one record at a time, holding nothing more than
+// the decoder's state and a buffer's worth of the file.
+class TraceReader {
+public:
+	struct Entry {
+		int kind;    // TraceRecorder::TagInstruction, TagMemory, TagRegister or TagGap
+		uint32_t a;  // PC, address or register; for gaps, how many events went
+		uint32_t b;  // opcode or value
+		bool isWrite, isByte;
+	};
+
+	TraceReader(const char *path);
+	~TraceReader();
+	bool isOpen() const { return file != nullptr; }
+	int options() const { return traceOptions; }
+	// false at the end, or if the rest of the file doesn't make sense
+	bool next(Entry &entry);
+	bool isDamaged() const { return damaged; }
+
+private:
+	FILE *file;
+	int traceOptions = 0;
+	bool damaged = false;
+	uint8_t buffer[0x10000];
+	size_t pos = 0, size = 0;
+	bool getByte(uint8_t &value);
+	bool getVarint(uint32_t &value);
+	bool getVarint64(uint64_t &value);
+
+	uint32_t lastPC = 0, lastAddr = 0;
+	uint32_t registers[17] = {};
+	std::vector<uint32_t> opcodeCache;
+};
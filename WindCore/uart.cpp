@@ -0,0 +1,177 @@
+#include "hardware.h"
+
+
+void UART::setEnabled(bool on, int64_t cycles) {
+	if (on && !enabled)
+		lastEventAt = cycles; // the line only starts moving now
+	enabled = on;
+	schedule();
+}
+
+void UART::setLineControl(uint8_t frame, uint16_t divisor) {
+	frameControl = frame;
+	baudDivisor = divisor;
+
+	// start bit + data bits + parity + stop bit(s)
+	int bits = 1 + (((frame & FrameCtrlWrdLenMask) >> 5) + 5) + 1;
+	if (frame & FrameCtrlParityEnable) bits++;
+	if (frame & FrameCtrlExtraStopBit) bits++;
+	int baud = BaudBase / (divisor + 1);
+	cyclesPerChar = ((int64_t)clockSpeed * bits) / baud;
+	if (cyclesPerChar < 1)
+		cyclesPerChar = 1;
+
+	// a smaller FIFO may have to lose some of its contents
+	if (rxCount > fifoDepth())
+		rxCount = fifoDepth();
+	if (txCount > fifoDepth())
+		txCount = fifoDepth();
+	schedule();
+}
+
+uint8_t UART::readData() {
+	if (rxCount == 0)
+		return 0;
+	uint8_t value = rxFifo[rxHead];
+	rxHead = (rxHead + 1) % FifoSize;
+	rxCount--;
+	if (rxCount == 0)
+		rxTimeout = false;
+	return value;
+}
+
+void UART::writeData(uint8_t value) {
+	// overflowing the TX FIFO just loses the byte, as on hardware
+	if (txCount < fifoDepth()) {
+		txFifo[(txHead + txCount) % FifoSize] = value;
+		txCount++;
+	}
+}
+
+void UART::schedule() {
+	if (enabled)
+		nextEventAt = lastEventAt + cyclesPerChar * (fifoEnabled() ? FifoTrigger : 1);
+	else
+		nextEventAt = INT64_MAX;
+}
+
+void UART::runEvent(int64_t cycles) {
+	int64_t chars = (cycles - lastEventAt) / cyclesPerChar;
+	if (chars < 1)
+		chars = 1;
+	lastEventAt = cycles;
+
+	// transmit everything that would have gone out by now, in one go;
+	// anything the backend can't take yet stays put
+	int txChars = (chars < txCount) ? (int)chars : txCount;
+	if (txChars > 0) {
+		uint8_t buffer[FifoSize];
+		for (int i = 0; i < txChars; i++)
+			buffer[i] = txFifo[(txHead + i) % FifoSize];
+		if (backend)
+			txChars = backend->write(buffer, txChars);
+		txHead = (txHead + txChars) % FifoSize;
+		txCount -= txChars;
+	}
+
+	// and take in as much as could have arrived and will fit
+	int room = fifoDepth() - rxCount;
+	int rxChars = (chars < room) ? (int)chars : room;
+	size_t received = 0;
+	if (rxChars > 0 && backend) {
+		uint8_t buffer[FifoSize];
+		received = backend->read(buffer, rxChars);
+		for (size_t i = 0; i < received; i++)
+			rxFifo[(rxHead + rxCount + i) % FifoSize] = buffer[i];
+		rxCount += received;
+	}
+
+	// characters stuck below the trigger level with nothing more
+	// arriving raise a receive timeout instead
+	rxTimeout = (received == 0 && rxCount > 0);
+
+	schedule();
+}
+
+
+uint32_t UART::readReg(uint32_t reg) {
+	if (reg == (UART0DATA & 0xFF)) {
+		return readData();
+	} else if (reg == (UART0FCR & 0xFF)) {
+		return frameControl;
+	} else if (reg == (UART0LCR & 0xFF)) {
+		return baudDivisor;
+	} else if (reg == (UART0CON & 0xFF)) {
+		return portControl;
+	} else if (reg == (UART0FLG & 0xFF)) {
+		return flags();
+	} else if (reg == (UART0INT & 0xFF)) {
+		return rawInterrupts() & interruptMask;
+	} else if (reg == (UART0INTM & 0xFF)) {
+		return interruptMask;
+	} else if (reg == (UART0INTR & 0xFF)) {
+		return rawInterrupts();
+	} else {
+		cpu->log<LogSerial, LogWarning>("unhandled uart read %x at pc=%08x lr=%08x", reg, cpu->getGPR(15), cpu->getGPR(14));
+		return 0xFFFFFFFF;
+	}
+}
+
+void UART::writeReg(uint32_t reg, uint32_t value, int64_t cycles) {
+	if (reg == (UART0DATA & 0xFF)) {
+		writeData(value & 0xFF);
+	} else if (reg == (UART0FCR & 0xFF)) {
+		setLineControl(value & 0x7F, baudDivisor);
+	} else if (reg == (UART0LCR & 0xFF)) {
+		setLineControl(frameControl, value & 0xFFF);
+	} else if (reg == (UART0CON & 0xFF)) {
+		portControl = value;
+		setEnabled(value & PortCtrlEnable, cycles);
+	} else if (reg == (UART0INT & 0xFF)) {
+		// clears the modem status interrupt, which we never raise
+	} else if (reg == (UART0INTM & 0xFF)) {
+		interruptMask = value;
+	} else {
+		cpu->log<LogSerial, LogWarning>("unhandled uart write %x value %08x at pc=%08x lr=%08x", reg, value, cpu->getGPR(15), cpu->getGPR(14));
+	}
+}
+
+
+void UART::saveState(StateWriter &out) const {
+	out.put(portControl);
+	out.put(frameControl);
+	out.put(baudDivisor);
+	out.put(interruptMask);
+	out.put(enabled);
+	out.put(rxFifo);
+	out.put(txFifo);
+	out.put(rxHead);
+	out.put(rxCount);
+	out.put(txHead);
+	out.put(txCount);
+	out.put(rxTimeout);
+	out.put(cyclesPerChar);
+	out.put(lastEventAt);
+	out.put(nextEventAt);
+}
+
+void UART::loadState(StateReader &in) {
+	in.get(portControl);
+	in.get(frameControl);
+	in.get(baudDivisor);
+	in.get(interruptMask);
+	in.get(enabled);
+	in.get(rxFifo);
+	in.get(txFifo);
+	in.get(rxHead);
+	in.get(rxCount);
+	in.get(txHead);
+	in.get(txCount);
+	in.get(rxTimeout);
+	in.get(cyclesPerChar);
+	in.get(lastEventAt);
+	in.get(nextEventAt);
+	if (rxHead < 0 || rxHead >= FifoSize || rxCount < 0 || rxCount > FifoSize ||
+		txHead < 0 || txHead >= FifoSize || txCount < 0 || txCount > FifoSize)
+		in.fail();
+}
@@ -25,7 +25,9 @@ enum Interrupt {
 	LCDINT = 14, // IrqLcd
 	SSEOTI = 15,  // IrqSpi
 	FIQ_INTERRUPTS = 0x000F,
-	IRQ_INTERRUPTS = 0xFFF0
+	IRQ_INTERRUPTS = 0xFFF0,
+	// enabled interrupts that can bring us out of standby
+	WAKE_INTERRUPTS = (1<<EXTFIQ) | (1<<MCINT) | (1<<EINT1) | (1<<EINT2) | (1<<EINT3) | (1<<RTCMI)
 };
 
 enum Register {
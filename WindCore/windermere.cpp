@@ -3,6 +3,9 @@
 #include "hardware.h"
 #include <time.h>
 #include "common.h"
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
 
 
 //#define INCLUDE_D
@@ -18,11 +21,60 @@ uint32_t Emulator::getRTC() {
 }
 
 
+void Emulator::updateEtnaInterrupt() {
+	pendingInterrupts &= ~(1 << EINT1);
+	if (etna.interruptPending())
+		pendingInterrupts |= (1 << EINT1);
+}
+
+void Emulator::updateCodecInterrupt() {
+	pendingInterrupts &= ~(1 << CSINT);
+	if (codec.interrupt)
+		pendingInterrupts |= (1 << CSINT);
+}
+
+uint32_t Emulator::readCodec(uint32_t reg) {
+	uint32_t v = 0;
+	if (reg == CODR)
+		v = codec.readData();
+	else if (reg == CONFG)
+		v = codec.config;
+	else if (reg == COLFG)
+		v = codec.flags();
+	updateCodecInterrupt();
+	return v;
+}
+
+void Emulator::writeCodec(uint32_t reg, uint32_t value) {
+	if (reg == CODR)
+		codec.writeData(value & 0xFF);
+	else if (reg == CONFG)
+		codec.setConfig(value & 0xFF, passedCycles);
+	else if (reg == COEOI)
+		codec.clearInterrupt();
+	updateCodecInterrupt();
+}
+
+void Emulator::updateUartInterrupts() {
+	pendingInterrupts &= ~((1 << UART1) | (1 << UART2));
+	if (uart1.interruptPending())
+		pendingInterrupts |= (1 << UART1);
+	if (uart2.interruptPending())
+		pendingInterrupts |= (1 << UART2);
+}
+
+
 uint32_t Emulator::readReg8(uint32_t reg) {
-	if ((reg & 0xF00) == 0x600) {
-		return uart1.readReg8(reg & 0xFF);
+	if ((reg & 0xF00) == 0xA00) {
+		return readCodec(reg);
+	} else if ((reg & 0xF00) == 0x600) {
+		uint32_t v = uart1.readReg8(reg & 0xFF);
+		updateUartInterrupts();
+		return v;
 	} else if ((reg & 0xF00) == 0x700) {
-		return uart2.readReg8(reg & 0xFF);
+		uint32_t v = uart2.readReg8(reg & 0xFF);
+		updateUartInterrupts();
+		return v;
 	} else if (reg == TC1CTRL) {
 		return tc1.config;
 	} else if (reg == TC2CTRL) {
@@ -44,19 +96,19 @@ uint32_t Emulator::readReg8(uint32_t reg) {
 	} else if (reg == PDDDR) {
 		return portDirections & 0xFF;
 	} else {
-//		printf("RegRead8 unknown:: pc=%08x lr=%08x reg=%03x\n", getGPR(15)-4, getGPR(14), reg);
+//		log<LogSystem, LogWarning>("RegRead8 unknown:: pc=%08x lr=%08x reg=%03x", getGPR(15)-4, getGPR(14), reg);
 		return 0xFF;
 	}
 }
 uint32_t Emulator::readReg32(uint32_t reg) {
 	if (reg == LCDCTL) {
-		printf("LCD control read pc=%08x lr=%08x !!!\n", getGPR(15), getGPR(14));
+		log<LogSystem, LogWarning>("LCD control read pc=%08x lr=%08x !!!", getGPR(15), getGPR(14));
 		return lcdControl;
 	} else if (reg == LCDST) {
-		printf("LCD state read pc=%08x lr=%08x !!!\n", getGPR(15), getGPR(14));
+		log<LogSystem, LogWarning>("LCD state read pc=%08x lr=%08x !!!", getGPR(15), getGPR(14));
 		return 0xFFFFFFFF;
 	} else if (reg == PWRSR) {
-//		printf("!!! PWRSR read pc=%08x lr=%08x !!!\n", getGPR(15), getGPR(14));
+//		log<LogSystem, LogWarning>("!!! PWRSR read pc=%08x lr=%08x !!!", getGPR(15), getGPR(14));
 		return pwrsr;
 	} else if (reg == INTSR) {
 		return pendingInterrupts & interruptMask;
@@ -64,27 +116,38 @@ uint32_t Emulator::readReg32(uint32_t reg) {
 		return pendingInterrupts;
 	} else if (reg == INTENS) {
 		return interruptMask;
+	} else if ((reg & 0xF00) == 0xA00) {
+		return readCodec(reg);
 	} else if ((reg & 0xF00) == 0x600) {
-		return uart1.readReg32(reg & 0xFF);
+		uint32_t v = uart1.readReg32(reg & 0xFF);
+		updateUartInterrupts();
+		return v;
 	} else if ((reg & 0xF00) == 0x700) {
-		return uart2.readReg32(reg & 0xFF);
+		uint32_t v = uart2.readReg32(reg & 0xFF);
+		updateUartInterrupts();
+		return v;
 	} else if (reg == TC1VAL) {
 		return tc1.value;
 	} else if (reg == TC2VAL) {
 		return tc2.value;
 	} else if (reg == SSDR) {
 		// as per 5000A7B0 in 5mx rom
-		uint16_t ssiValue = 0;
-		switch (lastSSIRequest) {
-		case 0xD0D3: ssiValue = (uint16_t)(50 + (touchX * 5.7)); break;
-		case 0x9093: ssiValue = (uint16_t)(3834 - (touchY * 13.225)); break;
-		case 0xA4A4: ssiValue = 3100; break; // MainBattery
-		case 0xE4E4: ssiValue = 3100; break; // BackupBattery
+		if (ssiReadCounter == 4) {
+			// the conversion happens now, so both halves come from the
+			// same pen position even if a scripted stroke moves it before
+			// the second read
+			switch (lastSSIRequest) {
+			case 0xD0D3: ssiSample = 50 + (touchX * 57) / 10; break;       // x * 5.7
+			case 0x9093: ssiSample = (153360 - touchY * 529) / 40; break;  // 3834 - y * 13.225
+			case 0xA4A4: ssiSample = 3100; break; // MainBattery
+			case 0xE4E4: ssiSample = 3100; break; // BackupBattery
+			default:     ssiSample = 0; break;
+			}
 		}
 
 		uint32_t ret = 0;
-		if (ssiReadCounter == 4) ret = (ssiValue >> 5) & 0x7F;
-		if (ssiReadCounter == 5) ret = (ssiValue << 3) & 0xF8;
+		if (ssiReadCounter == 4) ret = (ssiSample >> 5) & 0x7F;
+		if (ssiReadCounter == 5) ret = (ssiSample << 3) & 0xF8;
 		ssiReadCounter++;
 		if (ssiReadCounter == 6) ssiReadCounter = 0;
 
@@ -95,25 +158,33 @@ uint32_t Emulator::readReg32(uint32_t reg) {
 		return 0;
     } else if (reg == RTCDRL) {
         uint16_t v = rtc & 0xFFFF;
-//		log("RTCDRL: %04x", v);
+//		log<LogSystem, LogVerbose>("RTCDRL: %04x", v);
         return v;
     } else if (reg == RTCDRU) {
         uint16_t v = rtc >> 16;
-//		log("RTCDRU: %04x", v);
+//		log<LogSystem, LogVerbose>("RTCDRU: %04x", v);
         return v;
+	} else if (reg == RTCMRL) {
+		return rtcMatch & 0xFFFF;
+	} else if (reg == RTCMRU) {
+		return rtcMatch >> 16;
     } else if (reg == KSCAN) {
         return kScan;
     } else {
-//		printf("RegRead32 unknown:: pc=%08x lr=%08x reg=%03x\n", getGPR(15)-4, getGPR(14), reg);
+//		log<LogSystem, LogWarning>("RegRead32 unknown:: pc=%08x lr=%08x reg=%03x", getGPR(15)-4, getGPR(14), reg);
 		return 0xFFFFFFFF;
 	}
 }
 
 void Emulator::writeReg8(uint32_t reg, uint8_t value) {
-	if ((reg & 0xF00) == 0x600) {
-		uart1.writeReg8(reg & 0xFF, value);
+	if ((reg & 0xF00) == 0xA00) {
+		writeCodec(reg, value);
+	} else if ((reg & 0xF00) == 0x600) {
+		uart1.writeReg8(reg & 0xFF, value, passedCycles);
+		updateUartInterrupts();
 	} else if ((reg & 0xF00) == 0x700) {
-		uart2.writeReg8(reg & 0xFF, value);
+		uart2.writeReg8(reg & 0xFF, value, passedCycles);
+		updateUartInterrupts();
 	} else if (reg == TC1CTRL) {
 		tc1.setConfig(value);
 	} else if (reg == TC2CTRL) {
@@ -133,6 +204,8 @@ void Emulator::writeReg8(uint32_t reg, uint8_t value) {
 			etna.setPromBit0Low();
 		if ((portValues & 0x20000) && !(oldPorts & 0x20000))
 			etna.setPromBit1High();
+		if ((portValues ^ oldPorts) & 0x800000)
+			etna.cardPowerChanged(portValues & 0x800000);
 		diffPorts(oldPorts, portValues);
 	} else if (reg == PCDR) {
 		uint32_t oldPorts = portValues;
@@ -159,22 +232,24 @@ void Emulator::writeReg8(uint32_t reg, uint8_t value) {
     } else if (reg == KSCAN) {
         kScan = value;
     } else {
-//		printf("RegWrite8 unknown:: pc=%08x reg=%03x value=%02x\n", getGPR(15)-4, reg, value);
+//		log<LogSystem, LogWarning>("RegWrite8 unknown:: pc=%08x reg=%03x value=%02x", getGPR(15)-4, reg, value);
 	}
 }
 void Emulator::writeReg32(uint32_t reg, uint32_t value) {
-	if (reg == LCDCTL) {
-		printf("LCD: ctl write %08x\n", value);
+	if ((reg & 0xF00) == 0xA00) {
+		writeCodec(reg, value);
+	} else if (reg == LCDCTL) {
+		log<LogSystem, LogVerbose>("LCD: ctl write %08x", value);
 		lcdControl = value;
 	} else if (reg == LCD_DBAR1) {
-		printf("LCD: address write %08x\n", value);
+		log<LogSystem, LogVerbose>("LCD: address write %08x", value);
         lcdAddress = value;
 	} else if (reg == LCDT0) {
-		printf("LCD: horz timing write %08x\n", value);
+		log<LogSystem, LogVerbose>("LCD: horz timing write %08x", value);
 	} else if (reg == LCDT1) {
-		printf("LCD: vert timing write %08x\n", value);
+		log<LogSystem, LogVerbose>("LCD: vert timing write %08x", value);
 	} else if (reg == LCDT2) {
-		printf("LCD: clocks write %08x\n", value);
+		log<LogSystem, LogVerbose>("LCD: clocks write %08x", value);
 	} else if (reg == INTENS) {
 //		diffInterrupts(interruptMask, interruptMask | value);
 		interruptMask |= value;
@@ -183,6 +258,9 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 		interruptMask &= ~value;
 	} else if (reg == HALT) {
 		halted = true;
+	} else if (reg == STBY) {
+		log<LogSystem>("Entering standby");
+		asleep = true;
 	// BLEOI = 0x410,
 	// MCEOI = 0x414,
 	} else if (reg == TEOI) {
@@ -191,9 +269,11 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 	// STFCLR = 0x41C,
 	// E2EOI = 0x420,
 	} else if ((reg & 0xF00) == 0x600) {
-		uart1.writeReg32(reg & 0xFF, value);
+		uart1.writeReg32(reg & 0xFF, value, passedCycles);
+		updateUartInterrupts();
 	} else if ((reg & 0xF00) == 0x700) {
-		uart2.writeReg32(reg & 0xFF, value);
+		uart2.writeReg32(reg & 0xFF, value, passedCycles);
+		updateUartInterrupts();
 	} else if (reg == SSDR) {
 		if (value != 0)
 			lastSSIRequest = (lastSSIRequest >> 8) | (value & 0xFF00);
@@ -208,26 +288,40 @@ void Emulator::writeReg32(uint32_t reg, uint32_t value) {
 	} else if (reg == RTCDRL) {
 		rtc &= 0xFFFF0000;
 		rtc |= (value & 0xFFFF);
-		log("RTC write lower: %04x", value);
+		log<LogSystem, LogVerbose>("RTC write lower: %04x", value);
 	} else if (reg == RTCDRU) {
 		rtc &= 0x0000FFFF;
 		rtc |= (value & 0xFFFF) << 16;
-		log("RTC write upper: %04x", value);
+		log<LogSystem, LogVerbose>("RTC write upper: %04x", value);
+	} else if (reg == RTCMRL) {
+		rtcMatch &= 0xFFFF0000;
+		rtcMatch |= (value & 0xFFFF);
+	} else if (reg == RTCMRU) {
+		rtcMatch &= 0x0000FFFF;
+		rtcMatch |= (value & 0xFFFF) << 16;
+	} else if (reg == RTCEOI) {
+		pendingInterrupts &= ~(1 << RTCMI);
 	} else {
-//		printf("RegWrite32 unknown:: pc=%08x reg=%03x value=%08x\n", getGPR(15)-4, reg, value);
+//		log<LogSystem, LogWarning>("RegWrite32 unknown:: pc=%08x reg=%03x value=%08x", getGPR(15)-4, reg, value);
 	}
 }
 
-MaybeU32 Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize) {
+uint32_t Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize, bool &busError) {
 	uint8_t region = (physAddr >> 24) & 0xF1;
 	if (valueSize == V8) {
 		if (region == 0)
 			return ROM[physAddr & 0xFFFFFF];
 		else if (region == 0x10)
 			return ROM2[physAddr & 0x3FFFF];
-		else if (region == 0x20 && physAddr <= 0x20000FFF)
-			return etna.readReg8(physAddr & 0xFFF);
-		else if (region == 0x80 && physAddr <= 0x80000FFF)
+		else if (region == 0x20 && physAddr <= 0x20000FFF) {
+			uint32_t v = etna.readReg8(physAddr & 0xFFF);
+			updateEtnaInterrupt();
+			return v;
+		} else if ((region & 0xF0) == 0x30) {
+			uint32_t v = etna.readCard(physAddr & 0xFFFFFFF, 1);
+			updateEtnaInterrupt();
+			return v;
+		} else if (region == 0x80 && physAddr <= 0x80000FFF)
 			return readReg8(physAddr & 0xFFF);
 #if defined(INCLUDE_BANK1)
 		else if (region == 0xC0)
@@ -257,7 +351,10 @@ MaybeU32 Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize) {
 			LOAD_32LE(result, physAddr & 0x3FFFF, ROM2);
 		else if (region == 0x20 && physAddr <= 0x20000FFF)
 			result = etna.readReg32(physAddr & 0xFFF);
-		else if (region == 0x80 && physAddr <= 0x80000FFF)
+		else if ((region & 0xF0) == 0x30) {
+			result = etna.readCard(physAddr & 0xFFFFFFF, 4);
+			updateEtnaInterrupt();
+		} else if (region == 0x80 && physAddr <= 0x80000FFF)
 			result = readReg32(physAddr & 0xFFF);
 #if defined(INCLUDE_BANK1)
 		else if (region == 0xC0)
@@ -279,16 +376,21 @@ MaybeU32 Emulator::readPhysical(uint32_t physAddr, ValueSize valueSize) {
 #endif
 		else if (region >= 0xC0)
 			return 0xFFFFFFFF; // just throw accesses to unmapped RAM away
-		else
-			return {};
+		else {
+			busError = true;
+			return 0;
+		}
 		return result;
 	}
 
-	return {};
+	busError = true;
+	return 0;
 }
 
 bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueSize) {
 	uint8_t region = (physAddr >> 24) & 0xF1;
+	if (region >= 0xC0 && isTrackingDirty())
+		getPhysicalPointer(physAddr & ~3, 4, true); // which marks it
 	if (valueSize == V8) {
 #if defined(INCLUDE_BANK1)
 		if (region == 0xC0)
@@ -310,9 +412,13 @@ bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueS
 #endif
 		else if (region >= 0xC0)
 			return true; // just throw accesses to unmapped RAM away
-		else if (region == 0x20 && physAddr <= 0x20000FFF)
+		else if (region == 0x20 && physAddr <= 0x20000FFF) {
 			etna.writeReg8(physAddr & 0xFFF, value);
-		else if (region == 0x80 && physAddr <= 0x80000FFF)
+			updateEtnaInterrupt();
+		} else if ((region & 0xF0) == 0x30) {
+			etna.writeCard(physAddr & 0xFFFFFFF, value, 1);
+			updateEtnaInterrupt();
+		} else if (region == 0x80 && physAddr <= 0x80000FFF)
 			writeReg8(physAddr & 0xFFF, value);
 		else
 			return false;
@@ -333,14 +439,17 @@ bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueS
 		else if (region == 0xD0 || region == 0xD1)
 			STORE_32LE(value, physAddr & MemoryBlockMask, MemoryBlockD0);
 #else
-		if (region == 0xC0 || region == 0xC1 || region == 0xD0 || region == 0x01)
+		if (region == 0xC0 || region == 0xC1 || region == 0xD0 || region == 0xD1)
 			STORE_32LE(value, physAddr & MemoryBlockMask, MemoryBlockC0);
 #endif
 		else if (region >= 0xC0)
 			return true; // just throw accesses to unmapped RAM away
 		else if (region == 0x20 && physAddr <= 0x20000FFF)
 			etna.writeReg32(physAddr & 0xFFF, value);
-		else if (region == 0x80 && physAddr <= 0x80000FFF)
+		else if ((region & 0xF0) == 0x30) {
+			etna.writeCard(physAddr & 0xFFFFFFF, value, 4);
+			updateEtnaInterrupt();
+		} else if (region == 0x80 && physAddr <= 0x80000FFF)
 			writeReg32(physAddr & 0xFFF, value);
 		else
 			return false;
@@ -348,6 +457,44 @@ bool Emulator::writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueS
 	return true;
 }
 
+uint8_t *Emulator::getPhysicalPointer(uint32_t physAddr, uint32_t size, bool isWrite) {
+	uint8_t region = (physAddr >> 24) & 0xF1;
+
+	if (!isWrite) {
+		if (region == 0 && (physAddr & 0xFFFFFF) + size <= sizeof(ROM))
+			return &ROM[physAddr & 0xFFFFFF];
+		else if (region == 0x10 && (physAddr & 0x3FFFF) + size <= sizeof(ROM2))
+			return &ROM2[physAddr & 0x3FFFF];
+	}
+
+	// the block must not wrap around its mirror
+	if ((physAddr & MemoryBlockMask) + size > (MemoryBlockMask + 1))
+		return nullptr;
+
+	uint8_t *block = nullptr;
+#if defined(INCLUDE_BANK1)
+	if (region == 0xC0)
+		block = &MemoryBlockC0[physAddr & MemoryBlockMask];
+	else if (region == 0xC1)
+		block = &MemoryBlockC1[physAddr & MemoryBlockMask];
+	else if (region == 0xD0)
+		block = &MemoryBlockD0[physAddr & MemoryBlockMask];
+	else if (region == 0xD1)
+		block = &MemoryBlockD1[physAddr & MemoryBlockMask];
+#elif defined(INCLUDE_D)
+	if (region == 0xC0 || region == 0xC1)
+		block = &MemoryBlockC0[physAddr & MemoryBlockMask];
+	else if (region == 0xD0 || region == 0xD1)
+		block = &MemoryBlockD0[physAddr & MemoryBlockMask];
+#else
+	if (region == 0xC0 || region == 0xC1 || region == 0xD0 || region == 0xD1)
+		block = &MemoryBlockC0[physAddr & MemoryBlockMask];
+#endif
+	if (block && isWrite && isTrackingDirty())
+		markDirty(block, size);
+	return block;
+}
+
 
 
 void Emulator::configure() {
@@ -358,6 +505,12 @@ void Emulator::configure() {
 
 	uart1.cpu = this;
 	uart2.cpu = this;
+	uart1.clockSpeed = CLOCK_SPEED;
+	uart2.clockSpeed = CLOCK_SPEED;
+	uart1.setLineControl(0, 0);
+	uart2.setLineControl(0, 0);
+	codec.cpu = this;
+	codec.clockSpeed = CLOCK_SPEED;
 	memset(&tc1, 0, sizeof(tc1));
 	memset(&tc2, 0, sizeof(tc1));
 	tc1.clockSpeed = CLOCK_SPEED;
@@ -380,28 +533,187 @@ size_t Emulator::getROMSize() {
 void Emulator::loadROM(uint8_t *buffer, size_t size) {
 	memcpy(ROM, buffer, min(size, sizeof(ROM)));
 }
+void Emulator::setAudioOutput(AudioRing *ring) {
+	codec.output = ring;
+}
+bool Emulator::insertCard(CFCard *card) {
+	etna.insertCard(card);
+	updateEtnaInterrupt();
+	return true;
+}
+bool Emulator::setSerialBackend(int port, SerialBackend *backend) {
+	if (port == 0)
+		uart1.backend = backend;
+	else if (port == 1)
+		uart2.backend = backend;
+	else
+		return false;
+	return true;
+}
 
-void Emulator::executeUntil(int64_t cycles) {
+
+std::vector<EmuBase::MemoryRegion> Emulator::memoryRegions() {
+	return {
+		{"C0", MemoryBlockC0, sizeof(MemoryBlockC0)},
+		{"C1", MemoryBlockC1, sizeof(MemoryBlockC1)},
+		{"D0", MemoryBlockD0, sizeof(MemoryBlockD0)},
+		{"D1", MemoryBlockD1, sizeof(MemoryBlockD1)}
+	};
+}
+
+void Emulator::saveState(StateWriter &out) {
 	if (!configured)
 		configure();
+	out.header(getDeviceName());
+	saveBaseState(out);
+	out.put(pendingInterrupts);
+	out.put(interruptMask);
+	out.put(portValues);
+	out.put(portDirections);
+	out.put(pwrsr);
+	out.put(lcdControl);
+	out.put(lcdAddress);
+	out.put(rtc);
+	out.put(rtcMatch);
+	out.put(lastSSIRequest);
+	out.put(ssiReadCounter);
+	out.put(ssiSample);
+	out.put(kScan);
+	out.put(touchX);
+	out.put(touchY);
+	tc1.saveState(out);
+	tc2.saveState(out);
+	uart1.saveState(out);
+	uart2.saveState(out);
+	codec.saveState(out);
+	etna.saveState(out);
+	out.put(halted);
+	out.put(asleep);
+}
 
-	while (!asleep && passedCycles < cycles) {
-		if (passedCycles >= nextTickAt) {
-			// increment RTCDIV
-			if ((pwrsr & 0x3F) == 0x3F) {
-				rtc++;
-				pwrsr &= ~0x3F;
-			} else {
-				pwrsr++;
-			}
+bool Emulator::loadState(StateReader &in) {
+	// this sets up everything that isn't saved
+	if (!configured)
+		configure();
+	if (!in.header(getDeviceName()))
+		return false;
+	loadBaseState(in);
+	in.get(pendingInterrupts);
+	in.get(interruptMask);
+	in.get(portValues);
+	in.get(portDirections);
+	in.get(pwrsr);
+	in.get(lcdControl);
+	in.get(lcdAddress);
+	in.get(rtc);
+	in.get(rtcMatch);
+	in.get(lastSSIRequest);
+	in.get(ssiReadCounter);
+	in.get(ssiSample);
+	in.get(kScan);
+	in.get(touchX);
+	in.get(touchY);
+	tc1.loadState(in);
+	tc2.loadState(in);
+	uart1.loadState(in);
+	uart2.loadState(in);
+	codec.loadState(in);
+	etna.loadState(in);
+	in.get(halted);
+	in.get(asleep);
 
-			nextTickAt += TICK_INTERVAL;
-			pendingInterrupts |= (1<<TINT);
+	// whatever was held down then isn't now
+	memset(keyboardColumns, 0, sizeof(keyboardColumns));
+	keyboardAnyColumn = 0;
+	pendingInterrupts &= ~(1 << EINT3);
+	return in.ok() && in.atEnd();
+}
+
+
+void Emulator::advanceTicks(int64_t count) {
+	// RTCDIV lives in the bottom of PWRSR and carries into the RTC
+	uint32_t oldRtc = rtc;
+	int64_t div = (pwrsr & 0x3F) + count;
+	rtc += (uint32_t)(div / 64);
+	pwrsr = (pwrsr & ~0x3F) | (div % 64);
+
+	nextTickAt += count * TICK_INTERVAL;
+	pendingInterrupts |= (1<<TINT);
+	// did we go past the alarm?
+	if ((uint32_t)(rtcMatch - oldRtc - 1) < (uint32_t)(rtc - oldRtc))
+		pendingInterrupts |= (1<<RTCMI);
+}
+
+void Emulator::sleepUntil(int64_t cycles) {
+	// In standby only the 32kHz side keeps going (the tick and RTC);
+	// the CPU, timers, UARTs and codec are all frozen. Nothing can wake
+	// us before the alarm except input, so we jump straight to whichever
+	// comes first of that and `cycles`. An alarm that's already gone by
+	// won't go off, so it doesn't count.
+	if (pendingInterrupts & interruptMask & WAKE_INTERRUPTS) {
+		wakeUp();
+		return;
+	}
+
+	int64_t until = cycles;
+	if ((interruptMask & (1<<RTCMI)) && rtcMatch > rtc) {
+		int64_t ticksLeft = (int64_t)(rtcMatch - rtc - 1) * 64 + (64 - (pwrsr & 0x3F));
+		int64_t alarmAt = nextTickAt + (ticksLeft - 1) * TICK_INTERVAL;
+		if (alarmAt < until)
+			until = (alarmAt > passedCycles) ? alarmAt : passedCycles;
+	}
+	// scripted input counts too
+	if (nextInputEventAt < until)
+		until = (nextInputEventAt > passedCycles) ? nextInputEventAt : passedCycles;
+
+	if (until >= nextTickAt)
+		advanceTicks((until - nextTickAt) / TICK_INTERVAL + 1);
+
+	int64_t duration = until - passedCycles;
+	tc1.clockStopped(duration);
+	tc2.clockStopped(duration);
+	uart1.clockStopped(duration);
+	uart2.clockStopped(duration);
+	codec.clockStopped(duration);
+	idleCycles += duration;
+	passedCycles = until;
+
+	if (passedCycles >= nextInputEventAt)
+		runInputEvents();
+	if (asleep && (pendingInterrupts & interruptMask & WAKE_INTERRUPTS))
+		wakeUp();
+}
+
+void Emulator::wakeUp() {
+	log<LogSystem>("Leaving standby (rtc=%08x)", rtc);
+	asleep = false;
+	halted = false;
+}
+
+void Emulator::executeUntil(int64_t cycles) {
+	if (!configured)
+		configure();
+
+#ifndef __EMSCRIPTEN__
+	bool debugging = beginDebugging();
+#endif
+	while (passedCycles < cycles) {
+		if (asleep) {
+			sleepUntil(cycles);
+			continue;
 		}
+		if (passedCycles >= nextTickAt)
+			advanceTicks(1);
+		if (passedCycles >= nextInputEventAt)
+			runInputEvents();
 		if (tc1.tick(passedCycles))
 			pendingInterrupts |= (1<<TC1OI);
 		if (tc2.tick(passedCycles))
 			pendingInterrupts |= (1<<TC2OI);
+		if (uart1.tick(passedCycles) | uart2.tick(passedCycles))
+			updateUartInterrupts();
+		if (codec.tick(passedCycles))
+			updateCodecInterrupt();
 
 		if ((pendingInterrupts & interruptMask & FIQ_INTERRUPTS) != 0 && canAcceptFIQ()) {
 			requestFIQ();
@@ -420,39 +732,58 @@ void Emulator::executeUntil(int64_t cycles) {
 			int64_t nextEvent = nextTickAt;
 			if (tc1.nextTickAt < nextEvent) nextEvent = tc1.nextTickAt;
 			if (tc2.nextTickAt < nextEvent) nextEvent = tc2.nextTickAt;
+			if (uart1.nextEventAt < nextEvent) nextEvent = uart1.nextEventAt;
+			if (uart2.nextEventAt < nextEvent) nextEvent = uart2.nextEventAt;
+			if (codec.nextEventAt < nextEvent) nextEvent = codec.nextEventAt;
+			if (nextInputEventAt < nextEvent) nextEvent = nextInputEventAt;
 			if (cycles < nextEvent) nextEvent = cycles;
+			idleCycles += nextEvent - passedCycles;
 			passedCycles = nextEvent;
 		} else {
-			if (auto v = virtToPhys(getGPR(15) - 0xC); v.has_value() && instructionReady())
-				debugPC(v.value());
+			bool executing = instructionReady();
+			if (executing) {
+				bool fault = false;
+				uint32_t physPC = virtToPhys(getGPR(15) - 0xC, fault);
+				if (!fault)
+					debugPC(physPC);
+			}
+#ifndef __EMSCRIPTEN__
+			if (debugging && executing && checkBreakpoint())
+				break;
+#endif
+			if (executing && !hleHooks.empty() && runHleHook())
+				continue;
 			passedCycles += tick();
-
 #ifndef __EMSCRIPTEN__
-			uint32_t new_pc = getGPR(15) - 0xC;
-			if (_breakpoints.find(new_pc) != _breakpoints.end()) {
-				log("⚠️ Breakpoint triggered at %08x!", new_pc);
-				return;
+			if (debugging && stopReason == StopWatchpoint)
+				break;
+			if (debugging && executing && singleStep) {
+				stopReason = StopStep;
+				break;
 			}
 #endif
 		}
 	}
+
+	// let the outside world (LCD, debugger) see everything
+	drainWriteBuffer();
 }
 
 
 const char *Emulator::identifyObjectCon(uint32_t ptr) {
-	if (ptr == readVirtualDebug(0x80000980, V32).value()) return "process";
-	if (ptr == readVirtualDebug(0x80000984, V32).value()) return "thread";
-	if (ptr == readVirtualDebug(0x80000988, V32).value()) return "chunk";
-//	if (ptr == readVirtualDebug(0x8000098C, V32).value()) return "semaphore";
-//	if (ptr == readVirtualDebug(0x80000990, V32).value()) return "mutex";
-	if (ptr == readVirtualDebug(0x80000994, V32).value()) return "logicaldevice";
-	if (ptr == readVirtualDebug(0x80000998, V32).value()) return "physicaldevice";
-	if (ptr == readVirtualDebug(0x8000099C, V32).value()) return "channel";
-	if (ptr == readVirtualDebug(0x800009A0, V32).value()) return "server";
-//	if (ptr == readVirtualDebug(0x800009A4, V32).value()) return "unk9A4"; // name always null
-	if (ptr == readVirtualDebug(0x800009AC, V32).value()) return "library";
-//	if (ptr == readVirtualDebug(0x800009B0, V32).value()) return "unk9B0"; // name always null
-//	if (ptr == readVirtualDebug(0x800009B4, V32).value()) return "unk9B4"; // name always null
+	if (ptr == readVirtualDebug(0x80000980, V32)) return "process";
+	if (ptr == readVirtualDebug(0x80000984, V32)) return "thread";
+	if (ptr == readVirtualDebug(0x80000988, V32)) return "chunk";
+//	if (ptr == readVirtualDebug(0x8000098C, V32)) return "semaphore";
+//	if (ptr == readVirtualDebug(0x80000990, V32)) return "mutex";
+	if (ptr == readVirtualDebug(0x80000994, V32)) return "logicaldevice";
+	if (ptr == readVirtualDebug(0x80000998, V32)) return "physicaldevice";
+	if (ptr == readVirtualDebug(0x8000099C, V32)) return "channel";
+	if (ptr == readVirtualDebug(0x800009A0, V32)) return "server";
+//	if (ptr == readVirtualDebug(0x800009A4, V32)) return "unk9A4"; // name always null
+	if (ptr == readVirtualDebug(0x800009AC, V32)) return "library";
+//	if (ptr == readVirtualDebug(0x800009B0, V32)) return "unk9B0"; // name always null
+//	if (ptr == readVirtualDebug(0x800009B4, V32)) return "unk9B4"; // name always null
 	return NULL;
 }
 
@@ -461,19 +792,19 @@ void Emulator::fetchStr(uint32_t str, char *buf) {
 		strcpy(buf, "<NULL>");
 		return;
 	}
-	int size = readVirtualDebug(str, V32).value();
+	int size = readVirtualDebug(str, V32);
 	for (int i = 0; i < size; i++) {
-		buf[i] = readVirtualDebug(str + 4 + i, V8).value();
+		buf[i] = readVirtualDebug(str + 4 + i, V8);
 	}
 	buf[size] = 0;
 }
 
 void Emulator::fetchName(uint32_t obj, char *buf) {
-	fetchStr(readVirtualDebug(obj + 0x10, V32).value(), buf);
+	fetchStr(readVirtualDebug(obj + 0x10, V32), buf);
 }
 
 void Emulator::fetchProcessFilename(uint32_t obj, char *buf) {
-	fetchStr(readVirtualDebug(obj + 0x3C, V32).value(), buf);
+	fetchStr(readVirtualDebug(obj + 0x3C, V32), buf);
 }
 
 void Emulator::debugPC(uint32_t pc) {
@@ -488,9 +819,9 @@ void Emulator::debugPC(uint32_t pc) {
 			if (strcmp(wut, "process") == 0) {
 				char procName[1000];
 				fetchProcessFilename(obj, procName);
-				log("OBJS: added %s at %08x <%s> <%s>", wut, obj, objName, procName);
+				log<LogKernel>("OBJS: added %s at %08x <%s> <%s>", wut, obj, objName, procName);
 			} else {
-				log("OBJS: added %s at %08x <%s>", wut, obj, objName);
+				log<LogKernel>("OBJS: added %s at %08x <%s>", wut, obj, objName);
 			}
 		}
 	}
@@ -500,7 +831,7 @@ void Emulator::debugPC(uint32_t pc) {
 		uint32_t physAddr = getGPR(1);
 		uint32_t btIndex = getGPR(2);
 		uint32_t regionSize = getGPR(3);
-		log("KERNEL MMU SECTION: v:%08x p:%08x size:%08x idx:%02x",
+		log<LogKernel>("KERNEL MMU SECTION: v:%08x p:%08x size:%08x idx:%02x",
 			virtAddr, physAddr, regionSize, btIndex);
 	}
 	if (pc == 0x710) {
@@ -510,16 +841,16 @@ void Emulator::debugPC(uint32_t pc) {
 		uint32_t regionSize = getGPR(3);
 		uint32_t pageTableA = getGPR(4);
 		uint32_t pageTableB = getGPR(5);
-		log("KERNEL MMU PAGES: v:%08x p:%08x size:%08x idx:%02x tableA:%08x tableB:%08x",
+		log<LogKernel>("KERNEL MMU PAGES: v:%08x p:%08x size:%08x idx:%02x tableA:%08x tableB:%08x",
 			virtAddr, physAddr, regionSize, btIndex, pageTableA, pageTableB);
 	}
 
 	if (pc == 0x1576C) {
 		uint32_t rawEvent = getGPR(0);
-		uint32_t evtType = readVirtualDebug(rawEvent, V32).value_or(0);
-		uint32_t evtTick = readVirtualDebug(rawEvent + 4, V32).value_or(0);
-		uint32_t evtParamA = readVirtualDebug(rawEvent + 8, V32).value_or(0);
-		uint32_t evtParamB = readVirtualDebug(rawEvent + 0xC, V32).value_or(0);
+		uint32_t evtType = readVirtualDebug(rawEvent, V32);
+		uint32_t evtTick = readVirtualDebug(rawEvent + 4, V32);
+		uint32_t evtParamA = readVirtualDebug(rawEvent + 8, V32);
+		uint32_t evtParamB = readVirtualDebug(rawEvent + 0xC, V32);
 		const char *n = "???";
 		switch (evtType) {
 		case 0: n = "ENone"; break;
@@ -540,7 +871,7 @@ void Emulator::debugPC(uint32_t pc) {
 		case 15: n = "EButton3Up"; break;
 		case 16: n = "ESwitchOff"; break;
 		}
-		log("EVENT %s: tick=%d params=%d,%d", n, evtTick, evtParamA, evtParamB);
+		log<LogKernel>("EVENT %s: tick=%d params=%d,%d", n, evtTick, evtParamA, evtParamB);
 	}
 }
 
@@ -557,6 +888,48 @@ int Emulator::getLCDHeight()       const { return 240; }
 static bool initRgbValues = false;
 static uint32_t rgbValues[16];
 
+#ifdef __wasm_simd128__
+// At 4bpp (16 greys, which is what EPOC uses), 8 bytes of the LCD buffer
+// make 16 pixels: they're split into nibbles, low one first, and then
+// looked up with swizzle, once for each byte of the output pixel.
+static void convertLCD4bpp(const uint8_t *src, int lineWidth, uint8_t **lines, int width, int height, const uint32_t *colours, bool is32BitOutput) {
+	uint8_t planes[4][16];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			planes[c][i] = colours[i] >> (c * 8);
+	v128_t p0 = wasm_v128_load(planes[0]), p1 = wasm_v128_load(planes[1]);
+	v128_t p2 = wasm_v128_load(planes[2]), p3 = wasm_v128_load(planes[3]);
+	const v128_t nibble = wasm_i8x16_splat(0xF);
+
+	for (int y = 0; y < height; y++) {
+		const uint8_t *in = src + (lineWidth * y);
+		uint8_t *out = lines[y];
+		for (int x = 0; x < width; x += 16, in += 8) {
+			v128_t bytes = wasm_v128_load64_zero(in);
+			v128_t idx = wasm_i8x16_shuffle(wasm_v128_and(bytes, nibble), wasm_u8x16_shr(bytes, 4),
+				0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+			if (!is32BitOutput) {
+				wasm_v128_store(out + x, wasm_i8x16_swizzle(p0, idx));
+				continue;
+			}
+
+			v128_t c0 = wasm_i8x16_swizzle(p0, idx), c1 = wasm_i8x16_swizzle(p1, idx);
+			v128_t c2 = wasm_i8x16_swizzle(p2, idx), c3 = wasm_i8x16_swizzle(p3, idx);
+			// interleave the four planes back into pixels
+			v128_t lo01 = wasm_i8x16_shuffle(c0, c1, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+			v128_t hi01 = wasm_i8x16_shuffle(c0, c1, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+			v128_t lo23 = wasm_i8x16_shuffle(c2, c3, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+			v128_t hi23 = wasm_i8x16_shuffle(c2, c3, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+			uint8_t *px = out + (x * 4);
+			wasm_v128_store(px, wasm_i16x8_shuffle(lo01, lo23, 0, 8, 1, 9, 2, 10, 3, 11));
+			wasm_v128_store(px + 16, wasm_i16x8_shuffle(lo01, lo23, 4, 12, 5, 13, 6, 14, 7, 15));
+			wasm_v128_store(px + 32, wasm_i16x8_shuffle(hi01, hi23, 0, 8, 1, 9, 2, 10, 3, 11));
+			wasm_v128_store(px + 48, wasm_i16x8_shuffle(hi01, hi23, 4, 12, 5, 13, 6, 14, 7, 15));
+		}
+	}
+}
+#endif
+
 void Emulator::readLCDIntoBuffer(uint8_t **lines, bool is32BitOutput) const {
 	if (!initRgbValues) {
 		initRgbValues = true;
@@ -581,6 +954,17 @@ void Emulator::readLCDIntoBuffer(uint8_t **lines, bool is32BitOutput) const {
 
 		// build our image out
 		int lineWidth = (width * bpp) / 8;
+#ifdef __wasm_simd128__
+		if (bpp == 4) {
+			uint32_t colours[16];
+			for (int i = 0; i < 16; i++) {
+				int palValue = palette[i];
+				colours[i] = is32BitOutput ? rgbValues[palValue] : (uint8_t)((palValue | (palValue << 4)) ^ 0xFF);
+			}
+			convertLCD4bpp(lcdBuf + 0x20, lineWidth, lines, width, height, colours, is32BitOutput);
+			return;
+		}
+#endif
 		for (int y = 0; y < height; y++) {
 			int lineOffs = 0x20 + (lineWidth * y);
 			for (int x = 0; x < width; x++) {
@@ -605,50 +989,50 @@ void Emulator::readLCDIntoBuffer(uint8_t **lines, bool is32BitOutput) const {
 
 void Emulator::diffPorts(uint32_t oldval, uint32_t newval) {
 	uint32_t changes = oldval ^ newval;
-	if (changes & 1) log("PRT codec enable: %d", newval&1);
-	if (changes & 2) log("PRT audio amp enable: %d", newval&2);
-	if (changes & 4) log("PRT lcd power: %d", newval&4);
-	if (changes & 8) log("PRT etna door: %d", newval&8);
-	if (changes & 0x10) log("PRT sled: %d", newval&0x10);
-	if (changes & 0x20) log("PRT pump pwr2: %d", newval&0x20);
-	if (changes & 0x40) log("PRT pump pwr1: %d", newval&0x40);
-	if (changes & 0x80) log("PRT etna err: %d", newval&0x80);
-	if (changes & 0x100) log("PRT rs-232 rts: %d", newval&0x100);
-	if (changes & 0x200) log("PRT rs-232 dtr toggle: %d", newval&0x200);
-	if (changes & 0x400) log("PRT disable power led: %d", newval&0x400);
-	if (changes & 0x800) log("PRT enable uart1: %d", newval&0x800);
-	if (changes & 0x1000) log("PRT lcd backlight: %d", newval&0x1000);
-	if (changes & 0x2000) log("PRT enable uart0: %d", newval&0x2000);
-	if (changes & 0x4000) log("PRT dictaphone: %d", newval&0x4000);
+	if (changes & 1) log<LogSystem>("PRT codec enable: %d", newval&1);
+	if (changes & 2) log<LogSystem>("PRT audio amp enable: %d", newval&2);
+	if (changes & 4) log<LogSystem>("PRT lcd power: %d", newval&4);
+	if (changes & 8) log<LogSystem>("PRT etna door: %d", newval&8);
+	if (changes & 0x10) log<LogSystem>("PRT sled: %d", newval&0x10);
+	if (changes & 0x20) log<LogSystem>("PRT pump pwr2: %d", newval&0x20);
+	if (changes & 0x40) log<LogSystem>("PRT pump pwr1: %d", newval&0x40);
+	if (changes & 0x80) log<LogSystem>("PRT etna err: %d", newval&0x80);
+	if (changes & 0x100) log<LogSystem>("PRT rs-232 rts: %d", newval&0x100);
+	if (changes & 0x200) log<LogSystem>("PRT rs-232 dtr toggle: %d", newval&0x200);
+	if (changes & 0x400) log<LogSystem>("PRT disable power led: %d", newval&0x400);
+	if (changes & 0x800) log<LogSystem>("PRT enable uart1: %d", newval&0x800);
+	if (changes & 0x1000) log<LogSystem>("PRT lcd backlight: %d", newval&0x1000);
+	if (changes & 0x2000) log<LogSystem>("PRT enable uart0: %d", newval&0x2000);
+	if (changes & 0x4000) log<LogSystem>("PRT dictaphone: %d", newval&0x4000);
 // PROM read process makes this super spammy in stdout
-//	if (changes & 0x10000) log("PRT EECS: %d", newval&0x10000);
-//	if (changes & 0x20000) log("PRT EECLK: %d", newval&0x20000);
-	if (changes & 0x40000) log("PRT contrast0: %d", newval&0x40000);
-	if (changes & 0x80000) log("PRT contrast1: %d", newval&0x80000);
-	if (changes & 0x100000) log("PRT contrast2: %d", newval&0x100000);
-	if (changes & 0x200000) log("PRT contrast3: %d", newval&0x200000);
-	if (changes & 0x400000) log("PRT case open: %d", newval&0x400000);
-	if (changes & 0x800000) log("PRT etna cf power: %d", newval&0x800000);
+//	if (changes & 0x10000) log<LogSystem>("PRT EECS: %d", newval&0x10000);
+//	if (changes & 0x20000) log<LogSystem>("PRT EECLK: %d", newval&0x20000);
+	if (changes & 0x40000) log<LogSystem>("PRT contrast0: %d", newval&0x40000);
+	if (changes & 0x80000) log<LogSystem>("PRT contrast1: %d", newval&0x80000);
+	if (changes & 0x100000) log<LogSystem>("PRT contrast2: %d", newval&0x100000);
+	if (changes & 0x200000) log<LogSystem>("PRT contrast3: %d", newval&0x200000);
+	if (changes & 0x400000) log<LogSystem>("PRT case open: %d", newval&0x400000);
+	if (changes & 0x800000) log<LogSystem>("PRT etna cf power: %d", newval&0x800000);
 }
 
 void Emulator::diffInterrupts(uint16_t oldval, uint16_t newval) {
 	uint16_t changes = oldval ^ newval;
-	if (changes & 1) log("INTCHG external=%d", newval & 1);
-	if (changes & 2) log("INTCHG lowbat=%d", newval & 2);
-	if (changes & 4) log("INTCHG watchdog=%d", newval & 4);
-	if (changes & 8) log("INTCHG mediachg=%d", newval & 8);
-	if (changes & 0x10) log("INTCHG codec=%d", newval & 0x10);
-	if (changes & 0x20) log("INTCHG ext1=%d", newval & 0x20);
-	if (changes & 0x40) log("INTCHG ext2=%d", newval & 0x40);
-	if (changes & 0x80) log("INTCHG ext3=%d", newval & 0x80);
-	if (changes & 0x100) log("INTCHG timer1=%d", newval & 0x100);
-	if (changes & 0x200) log("INTCHG timer2=%d", newval & 0x200);
-	if (changes & 0x400) log("INTCHG rtcmatch=%d", newval & 0x400);
-	if (changes & 0x800) log("INTCHG tick=%d", newval & 0x800);
-	if (changes & 0x1000) log("INTCHG uart1=%d", newval & 0x1000);
-	if (changes & 0x2000) log("INTCHG uart2=%d", newval & 0x2000);
-	if (changes & 0x4000) log("INTCHG lcd=%d", newval & 0x4000);
-	if (changes & 0x8000) log("INTCHG spi=%d", newval & 0x8000);
+	if (changes & 1) log<LogSystem, LogVerbose>("INTCHG external=%d", newval & 1);
+	if (changes & 2) log<LogSystem, LogVerbose>("INTCHG lowbat=%d", newval & 2);
+	if (changes & 4) log<LogSystem, LogVerbose>("INTCHG watchdog=%d", newval & 4);
+	if (changes & 8) log<LogSystem, LogVerbose>("INTCHG mediachg=%d", newval & 8);
+	if (changes & 0x10) log<LogSystem, LogVerbose>("INTCHG codec=%d", newval & 0x10);
+	if (changes & 0x20) log<LogSystem, LogVerbose>("INTCHG ext1=%d", newval & 0x20);
+	if (changes & 0x40) log<LogSystem, LogVerbose>("INTCHG ext2=%d", newval & 0x40);
+	if (changes & 0x80) log<LogSystem, LogVerbose>("INTCHG ext3=%d", newval & 0x80);
+	if (changes & 0x100) log<LogSystem, LogVerbose>("INTCHG timer1=%d", newval & 0x100);
+	if (changes & 0x200) log<LogSystem, LogVerbose>("INTCHG timer2=%d", newval & 0x200);
+	if (changes & 0x400) log<LogSystem, LogVerbose>("INTCHG rtcmatch=%d", newval & 0x400);
+	if (changes & 0x800) log<LogSystem, LogVerbose>("INTCHG tick=%d", newval & 0x800);
+	if (changes & 0x1000) log<LogSystem, LogVerbose>("INTCHG uart1=%d", newval & 0x1000);
+	if (changes & 0x2000) log<LogSystem, LogVerbose>("INTCHG uart2=%d", newval & 0x2000);
+	if (changes & 0x4000) log<LogSystem, LogVerbose>("INTCHG lcd=%d", newval & 0x4000);
+	if (changes & 0x8000) log<LogSystem, LogVerbose>("INTCHG spi=%d", newval & 0x8000);
 }
 
 
@@ -658,20 +1042,18 @@ uint32_t Emulator::readKeyboard() {
 		return keyboardColumns[kScan & 7];
 	} else if (kScan == 0) {
 		// Report all columns combined
-		uint8_t val = 0;
-		for (int i = 0; i < 8; i++)
-			val |= keyboardColumns[i];
-		return val;
+		return keyboardAnyColumn;
 	} else {
 		return 0;
 	}
 }
 
-void Emulator::setKeyboardKey(EpocKey key, bool value) {
-	int idx = -1;
-#define KEY(column, bit) idx = (column << 8) | (1 << bit); break
-
-	switch ((int)key) {
+// Where each key sits in the matrix, as (column << 8) | row bit.
+// This is all worked out at compile time, so a key event is a table
+// lookup, a bit twiddle and re-ORing the handful of column bytes.
+#define KEY(column, bit) return (column << 8) | (1 << bit)
+static constexpr int keyPosition(int key) {
+	switch (key) {
 	case EStdKeyDictaphoneRecord: KEY(0, 6);
 	case '1':                     KEY(0, 5);
 	case '2':                     KEY(0, 4);
@@ -736,13 +1118,35 @@ void Emulator::setKeyboardKey(EpocKey key, bool value) {
 	case EStdKeyLeftArrow:        KEY(7, 1);
 	case EStdKeyRightArrow:       KEY(7, 0);
 	}
+	return -1;
+}
+#undef KEY
 
-	if (idx >= 0) {
-		if (value)
-			keyboardColumns[idx >> 8] |= (idx & 0xFF);
-		else
-			keyboardColumns[idx >> 8] &= ~(idx & 0xFF);
+static constexpr struct KeyMatrix {
+	int16_t position[EStdKeyDial + 1];
+	constexpr KeyMatrix() : position() {
+		for (int i = 0; i <= EStdKeyDial; i++)
+			position[i] = keyPosition(i);
 	}
+} keyMatrix;
+
+void Emulator::setKeyboardKey(EpocKey key, bool value) {
+	int idx = ((unsigned)key <= EStdKeyDial) ? keyMatrix.position[key] : -1;
+	if (idx < 0)
+		return;
+
+	if (value)
+		keyboardColumns[idx >> 8] |= (idx & 0xFF);
+	else
+		keyboardColumns[idx >> 8] &= ~(idx & 0xFF);
+	// keep the all-columns view current so KSCAN reads don't rebuild it
+	keyboardAnyColumn = 0;
+	for (int i = 0; i < 8; i++)
+		keyboardAnyColumn |= keyboardColumns[i];
+
+	// a keypress pulls WAKEUP, so it'll bring us out of standby
+	if (value && asleep)
+		wakeUp();
 }
 
 void Emulator::updateTouchInput(int32_t x, int32_t y, bool down) {
@@ -24,19 +24,31 @@ private:
     uint32_t lcdControl = 0;
     uint32_t lcdAddress = 0;
     uint32_t rtc = 0;
+	uint32_t rtcMatch = 0;
 	uint16_t lastSSIRequest = 0;
 	int ssiReadCounter = 0;
+	uint16_t ssiSample = 0;
 
 	uint32_t kScan = 0;
-	uint8_t keyboardColumns[8] = {0,0,0,0,0,0,0};
+	uint8_t keyboardColumns[8] = {0,0,0,0,0,0,0,0};
+	uint8_t keyboardAnyColumn = 0;
 	int32_t touchX = 0, touchY = 0;
 
     Timer tc1, tc2;
     UART uart1, uart2;
+	Codec codec;
 	Etna etna;
 	bool halted = false, asleep = false;
 
     uint32_t getRTC();
+	void advanceTicks(int64_t count);
+	void sleepUntil(int64_t cycles);
+	void wakeUp();
+	void updateUartInterrupts();
+	void updateEtnaInterrupt();
+	void updateCodecInterrupt();
+	uint32_t readCodec(uint32_t reg);
+	void writeCodec(uint32_t reg, uint32_t value);
 
     uint32_t readReg8(uint32_t reg);
     uint32_t readReg32(uint32_t reg);
@@ -44,8 +56,9 @@ private:
     void writeReg32(uint32_t reg, uint32_t value);
 
 public:
-	MaybeU32 readPhysical(uint32_t physAddr, ValueSize valueSize) override;
+	uint32_t readPhysical(uint32_t physAddr, ValueSize valueSize, bool &busError) override;
 	bool writePhysical(uint32_t value, uint32_t physAddr, ValueSize valueSize) override;
+	uint8_t *getPhysicalPointer(uint32_t physAddr, uint32_t size, bool isWrite) override;
 
 private:
     bool configured = false;
@@ -65,6 +78,9 @@ public:
 	uint8_t *getROMBuffer() override;
 	size_t getROMSize() override;
 	void loadROM(uint8_t *buffer, size_t size) override;
+	bool setSerialBackend(int port, SerialBackend *backend) override;
+	bool insertCard(CFCard *card) override;
+	void setAudioOutput(AudioRing *ring) override;
 	void executeUntil(int64_t cycles) override;
 	int32_t getClockSpeed() const override { return CLOCK_SPEED; }
 	const char *getDeviceName() const override;
@@ -77,5 +93,8 @@ public:
 	void readLCDIntoBuffer(uint8_t **lines, bool is32BitOutput) const override;
 	void setKeyboardKey(EpocKey key, bool value) override;
 	void updateTouchInput(int32_t x, int32_t y, bool down) override;
+	std::vector<MemoryRegion> memoryRegions() override;
+	void saveState(StateWriter &out) override;
+	bool loadState(StateReader &in) override;
 };
 }
@@ -2,4 +2,6 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     WindQt \
+    WindLink \
+    WindTrace \
     WindCore
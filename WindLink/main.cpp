@@ -0,0 +1,213 @@
+#include "../WindCore/clps7111.h"
+#include "../WindCore/hletable.h"
+#include "../WindCore/inputscript.h"
+#include "../WindCore/windermere.h"
+#include "plp.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+
+// Headless harness for the serial link: boots a ROM and either runs
+// file transfers against it with the built-in PLP peer, or hands the
+// port to an outside program (plptools' ncpd, say) and just watches.
+// Either way it reports how fast bytes moved, in emulated and wall time.
+// The device still needs its Remote Link switched on (at 115200), which
+// --script can do by pressing the keys for it; on a 5mx that boots to
+// the System screen, something like:
+//
+//   20 key LeftCtrl down     # give it time to boot first
+//   +0.1 press L             # Tools > Remote link
+//   +0.1 key LeftCtrl up
+//   +1 key Enter down        # accept the dialog as it stands
+//   +0.1 key Enter up
+
+// Counts what crosses the port on the way to another backend
+class CountingBackend : public SerialBackend {
+	SerialBackend *inner;
+public:
+	uint64_t bytesIn = 0, bytesOut = 0;
+	CountingBackend(SerialBackend *inner) : inner(inner) { }
+	~CountingBackend() override { delete inner; }
+	size_t read(uint8_t *buffer, size_t size) override {
+		size_t count = inner->read(buffer, size);
+		bytesIn += count;
+		return count;
+	}
+	size_t write(const uint8_t *buffer, size_t size) override {
+		size_t count = inner->write(buffer, size);
+		bytesOut += count;
+		return count;
+	}
+};
+
+static EmuBase *loadEmulator(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return nullptr;
+	std::vector<uint8_t> buffer;
+	uint8_t chunk[0x10000];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		buffer.insert(buffer.end(), chunk, chunk + n);
+	fclose(f);
+	if (buffer.size() < 0x400000)
+		return nullptr;
+
+	// same detection as the Qt front-end
+	EmuBase *emu = nullptr;
+	uint8_t *romData = buffer.data();
+	uint32_t variantFile = *((uint32_t *)&romData[0x80 + 0x4C]) & 0xFFFFFFF;
+	if (variantFile < (buffer.size() - 8)) {
+		uint32_t variantImg = *((uint32_t *)&romData[variantFile + 4]) & 0xFFFFFFF;
+		if (variantImg < (buffer.size() - 0x70)) {
+			uint32_t variant = *((uint32_t *)&romData[variantImg + 0x60]);
+			if (variant == 0x7060001)
+				emu = new Windermere::Emulator;
+			else if (variant == 0x5040001)
+				emu = new CLPS7111::Emulator;
+		}
+	}
+
+	if (emu)
+		emu->loadROM(romData, buffer.size());
+	return emu;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"usage: WindLink ROM [options]\n"
+		"  --put LOCAL REMOTE   copy a file onto the device (e.g. C:/Data.txt)\n"
+		"  --get REMOTE LOCAL   copy a file off the device\n"
+		"  --peer SPEC          let an outside program drive the link instead\n"
+		"                       (SPEC as for --serial1 in WindQt)\n"
+		"  --port N             which UART to use (default 1)\n"
+		"  --script FILE        press keys and tap the screen at set times\n"
+		"                       (to switch Remote Link on, say)\n"
+		"  --hle FILE           run the routines listed in FILE natively\n"
+		"  --timeout SECONDS    give up after this much emulated time (default 300)\n");
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+#ifdef SIGPIPE
+	// the --peer program going away should end in an error, not a signal
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	EmuBase *emu = loadEmulator(argv[1]);
+	if (!emu) {
+		fprintf(stderr, "could not load ROM %s\n", argv[1]);
+		return 1;
+	}
+	// with no logger set, nothing gets logged at all
+
+	int32_t clockSpeed = emu->getClockSpeed();
+	PlpPeer peer([emu]() { return (int64_t)emu->currentCycles(); }, clockSpeed);
+	CountingBackend *external = nullptr;
+	int port = 0;
+	double timeout = 300;
+	bool haveTransfers = false;
+
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "--put") && i + 2 < argc) {
+			peer.queuePut(argv[i + 1], argv[i + 2]);
+			haveTransfers = true;
+			i += 2;
+		} else if (!strcmp(argv[i], "--get") && i + 2 < argc) {
+			peer.queueGet(argv[i + 1], argv[i + 2]);
+			haveTransfers = true;
+			i += 2;
+		} else if (!strcmp(argv[i], "--peer") && i + 1 < argc) {
+#ifdef WINDCORE_SERIAL_POSIX
+			SerialBackend *backend = createSerialBackend(argv[++i]);
+			if (!backend) {
+				fprintf(stderr, "could not open %s\n", argv[i]);
+				return 1;
+			}
+			external = new CountingBackend(backend);
+#else
+			fprintf(stderr, "--peer isn't supported on this platform\n");
+			return 1;
+#endif
+		} else if (!strcmp(argv[i], "--script") && i + 1 < argc) {
+			std::string error;
+			if (!loadInputScript(emu, argv[++i], error)) {
+				fprintf(stderr, "%s\n", error.c_str());
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--hle") && i + 1 < argc) {
+			std::string error;
+			if (!loadHleTable(emu, argv[++i], error)) {
+				fprintf(stderr, "%s\n", error.c_str());
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+			port = atoi(argv[++i]) - 1;
+		} else if (!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+			timeout = atof(argv[++i]);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (!emu->setSerialBackend(port, external ? (SerialBackend *)external : (SerialBackend *)&peer)) {
+		fprintf(stderr, "no such serial port\n");
+		return 1;
+	}
+	if (!external && !haveTransfers) {
+		usage();
+		return 1;
+	}
+
+	// run in slices of one tick interrupt until we're done
+	auto wallStart = std::chrono::steady_clock::now();
+	int64_t deadline = (int64_t)(timeout * clockSpeed);
+	while ((int64_t)emu->currentCycles() < deadline) {
+		emu->executeUntil(emu->currentCycles() + (clockSpeed / 64));
+		if (!external && peer.finished())
+			break;
+	}
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	double emuSeconds = (double)emu->currentCycles() / clockSpeed;
+
+	int status = 0;
+	uint64_t bytes;
+	double emuBusySeconds;
+	if (external) {
+		bytes = external->bytesIn + external->bytesOut;
+		emuBusySeconds = emuSeconds;
+		printf("line traffic: %llu bytes in, %llu bytes out\n",
+			(unsigned long long)external->bytesIn, (unsigned long long)external->bytesOut);
+	} else {
+		bytes = peer.payloadBytes;
+		emuBusySeconds = 0;
+		if (peer.firstTransferAt >= 0 && peer.lastTransferAt >= 0)
+			emuBusySeconds = (double)(peer.lastTransferAt - peer.firstTransferAt) / clockSpeed;
+		if (peer.hasFailed()) {
+			printf("transfer failed: %s\n", peer.errorMessage().c_str());
+			status = 1;
+		} else if (!peer.finished()) {
+			printf(peer.isConnected() ? "timed out mid-transfer\n" : "timed out waiting for the device to connect\n");
+			status = 1;
+		}
+		printf("file data: %llu bytes\n", (unsigned long long)bytes);
+	}
+
+	printf("emulated: %.2f s total, %.2f s transferring", emuSeconds, emuBusySeconds);
+	if (emuBusySeconds > 0)
+		printf(", %.0f bytes/s", bytes / emuBusySeconds);
+	printf("\nwall:     %.2f s, %.0f bytes/s (%.1fx real time)\n",
+		wallSeconds, (wallSeconds > 0) ? bytes / wallSeconds : 0.0,
+		(wallSeconds > 0) ? emuSeconds / wallSeconds : 0.0);
+
+	emu->setSerialBackend(port, nullptr);
+	delete external;
+	return status;
+}
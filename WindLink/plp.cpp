@@ -0,0 +1,510 @@
+#include "plp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint16_t crcTable[256];
+
+static void initCrcTable() {
+	for (int i = 0; i < 256; i++) {
+		uint16_t crc = i << 8;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		crcTable[i] = crc;
+	}
+}
+
+static uint16_t addToCrc(uint16_t crc, uint8_t b) {
+	return (crc << 8) ^ crcTable[((crc >> 8) ^ b) & 0xFF];
+}
+
+static void add16(std::vector<uint8_t> &v, uint16_t value) {
+	v.push_back(value & 0xFF);
+	v.push_back(value >> 8);
+}
+
+static void add32(std::vector<uint8_t> &v, uint32_t value) {
+	add16(v, value & 0xFFFF);
+	add16(v, value >> 16);
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static std::string epocPath(const std::string &path) {
+	std::string result = path;
+	for (char &c : result)
+		if (c == '/') c = '\\';
+	return result;
+}
+
+
+PlpPeer::PlpPeer(Clock clock, int32_t clockSpeed) : clock(clock), clockSpeed(clockSpeed) {
+	initCrcTable();
+	conMagic = (uint32_t)rand();
+}
+
+PlpPeer::~PlpPeer() {
+	if (file)
+		fclose(file);
+}
+
+void PlpPeer::queuePut(const std::string &localPath, const std::string &remotePath) {
+	transfers.push_back({true, localPath, epocPath(remotePath)});
+	done = false;
+}
+
+void PlpPeer::queueGet(const std::string &remotePath, const std::string &localPath) {
+	transfers.push_back({false, localPath, epocPath(remotePath)});
+	done = false;
+}
+
+void PlpPeer::fail(const std::string &message) {
+	error = message;
+	failed = true;
+	if (file) {
+		fclose(file);
+		file = nullptr;
+	}
+}
+
+
+
+// Serial side
+size_t PlpPeer::read(uint8_t *buffer, size_t size) {
+	int64_t now = clock();
+
+	if (!linkUp) {
+		// keep knocking until the device answers
+		if (lastReqAt < 0 || (now - lastReqAt) > clockSpeed / 2) {
+			std::vector<uint8_t> magic;
+			add32(magic, conMagic);
+			sendLinkPacket(LinkReq, LinkReqReq, magic);
+			lastReqAt = now;
+		}
+	} else {
+		if (!outstanding.empty() && (now - lastSendAt) > clockSpeed / 4) {
+			// nothing acked in a while, so send the whole window again
+			if (++retries > MaxRetries) {
+				fail("link timed out");
+				linkReset();
+			} else {
+				for (auto &o : outstanding)
+					sendLinkPacket(LinkData, o.seq, o.payload);
+				lastSendAt = now;
+			}
+		}
+		// we'd normally wait for the device to introduce itself
+		if (!ncpInfoSent && (now - linkUpAt) > clockSpeed * 2)
+			sendNcpInfo();
+	}
+
+	size_t count = 0;
+	while (count < size && !lineOut.empty()) {
+		buffer[count++] = lineOut.front();
+		lineOut.pop_front();
+	}
+	return count;
+}
+
+size_t PlpPeer::write(const uint8_t *buffer, size_t size) {
+	for (size_t i = 0; i < size; i++)
+		receiveByte(buffer[i]);
+	return size;
+}
+
+
+
+// Framing
+void PlpPeer::sendFrame(const std::vector<uint8_t> &payload) {
+	lineOut.push_back(0x16); // SYN
+	lineOut.push_back(0x10); // DLE
+	lineOut.push_back(0x02); // STX
+
+	uint16_t crc = 0;
+	for (uint8_t b : payload) {
+		crc = addToCrc(crc, b);
+		if (b == 0x10)
+			lineOut.push_back(0x10);
+		lineOut.push_back(b);
+	}
+
+	lineOut.push_back(0x10); // DLE
+	lineOut.push_back(0x03); // ETX
+	lineOut.push_back(crc >> 8);
+	lineOut.push_back(crc & 0xFF);
+}
+
+void PlpPeer::receiveByte(uint8_t b) {
+	switch (frameState) {
+	case WaitSyn:
+		if (b == 0x16) frameState = WaitDle;
+		break;
+	case WaitDle:
+		frameState = (b == 0x10) ? WaitStx : ((b == 0x16) ? WaitDle : WaitSyn);
+		break;
+	case WaitStx:
+		if (b == 0x02) {
+			frameIn.clear();
+			frameCrc = 0;
+			frameState = InFrame;
+		} else {
+			frameState = WaitSyn;
+		}
+		break;
+	case InFrame:
+		if (b == 0x10) {
+			frameState = InFrameDle;
+		} else {
+			frameIn.push_back(b);
+			frameCrc = addToCrc(frameCrc, b);
+		}
+		break;
+	case InFrameDle:
+		if (b == 0x10) {
+			frameIn.push_back(b);
+			frameCrc = addToCrc(frameCrc, b);
+			frameState = InFrame;
+		} else if (b == 0x03) {
+			frameState = WaitCrcHi;
+		} else {
+			frameState = WaitSyn; // garbage, drop it
+		}
+		break;
+	case WaitCrcHi:
+		frameCrc ^= (b << 8);
+		frameState = WaitCrcLo;
+		break;
+	case WaitCrcLo:
+		frameCrc ^= b;
+		frameState = WaitSyn;
+		// a bad frame just gets retransmitted by the other end
+		if (frameCrc == 0 && !frameIn.empty())
+			receiveLinkPacket(frameIn);
+		break;
+	}
+}
+
+
+
+// Link layer
+void PlpPeer::sendLinkPacket(int type, int seq, const std::vector<uint8_t> &payload) {
+	std::vector<uint8_t> packet;
+	if (seq < 8) {
+		packet.push_back(type | seq);
+	} else {
+		// extended sequence number
+		packet.push_back(type | 8 | (seq & 7));
+		packet.push_back(seq >> 3);
+	}
+	packet.insert(packet.end(), payload.begin(), payload.end());
+	sendFrame(packet);
+}
+
+void PlpPeer::linkReset() {
+	linkUp = false;
+	outstanding.clear();
+	linkQueue.clear();
+	txSeq = 1;
+	rxSeq = 0;
+	retries = 0;
+	ncpInfoSent = false;
+	rfsvRemoteChannel = -1;
+	rfsvConnecting = false;
+	nextServerChannel = NcpFirstServerChannel;
+	for (auto &r : ncpReassembly)
+		r.clear();
+}
+
+void PlpPeer::linkConnected() {
+	linkReset();
+	linkUp = true;
+	linkUpAt = clock();
+}
+
+void PlpPeer::receiveLinkPacket(std::vector<uint8_t> &packet) {
+	int type = packet[0] & 0xF0;
+	int seq = packet[0] & 0x0F;
+	size_t headerSize = 1;
+	if (seq & 8) {
+		if (packet.size() < 2)
+			return;
+		seq = (seq & 7) | (packet[1] << 3);
+		headerSize = 2;
+	}
+	packet.erase(packet.begin(), packet.begin() + headerSize);
+
+	switch (type) {
+	case LinkReq:
+		if (seq == LinkReqReq) {
+			// the device wants to (re)connect; agree using its magic
+			std::vector<uint8_t> reply(packet.begin(), packet.end());
+			sendLinkPacket(LinkReq, LinkReqCon, reply);
+			linkConnected();
+		} else if (seq == LinkReqCon && packet.size() >= 4 && get32(packet.data()) == conMagic) {
+			linkConnected();
+			sendLinkPacket(LinkAck, 0, {});
+		}
+		break;
+	case LinkDisc:
+		linkReset();
+		break;
+	case LinkAck:
+		// acks are cumulative: drop everything up to this one
+		for (size_t i = 0; i < outstanding.size(); i++) {
+			if (outstanding[i].seq == seq) {
+				outstanding.erase(outstanding.begin(), outstanding.begin() + i + 1);
+				retries = 0;
+				lastSendAt = clock();
+				pumpLink();
+				break;
+			}
+		}
+		break;
+	case LinkData:
+		if (!linkUp)
+			break;
+		if (seq == ((rxSeq + 1) & SeqMask)) {
+			rxSeq = seq;
+			sendLinkPacket(LinkAck, rxSeq, {});
+			receiveNcp(packet);
+		} else {
+			// a repeat of something we already have
+			sendLinkPacket(LinkAck, rxSeq, {});
+		}
+		break;
+	}
+}
+
+void PlpPeer::pumpLink() {
+	while (linkUp && outstanding.size() < Window && !linkQueue.empty()) {
+		outstanding.push_back({txSeq, std::move(linkQueue.front())});
+		linkQueue.pop_front();
+		sendLinkPacket(LinkData, txSeq, outstanding.back().payload);
+		txSeq = (txSeq + 1) & SeqMask;
+		lastSendAt = clock();
+	}
+}
+
+
+
+// NCP
+void PlpPeer::sendNcpControl(int channel, int type, const std::vector<uint8_t> &data) {
+	std::vector<uint8_t> packet = {0, (uint8_t)channel, (uint8_t)type};
+	packet.insert(packet.end(), data.begin(), data.end());
+	linkQueue.push_back(std::move(packet));
+	pumpLink();
+}
+
+void PlpPeer::sendNcpData(int localChannel, int remoteChannel, const std::vector<uint8_t> &data) {
+	size_t pos = 0;
+	do {
+		size_t len = data.size() - pos;
+		if (len > NcpMaxFrame)
+			len = NcpMaxFrame;
+		bool last = (pos + len) == data.size();
+		std::vector<uint8_t> packet = {(uint8_t)remoteChannel, (uint8_t)localChannel, (uint8_t)(last ? 1 : 2)};
+		packet.insert(packet.end(), data.begin() + pos, data.begin() + pos + len);
+		linkQueue.push_back(std::move(packet));
+		pos += len;
+	} while (pos < data.size());
+	pumpLink();
+}
+
+void PlpPeer::sendNcpInfo() {
+	std::vector<uint8_t> info = {NcpVersion};
+	add32(info, (uint32_t)time(nullptr));
+	sendNcpControl(0, NcpInfo, info);
+	ncpInfoSent = true;
+
+	if (rfsvRemoteChannel < 0 && !rfsvConnecting) {
+		const char *name = "SYS$RFSV";
+		std::vector<uint8_t> request(name, name + strlen(name) + 1);
+		sendNcpControl(NcpRfsvChannel, NcpConnectToServer, request);
+		rfsvConnecting = true;
+	}
+}
+
+void PlpPeer::receiveNcp(std::vector<uint8_t> &packet) {
+	if (packet.size() < 3)
+		return;
+
+	int channel = packet[0];
+	if (channel == 0) {
+		receiveNcpControl(packet[1], packet[2], packet.data() + 3, packet.size() - 3);
+		return;
+	}
+
+	// data for one of our channels, possibly split over several frames
+	auto &message = ncpReassembly[channel];
+	message.insert(message.end(), packet.begin() + 3, packet.end());
+	if (packet[2] == 2)
+		return;
+
+	if (channel == NcpRfsvChannel)
+		receiveRfsv(message);
+	// anything the device sends our pretend servers is ignored
+	message.clear();
+}
+
+void PlpPeer::receiveNcpControl(int remoteChannel, int type, const uint8_t *data, size_t len) {
+	switch (type) {
+	case NcpInfo:
+		if (!ncpInfoSent)
+			sendNcpInfo();
+		break;
+	case NcpConnectToServer: {
+		// the device wants to talk to one of our servers (LINK.* etc);
+		// say yes so it's happy, then ignore whatever it sends
+		std::vector<uint8_t> response = {(uint8_t)remoteChannel, 0};
+		sendNcpControl(nextServerChannel, NcpConnectResponse, response);
+		if (nextServerChannel < 255)
+			nextServerChannel++;
+		break;
+	}
+	case NcpConnectResponse:
+		if (len >= 2 && data[0] == NcpRfsvChannel) {
+			rfsvConnecting = false;
+			if (data[1] == 0) {
+				rfsvRemoteChannel = remoteChannel;
+				startNextTransfer();
+			} else {
+				fail("device refused the SYS$RFSV connection");
+			}
+		}
+		break;
+	case NcpChannelDisconnect:
+	case NcpChannelClosed:
+		if (len >= 1 && data[0] == NcpRfsvChannel && rfsvRemoteChannel >= 0) {
+			rfsvRemoteChannel = -1;
+			if (step != Idle)
+				fail("SYS$RFSV channel closed mid-transfer");
+		}
+		break;
+	case NcpEnd:
+		linkReset();
+		break;
+	}
+}
+
+
+
+// RFSV
+void PlpPeer::rfsvRequest(uint16_t command, const std::vector<uint8_t> &params) {
+	std::vector<uint8_t> request;
+	add16(request, command);
+	add16(request, ++rfsvSerial);
+	request.insert(request.end(), params.begin(), params.end());
+	sendNcpData(NcpRfsvChannel, rfsvRemoteChannel, request);
+}
+
+void PlpPeer::startNextTransfer() {
+	if (rfsvRemoteChannel < 0 || step != Idle || failed)
+		return;
+	if (transfers.empty()) {
+		done = true;
+		return;
+	}
+
+	const Transfer &t = transfers.front();
+	file = fopen(t.local.c_str(), t.put ? "rb" : "wb");
+	if (!file) {
+		fail("cannot open " + t.local);
+		return;
+	}
+	if (firstTransferAt < 0)
+		firstTransferAt = clock();
+
+	std::vector<uint8_t> params;
+	add32(params, t.put ? ModeReadWrite : ModeShareReaders);
+	add16(params, t.remote.size());
+	params.insert(params.end(), t.remote.begin(), t.remote.end());
+	rfsvRequest(t.put ? RfsvReplaceFile : RfsvOpenFile, params);
+	step = Opening;
+}
+
+void PlpPeer::continueTransfer() {
+	const Transfer &t = transfers.front();
+	std::vector<uint8_t> params;
+	add32(params, handle);
+
+	if (t.put) {
+		uint8_t chunk[RfsvChunk];
+		size_t len = fread(chunk, 1, sizeof(chunk), file);
+		if (len > 0) {
+			params.insert(params.end(), chunk, chunk + len);
+			payloadBytes += len;
+			rfsvRequest(RfsvWriteFile, params);
+			step = Moving;
+			return;
+		}
+	} else if (step == Opening) {
+		add32(params, RfsvChunk);
+		rfsvRequest(RfsvReadFile, params);
+		step = Moving;
+		return;
+	}
+
+	rfsvRequest(RfsvCloseHandle, params);
+	step = Closing;
+}
+
+void PlpPeer::receiveRfsv(const std::vector<uint8_t> &packet) {
+	if (packet.size() < 8 || packet[0] != RfsvResponse || step == Idle)
+		return;
+	if ((packet[2] | (packet[3] << 8)) != rfsvSerial)
+		return; // stale
+
+	int32_t status = (int32_t)get32(&packet[4]);
+	const uint8_t *data = packet.data() + 8;
+	size_t len = packet.size() - 8;
+	const Transfer &t = transfers.front();
+
+	if (status != 0) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), " (EPOC error %d)", status);
+		fail((t.put ? "writing " : "reading ") + t.remote + buf);
+		return;
+	}
+
+	switch (step) {
+	case Opening:
+		if (len < 4) {
+			fail("bad response opening " + t.remote);
+			return;
+		}
+		handle = get32(data);
+		continueTransfer();
+		break;
+	case Moving:
+		if (!t.put) {
+			fwrite(data, 1, len, file);
+			payloadBytes += len;
+			if (len == RfsvChunk) {
+				std::vector<uint8_t> params;
+				add32(params, handle);
+				add32(params, RfsvChunk);
+				rfsvRequest(RfsvReadFile, params);
+				break;
+			}
+			std::vector<uint8_t> params;
+			add32(params, handle);
+			rfsvRequest(RfsvCloseHandle, params);
+			step = Closing;
+		} else {
+			continueTransfer();
+		}
+		break;
+	case Closing:
+		fclose(file);
+		file = nullptr;
+		lastTransferAt = clock();
+		transfers.pop_front();
+		step = Idle;
+		startNextTransfer();
+		break;
+	case Idle:
+		break;
+	}
+}
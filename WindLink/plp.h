@@ -0,0 +1,134 @@
+#pragma once
+#include "../WindCore/serial.h"
+#include <stdio.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Just enough of the Psion Link Protocol to push files into and pull
+// files out of an EPOC device, sitting directly on an emulated UART.
+// Layers, from the bottom up:
+//  - framing: SYN DLE STX, DLE-stuffed payload, DLE ETX, CRC-16/CCITT
+//  - link: EPOC-style REQ_REQ/REQ_CON handshake, 11-bit sequence
+//    numbers, a window of outstanding frames, go-back-N retransmits
+//  - NCP: the control channel plus one client channel to SYS$RFSV
+//  - RFSV32: open/replace, read, write and close
+// Only one side of plptools' ncpd/plpftp is implemented, so this is
+// useless against anything other than a real (or emulated) Psion.
+class PlpPeer : public SerialBackend {
+public:
+	typedef std::function<int64_t()> Clock;
+	PlpPeer(Clock clock, int32_t clockSpeed);
+	~PlpPeer() override;
+
+	// SerialBackend: read() is what the device receives from us,
+	// and doubles as our timer since the UART calls it regularly
+	size_t read(uint8_t *buffer, size_t size) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+
+	void queuePut(const std::string &localPath, const std::string &remotePath);
+	void queueGet(const std::string &remotePath, const std::string &localPath);
+	bool finished() const { return done || failed; }
+	bool hasFailed() const { return failed; }
+	const std::string &errorMessage() const { return error; }
+	bool isConnected() const { return rfsvRemoteChannel >= 0; }
+
+	// file contents moved so far, and when the first transfer started
+	uint64_t payloadBytes = 0;
+	int64_t firstTransferAt = -1, lastTransferAt = -1;
+
+private:
+	enum {
+		LinkAck = 0x00,
+		LinkDisc = 0x10,
+		LinkReq = 0x20,
+		LinkData = 0x30,
+		LinkReqReq = 1,  // sequence field of a LinkReq
+		LinkReqCon = 4,
+		SeqMask = 2047,
+		Window = 8,
+		MaxRetries = 10
+	};
+	enum {
+		NcpXoff = 1,
+		NcpXon = 2,
+		NcpConnectToServer = 3,
+		NcpConnectResponse = 4,
+		NcpChannelClosed = 5,
+		NcpInfo = 6,
+		NcpChannelDisconnect = 7,
+		NcpEnd = 8,
+		NcpVersion = 6,        // what a Series 5 speaks
+		NcpMaxFrame = 250,
+		NcpRfsvChannel = 1,
+		NcpFirstServerChannel = 2
+	};
+	enum {
+		RfsvCloseHandle = 0x01,
+		RfsvOpenFile = 0x16,
+		RfsvReadFile = 0x18,
+		RfsvWriteFile = 0x19,
+		RfsvReplaceFile = 0x2A,
+		RfsvResponse = 0x11,
+		RfsvChunk = 2000,
+		ModeShareReaders = 0x0001,
+		ModeReadWrite = 0x0200
+	};
+
+	Clock clock;
+	int32_t clockSpeed;
+	std::deque<uint8_t> lineOut;
+
+	// framing
+	enum FrameState { WaitSyn, WaitDle, WaitStx, InFrame, InFrameDle, WaitCrcHi, WaitCrcLo };
+	FrameState frameState = WaitSyn;
+	std::vector<uint8_t> frameIn;
+	uint16_t frameCrc = 0;
+	void receiveByte(uint8_t b);
+	void sendFrame(const std::vector<uint8_t> &payload);
+
+	// link
+	struct Outstanding { int seq; std::vector<uint8_t> payload; };
+	bool linkUp = false;
+	uint32_t conMagic;
+	int txSeq = 1, rxSeq = 0, retries = 0;
+	int64_t lastReqAt = -1, lastSendAt = 0, linkUpAt = 0;
+	std::deque<Outstanding> outstanding;
+	std::deque<std::vector<uint8_t>> linkQueue;
+	void receiveLinkPacket(std::vector<uint8_t> &packet);
+	void sendLinkPacket(int type, int seq, const std::vector<uint8_t> &payload);
+	void linkConnected();
+	void linkReset();
+	void pumpLink();
+
+	// NCP
+	bool ncpInfoSent = false;
+	int rfsvRemoteChannel = -1, nextServerChannel = NcpFirstServerChannel;
+	bool rfsvConnecting = false;
+	std::vector<uint8_t> ncpReassembly[256];
+	void receiveNcp(std::vector<uint8_t> &packet);
+	void receiveNcpControl(int remoteChannel, int type, const uint8_t *data, size_t len);
+	void sendNcpControl(int channel, int type, const std::vector<uint8_t> &data);
+	void sendNcpData(int localChannel, int remoteChannel, const std::vector<uint8_t> &data);
+	void sendNcpInfo();
+
+	// RFSV
+	struct Transfer {
+		bool put;
+		std::string local, remote;
+	};
+	enum RfsvStep { Idle, Opening, Moving, Closing };
+	std::deque<Transfer> transfers;
+	RfsvStep step = Idle;
+	FILE *file = nullptr;
+	uint32_t handle = 0;
+	uint16_t rfsvSerial = 0;
+	bool done = false, failed = false;
+	std::string error;
+	void rfsvRequest(uint16_t command, const std::vector<uint8_t> &params);
+	void receiveRfsv(const std::vector<uint8_t> &packet);
+	void startNextTransfer();
+	void continueTransfer();
+	void fail(const std::string &message);
+};
@@ -24,11 +24,13 @@ CONFIG += c++17
 QMAKE_MACOSX_DEPLOYMENT_TARGET = 10.14
 
 SOURCES += \
+        emuthread.cpp \
         main.cpp \
         mainwindow.cpp \
         pdascreenwindow.cpp
 
 HEADERS += \
+        emuthread.h \
         mainwindow.h \
         pdascreenwindow.h
 
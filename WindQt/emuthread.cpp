@@ -0,0 +1,269 @@
+#include "emuthread.h"
+#include <string.h>
+
+static double hostSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EmuThread::EmuThread(EmuBase *emu, QObject *parent) :
+	QThread(parent),
+	emu(emu),
+	governor(emu->getClockSpeed())
+{
+}
+
+EmuThread::~EmuThread()
+{
+	stop();
+}
+
+void EmuThread::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quitting = true;
+	}
+	wake.notify_all();
+	wait();
+}
+
+void EmuThread::setFreeRunning(bool value)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		freeRunning = value;
+	}
+	wake.notify_all();
+}
+
+void EmuThread::post(std::function<void()> command)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		commands.push_back(std::move(command));
+	}
+	wake.notify_all();
+}
+
+EmuThread::Frame EmuThread::latestFrame()
+{
+	framePending = false;
+	std::lock_guard<std::mutex> guard(frameLock);
+	return frames[back ^ 1];
+}
+
+
+void EmuThread::pushInput(const InputEvent &event)
+{
+	size_t head = inputHead.load(std::memory_order_relaxed);
+	if (head - inputTail.load(std::memory_order_acquire) == InputCapacity)
+		return; // full, which takes a lot of mouse movement while stopped
+	inputs[head & (InputCapacity - 1)] = event;
+	inputHead.store(head + 1, std::memory_order_release);
+}
+
+void EmuThread::applyInput()
+{
+	size_t tail = inputTail.load(std::memory_order_relaxed);
+	size_t head = inputHead.load(std::memory_order_acquire);
+	for (; tail != head; tail++) {
+		const InputEvent &event = inputs[tail & (InputCapacity - 1)];
+		if (event.kind == InputKey)
+			emu->setKeyboardKey(event.key, event.down);
+		else
+			emu->updateTouchInput(event.x, event.y, event.down);
+	}
+	inputTail.store(tail, std::memory_order_release);
+}
+
+
+void EmuThread::capture(Frame &frame, bool withDebugState)
+{
+	int width = emu->getLCDWidth(), height = emu->getLCDHeight();
+	if (frame.lcd.width() != width || frame.lcd.height() != height)
+		frame.lcd = QImage(width, height, QImage::Format_Grayscale8);
+	uint8_t *lines[1024];
+	for (int y = 0; y < height; y++)
+		lines[y] = frame.lcd.scanLine(y);
+	emu->readLCDIntoBuffer(lines, false);
+
+	frame.hasDebugState = withDebugState && wantState;
+	frame.hasCode = frame.hasDebugState && wantCode;
+	frame.hasMemory = frame.hasDebugState && wantMemory;
+	if (!frame.hasDebugState)
+		return;
+
+	frame.cycles = emu->currentCycles();
+	frame.speed = governor.achievedSpeed();
+	for (int i = 0; i < 16; i++)
+		frame.regs[i] = emu->getGPR(i);
+	frame.cpsr = emu->getCPSR();
+	frame.instructionReady = emu->instructionReady();
+
+	// Memory is read through virtToPhys and getPhysicalPointer, which
+	// (unlike readVirtual) don't touch the TLB, watchpoints or tracing,
+	// so looking can't change what the emulator does next
+	if (frame.hasCode)
+		captureCode(frame);
+	if (frame.hasMemory)
+		captureMemory(frame);
+}
+
+void EmuThread::captureCode(Frame &frame)
+{
+	// the code either side of the PC
+	const uint32_t context = 8 * 4;
+	uint32_t pc = frame.regs[15] - 8;
+	uint32_t minCode = pc - context;
+	if (minCode >= (UINT32_MAX - context))
+		minCode = 0;
+	uint32_t maxCode = pc + context;
+	if (maxCode < context)
+		maxCode = UINT32_MAX;
+
+	frame.codeBase = minCode;
+	frame.codeCount = 0;
+	for (uint32_t addr = minCode; addr >= minCode && addr <= maxCode && frame.codeCount < Frame::MaxCodeWords; addr += 4) {
+		bool fault = false;
+		uint32_t physAddr = emu->virtToPhys(addr, fault);
+		uint32_t word = 0;
+		if (!fault) {
+			if (const uint8_t *ptr = emu->getPhysicalPointer(physAddr, 4, false))
+				memcpy(&word, ptr, 4);
+			else
+				word = emu->readPhysical(physAddr, ARM710::V32, fault);
+		}
+		frame.code[frame.codeCount] = word;
+		frame.codeValid[frame.codeCount] = !fault;
+		frame.codeCount++;
+	}
+}
+
+void EmuThread::captureMemory(Frame &frame)
+{
+	uint32_t virtBase = memoryViewAddress.load() & ~0xFF;
+	bool fault = false;
+	frame.memoryBase = virtBase;
+	frame.memoryPhysBase = emu->virtToPhys(virtBase, fault);
+	frame.memoryValid = !fault;
+	if (!frame.memoryValid)
+		return;
+
+	// RAM and ROM in one go; anything else a byte at a time, as before
+	if (const uint8_t *ptr = emu->getPhysicalPointer(frame.memoryPhysBase, 0x100, false)) {
+		memcpy(frame.memory, ptr, 0x100);
+	} else {
+		for (int i = 0; i < 0x100; i++)
+			frame.memory[i] = emu->readPhysical(frame.memoryPhysBase + i, ARM710::V8, fault);
+	}
+}
+
+void EmuThread::publish(bool throttled)
+{
+	// if the UI hasn't collected the last one yet, it's busy; it'll
+	// get whatever comes after, so don't bother converting this one
+	if (throttled && framePending)
+		return;
+
+	// while running freely, the debugger's state is only worth copying
+	// a few times a second; anything the UI asked for gets it straight away
+	auto now = std::chrono::steady_clock::now();
+	bool withDebugState = !throttled || (now - lastDebugCapture) >= std::chrono::milliseconds(debugInterval.load());
+	if (withDebugState)
+		lastDebugCapture = now;
+
+	// only we ever touch the back frame, so this needs no lock
+	capture(frames[back], withDebugState);
+	{
+		std::lock_guard<std::mutex> guard(frameLock);
+		back ^= 1;
+	}
+	// if the UI hasn't got round to the last one, don't pile up more
+	if (!framePending.exchange(true))
+		emit frameReady();
+}
+
+
+void EmuThread::runSlice()
+{
+	int64_t start = emu->currentCycles(), startIdle = emu->currentIdleCycles();
+	int64_t target = start + governor.beginFrame(hostSeconds());
+#ifdef WINDCORE_GDB_STUB
+	if (gdbStub) {
+		// GDB decides when things run, and handles its own breakpoints
+		gdbStub->run(target);
+		governor.endFrame(emu->currentCycles() - start, emu->currentIdleCycles() - startIdle, hostSeconds());
+		return;
+	}
+#endif
+	emu->executeUntil(target);
+	governor.endFrame(emu->currentCycles() - start, emu->currentIdleCycles() - startIdle, hostSeconds());
+	if (emu->lastStopReason() == EmuBase::StopBreakpoint || emu->lastStopReason() == EmuBase::StopWatchpoint) {
+		freeRunning = false;
+		emit stoppedOnBreak();
+	}
+}
+
+void EmuThread::run()
+{
+	using namespace std::chrono;
+	const auto slice = microseconds(1000000 / 64);
+	auto deadline = steady_clock::now();
+	bool wasRunning = false;
+
+	publish(false);
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (!quitting) {
+		bool ranCommands = false, ranSlice = false, stopped = false;
+		while (!commands.empty()) {
+			std::function<void()> command = std::move(commands.front());
+			commands.pop_front();
+			guard.unlock();
+			if (command)
+				command();
+			guard.lock();
+			ranCommands = true;
+		}
+		guard.unlock();
+
+		applyInput();
+
+		bool running = freeRunning;
+#ifdef WINDCORE_GDB_STUB
+		// GDB gets answered while we're stopped too (it attaches before
+		// anything's run), and can set things going by itself
+		if (gdbStub && !running)
+			running = gdbStub->service();
+#endif
+		if (running && !wasRunning) {
+			deadline = steady_clock::now();
+			governor.reset();
+		}
+		if (!running && wasRunning)
+			stopped = true; // the debugger will want to see where
+		wasRunning = running;
+		if (running && steady_clock::now() >= deadline) {
+			runSlice();
+			ranSlice = true;
+			// if the host can't keep up (or there's no limit), don't wait
+			// at all; if we've fallen well behind anyway, the governor has
+			// already given up on catching up
+			deadline += slice;
+			if (governor.isUnlimited() || governor.isFallingBehind() || steady_clock::now() - deadline > slice * 4)
+				deadline = steady_clock::now();
+		}
+
+		// a screen update per batch at most, and none if the last is
+		// still to be shown
+		if (ranCommands || stopped || (ranSlice && governor.presentDue(hostSeconds())))
+			publish(!ranCommands && !stopped && freeRunning);
+
+		guard.lock();
+		if (quitting || !commands.empty())
+			continue;
+		// even when stopped, wake up now and then to deal with input
+		wake.wait_until(guard, running ? deadline : steady_clock::now() + slice);
+	}
+}
@@ -0,0 +1,140 @@
+#ifndef EMUTHREAD_H
+#define EMUTHREAD_H
+
+#include <QThread>
+#include <QImage>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include "../WindCore/emubase.h"
+#include "../WindCore/gdbstub.h"
+#include "../WindCore/governor.h"
+
+// Runs the emulator on its own thread, 64 batches a second, with a
+// SpeedGovernor deciding how much emulated time each covers (1/64
+// second at real time). Nothing else touches the emulator while
+// it's running: the UI gets a copy of the screen and of the state the
+// debugger shows after each slice, hands over key and touch events
+// through a lock-free queue, and anything else it wants done goes
+// through post() and runs between slices.
+class EmuThread : public QThread
+{
+	Q_OBJECT
+
+public:
+	// Everything the UI shows, as of the end of a slice. The screen is
+	// always there; the debugger's state only as often as it asks.
+	struct Frame {
+		QImage lcd;
+		bool hasDebugState = false, hasCode = false, hasMemory = false;
+		int64_t cycles = 0;
+		double speed = 0; // achieved, as a multiple of real time
+		uint32_t regs[16] = {}, cpsr = 0;
+		bool instructionReady = false;
+		// the code around the PC
+		enum { MaxCodeWords = 17 };
+		uint32_t codeBase = 0;
+		int codeCount = 0;
+		uint32_t code[MaxCodeWords];
+		bool codeValid[MaxCodeWords];
+		// the memory view
+		uint32_t memoryBase = 0, memoryPhysBase = 0;
+		bool memoryValid = false;
+		uint8_t memory[0x100];
+	};
+
+	explicit EmuThread(EmuBase *emu, QObject *parent = nullptr);
+	~EmuThread() override;
+	// returns once the thread's finished; anything still posted is dropped
+	void stop();
+
+	// free-running means executing slices back to back; otherwise the
+	// thread only wakes up for posted work
+	void setFreeRunning(bool value);
+	bool isFreeRunning() const { return freeRunning.load(); }
+
+	// runs on the emulation thread between slices, after which a new
+	// frame is published; an empty function just asks for a new frame
+	void post(std::function<void()> command);
+
+	// only ever called from the UI thread
+	void queueKey(EpocKey key, bool down) { pushInput({InputKey, down, key, 0, 0}); }
+	void queueTouch(int x, int y, bool down) { pushInput({InputTouch, down, EStdKeyNull, x, y}); }
+
+	void setMemoryViewAddress(uint32_t address) { memoryViewAddress.store(address); }
+	// which parts of the debugger's state are wanted, and how often
+	// while running; when stopped, every frame has whatever's wanted
+	void setDebugCapture(bool state, bool code, bool memory) {
+		wantState = state;
+		wantCode = state && code;
+		wantMemory = state && memory;
+	}
+	void setDebugInterval(int ms) { debugInterval = ms; }
+	// see SpeedGovernor::setSpeed
+	void setSpeed(double multiple) { post([this, multiple] { governor.setSpeed(multiple); }); }
+
+	// the latest frame; holding on to the copy won't hold up emulation
+	Frame latestFrame();
+
+#ifdef WINDCORE_GDB_STUB
+	void setGdbStub(GdbStub *stub) { post([this, stub] { gdbStub = stub; }); }
+#endif
+
+signals:
+	// there's a new frame; not sent again until latestFrame is called
+	void frameReady();
+	// free-running stopped on a breakpoint or watchpoint
+	void stoppedOnBreak();
+
+protected:
+	void run() override;
+
+private:
+	EmuBase *emu;
+	SpeedGovernor governor;
+#ifdef WINDCORE_GDB_STUB
+	GdbStub *gdbStub = nullptr;
+#endif
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> commands;
+	bool quitting = false;
+	std::atomic<bool> freeRunning{false};
+	std::atomic<uint32_t> memoryViewAddress{0};
+	std::atomic<bool> wantState{true}, wantCode{true}, wantMemory{true};
+	std::atomic<int> debugInterval{100};
+	std::chrono::steady_clock::time_point lastDebugCapture;
+
+	// double-buffered: the emulation thread fills frames[back] while
+	// the UI reads the other one
+	std::mutex frameLock;
+	Frame frames[2];
+	int back = 0;
+	std::atomic<bool> framePending{false};
+	void capture(Frame &frame, bool withDebugState);
+	void captureCode(Frame &frame);
+	void captureMemory(Frame &frame);
+	void publish(bool throttled);
+
+	// single producer (the UI), single consumer (us), like AudioRing
+	enum InputKind { InputKey, InputTouch };
+	struct InputEvent {
+		InputKind kind;
+		bool down;
+		EpocKey key;
+		int x, y;
+	};
+	enum { InputCapacity = 0x100 };
+	InputEvent inputs[InputCapacity];
+	std::atomic<size_t> inputHead{0}, inputTail{0};
+	void pushInput(const InputEvent &event);
+	void applyInput();
+
+	void runSlice();
+};
+
+#endif // EMUTHREAD_H
@@ -2,16 +2,25 @@
 #include <QApplication>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <memory>
+#include <signal.h>
 #include "../WindCore/clps7111.h"
+#include "../WindCore/hletable.h"
+#include "../WindCore/inputscript.h"
+#include "../WindCore/trace.h"
 #include "../WindCore/windermere.h"
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 	auto args = a.arguments();
+#ifdef SIGPIPE
+	// a GDB or serial peer hanging up shouldn't take the emulator with it
+	signal(SIGPIPE, SIG_IGN);
+#endif
 
 	QString romFile;
-	if (args.length() > 1)
+	if (args.length() > 1 && !args.last().startsWith("--"))
 		romFile = args.last();
 	else
 		romFile = QFileDialog::getOpenFileName(nullptr, "Select a ROM");
@@ -52,7 +61,133 @@ int main(int argc, char *argv[])
 	}
 
 	emu->loadROM(romData, buffer.size());
+
+#ifdef WINDCORE_SERIAL_POSIX
+	// --serial1=SPEC and --serial2=SPEC attach the UARTs to the host
+	// (see createSerialBackend for what SPEC can be)
+	for (const QString &arg : args) {
+		for (int port = 0; port < 2; port++) {
+			QString prefix = QStringLiteral("--serial%1=").arg(port + 1);
+			if (arg.startsWith(prefix)) {
+				QByteArray spec = arg.mid(prefix.length()).toLocal8Bit();
+				SerialBackend *backend = createSerialBackend(spec.constData());
+				if (backend)
+					emu->setSerialBackend(port, backend);
+				else
+					QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("Couldn't open serial port %1").arg(arg));
+			}
+		}
+	}
+#endif
+
+	// --cf=IMAGE puts a CompactFlash card backed by IMAGE in the socket
+	for (const QString &arg : args) {
+		if (arg.startsWith("--cf=")) {
+			CFCard *card = new CFCard;
+			QByteArray path = arg.mid(5).toLocal8Bit();
+			if (card->openImage(path.constData()) && emu->insertCard(card)) {
+				if (card->isReadOnly())
+					QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("%1 is read-only, so the card will be too").arg(arg.mid(5)));
+			} else {
+				QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("Couldn't insert CF card %1").arg(arg.mid(5)));
+				delete card;
+			}
+		}
+	}
+
+	// --wav=FILE records whatever the codec plays
+	AudioRing audioRing;
+	std::unique_ptr<WavFileSink> wavSink;
+	for (const QString &arg : args) {
+		if (arg.startsWith("--wav=")) {
+			QByteArray path = arg.mid(6).toLocal8Bit();
+			wavSink.reset(new WavFileSink(audioRing, path.constData(), Codec::SampleRate));
+			if (wavSink->isOpen())
+				emu->setAudioOutput(&audioRing);
+			else
+				QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("Couldn't open %1 for writing").arg(arg.mid(6)));
+		}
+	}
+
+	// --log=SUBSYSTEM:LEVEL,... picks how much each part of the emulator
+	// logs, e.g. --log=all:warning,serial:verbose
+	for (const QString &arg : args) {
+		if (arg.startsWith("--log=")) {
+			QByteArray spec = arg.mid(6).toLatin1();
+			if (!emu->logPipeline().configure(spec.constData()))
+				QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("Couldn't make sense of %1").arg(arg));
+		}
+	}
+
+	// --trace=FILE[,mem][,regs] records every instruction executed,
+	// optionally with data accesses and register changes too
+	std::unique_ptr<TraceRecorder> tracer;
+	for (const QString &arg : args) {
+		if (arg.startsWith("--trace=")) {
+			QStringList parts = arg.mid(8).split(',');
+			int options = 0;
+			if (parts.contains("mem")) options |= TraceRecorder::TraceMemory;
+			if (parts.contains("regs")) options |= TraceRecorder::TraceRegisters;
+			QByteArray path = parts[0].toLocal8Bit();
+			tracer.reset(new TraceRecorder(path.constData(), options));
+			if (tracer->isOpen())
+				emu->setTracer(tracer.get());
+			else
+				QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("Couldn't open %1 for writing").arg(parts[0]));
+		}
+	}
+
+	// --hle=FILE replaces the EPOC routines it lists for this ROM with
+	// native code (see loadHleTable)
+	for (const QString &arg : args) {
+		if (arg.startsWith("--hle=")) {
+			QByteArray path = arg.mid(6).toLocal8Bit();
+			std::string error;
+			if (!loadHleTable(emu, path.constData(), error))
+				QMessageBox::warning(nullptr, "WindEmu", QString::fromStdString(error));
+		}
+	}
+
+	// --script=FILE presses keys at set times (see loadInputScript); it
+	// has to be queued before the emulation thread starts
+	for (const QString &arg : args) {
+		if (arg.startsWith("--script=")) {
+			QByteArray path = arg.mid(9).toLocal8Bit();
+			std::string error;
+			if (!loadInputScript(emu, path.constData(), error))
+				QMessageBox::warning(nullptr, "WindEmu", QString::fromStdString(error));
+		}
+	}
+
 	MainWindow w(emu);
+	// --speed=N runs at N times real time, --speed=max as fast as it can
+	for (const QString &arg : args) {
+		if (arg.startsWith("--speed=")) {
+			bool ok = true;
+			double multiple = (arg.mid(8) == "max") ? 0 : arg.mid(8).toDouble(&ok);
+			if (ok)
+				w.setSpeed(multiple);
+		}
+	}
+	// --debug-refresh=HZ sets how often the debugger panes update while
+	// running (10 by default); they're never updated while hidden
+	for (const QString &arg : args) {
+		if (arg.startsWith("--debug-refresh="))
+			w.setDebugRefreshRate(arg.mid(16).toInt());
+	}
+#ifdef WINDCORE_GDB_STUB
+	// --gdb=tcp:PORT or --gdb=unix:PATH waits for GDB to connect
+	for (const QString &arg : args) {
+		if (arg.startsWith("--gdb=")) {
+			QByteArray spec = arg.mid(6).toLocal8Bit();
+			GdbStub *stub = GdbStub::create(emu, spec.constData());
+			if (stub)
+				w.setGdbStub(stub);
+			else
+				QMessageBox::warning(nullptr, "WindEmu", QStringLiteral("Couldn't listen for GDB on %1").arg(arg.mid(6)));
+		}
+	}
+#endif
     w.show();
 
     return a.exec();
@@ -1,53 +1,118 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
-#include <QTimer>
+#include <stdio.h>
 #include "../WindCore/decoder.h"
 #include "clps7111.h"
 
 MainWindow::MainWindow(EmuBase *emu, QWidget *parent) :
     QMainWindow(parent),
 	ui(new Ui::MainWindow),
-	pdaScreen(emu),
-	emu(emu)
+	emu(emu),
+	emuThread(emu),
+	pdaScreen(emu, &emuThread)
 {
     ui->setupUi(this);
 	ui->logView->setMaximumBlockCount(1000);
 
 	elapsedTimer.start();
-	emu->setLogger([&](const char *str) {
-		QString fullStr = QStringLiteral("[%1] %2").arg(elapsedTimer.elapsed()).arg(str);
-		ui->logView->appendPlainText(fullStr);
+	emu->setLogger([this](const char *str) {
+		// this runs on the log thread, so hand the line over to the UI
+		QString fullStr = QStringLiteral("[%1] %2").arg(elapsedTimer.elapsed()).arg(QString::fromUtf8(str));
+		QMetaObject::invokeMethod(ui->logView, [this, fullStr] {
+			ui->logView->appendPlainText(fullStr);
+		}, Qt::QueuedConnection);
 	});
 
-    timer = new QTimer(this);
-    timer->setInterval(1000/64);
-    connect(timer, SIGNAL(timeout()), SLOT(execTimer()));
+	connect(&emuThread, SIGNAL(frameReady()), SLOT(showFrame()));
+	connect(&emuThread, SIGNAL(stoppedOnBreak()), SLOT(stoppedOnBreak()));
+	connect(ui->tabWidget, &QTabWidget::currentChanged, this, [this] { updateDebugCapture(); });
 
 	pdaScreen.show();
 
-	updateScreen();
+	emuThread.setMemoryViewAddress(ui->memoryViewAddress->text().toUInt(nullptr, 16));
+	emuThread.start();
 }
 
 MainWindow::~MainWindow()
 {
+	// posted commands can touch the UI from the emulation thread, so
+	// it has to be gone before any of that is
+	emuThread.stop();
+	emu->setLogger(nullptr);
     delete ui;
 }
 
-void MainWindow::updateScreen()
+void MainWindow::showFrame()
 {
-    ui->cycleCounter->setText(QString("Cycles: %1").arg(emu->currentCycles()));
+	// everything here comes from the copy the emulation thread made,
+	// so it can keep running while we draw
+	EmuThread::Frame frame = emuThread.latestFrame();
+	pdaScreen.showLCD(frame.lcd);
+
+	updateDebugCapture();
+	if (!frame.hasDebugState)
+		return;
+
+	ui->cycleCounter->setText(QString("Cycles: %1 (%2x)").arg(frame.cycles).arg(frame.speed, 0, 'f', 1));
+	showRegisters(frame);
+	if (frame.hasCode)
+		showCode(frame);
+	if (frame.hasMemory)
+		showMemory(frame);
+}
 
-	updateMemory();
+void MainWindow::updateDebugCapture()
+{
+	// only ask for what can actually be seen; a tab that isn't
+	// showing, or a minimised window, costs nothing
+	bool visible = isVisible() && !isMinimized();
+	bool wantCode = ui->codeLabel->isVisible(), wantMemory = ui->memoryViewLabel->isVisible();
+	bool changed = (visible != debugVisible) || (wantCode != debugWantCode) || (wantMemory != debugWantMemory);
+	debugVisible = visible;
+	debugWantCode = wantCode;
+	debugWantMemory = wantMemory;
+	emuThread.setDebugCapture(visible, wantCode, wantMemory);
+
+	// if something's just come into view, it shouldn't have to wait
+	if (changed && visible)
+		emuThread.post(nullptr);
+}
+
+void MainWindow::setDebugRefreshRate(int hz)
+{
+	emuThread.setDebugInterval((hz > 0) ? (1000 / hz) : 0);
+}
+
+void MainWindow::changeEvent(QEvent *event)
+{
+	QMainWindow::changeEvent(event);
+	if (event->type() == QEvent::WindowStateChange)
+		updateDebugCapture();
+}
+
+void MainWindow::showEvent(QShowEvent *event)
+{
+	QMainWindow::showEvent(event);
+	updateDebugCapture();
+}
+
+void MainWindow::hideEvent(QHideEvent *event)
+{
+	QMainWindow::hideEvent(event);
+	updateDebugCapture();
+}
 
+void MainWindow::showRegisters(const EmuThread::Frame &frame)
+{
 	char flagDisplay[] = {
-		(emu->getCPSR() & 0x80000000) ? 'N' : '-',
-		(emu->getCPSR() & 0x40000000) ? 'Z' : '-',
-		(emu->getCPSR() & 0x20000000) ? 'C' : '-',
-		(emu->getCPSR() & 0x10000000) ? 'V' : '-',
+		(frame.cpsr & 0x80000000) ? 'N' : '-',
+		(frame.cpsr & 0x40000000) ? 'Z' : '-',
+		(frame.cpsr & 0x20000000) ? 'C' : '-',
+		(frame.cpsr & 0x10000000) ? 'V' : '-',
 		0
 	};
 	const char *modeName = "???";
-	switch (emu->getCPSR() & 0x1F) {
+	switch (frame.cpsr & 0x1F) {
 	case 0x10: modeName = "User"; break;
 	case 0x11: modeName = "FIQ"; break;
 	case 0x12: modeName = "IRQ"; break;
@@ -56,63 +121,62 @@ void MainWindow::updateScreen()
 	case 0x1B: modeName = "Undefined"; break;
 	}
 
-    ui->regsLabel->setText(
-				QString("R0: %1 / R1: %2 / R2: %3 / R3: %4 / R4: %5 / R5: %6 / R6: %7 / R7: %8\nR8: %9 / R9: %10 / R10:%11 / R11:%12 / R12:%13 / SP: %14 / LR: %15 / PC: %16\n%17 / Mode: %18")
-                .arg(emu->getGPR(0), 8, 16)
-                .arg(emu->getGPR(1), 8, 16)
-                .arg(emu->getGPR(2), 8, 16)
-                .arg(emu->getGPR(3), 8, 16)
-                .arg(emu->getGPR(4), 8, 16)
-                .arg(emu->getGPR(5), 8, 16)
-                .arg(emu->getGPR(6), 8, 16)
-                .arg(emu->getGPR(7), 8, 16)
-                .arg(emu->getGPR(8), 8, 16)
-                .arg(emu->getGPR(9), 8, 16)
-                .arg(emu->getGPR(10), 8, 16)
-                .arg(emu->getGPR(11), 8, 16)
-                .arg(emu->getGPR(12), 8, 16)
-                .arg(emu->getGPR(13), 8, 16)
-                .arg(emu->getGPR(14), 8, 16)
-                .arg(emu->getGPR(15), 8, 16)
-				.arg(flagDisplay)
-				.arg(modeName)
-                );
+	const uint32_t *r = frame.regs;
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer),
+		"R0: %8x / R1: %8x / R2: %8x / R3: %8x / R4: %8x / R5: %8x / R6: %8x / R7: %8x\n"
+		"R8: %8x / R9: %8x / R10:%8x / R11:%8x / R12:%8x / SP: %8x / LR: %8x / PC: %8x\n"
+		"%s / Mode: %s",
+		r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7],
+		r[8], r[9], r[10], r[11], r[12], r[13], r[14], r[15],
+		flagDisplay, modeName);
+	ui->regsLabel->setText(QString::fromLatin1(buffer));
+}
 
+void MainWindow::showCode(const EmuThread::Frame &frame)
+{
     // show a crude disassembly
-    const int context = 8 * 4;
-	uint32_t pc = emu->getGPR(15) - 8;
-    uint32_t minCode = pc - context;
-	if (minCode >= (UINT32_MAX - context))
-        minCode = 0;
-    uint32_t maxCode = pc + context;
-	if (maxCode < context)
-        maxCode = UINT32_MAX;
-
+	uint32_t pc = frame.regs[15] - 8;
 	QStringList codeLines;
-	for (uint32_t addr = minCode; addr >= minCode && addr <= maxCode; addr += 4) {
-		const char *prefix = (addr == pc) ? (emu->instructionReady() ? "==>" : "...") : "   ";
-        struct ARMInstructionInfo info;
-        char buffer[512];
-
-		auto result = emu->readVirtual(addr, ARM710::V32);
-		if (result.first.has_value()) {
-			uint32_t opcode = result.first.value();
-			ARMDecodeARM(opcode, &info);
-			ARMDisassemble(&info, addr, buffer, sizeof(buffer));
-			codeLines.append(QString("%1 %2 | %3 | %4").arg(prefix).arg(addr, 8, 16).arg(opcode, 8, 16).arg(buffer));
-		}
+	for (int i = 0; i < frame.codeCount; i++) {
+		if (!frame.codeValid[i])
+			continue;
+		uint32_t addr = frame.codeBase + (i * 4);
+		const char *prefix = (addr == pc) ? (frame.instructionReady ? "==>" : "...") : "   ";
+		codeLines.append(QString::fromLatin1(prefix) + ' ' + disassemble(addr, frame.code[i]));
     }
 	ui->codeLabel->setText(codeLines.join('\n'));
+}
 
-    // now, the actual screen
-	pdaScreen.updateScreen();
+QString MainWindow::disassemble(uint32_t addr, uint32_t opcode)
+{
+	// while it's running, the PC mostly goes round the same loops, so
+	// most of these will have been seen already; the opcode is checked
+	// in case the code (or the mapping) has changed underneath
+	auto it = disassemblyCache.find(addr);
+	if (it != disassemblyCache.end() && it->opcode == opcode)
+		return it->text;
+
+	if (disassemblyCache.size() >= 0x4000)
+		disassemblyCache.clear();
+
+	struct ARMInstructionInfo info;
+	char buffer[512], line[600];
+	ARMDecodeARM(opcode, &info);
+	ARMDisassemble(&info, addr, buffer, sizeof(buffer));
+	snprintf(line, sizeof(line), "%8x | %8x | %s", addr, opcode, buffer);
+
+	CachedDisassembly &entry = disassemblyCache[addr];
+	entry.opcode = opcode;
+	entry.text = QString::fromLatin1(line);
+	return entry.text;
 }
 
 
 
 void MainWindow::on_startButton_clicked()
 {
-    timer->start();
+	emuThread.setFreeRunning(true);
     ui->startButton->setEnabled(false);
     ui->stopButton->setEnabled(true);
     ui->stepInsnButton->setEnabled(false);
@@ -121,7 +185,7 @@ void MainWindow::on_startButton_clicked()
 
 void MainWindow::on_stopButton_clicked()
 {
-    timer->stop();
+	emuThread.setFreeRunning(false);
     ui->startButton->setEnabled(true);
     ui->stopButton->setEnabled(false);
     ui->stepInsnButton->setEnabled(true);
@@ -130,45 +194,108 @@ void MainWindow::on_stopButton_clicked()
 
 void MainWindow::on_stepTickButton_clicked()
 {
-//    emu->executeUntil(emu->currentCycles() + (CLOCK_SPEED * 2));
-	emu->executeUntil(emu->currentCycles() + 25000000);
-	updateScreen();
+	emuThread.post([this] {
+//		emu->executeUntil(emu->currentCycles() + (CLOCK_SPEED * 2));
+		emu->executeUntil(emu->currentCycles() + 25000000);
+	});
 }
 
 void MainWindow::on_stepInsnButton_clicked()
 {
-    emu->executeUntil(emu->currentCycles() + 1);
-    updateScreen();
+	emuThread.post([this] { emu->executeUntil(emu->currentCycles() + 1); });
+}
+
+static const double speeds[] = {1, 2, 4, 8, 0};
+
+void MainWindow::on_speedBox_currentIndexChanged(int index)
+{
+	if (index >= 0 && index < (int)(sizeof(speeds) / sizeof(speeds[0])))
+		emuThread.setSpeed(speeds[index]);
 }
 
-void MainWindow::execTimer()
+void MainWindow::setSpeed(double multiple)
 {
-	if (emu) {
-		emu->executeUntil(emu->currentCycles() + (emu->getClockSpeed() / 64));
-		updateScreen();
+	emuThread.setSpeed(multiple);
+	// reflect it in the box if it's one of ours, without sending it back
+	for (int i = 0; i < (int)(sizeof(speeds) / sizeof(speeds[0])); i++) {
+		if (speeds[i] == multiple) {
+			const QSignalBlocker blocker(ui->speedBox);
+			ui->speedBox->setCurrentIndex(i);
+		}
 	}
 }
 
+void MainWindow::stoppedOnBreak()
+{
+	// the emulation thread has already stopped itself
+	on_stopButton_clicked();
+}
+
 void MainWindow::on_addBreakButton_clicked()
 {
 	uint32_t addr = ui->breakpointAddress->text().toUInt(nullptr, 16);
-	emu->breakpoints().insert(addr);
-	updateBreakpointsList();
+	emuThread.post([this, addr] {
+		emu->breakpoints().insert(addr);
+		updateBreakpointsList();
+	});
 }
 
 void MainWindow::on_removeBreakButton_clicked()
 {
 	uint32_t addr = ui->breakpointAddress->text().toUInt(nullptr, 16);
-	emu->breakpoints().erase(addr);
-	updateBreakpointsList();
+	emuThread.post([this, addr] {
+		emu->breakpoints().erase(addr);
+		updateBreakpointsList();
+	});
+}
+
+EmuBase::Watchpoint MainWindow::watchpointFromUI() const
+{
+	static const EmuBase::WatchKind kinds[] = {EmuBase::WatchWrite, EmuBase::WatchRead, EmuBase::WatchAccess};
+	QStringList parts = ui->watchAddress->text().split(',');
+	EmuBase::Watchpoint w;
+	w.addr = parts[0].trimmed().toUInt(nullptr, 16);
+	w.length = (parts.size() > 1) ? parts[1].trimmed().toUInt(nullptr, 16) : 4;
+	w.kind = kinds[ui->watchKind->currentIndex()];
+	w.physical = ui->watchPhysical->isChecked();
+	return w;
+}
+
+void MainWindow::on_addWatchButton_clicked()
+{
+	EmuBase::Watchpoint w = watchpointFromUI();
+	emuThread.post([this, w] {
+		emu->addWatchpoint(w);
+		updateBreakpointsList();
+	});
+}
+
+void MainWindow::on_removeWatchButton_clicked()
+{
+	EmuBase::Watchpoint w = watchpointFromUI();
+	emuThread.post([this, w] {
+		emu->removeWatchpoint(w);
+		updateBreakpointsList();
+	});
 }
 
 void MainWindow::updateBreakpointsList()
 {
-	ui->breakpointsList->clear();
+	// called on the emulation thread, which owns the lists
+	QStringList items;
 	for (uint32_t addr : emu->breakpoints()) {
-		ui->breakpointsList->addItem(QString::number(addr, 16));
+		items.append(QString::number(addr, 16));
+	}
+	for (const EmuBase::Watchpoint &w : emu->watchpoints()) {
+		const char *kind = (w.kind == EmuBase::WatchWrite) ? "write" : (w.kind == EmuBase::WatchRead) ? "read" : "access";
+		items.append(QStringLiteral("%1,%2 %3%4")
+			.arg(w.addr, 0, 16).arg(w.length, 0, 16).arg(kind)
+			.arg(w.physical ? " (phys)" : ""));
 	}
+	QMetaObject::invokeMethod(ui->breakpointsList, [this, items] {
+		ui->breakpointsList->clear();
+		ui->breakpointsList->addItems(items);
+	}, Qt::QueuedConnection);
 }
 
 void MainWindow::on_memoryViewAddress_textEdited(const QString &)
@@ -178,45 +305,46 @@ void MainWindow::on_memoryViewAddress_textEdited(const QString &)
 
 void MainWindow::updateMemory()
 {
-	uint32_t virtBase = ui->memoryViewAddress->text().toUInt(nullptr, 16) & ~0xFF;
-	auto physBaseOpt = emu->virtToPhys(virtBase);
-	auto physBase = physBaseOpt.value_or(0xFFFFFFFF);
-	bool ok = physBaseOpt.has_value();
+	// the next frame will have it
+	emuThread.setMemoryViewAddress(ui->memoryViewAddress->text().toUInt(nullptr, 16));
+	emuThread.post(nullptr);
+}
+
+void MainWindow::showMemory(const EmuThread::Frame &frame)
+{
+	uint32_t virtBase = frame.memoryBase;
+	uint32_t physBase = frame.memoryPhysBase;
+	bool ok = frame.memoryValid;
 	if (ok && (virtBase != physBase))
 		ui->physicalAddressLabel->setText(QStringLiteral("Physical: %1").arg(physBase, 8, 16, QLatin1Char('0')));
 
-	uint8_t block[0x100];
-	if (ok) {
-		for (int i = 0; i < 0x100; i++) {
-			block[i] = emu->readPhysical(physBase + i, ARM710::V8).value();
-		}
-	}
+	const uint8_t *block = frame.memory;
 
-	QStringList output;
+	// 16 rows of address, hex and text
+	char output[16 * 80];
+	char *out = output;
 	for (int row = 0; row < 16; row++) {
-		QString outLine;
-		outLine.reserve(8 + 2 + (2 * 16) + 3 + 16);
-		outLine.append(QStringLiteral("%1 |").arg(virtBase + (row * 16), 8, 16));
+		out += sprintf(out, "%s%8x |", row ? "\n" : "", virtBase + (row * 16));
 		for (int col = 0; col < 16; col++) {
 			if (ok)
-				outLine.append(QStringLiteral(" %1").arg(block[row*16+col], 2, 16, QLatin1Char('0')));
+				out += sprintf(out, " %02x", block[row*16+col]);
 			else
-				outLine.append(QStringLiteral(" ??"));
+				out += sprintf(out, " ??");
 		}
-		outLine.append(QStringLiteral(" | "));
+		out += sprintf(out, " | ");
 		for (int col = 0; col < 16; col++) {
 			uint8_t byte = block[row*16+col];
 			if (!ok)
-				outLine.append('?');
+				*out++ = '?';
 			else if (byte >= 0x20 && byte <= 0x7E)
-				outLine.append(byte);
+				*out++ = byte;
 			else
-				outLine.append('.');
+				*out++ = '.';
 		}
-		output.append(outLine);
 	}
+	*out = 0;
 
-	ui->memoryViewLabel->setText(output.join('\n'));
+	ui->memoryViewLabel->setText(QString::fromLatin1(output));
 }
 
 void MainWindow::on_memoryAdd1_clicked() { adjustMemoryAddress(1); }
@@ -239,14 +367,18 @@ void MainWindow::on_writeByteButton_clicked()
 {
 	uint32_t address = ui->memoryViewAddress->text().toUInt(nullptr, 16);
 	uint8_t value = (uint8_t)ui->memoryWriteValue->text().toUInt(nullptr, 16);
-	emu->writeVirtual(value, address, ARM710::V8);
-	updateMemory();
+	emuThread.post([this, address, value] {
+		emu->writeVirtual(value, address, ARM710::V8);
+		emu->drainWriteBuffer();
+	});
 }
 
 void MainWindow::on_writeDwordButton_clicked()
 {
 	uint32_t address = ui->memoryViewAddress->text().toUInt(nullptr, 16);
 	uint32_t value = ui->memoryWriteValue->text().toUInt(nullptr, 16);
-	emu->writeVirtual(value, address, ARM710::V32);
-	updateMemory();
+	emuThread.post([this, address, value] {
+		emu->writeVirtual(value, address, ARM710::V32);
+		emu->drainWriteBuffer();
+	});
 }
@@ -3,7 +3,10 @@
 
 #include <QMainWindow>
 #include <QElapsedTimer>
+#include <QHash>
 #include "../WindCore/emubase.h"
+#include "../WindCore/gdbstub.h"
+#include "emuthread.h"
 #include "pdascreenwindow.h"
 
 namespace Ui {
@@ -17,19 +20,37 @@ class MainWindow : public QMainWindow
 public:
 	explicit MainWindow(EmuBase *emu, QWidget *parent = nullptr);
     ~MainWindow() override;
+#ifdef WINDCORE_GDB_STUB
+	void setGdbStub(GdbStub *stub) { emuThread.setGdbStub(stub); }
+#endif
+	// how often the debugger panes update while running
+	void setDebugRefreshRate(int hz);
+	// as a multiple of real time, or 0 for as fast as possible
+	void setSpeed(double multiple);
+
+protected:
+	void changeEvent(QEvent *event) override;
+	void showEvent(QShowEvent *event) override;
+	void hideEvent(QHideEvent *event) override;
 
 private slots:
-    void execTimer();
+    void showFrame();
+    void stoppedOnBreak();
 
     void on_startButton_clicked();
     void on_stopButton_clicked();
     void on_stepInsnButton_clicked();
     void on_stepTickButton_clicked();
+    void on_speedBox_currentIndexChanged(int index);
 
     void on_addBreakButton_clicked();
 
     void on_removeBreakButton_clicked();
 
+    void on_addWatchButton_clicked();
+
+    void on_removeWatchButton_clicked();
+
     void on_memoryViewAddress_textEdited(const QString &arg1);
     void on_memoryAdd1_clicked();
     void on_memoryAdd4_clicked();
@@ -47,12 +68,25 @@ private slots:
 private:
 	QElapsedTimer elapsedTimer;
     Ui::MainWindow *ui;
-	PDAScreenWindow pdaScreen;
 	EmuBase *emu;
-    QTimer *timer;
-    void updateScreen();
+	EmuThread emuThread;
+	PDAScreenWindow pdaScreen;
+
+	bool debugVisible = false, debugWantCode = false, debugWantMemory = false;
+	void updateDebugCapture();
+	void showRegisters(const EmuThread::Frame &frame);
+	void showCode(const EmuThread::Frame &frame);
+
+	struct CachedDisassembly {
+		uint32_t opcode;
+		QString text;
+	};
+	QHash<uint32_t, CachedDisassembly> disassemblyCache;
+	QString disassemble(uint32_t addr, uint32_t opcode);
     void updateBreakpointsList();
+    EmuBase::Watchpoint watchpointFromUI() const;
     void updateMemory();
+    void showMemory(const EmuThread::Frame &frame);
     void adjustMemoryAddress(int offset);
 };
 
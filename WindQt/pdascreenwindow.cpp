@@ -1,10 +1,60 @@
 #include "pdascreenwindow.h"
+#include "emuthread.h"
 #include <QKeyEvent>
+#include <QPainter>
+#include <QPaintEvent>
+#include <string.h>
 
-PDAScreenWindow::PDAScreenWindow(EmuBase *emu, QWidget *parent) :
+LCDView::LCDView(QWidget *parent) :
+	QWidget(parent)
+{
+	// every pixel gets painted, so Qt needn't clear it first
+	setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void LCDView::present(const QImage &frame)
+{
+	if (image.size() != frame.size() || image.format() != frame.format()) {
+		// only ever the first time
+		image = frame.copy();
+		update();
+		return;
+	}
+
+	// image is never shared, so scanLine() won't detach it
+	int lineBytes = (frame.width() * frame.depth() + 7) / 8;
+	int first = -1, last = -1;
+	for (int y = 0; y < frame.height(); y++) {
+		const uchar *src = frame.constScanLine(y);
+		uchar *dest = image.scanLine(y);
+		if (memcmp(dest, src, lineBytes) != 0) {
+			memcpy(dest, src, lineBytes);
+			if (first < 0)
+				first = y;
+			last = y;
+		}
+	}
+	if (first >= 0)
+		update(0, first, width(), last - first + 1);
+}
+
+void LCDView::paintEvent(QPaintEvent *event)
+{
+	QPainter painter(this);
+	if (image.isNull())
+		painter.fillRect(event->rect(), Qt::black);
+	else
+		painter.drawImage(event->rect(), image, event->rect());
+}
+
+
+// Only the device's fixed geometry is read from the emulator here;
+// input goes through the emulation thread, which owns everything else.
+PDAScreenWindow::PDAScreenWindow(EmuBase *emu, EmuThread *emuThread, QWidget *parent) :
 	QWidget(parent),
 	emu(emu),
-	lcd(new QLabel(this))
+	emuThread(emuThread),
+	lcd(new LCDView(this))
 {
 	setWindowTitle("WindEmu");
 	setFixedSize(emu->getDigitiserWidth(), emu->getDigitiserHeight());
@@ -52,14 +102,8 @@ PDAScreenWindow::PDAScreenWindow(EmuBase *emu, QWidget *parent) :
 	}
 }
 
-void PDAScreenWindow::updateScreen() {
-	uint8_t *lines[1024];
-	QImage img(emu->getLCDWidth(), emu->getLCDHeight(), QImage::Format_Grayscale8);
-	for (int y = 0; y < img.height(); y++)
-		lines[y] = img.scanLine(y);
-	emu->readLCDIntoBuffer(lines, false);
-
-	lcd->setPixmap(QPixmap::fromImage(std::move(img)));
+void PDAScreenWindow::showLCD(const QImage &image) {
+	lcd->present(image);
 }
 
 #ifdef Q_OS_MAC
@@ -172,32 +216,32 @@ static EpocKey resolveKey(int key) {
 
 void PDAScreenWindow::keyPressEvent(QKeyEvent *event)
 {
-	emu->log("KeyPress: QtKey=%d nativeVirtualKey=%x nativeModifiers=%x", event->key(), event->nativeVirtualKey(), event->nativeModifiers());
+	emu->log<LogSystem, LogVerbose>("KeyPress: QtKey=%d nativeVirtualKey=%x nativeModifiers=%x", event->key(), event->nativeVirtualKey(), event->nativeModifiers());
 	EpocKey k = resolveKey(event->key(), event->nativeVirtualKey());
 	if (k != EStdKeyNull)
-		emu->setKeyboardKey(k, true);
+		emuThread->queueKey(k, true);
 }
 
 void PDAScreenWindow::keyReleaseEvent(QKeyEvent *event)
 {
 	EpocKey k = resolveKey(event->key(), event->nativeVirtualKey());
 	if (k != EStdKeyNull)
-		emu->setKeyboardKey(k, false);
+		emuThread->queueKey(k, false);
 }
 
 
 void PDAScreenWindow::mousePressEvent(QMouseEvent *event)
 {
-	emu->updateTouchInput(event->x(), event->y(), true);
+	emuThread->queueTouch(event->x(), event->y(), true);
 }
 
 void PDAScreenWindow::mouseReleaseEvent(QMouseEvent *event)
 {
-	emu->updateTouchInput(event->x(), event->y(), false);
+	emuThread->queueTouch(event->x(), event->y(), false);
 }
 
 void PDAScreenWindow::mouseMoveEvent(QMouseEvent *event)
 {
 	if (event->buttons() & Qt::LeftButton)
-		emu->updateTouchInput(event->x(), event->y(), true);
+		emuThread->queueTouch(event->x(), event->y(), true);
 }
@@ -3,20 +3,38 @@
 
 #include <QWidget>
 #include <QLabel>
+#include <QImage>
 #include "emubase.h"
 
+class EmuThread;
+
+// Keeps one image for as long as it lives, copies in only the lines
+// that differ from the last frame, and repaints only those, straight
+// from the image (no QPixmap in between)
+class LCDView : public QWidget
+{
+	QImage image;
+
+public:
+	explicit LCDView(QWidget *parent = nullptr);
+	void present(const QImage &frame);
+
+protected:
+	void paintEvent(QPaintEvent *event) override;
+};
+
 class PDAScreenWindow : public QWidget
 {
 	Q_OBJECT
 private:
 	EmuBase *emu;
-	QLabel *lcd;
+	EmuThread *emuThread;
+	LCDView *lcd;
 
 public:
-	explicit PDAScreenWindow(EmuBase *emu, QWidget *parent = nullptr);
+	explicit PDAScreenWindow(EmuBase *emu, EmuThread *emuThread, QWidget *parent = nullptr);
 
-public slots:
-	void updateScreen();
+	void showLCD(const QImage &image);
 
 protected:
 	void keyPressEvent(QKeyEvent *event) override;
@@ -0,0 +1,24 @@
+QT       -= core gui
+
+TARGET = WindTrace
+TEMPLATE = app
+
+CONFIG += console c++17
+CONFIG -= app_bundle
+QMAKE_MACOSX_DEPLOYMENT_TARGET = 10.14
+
+SOURCES += \
+        main.cpp
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../WindCore/release/ -lWindCore
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../WindCore/debug/ -lWindCore
+else:unix: LIBS += -L$$OUT_PWD/../WindCore/ -lWindCore
+
+INCLUDEPATH += $$PWD/../WindCore
+DEPENDPATH += $$PWD/../WindCore
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../WindCore/release/libWindCore.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../WindCore/debug/libWindCore.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../WindCore/release/WindCore.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../WindCore/debug/WindCore.lib
+else:unix: PRE_TARGETDEPS += $$OUT_PWD/../WindCore/libWindCore.a
@@ -0,0 +1,262 @@
+#include "../WindCore/trace.h"
+#include "../WindCore/decoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Compares two traces from WindQt's --trace (say, from before and after
+// a change to the CPU core) and reports where they first part ways,
+// with some disassembled context either side. Both files are streamed,
+// so it takes the same memory for a thousand instructions as for a few
+// billion.
+
+static const char *registerNames[17] = {
+	"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+	"r8", "r9", "r10", "r11", "r12", "sp", "lr", "pc", "cpsr"
+};
+
+// An instruction, plus whatever it accessed and changed
+struct Step {
+	enum { MaxAccesses = 16 }; // an LDM/STM of every register
+	uint64_t index;
+	uint32_t pc, opcode;
+	int accessCount, changeCount;
+	TraceReader::Entry accesses[MaxAccesses];
+	struct { uint32_t reg, value; } changes[17];
+};
+
+class StepReader {
+	TraceReader reader;
+	TraceReader::Entry pending;
+	bool havePending = false;
+	uint64_t count = 0;
+
+	void readPending() {
+		havePending = reader.next(pending);
+		// steps can't be lined up across a gap, so that's the end
+		if (havePending && pending.kind == TraceRecorder::TagGap) {
+			gapSize = pending.a;
+			havePending = false;
+		}
+	}
+
+public:
+	uint32_t registers[17] = {};
+	uint32_t gapSize = 0; // events dropped at the point it stopped, if any
+
+	StepReader(const char *path) : reader(path) {
+		// the registers as they were when tracing started come first
+		for (readPending(); havePending && pending.kind == TraceRecorder::TagRegister; readPending())
+			registers[pending.a] = pending.b;
+	}
+	bool isOpen() const { return reader.isOpen(); }
+	bool isDamaged() const { return reader.isDamaged(); }
+	int options() const { return reader.options(); }
+	uint64_t stepCount() const { return count; }
+
+	bool next(Step &step) {
+		// anything before the first instruction (which can only be
+		// registers) has been dealt with already
+		while (havePending && pending.kind != TraceRecorder::TagInstruction)
+			readPending();
+		if (!havePending)
+			return false;
+
+		step.index = count;
+		step.pc = pending.a;
+		step.opcode = pending.b;
+		step.accessCount = 0;
+		step.changeCount = 0;
+		for (readPending(); havePending && pending.kind != TraceRecorder::TagInstruction; readPending()) {
+			if (pending.kind == TraceRecorder::TagMemory) {
+				// more than an instruction can make; keep the count honest
+				if (step.accessCount < Step::MaxAccesses)
+					step.accesses[step.accessCount] = pending;
+				step.accessCount++;
+			} else if (step.changeCount < 17) {
+				step.changes[step.changeCount].reg = pending.a;
+				step.changes[step.changeCount].value = pending.b;
+				step.changeCount++;
+				registers[pending.a] = pending.b;
+			}
+		}
+		// if a gap cut it short, there's no telling what it did
+		if (gapSize)
+			return false;
+		count++;
+		return true;
+	}
+};
+
+static bool sameStep(const Step &a, const Step &b, bool compareAccesses, bool compareChanges) {
+	if (a.pc != b.pc || a.opcode != b.opcode)
+		return false;
+
+	if (compareAccesses) {
+		if (a.accessCount != b.accessCount)
+			return false;
+		for (int i = 0; i < a.accessCount && i < Step::MaxAccesses; i++) {
+			const TraceReader::Entry &x = a.accesses[i], &y = b.accesses[i];
+			if (x.a != y.a || x.b != y.b || x.isWrite != y.isWrite || x.isByte != y.isByte)
+				return false;
+		}
+	}
+
+	if (compareChanges) {
+		if (a.changeCount != b.changeCount)
+			return false;
+		for (int i = 0; i < a.changeCount; i++)
+			if (a.changes[i].reg != b.changes[i].reg || a.changes[i].value != b.changes[i].value)
+				return false;
+	}
+	return true;
+}
+
+static void printStep(const char *label, const Step &step) {
+	struct ARMInstructionInfo info;
+	char text[256];
+	ARMDecodeARM(step.opcode, &info);
+	ARMDisassemble(&info, step.pc, text, sizeof(text));
+	printf("%s %12llu  %08x  %08x  %s\n", label, (unsigned long long)step.index, step.pc, step.opcode, text);
+
+	for (int i = 0; i < step.accessCount && i < Step::MaxAccesses; i++) {
+		const TraceReader::Entry &access = step.accesses[i];
+		printf("%s %12s  %s%s [%08x] = %0*x\n", label, "",
+			access.isWrite ? "write" : "read ", access.isByte ? "8 " : "32",
+			access.a, access.isByte ? 2 : 8, access.b);
+	}
+	if (step.accessCount > Step::MaxAccesses)
+		printf("%s %12s  (%d more accesses)\n", label, "", step.accessCount - Step::MaxAccesses);
+
+	if (step.changeCount > 0) {
+		printf("%s %12s ", label, "");
+		for (int i = 0; i < step.changeCount; i++)
+			printf(" %s=%08x", registerNames[step.changes[i].reg], step.changes[i].value);
+		printf("\n");
+	}
+}
+
+static void usage() {
+	fprintf(stderr,
+		"usage: WindTrace [options] A.trace B.trace\n"
+		"  --context N   instructions to show before the divergence (default 10)\n"
+		"  --after N     instructions to show after it, from each trace (default 5)\n");
+}
+
+int main(int argc, char **argv) {
+	int context = 10, after = 5;
+	const char *paths[2] = {nullptr, nullptr};
+	int pathCount = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--context") && i + 1 < argc) {
+			context = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--after") && i + 1 < argc) {
+			after = atoi(argv[++i]);
+		} else if (argv[i][0] != '-' && pathCount < 2) {
+			paths[pathCount++] = argv[i];
+		} else {
+			usage();
+			return 2;
+		}
+	}
+	if (pathCount != 2 || context < 0 || after < 0) {
+		usage();
+		return 2;
+	}
+
+	StepReader a(paths[0]), b(paths[1]);
+	for (int i = 0; i < 2; i++) {
+		if (!(i ? b : a).isOpen()) {
+			fprintf(stderr, "could not read trace %s\n", paths[i]);
+			return 2;
+		}
+	}
+
+	// only compare what both traces recorded
+	int common = a.options() & b.options();
+	bool compareAccesses = common & TraceRecorder::TraceMemory;
+	bool compareChanges = common & TraceRecorder::TraceRegisters;
+	if (a.options() != b.options())
+		printf("note: the traces were recorded with different options, so timing may differ too\n");
+
+	if (compareChanges && memcmp(a.registers, b.registers, sizeof(a.registers)) != 0) {
+		printf("the traces start from different registers:\n");
+		for (int i = 0; i < 17; i++)
+			if (a.registers[i] != b.registers[i])
+				printf("  %-4s A=%08x B=%08x\n", registerNames[i], a.registers[i], b.registers[i]);
+		return 1;
+	}
+
+	// the last few steps both agreed on, oldest first
+	std::vector<Step> history(context ? context : 1);
+	size_t historyCount = 0;
+	Step stepA, stepB;
+	bool haveA, haveB;
+	for (;;) {
+		haveA = a.next(stepA);
+		haveB = b.next(stepB);
+		if (!haveA || !haveB || !sameStep(stepA, stepB, compareAccesses, compareChanges))
+			break;
+		if (context) {
+			history[historyCount % context] = stepA;
+			historyCount++;
+		}
+		if ((stepA.index + 1) % 100000000 == 0)
+			fprintf(stderr, "%llu instructions match so far\n", (unsigned long long)(stepA.index + 1));
+	}
+
+	for (int i = 0; i < 2; i++) {
+		StepReader &reader = i ? b : a;
+		if (reader.isDamaged())
+			printf("note: %s is cut short or damaged\n", paths[i]);
+		if (reader.gapSize)
+			printf("note: %s stops at a gap of %u events, dropped while its writer fell behind\n", paths[i], reader.gapSize);
+	}
+
+	if (!haveA && !haveB) {
+		printf("the traces match (%llu instructions)\n", (unsigned long long)a.stepCount());
+		return 0;
+	}
+
+	uint64_t agreed = haveA ? stepA.index : stepB.index;
+	if (!haveA || !haveB)
+		printf("the traces match for %llu instructions, then %s ends\n", (unsigned long long)agreed, haveA ? "B" : "A");
+	else
+		printf("the traces match for %llu instructions, then diverge:\n", (unsigned long long)agreed);
+	printf("\n");
+
+	size_t first = (historyCount > (size_t)context) ? historyCount - context : 0;
+	for (size_t i = first; i < historyCount; i++)
+		printStep("   ", history[i % context]);
+
+	if (haveA)
+		printStep("A: ", stepA);
+	if (haveB)
+		printStep("B: ", stepB);
+
+	if (compareChanges && haveA && haveB) {
+		// where that leaves the registers
+		bool heading = true;
+		for (int i = 0; i < 17; i++) {
+			if (a.registers[i] != b.registers[i]) {
+				if (heading)
+					printf("\nregisters afterwards:\n");
+				heading = false;
+				printf("  %-4s A=%08x B=%08x\n", registerNames[i], a.registers[i], b.registers[i]);
+			}
+		}
+	}
+
+	// and a little of where each went next
+	for (int i = 0; i < 2; i++) {
+		StepReader &reader = i ? b : a;
+		if (!(i ? haveB : haveA))
+			continue;
+		printf("\nthen %s:\n", i ? "B" : "A");
+		Step step;
+		for (int n = 0; n < after && reader.next(step); n++)
+			printStep(i ? "B: " : "A: ", step);
+	}
+	return 1;
+}
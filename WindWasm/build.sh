@@ -1,7 +1,19 @@
 #!/bin/sh
 
-FLAGS="-O3 -s WASM_OBJECT_FILES=0 -std=c++17"
+# Threads need SharedArrayBuffer, so the page has to be served with
+# COOP/COEP headers; THREADS=0 builds one that runs everything on the
+# page's thread instead, for anywhere that can't send them.
+FLAGS="-O3 -flto -msimd128 -std=c++17"
+# the emulator is ~49MB of that; the rest can grow if need be
+LINKFLAGS="-s INITIAL_MEMORY=58720256 -s ALLOW_MEMORY_GROWTH=1"
+# zlib for save states, and what shell.html needs from the runtime
+LINKFLAGS="$LINKFLAGS -s USE_ZLIB=1 -s EXPORTED_RUNTIME_METHODS=addRunDependency,removeRunDependency,FS"
+if [ "$THREADS" != "0" ]; then
+	FLAGS="$FLAGS -pthread"
+	# one for the emulator and one for the log, up front
+	LINKFLAGS="$LINKFLAGS -s PTHREAD_POOL_SIZE=2 -s DEFAULT_PTHREAD_STACK_SIZE=1048576"
+fi
 
 mkdir -p obj
-for i in arm710 emubase etna windermere; do emcc -c $FLAGS -o obj/$i.o ../WindCore/$i.cpp; done
-emcc $FLAGS -s TOTAL_MEMORY=78643200 --llvm-lto 1 --preload-file rom/5mx.bin --shell-file shell.html obj/*.o main.cpp -o WindEmu.html
\ No newline at end of file
+for i in arm710 audio cfcard codec emubase etna governor logging savestate serial trace uart windermere; do emcc -c $FLAGS -o obj/$i.o ../WindCore/$i.cpp; done
+emcc $FLAGS $LINKFLAGS --preload-file rom/5mx.bin --shell-file shell.html obj/*.o main.cpp -o WindEmu.html
@@ -1,10 +1,22 @@
 #include "../WindCore/emubase.h"
+#include "../WindCore/governor.h"
 #include "../WindCore/windermere.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
 #include <emscripten.h>
 #include <SDL.h>
+#include <zlib.h>
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <chrono>
+#include <thread>
+#endif
 
 EmuBase *emu;
+SpeedGovernor *governor;
 // SDL_Window *window;
 SDL_Surface *surface;
 
@@ -70,39 +82,372 @@ static EpocKey resolveKey(SDLKey sym) {
 	return EStdKeyNull;
 }
 
-void emuEventLoop() {
-	// printf("Doing it\n");
-	emu->executeUntil(emu->currentCycles() + (emu->getClockSpeed() / 64));
+// called from the page: 1 is real time, 0 as fast as possible
+static std::atomic<double> requestedSpeed{1};
+extern "C" EMSCRIPTEN_KEEPALIVE void setSpeed(double multiple) {
+	requestedSpeed = multiple;
+}
+
+static double hostSeconds() {
+	return emscripten_get_now() / 1000;
+}
+
+
+// With threads, the emulator runs in a worker of its own and only the
+// worker touches it; input gets there through a lock-free queue, like
+// EmuThread's in WindQt. Without, it's all applied straight away.
+struct InputEvent {
+	bool isKey, down;
+	EpocKey key;
+	int x, y;
+};
+
+static void applyInput(const InputEvent &event) {
+	if (event.isKey)
+		emu->setKeyboardKey(event.key, event.down);
+	else
+		emu->updateTouchInput(event.x, event.y, event.down);
+}
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+enum { InputCapacity = 0x100 };
+static InputEvent inputs[InputCapacity];
+static std::atomic<size_t> inputHead{0}, inputTail{0};
+
+static void queueInput(const InputEvent &event) {
+	size_t head = inputHead.load(std::memory_order_relaxed);
+	if (head - inputTail.load(std::memory_order_acquire) == InputCapacity)
+		return;
+	inputs[head & (InputCapacity - 1)] = event;
+	inputHead.store(head + 1, std::memory_order_release);
+}
 
+static void applyQueuedInput() {
+	size_t tail = inputTail.load(std::memory_order_relaxed);
+	size_t head = inputHead.load(std::memory_order_acquire);
+	for (; tail != head; tail++)
+		applyInput(inputs[tail & (InputCapacity - 1)]);
+	inputTail.store(tail, std::memory_order_release);
+}
+#else
+static void queueInput(const InputEvent &event) {
+	applyInput(event);
+}
+#endif
+
+
+// The LCD is converted into one of three buffers on the heap: one being
+// written by the emulation, one waiting to be shown and one on screen.
+// lcdReady has the index of the waiting one, plus NewLCDFrame if it
+// hasn't been picked up yet; it's swapped for another by whichever side
+// is done with theirs, so neither ever waits for the other. The page
+// hands the buffer to the canvas as ImageData, without SDL in between.
+enum { NewLCDFrame = 4 };
+static uint32_t *lcdPixels[3];
+static int lcdWriting = 0, lcdLastWritten = 1, lcdShowing = 2;
+static std::atomic<int> lcdReady{1};
+static bool convertedLast = false;
+
+// emulation side
+static void convertLCD() {
+	// if the last one's still waiting, the page is busy; don't bother
+	if (lcdReady.load(std::memory_order_acquire) & NewLCDFrame)
+		return;
+
+	int width = emu->getLCDWidth(), height = emu->getLCDHeight();
+	uint32_t *buffer = lcdPixels[lcdWriting];
 	uint8_t *lines[480];
+	for (int y = 0; y < height; y++)
+		lines[y] = (uint8_t *)(buffer + (y * width));
+	emu->readLCDIntoBuffer(lines, true);
+
+	// nobody writes to the last one once it's been handed over, so it's
+	// safe to compare against whether or not it's been picked up yet
+	if (memcmp(buffer, lcdPixels[lcdLastWritten], width * height * 4) == 0)
+		return;
+	lcdLastWritten = lcdWriting;
+	lcdWriting = lcdReady.exchange(lcdWriting | NewLCDFrame, std::memory_order_acq_rel) & 3;
+}
+
+// page side
+static void presentLCD() {
+	if (!(lcdReady.load(std::memory_order_acquire) & NewLCDFrame))
+		return;
+	lcdShowing = lcdReady.exchange(lcdShowing, std::memory_order_acq_rel) & 3;
+
+	EM_ASM({
+		// (no top-level commas in here, or EM_ASM splits the code up)
+		var ptr = $0;
+		var size = $1 * $2 * 4;
+		var images = Module.lcdImages;
+		if (!images || images.heap !== HEAPU8.buffer)
+			images = Module.lcdImages = {heap: HEAPU8.buffer};
+		var image = images[ptr];
+		if (typeof SharedArrayBuffer !== 'undefined' && HEAPU8.buffer instanceof SharedArrayBuffer) {
+			// ImageData won't look at shared memory, so that needs a copy
+			if (!image)
+				image = images[ptr] = new ImageData($1, $2);
+			image.data.set(HEAPU8.subarray(ptr, ptr + size));
+		} else if (!image) {
+			// a view straight onto the heap; the browser copies from it
+			image = images[ptr] = new ImageData(new Uint8ClampedArray(HEAPU8.buffer, ptr, size), $1, $2);
+		}
+		Module.ctx.putImageData(image, $3, $4);
+	}, lcdPixels[lcdShowing], emu->getLCDWidth(), emu->getLCDHeight(), emu->getLCDOffsetX(), emu->getLCDOffsetY());
+}
+
 
-	SDL_LockSurface(surface);
-	int baseX = emu->getLCDOffsetX();
-	int baseY = emu->getLCDOffsetY();
-	int height = emu->getLCDHeight();
-	for (int y = 0; y < height; y++) {
-		lines[y] = (uint8_t *)surface->pixels + (surface->pitch * (y + baseY)) + (baseX * 4);
+// Save states are kept in IndexedDB (see shell.html): the machine
+// state, plus RAM and the CF card's image in 16KB chunks, each one
+// compressed on its own. The emulator and the card keep a DirtyMap of
+// which chunks have been written to; every few seconds, and when the
+// page is hidden, the emulation side hashes just those, and the ones
+// that really have changed since they were last stored get compressed
+// and handed over. (Some marks are spurious, such as the CPU checking
+// whether code it's fetching could be written, so the hash still
+// matters.) The page writes them all, with the state, in one
+// transaction. All-zero chunks (most of RAM, most of the time) are
+// stored empty.
+enum { ChunkSize = DirtyMap::ChunkSize, SaveInterval = 5 };
+enum : uint64_t { ChunkUnsaved = 2 }; // real hashes are odd, or 0 for zeroes
+
+struct PersistedRegion {
+	uint8_t *data = nullptr;
+	size_t size = 0;
+	std::vector<uint64_t> hashes;
+	DirtyMap *written = nullptr; // what to look at next time; null for all of it
+	void track(uint8_t *newData, size_t newSize) {
+		data = newData;
+		size = newSize;
+		hashes.assign((size + ChunkSize - 1) / ChunkSize, ChunkUnsaved);
 	}
-	emu->readLCDIntoBuffer(lines, true);
-	SDL_UnlockSurface(surface);
-	SDL_Flip(surface);
+	size_t chunkBytes(size_t chunk) const {
+		return (size - chunk * ChunkSize < ChunkSize) ? (size - chunk * ChunkSize) : ChunkSize;
+	}
+};
+// RAM, then the card (if there is one)
+static std::vector<PersistedRegion> persisted;
+static size_t cardRegion;
+
+struct SaveBatch {
+	struct Record {
+		int region, chunk;
+		std::vector<uint8_t> data;
+	};
+	std::vector<Record> records; // the state is region -1
+	double cardSize = 0;
+	bool cardChanged = false;
+};
+static std::atomic<SaveBatch *> pendingSave{nullptr};
+static std::atomic<bool> saveRequested{false}, saveEverything{false};
+static double lastSaveAt = 0;
+
+static CFCard *card;
+static std::atomic<int> cardRequest{-1}; // a /cardN.img to insert, 0 to eject
+static int cardImage = 0;
+static bool cardChanged = false;
+
+static uint64_t hashChunk(const uint8_t *data, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ULL, any = 0;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		any |= word;
+		hash = (hash ^ word) * 0x100000001B3ULL;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		any |= data[i];
+		hash = (hash ^ data[i]) * 0x100000001B3ULL;
+	}
+	return any ? (hash | 1) : 0;
+}
 
+static void hashAll(PersistedRegion &region) {
+	for (size_t i = 0; i < region.hashes.size(); i++)
+		region.hashes[i] = hashChunk(region.data + (i * ChunkSize), region.chunkBytes(i));
+}
+
+// the size goes first, as uncompress needs to know it
+static std::vector<uint8_t> compressChunk(const uint8_t *data, size_t size) {
+	uLongf length = compressBound(size);
+	std::vector<uint8_t> out(4 + length);
+	uint32_t original = size;
+	memcpy(out.data(), &original, 4);
+	compress2(out.data() + 4, &length, data, size, 1);
+	out.resize(4 + length);
+	return out;
+}
+
+static bool uncompressChunk(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+	uint32_t original;
+	if (size < 4)
+		return false;
+	memcpy(&original, data, 4);
+	out.resize(original);
+	uLongf length = original;
+	return uncompress(out.data(), &length, data + 4, size - 4) == Z_OK && length == original;
+}
+
+// emulation side, between batches
+static void stageSave() {
+	// if the page is still busy with the last one, it'll have to wait
+	if (pendingSave.load(std::memory_order_acquire))
+		return;
+
+	SaveBatch *batch = new SaveBatch;
+	StateWriter state;
+	emu->saveState(state);
+	batch->records.push_back({-1, 0, compressChunk(state.result().data(), state.result().size())});
+
+	bool everything = saveEverything.exchange(false);
+	for (size_t r = 0; r < persisted.size(); r++) {
+		PersistedRegion &region = persisted[r];
+		for (size_t i = 0; i < region.hashes.size(); i++) {
+			bool written = !region.written || region.written->take(i);
+			if (!written && !everything)
+				continue;
+			const uint8_t *chunk = region.data + (i * ChunkSize);
+			uint64_t hash = hashChunk(chunk, region.chunkBytes(i));
+			if (hash == region.hashes[i] && !everything)
+				continue;
+			region.hashes[i] = hash;
+			SaveBatch::Record record = {(int)r, (int)i, {}};
+			if (hash)
+				record.data = compressChunk(chunk, region.chunkBytes(i));
+			batch->records.push_back(std::move(record));
+		}
+	}
+	batch->cardSize = card->hasImage() ? card->imageBytes() : 0;
+	batch->cardChanged = cardChanged || everything;
+	cardChanged = false;
+	pendingSave.store(batch, std::memory_order_release);
+}
+
+// page side; called each frame, and by a timer for when there aren't any
+extern "C" EMSCRIPTEN_KEEPALIVE void flushSaves() {
+	SaveBatch *batch = pendingSave.load(std::memory_order_acquire);
+	if (!batch)
+		return;
+	EM_ASM({ Module.saveBegin($0, $1, $2); }, (int)cardRegion, batch->cardSize, batch->cardChanged);
+	for (const SaveBatch::Record &record : batch->records)
+		// a copy, as the heap may be shared (which IndexedDB won't take)
+		EM_ASM({ Module.saveChunk($0, $1, HEAPU8.slice($2, $2 + $3)); }, record.region, record.chunk, record.data.data(), (int)record.data.size());
+	EM_ASM({ Module.saveCommit(); });
+	// transactions on the same store run in order, so the next can go
+	pendingSave.store(nullptr, std::memory_order_release);
+	delete batch;
+}
+
+extern "C" EMSCRIPTEN_KEEPALIVE void requestSave() {
+	saveRequested = true;
+}
+
+// if a write fails, what's stored can't be trusted to match the hashes
+extern "C" EMSCRIPTEN_KEEPALIVE void saveFailed() {
+	saveEverything = true;
+}
+
+// the page puts the image in /cardN.img first
+extern "C" EMSCRIPTEN_KEEPALIVE void insertCard(int image) {
+	cardRequest = image;
+}
+
+static void swapCard(int image) {
+	char path[32];
+	emu->insertCard(nullptr);
+	card->closeImage();
+	if (cardImage) {
+		snprintf(path, sizeof(path), "/card%d.img", cardImage);
+		unlink(path);
+	}
+	cardImage = image;
+	if (image) {
+		snprintf(path, sizeof(path), "/card%d.img", image);
+		if (card->openImage(path))
+			emu->insertCard(card);
+		else
+			printf("Couldn't open the card image\n");
+	}
+	persisted[cardRegion].track(card->imageData(), card->hasImage() ? card->imageBytes() : 0);
+	card->trackWrites();
+	persisted[cardRegion].written = &card->writeMap();
+	cardChanged = true;
+}
+
+static void runBatch() {
+	int image = cardRequest.exchange(-1);
+	if (image >= 0)
+		swapCard(image);
+
+	governor->setSpeed(requestedSpeed);
+	int64_t start = emu->currentCycles(), startIdle = emu->currentIdleCycles();
+	emu->executeUntil(start + governor->beginFrame(hostSeconds()));
+	governor->endFrame(emu->currentCycles() - start, emu->currentIdleCycles() - startIdle, hostSeconds());
+#ifndef __EMSCRIPTEN_PTHREADS__
+	// with threads, the log has its own
+	emu->logPipeline().flush();
+#endif
+
+	// there's no need to convert the screen more often than it's shown;
+	// on a slow machine, doing every other one leaves more for emulation
+	bool underLoad = governor->isFallingBehind() && convertedLast;
+	convertedLast = !underLoad && governor->presentDue(hostSeconds());
+	if (convertedLast)
+		convertLCD();
+
+	if (saveRequested.exchange(false) || hostSeconds() - lastSaveAt >= SaveInterval) {
+		lastSaveAt = hostSeconds();
+		stageSave();
+	}
+}
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+// 64 batches a second, as in WindQt
+static void emulationThread() {
+	using namespace std::chrono;
+	const auto slice = microseconds(1000000 / 64);
+	auto deadline = steady_clock::now();
+	for (;;) {
+		applyQueuedInput();
+		runBatch();
+		// if the host can't keep up (or there's no limit), don't wait
+		deadline += slice;
+		if (governor->isUnlimited() || governor->isFallingBehind() || steady_clock::now() - deadline > slice * 4)
+			deadline = steady_clock::now();
+		else
+			std::this_thread::sleep_until(deadline);
+	}
+}
+#endif
+
+void emuEventLoop() {
+	// printf("Doing it\n");
 	SDL_Event event;
 	while (SDL_PollEvent(&event)) {
 		if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
 			EpocKey k = resolveKey(event.key.keysym.sym);
 			if (k != EStdKeyNull)
-				emu->setKeyboardKey(k, (event.key.state == SDL_PRESSED));
+				queueInput({true, (event.key.state == SDL_PRESSED), k, 0, 0});
 		} else if (event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEBUTTONUP) {
 			if (event.button.button == SDL_BUTTON_LEFT)
-				emu->updateTouchInput(event.button.x, event.button.y, (event.button.state == SDL_PRESSED));
+				queueInput({false, (event.button.state == SDL_PRESSED), EStdKeyNull, event.button.x, event.button.y});
 		} else if (event.type == SDL_MOUSEMOTION) {
-			emu->updateTouchInput(event.motion.x, event.motion.y, (event.motion.state & SDL_BUTTON(1)));
+			queueInput({false, (event.motion.state & SDL_BUTTON(1)) != 0, EStdKeyNull, event.motion.x, event.motion.y});
 		}
 	}
+
+#ifndef __EMSCRIPTEN_PTHREADS__
+	// this runs once per animation frame, at whatever rate the display
+	// goes; the governor decides how much emulation that's worth
+	runBatch();
+#endif
+	presentLCD();
+	flushSaves();
 }
 
-int main(int argc, char **argv) {
+static void createEmulator() {
 	emu = new Windermere::Emulator;
 	emu->setLogger([](const char *str) {
 		printf("%s\n", str);
@@ -110,6 +455,97 @@ int main(int argc, char **argv) {
 	FILE *f = fopen("rom/5mx.bin", "rb");
 	fread(emu->getROMBuffer(), 1, 10485760, f);
 	fclose(f);
+}
+
+// Before anything runs: the page has already read whatever was stored
+// into Module.saved. The card comes back regardless; RAM and the rest
+// only if there's a state to go with them that'll load.
+static void restoreSaved() {
+	for (const EmuBase::MemoryRegion &region : emu->memoryRegions()) {
+		persisted.emplace_back();
+		persisted.back().track(region.data, region.size);
+	}
+	cardRegion = persisted.size();
+	persisted.emplace_back();
+	card = new CFCard;
+
+	double cardSize = EM_ASM_DOUBLE({ return Module.saved ? Module.saved.cardSize : 0; });
+	if (cardSize > 0) {
+		FILE *f = fopen("/card1.img", "wb");
+		bool made = f && ftruncate(fileno(f), (off_t)cardSize) == 0;
+		if (f)
+			fclose(f);
+		if (made)
+			swapCard(1);
+	}
+	bool haveState = EM_ASM_INT({ return (Module.saved && Module.saved.state) ? 1 : 0; });
+
+	int count = EM_ASM_INT({ return Module.saved ? Module.saved.chunks.length : 0; });
+	std::vector<uint8_t> packed, chunk;
+	for (int i = 0; i < count; i++) {
+		int r = EM_ASM_INT({ return Module.saved.chunks[$0][0]; }, i);
+		int c = EM_ASM_INT({ return Module.saved.chunks[$0][1]; }, i);
+		packed.resize(EM_ASM_INT({ return Module.saved.chunks[$0][2].length; }, i));
+		if (r < 0 || r >= (int)persisted.size() || (r != (int)cardRegion && !haveState))
+			continue;
+		PersistedRegion &region = persisted[r];
+		if (c < 0 || c >= (int)region.hashes.size())
+			continue;
+		uint8_t *dest = region.data + ((size_t)c * ChunkSize);
+		if (packed.empty()) {
+			memset(dest, 0, region.chunkBytes(c));
+			continue;
+		}
+		EM_ASM({ HEAPU8.set(Module.saved.chunks[$0][2], $1); }, i, packed.data());
+		if (uncompressChunk(packed.data(), packed.size(), chunk) && chunk.size() == region.chunkBytes(c))
+			memcpy(dest, chunk.data(), chunk.size());
+	}
+
+	bool resumed = false;
+	if (haveState) {
+		packed.resize(EM_ASM_INT({ return Module.saved.state.length; }));
+		EM_ASM({ HEAPU8.set(Module.saved.state, $0); }, packed.data());
+		std::vector<uint8_t> state;
+		if (uncompressChunk(packed.data(), packed.size(), state)) {
+			StateReader reader(state.data(), state.size());
+			resumed = emu->loadState(reader);
+		}
+		if (!resumed) {
+			// start again from scratch, with the same card in
+			printf("Couldn't resume from the saved state; starting afresh\n");
+			delete emu;
+			createEmulator();
+			if (card->hasImage())
+				emu->insertCard(card);
+			size_t r = 0;
+			for (const EmuBase::MemoryRegion &region : emu->memoryRegions())
+				persisted[r++].track(region.data, region.size);
+		}
+	}
+	EM_ASM({ Module.saved = null; });
+
+	// what's there now is what's stored, so only changes need writing
+	emu->trackDirtyMemory();
+	for (size_t r = 0; r < cardRegion; r++)
+		persisted[r].written = &emu->dirtyMap(r);
+	for (size_t r = 0; r < persisted.size(); r++) {
+		if (resumed || r == cardRegion) {
+			hashAll(persisted[r]);
+			if (persisted[r].written)
+				persisted[r].written->clearAll();
+		}
+	}
+	cardChanged = false;
+}
+
+int main(int argc, char **argv) {
+	createEmulator();
+	restoreSaved();
+#ifdef __EMSCRIPTEN_PTHREADS__
+	governor = new SpeedGovernor(emu->getClockSpeed());
+#else
+	governor = new SpeedGovernor(emu->getClockSpeed(), 1.0 / 60);
+#endif
 
 	if (SDL_Init(SDL_INIT_TIMER|SDL_INIT_VIDEO) != 0) {
 		printf("SDL_Init failed: %s\n", SDL_GetError());
@@ -122,8 +558,18 @@ int main(int argc, char **argv) {
 	}
 
 	EM_ASM("SDL.defaults.copyOnLock = false; SDL.defaults.discardOnLock = true; SDL.defaults.opaqueFrontBuffer = false;");
+	for (int i = 0; i < 3; i++)
+		lcdPixels[i] = (uint32_t *)calloc(emu->getLCDWidth() * emu->getLCDHeight(), 4);
+
+	lastSaveAt = hostSeconds();
+#ifdef __EMSCRIPTEN_PTHREADS__
+	std::thread(emulationThread).detach();
+#endif
+	// animation frames stop while the page is hidden, saves shouldn't
+	EM_ASM({ setInterval(function() { Module._flushSaves(); }, 500); });
 
-	emscripten_set_main_loop(&emuEventLoop, 64, 1);
+	// 0 means requestAnimationFrame
+	emscripten_set_main_loop(&emuEventLoop, 0, 1);
 
 	return 0;
 }